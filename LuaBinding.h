@@ -120,6 +120,12 @@
     {
         return (unsigned int)lua_tonumber(L, idx);
     }
+#ifndef lua_pushglobaltable
+    inline void lua_pushglobaltable(lua_State* L)
+    {
+        lua_pushvalue(L, LUA_GLOBALSINDEX);
+    }
+#endif
 #else
     inline int lua_getlen(lua_State* L, int idx)
     {
@@ -296,1321 +302,1509 @@ namespace LuaBinding {
 }
 
 
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
 
 namespace LuaBinding {
-    template<typename C, typename ...Functions>
-    class OverloadedFunction;
-    template<typename T>
-    class Class;
-    class DynClass;
-    class Object;
-    class ObjectRef;
-    class Environment;
-    class State;
-    class IndexProxy;
-    template<typename T>
-    class Stack;
-    template<typename T>
-    class StackClass;
-    template<typename T>
-    class helper;
+    // lua_Alloc keeping freed blocks of up to 256 bytes in per size class free lists, carved from
+    // slabs, so the small strings, tables and userdata boxes Lua churns through skip malloc.
+    // Bigger blocks go to realloc/free. Not thread safe: give every State its own allocator,
+    // and keep it alive until the State is closed.
+    class PoolAllocator {
+        static constexpr size_t granularity = 16;
+        static constexpr size_t classes = 16;
+        static constexpr size_t max_small = granularity * classes;
+
+        struct Node {
+            Node* next;
+        };
 
+        Node* lists[classes] = {};
+        std::vector<void*> slabs;
+        char* cursor = nullptr;
+        char* end = nullptr;
+        size_t slab_size;
+        size_t in_use = 0;
 
+        static size_t size_class(size_t size)
+        {
+            return (size - 1) / granularity;
+        }
 
-    template <class R, class... Params>
-    class Traits;
-    template <class T, class... Params>
-    class TraitsCtor;
-    template <class R, class... Params>
-    class TraitsSTDFunction;
-    template <class T>
-    class TraitsCFunc;
-    template <class R, class T, class... Params>
-    class TraitsClass;
-    template <class R, class T, class... Params>
-    class TraitsFunClass;
-    template <class R, class... Params>
-    class TraitsNClass;
-    template <class T>
-    class TraitsClassNCFunc;
-    template <class T>
-    class TraitsClassFunNCFunc;
-    template <class T>
-    class TraitsClassCFunc;
-    template <class T>
-    class TraitsClassFunCFunc;
-    template <class T>
-    class TraitsClassLCFunc;
-    template <class T>
-    class TraitsClassFunLCFunc;
-    template <class T>
-    class TraitsClassFunNLCFunc;
-    template <class R, class T>
-    class TraitsClassProperty;
-    template <class R, class T>
-    class TraitsClassPropertyNFn;
-    template <class R, class T>
-    class TraitsClassPropertyFn;
-    template <class R, class T>
-    class TraitsClassPropertyNFunFn;
-    template <class R, class T>
-    class TraitsClassPropertyFunFn;
-    template <class R, class T>
-    class TraitsClassPropertyNFunCFn;
-    template <class R, class T>
-    class TraitsClassPropertyNFunLCFn;
-    template <class R, class T>
-    class TraitsClassPropertyFunLCFn;
-    template <class R, class T>
-    class TraitsClassPropertyNFunC;
-    template <class R, class T>
-    class TraitsClassPropertyFunC;
-    template <class R, class T>
-    class TraitsClassPropertyNCFun;
-    template <class R, class T>
-    class TraitsClassPropertyCFun;
-}
+        void* take(size_t c)
+        {
+            if (auto node = lists[c])
+            {
+                lists[c] = node->next;
+                return node;
+            }
+            auto size = (c + 1) * granularity;
+            if ((size_t)(end - cursor) < size)
+            {
+                // the tail of the old slab is handed out to the smaller classes
+                while ((size_t)(end - cursor) >= granularity)
+                {
+                    auto rest = size_class(end - cursor);
+                    if ((rest + 1) * granularity > (size_t)(end - cursor))
+                        rest--;
+                    give(cursor, rest);
+                    cursor += (rest + 1) * granularity;
+                }
+                auto slab = (char*)malloc(slab_size);
+                if (!slab)
+                    return nullptr;
+                slabs.push_back(slab);
+                cursor = slab;
+                end = slab + slab_size;
+            }
+            auto p = cursor;
+            cursor += size;
+            return p;
+        }
 
+        void give(void* p, size_t c)
+        {
+            auto node = (Node*)p;
+            node->next = lists[c];
+            lists[c] = node;
+        }
+    public:
+        explicit PoolAllocator(size_t slab_size = 64 * 1024) : slab_size(slab_size < max_small ? max_small : slab_size)
+        {}
+        PoolAllocator(const PoolAllocator&) = delete;
+        PoolAllocator& operator=(const PoolAllocator&) = delete;
+        ~PoolAllocator()
+        {
+            for (auto slab : slabs)
+                free(slab);
+        }
 
+        // the lua_Alloc, ud is the PoolAllocator
+        static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+        {
+            return ((PoolAllocator*)ud)->reallocate(ptr, osize, nsize);
+        }
 
-#include <map>
-#include <optional>
-#include <vector>
-#include <set>
-#include <list>
-#include <map>
-#include <queue>
-#include <stack>
-#include <deque>
-#include <unordered_set>
+        void* reallocate(void* ptr, size_t osize, size_t nsize)
+        {
+            // without a block osize is the type of the new object
+            if (!ptr)
+                osize = 0;
+            auto small = osize && osize <= max_small;
+            if (!nsize)
+            {
+                if (small)
+                    give(ptr, size_class(osize));
+                else
+                    free(ptr);
+                in_use -= osize;
+                return nullptr;
+            }
+            if (small && nsize <= max_small && size_class(osize) == size_class(nsize))
+            {
+                in_use += nsize - osize;
+                return ptr;
+            }
+            if (ptr && !small && nsize > max_small)
+            {
+                auto p = realloc(ptr, nsize);
+                if (p)
+                    in_use += nsize - osize;
+                return p;
+            }
+            auto p = nsize <= max_small ? take(size_class(nsize)) : malloc(nsize);
+            if (!p)
+            {
+                // Lua expects shrinking to succeed; the old block is big enough, and it ends up
+                // in the free list of its new size
+                if (ptr && nsize <= osize)
+                {
+                    in_use -= osize - nsize;
+                    return ptr;
+                }
+                return nullptr;
+            }
+            if (ptr)
+            {
+                memcpy(p, ptr, osize < nsize ? osize : nsize);
+                if (small)
+                    give(ptr, size_class(osize));
+                else
+                    free(ptr);
+            }
+            in_use += nsize - osize;
+            return p;
+        }
+
+        // bytes Lua currently holds
+        [[nodiscard]] size_t used() const
+        {
+            return in_use;
+        }
+
+        // bytes taken by slabs, blocks above 256 bytes not included
+        [[nodiscard]] size_t reserved() const
+        {
+            return slabs.size() * slab_size;
+        }
+    };
+}
+
+#include <climits>
+#include <cstddef>
 #include <unordered_map>
-#include <atomic>
+
+#include <new>
 
 namespace LuaBinding {
     namespace detail {
-        template<typename T>
-        concept is_pushable = requires(T a) {
-            { LuaBinding::Stack<std::decay_t<T>>::is(nullptr, 0) };
-        };
+        // C++ objects owned by a lua_State: a userdata in the registry under the address of key,
+        // destroyed by its __gc when the state closes or when it is dropped. The __gc also clears
+        // the registry entry, so finalizers running later during lua_close see no object.
+        template<class T>
+        T* state_data(lua_State* L, const void* key)
+        {
+            lua_rawgetp(L, LUA_REGISTRYINDEX, key);
+            auto data = (T*)lua_touserdata(L, -1);
+            lua_pop(L, 1);
+            return data;
+        }
 
-        template<typename T>
-        concept is_atomic = std::is_same_v<T, std::atomic<typename T::value_type>>;
+        template<class T>
+        int destroy_state_data(lua_State* L)
+        {
+            auto data = (T*)lua_touserdata(L, 1);
+            auto key = lua_touserdata(L, lua_upvalueindex(1));
+            lua_rawgetp(L, LUA_REGISTRYINDEX, key);
+            auto current = lua_touserdata(L, -1) == data;
+            lua_pop(L, 1);
+            if (current)
+            {
+                lua_pushnil(L);
+                lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+            }
+            data->~T();
+            return 0;
+        }
 
-        template<class T> requires is_pushable<T> && (!is_atomic<T>)
-        T get(lua_State* L, int index)
+        template<class T, class ...Args>
+        T* make_state_data(lua_State* L, const void* key, Args&&... args)
         {
-            int offset = 0;
-            return Stack<T>::get(L, index, offset);
+            auto data = new (lua_newuserdata(L, sizeof(T))) T(std::forward<Args>(args)...);
+            lua_newtable(L);
+            lua_pushlightuserdata(L, (void*)key);
+            lua_pushcclosure(L, destroy_state_data<T>, 1);
+            lua_setfield(L, -2, "__gc");
+            lua_setmetatable(L, -2);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+            return data;
         }
 
-        template<class T> requires (!is_pushable<T>) && (!is_atomic<T>)
-        T get(lua_State* L, int index)
+        inline void drop_state_data(lua_State* L, const void* key)
         {
-            int offset = 0;
-            return StackClass<T>::get(L, index, offset);
+            lua_pushnil(L);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, key);
         }
+    }
+}
 
-        template<class T> requires is_atomic<T>
-        T::value_type get(lua_State* L, int index)
+namespace LuaBinding {
+    // Size reported to the collector for a boxed T, sizeof(T) unless set through Class<T>::external_size
+    template<class T>
+    struct ExternalSize {
+        static inline size_t (*size)(const T&) = nullptr;
+
+        static size_t of(const T& t)
         {
-            int offset = 0;
-            return Stack<T>::get(L, index, offset);
+            return size ? size(t) : sizeof(T);
         }
+    };
 
-        template<class T> requires is_pushable<T>
-        T extract(lua_State* L, int index)
+    // Boxed objects of one class, external is the bytes reported for the live ones
+    struct InstanceStats {
+        string_type name;
+        size_t created = 0;
+        size_t collected = 0;
+        size_t peak = 0;
+        size_t external = 0;
+
+        [[nodiscard]] size_t live() const
         {
-            int offset = 0;
-            auto r = Stack<T>::get(L, index, offset);
-            lua_remove(L, index);
-            return r;
+            return created - collected;
         }
+    };
 
-        template<class T> requires (!is_pushable<T>)
-        T extract(lua_State* L, int index)
+    // C++ memory owned by userdata boxes. Lua only sees the two pointer box, so the bytes are fed
+    // to the collector as lua_gc steps once they add up to step_size.
+    class ExternalMemory {
+        size_t total = 0;
+        size_t debt = 0;
+        size_t step = 64 * 1024;
+        std::unordered_map<const void*, InstanceStats> types;
+
+        static char* key()
         {
-            int offset = 0;
-            auto r = StackClass<T>::get(L, index, offset);
-            lua_remove(L, index);
-            return r;
+            static char k;
+            return &k;
+        }
+    public:
+        static ExternalMemory* get(lua_State* L)
+        {
+            return detail::state_data<ExternalMemory>(L, key());
         }
 
-        template<class T> requires is_pushable<T>
-        int push(lua_State* L, T&& t)
+        static ExternalMemory& of(lua_State* L)
         {
-            return Stack<T>::push(L, std::move(t));
+            if (auto memory = get(L))
+                return *memory;
+            return *detail::make_state_data<ExternalMemory>(L, key());
         }
 
-        template<class T> requires is_pushable<T>
-        int push(lua_State* L, T& t)
+        void add(lua_State* L, size_t bytes)
         {
-            return Stack<T>::push(L, t);
+            total += bytes;
+            debt += bytes;
+            if (debt < step)
+                return;
+            auto kb = (int)(debt / 1024 > INT_MAX ? INT_MAX : debt / 1024);
+            debt = 0;
+            lua_gc(L, LUA_GCSTEP, kb);
         }
 
-        template<class T> requires (!is_pushable<T> && !std::is_same_v<T, nullptr_t>)
-        int push(lua_State*L, T& t)
+        void remove(size_t bytes)
         {
-            return StackClass<T>::push(L, t);
+            total = total > bytes ? total - bytes : 0;
         }
 
-        template<class T> requires (!is_pushable<T> && !std::is_same_v<T, nullptr_t>)
-        int push(lua_State*L, T&& t)
+        // bytes reported and not freed yet
+        [[nodiscard]] size_t size() const
         {
-            return StackClass<T>::push(L, t);
+            return total;
         }
 
-        template<class T> requires (!is_pushable<T> && std::is_same_v<T, nullptr_t>)
-        int push(lua_State* L, T& t)
+        void created(const void* type, size_t bytes)
         {
-            lua_pushnil(L);
-            return 1;
+            auto& t = types[type];
+            t.created++;
+            t.external += bytes;
+            if (t.live() > t.peak)
+                t.peak = t.live();
         }
 
-        template<class T> requires (!is_pushable<T> && std::is_same_v<T, nullptr_t>)
-        int push(lua_State* L, T&& t)
+        void collected(const void* type, size_t bytes)
         {
-            lua_pushnil(L);
-            return 1;
+            auto& t = types[type];
+            t.collected++;
+            t.external = t.external > bytes ? t.external - bytes : 0;
         }
 
-        template<class T> requires is_pushable<T>
-        bool is(lua_State* L, int index)
+        void resized(const void* type, size_t from, size_t to)
         {
-            return Stack<T>::is(L, index);
+            auto& t = types[type];
+            t.external = t.external + to > from ? t.external + to - from : 0;
         }
 
-        template<class T> requires (!is_pushable<T>)
-        bool is(lua_State* L, int index)
+        // Sizes are taken when an object is boxed. Call this when a boxed T owned by Lua, one
+        // constructed by a script or pushed by value, changed what it owns; bytes defaults to
+        // ExternalSize<T>::of(*p). Pointers pushed by reference have no size to update.
+        template<class T>
+        static void resize(lua_State* L, T* p, size_t bytes);
+
+        template<class T>
+        static void resize(lua_State* L, T* p)
         {
-            return StackClass<T>::is(L, index);
+            resize(L, p, ExternalSize<T>::of(*p));
         }
 
-        template<class T> requires is_pushable<T>
-        const char* basic_type_name(lua_State* L)
+        void name(const void* type, string_type name)
         {
-            return Stack<T>::basic_type_name(L);
+            types[type].name = std::move(name);
         }
 
-        template<class T> requires (!is_pushable<T>)
-        const char* basic_type_name(lua_State* L)
+        // per class, keyed by detail::type_key<T>() or the DynClass
+        [[nodiscard]] const std::unordered_map<const void*, InstanceStats>& instances() const
         {
-            return "userdata";
+            return types;
         }
 
-        template<class T> requires is_pushable<T>
-        int basic_type(lua_State* L)
+        // pending bytes before the collector is stepped
+        void set_step_size(size_t bytes)
         {
-            return Stack<T>::basic_type(L);
+            step = bytes;
         }
 
-        template<class T> requires (!is_pushable<T>)
-        int basic_type(lua_State* L)
+        [[nodiscard]] size_t step_size() const
         {
-            return LUA_TUSERDATA;
+            return step;
         }
-    }
+    };
 
-    template<typename T>
-    class Stack {
-    public:
-        static int push(lua_State* L, T t) {
-            static_assert(sizeof(T) == 0, "Unspecialized use of Stack<T>::push");
+    namespace detail {
+        // identifies T in ExternalMemory::instances()
+        template<class T>
+        const void* type_key()
+        {
+            static char k;
+            return &k;
         }
-        static bool is(lua_State* L, int index) = delete;
-        static T get(lua_State* L, int index, int& offset) {
-            static_assert(sizeof(T) == 0, "Unspecialized use of Stack<T>::get");
+
+        // C++ objects boxed in userdata come from the allocator of their State. The block starts
+        // with its size and the size reported to ExternalMemory, both needed by the free.
+        constexpr size_t object_header = alignof(std::max_align_t) > 2 * sizeof(size_t) ? alignof(std::max_align_t) : 2 * sizeof(size_t);
+
+        inline void* new_object(lua_State* L, size_t size)
+        {
+            void* ud;
+            auto f = lua_getallocf(L, &ud);
+            auto p = (char*)f(ud, nullptr, 0, size + object_header);
+            if (!p)
+                luaL_error(L, "not enough memory");
+            ((size_t*)p)[0] = size;
+            ((size_t*)p)[1] = 0;
+            return p + object_header;
         }
-        static const char* type_name(lua_State* L) {
-            return "";
+
+        // reports the object of the given type once its box is set up on the stack, may run a collector step
+        inline void report_object(lua_State* L, void* p, size_t external, const void* type)
+        {
+            ((size_t*)((char*)p - object_header))[1] = external;
+            auto& memory = ExternalMemory::of(L);
+            memory.created(type, external);
+            memory.add(L, external);
         }
-        static const char* basic_type_name(lua_State* L) {
-            return "";
+
+        template<class T>
+        void report_object(lua_State* L, T* p)
+        {
+            report_object(L, (void*)p, ExternalSize<T>::of(*p), type_key<std::remove_cv_t<T>>());
         }
-        static int basic_type(lua_State* L) {
-            return LUA_TNONE;
-        }
-    };
 
-    template<typename T>
-    class StackClass {
-    public:
-        static int push(lua_State* L, T& t) requires (!std::is_convertible_v<T, void*>)
-        {
-            auto _t = new (malloc(sizeof(T))) T(t);
-            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
-            *u = _t; *(u + 1) = (void*)0xC0FFEE;
-            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
-            lua_setmetatable(L, -2);
-            return 1;
-        }
-        static int push(lua_State* L, T&& t) requires (!std::is_convertible_v<T, void*>)
+        inline void resize_object(lua_State* L, void* p, size_t external, const void* type)
         {
-            auto _t = new (malloc(sizeof(T))) T(t);
-            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
-            *u = _t; *(u + 1) = (void*)0xC0FFEE;
-            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
-            lua_setmetatable(L, -2);
-            return 1;
+            auto& reported = ((size_t*)((char*)p - object_header))[1];
+            auto old = reported;
+            reported = external;
+            auto& memory = ExternalMemory::of(L);
+            memory.resized(type, old, external);
+            if (external > old)
+                memory.add(L, external - old);
+            else
+                memory.remove(old - external);
         }
-        static int push(lua_State* L, T& t) requires std::is_convertible_v<T, void*>
-        {
-            if (t == nullptr)
-            {
-                lua_pushnil(L);
-                return 1;
-            }
-            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
-            *u = (void*)t; *(u + 1) = 0;
 
-            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
-            lua_setmetatable(L, -2);
-            return 1;
-        }
-        static int push(lua_State* L, T&& t) requires std::is_convertible_v<T, void*>
+        inline void free_object(lua_State* L, void* p, const void* type)
         {
-            if (t == nullptr)
+            if (!p)
+                return;
+            auto block = (char*)p - object_header;
+            if (auto memory = ExternalMemory::get(L))
             {
-                lua_pushnil(L);
-                return 1;
+                memory->remove(((size_t*)block)[1]);
+                memory->collected(type, ((size_t*)block)[1]);
             }
-            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
-            *u = (void*)t; *(u + 1) = 0;
-            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
-            lua_setmetatable(L, -2);
-            return 1;
+            void* ud;
+            auto f = lua_getallocf(L, &ud);
+            f(ud, block, ((size_t*)block)[0] + object_header, 0);
         }
-        static bool is(lua_State* L, int index) requires std::is_same_v<T, void*> {
-#ifdef FLUENT_USERDATA_CHECKS
-            if (!lua_isuserdata(L, index) && !lua_isnumber(L, index)) return false;
-#else
-            if (!lua_isuserdata(L, index)) return false;
+    }
+
+    template<class T>
+    void ExternalMemory::resize(lua_State* L, T* p, size_t bytes)
+    {
+        detail::resize_object(L, (void*)p, bytes, detail::type_key<std::remove_cv_t<T>>());
+    }
+}
+
+#if defined(LUABINDING_CALL_STATS) || defined(LUABINDING_SYMBOL_MAP)
+#include <cstdio>
 #endif
-            return true;
-        }
-        static bool is(lua_State* L, int index) requires (!std::is_same_v<T, void*>) {
-            if (!lua_isuserdata(L, index)) {
-#ifdef FLUENT_USERDATA_CHECKS
-                if constexpr (std::is_convertible_v<T, uintptr_t>)
-                    if (lua_isnumber(L, index))
-                        return true;
+#ifdef LUABINDING_CALL_STATS
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
 #endif
-                return false;
-            }
-            lua_getmetatable(L, index);
-            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
-            auto res = lua_compare(L, -1, -2, LUA_OPEQ);
-            lua_pop(L, 2);
-            return res == 1;
-        }
-        static const char* type_name(lua_State* L) {
-            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
-            if (luaL_getfield(L, -1, "__name"))
-            {
-                auto name = lua_tostring(L, -1);
-                lua_pop(L, 2);
-                return name;
-            }
-            lua_pop(L, 2);
-            return typeid(T).name();
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "userdata";
-        }
-        static int basic_type(lua_State* L) {
-            return LUA_TUSERDATA;
-        }
-        static T get(lua_State* L, int index, int& offset) requires (std::is_convertible_v<T, void*>)
+
+namespace LuaBinding {
+#if defined(LUABINDING_CALL_STATS) || defined(LUABINDING_SYMBOL_MAP)
+    namespace detail {
+        // the registry table of named bindings, name -> closure
+        inline char* bindings_key()
         {
-            index += offset;
-            if (!is(L, index))
-            {
-                if constexpr (std::is_convertible_v<T, void*>)
-                    if (lua_isnoneornil(L, index))
-                        return nullptr;
-                luaL_typeerror(L, index, type_name(L));
-            }
-#ifdef FLUENT_USERDATA_CHECKS
-            if (lua_isnumber(L, index))
-                return (T)(uintptr_t)lua_tonumber(L, index);
-#endif
-            return *(T*)lua_touserdata(L, index);
+            static char k;
+            return &k;
         }
-        static T get(lua_State* L, int index, int& offset) requires (!std::is_convertible_v<T, void*>)
-        {
-            index += offset;
-            if (!is(L, index))
-            {
-                luaL_typeerror(L, index, type_name(L));
-            }
-#ifdef FLUENT_USERDATA_CHECKS
-            if constexpr (std::is_convertible_v<T, uintptr_t>)
-                if (lua_isnumber(L, index))
-                    return (T)(uintptr_t)lua_tonumber(L, index);
+    }
 #endif
-            return **(T**)lua_touserdata(L, index);
-        }
+
+#ifdef LUABINDING_CALL_STATS
+    // Calls of one bound function, histogram bucket i counts calls taking [2^(i-1), 2^i) microseconds
+    struct CallStat {
+        static constexpr int buckets = 24;
+        string_type name;
+        uint64_t calls = 0;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+        std::chrono::nanoseconds total{ 0 };
+        std::chrono::nanoseconds max{ 0 };
+        uint64_t histogram[buckets] = {};
     };
 
-    template<>
-    class Stack<int> {
+    // Counters of the bound functions of a lua_State, filled by the thunk wrappers when
+    // LUABINDING_CALL_STATS is defined. Bindings are keyed by their upvalue, so each registration counts on its own; the
+    // names come from State/Class registration. Bytes are string bytes passed in and returned.
+    // Calls that raise an error are not recorded.
+    class CallStats {
     public:
-        static int push(lua_State* L, int t)
+        // see TraceRecorder: TraceCall sees the arguments before each call and returns a ticket,
+        // TraceDone gets it back with the time once the call returns without an error
+        using TraceCall = uint64_t(*)(void* ud, lua_State* L, const void* k, int args);
+        using TraceDone = void(*)(void* ud, uint64_t ticket, std::chrono::nanoseconds time);
+        // called as each binding returns, with its frame still on the stack, see Profiler
+        using Sampler = void(*)(void* ud, lua_State* L);
+    private:
+        std::unordered_map<const void*, CallStat> stats;
+        TraceCall trace_call = nullptr;
+        TraceDone trace_done = nullptr;
+        void* trace_ud = nullptr;
+        Sampler sampler = nullptr;
+        void* sampler_ud = nullptr;
+        std::shared_ptr<void> token = std::make_shared<char>();
+
+        static char* key()
         {
-            lua_pushnumber(L, (double)t);
-            return 1;
-        }
-        static bool is(lua_State* L, int index) {
-            return lua_isnumber(L, index);
+            static char k;
+            return &k;
         }
-        static int get(lua_State* L, int index, int& offset)
+
+        static size_t string_bytes(lua_State* L, int from, int to)
         {
-            return (int32_t)lua_tonumber(L, index+offset);
-        }
-        static const char* type_name(lua_State* L) {
-            return "integer";
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "number";
-        }
-        static int basic_type(lua_State* L) {
-            return LUA_TNUMBER;
+            size_t bytes = 0;
+            for (auto i = from; i <= to; i++)
+                if (lua_type(L, i) == LUA_TSTRING)
+                    bytes += lua_getlen(L, i);
+            return bytes;
         }
-    };
-
-    template<>
-    class Stack<unsigned int> {
     public:
-        static int push(lua_State* L, unsigned int t)
+        static CallStats* get(lua_State* L)
         {
-            lua_pushnumber(L, (double)t);
-            return 1;
-        }
-        static bool is(lua_State* L, int index) {
-            return lua_isnumber(L, index);
+            return detail::state_data<CallStats>(L, key());
         }
-        static unsigned int get(lua_State* L, int index, int& offset)
+
+        static CallStats& of(lua_State* L)
         {
-            return lua_touinteger(L, index+offset);
-        }
-        static const char* type_name(lua_State* L) {
-            return "unsigned integer";
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "number";
-        }
-        static int basic_type(lua_State* L) {
-            return LUA_TNUMBER;
+            if (auto calls = get(L))
+                return *calls;
+            return *detail::make_state_data<CallStats>(L, key());
         }
-    };
 
-    template<>
-    class Stack<void> {
-    public:
-        static int push(lua_State* L)
+        // the key of the bound closure at idx: its first upvalue, or the C function without one
+        static const void* binding(lua_State* L, int idx)
         {
-            lua_pushnil(L);
-            return 1;
-        }
-        static bool is(lua_State* L, int index) {
-            return lua_isnoneornil(L, index);
-        }
-        static const char* type_name(lua_State* L) {
-            return "nil";
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "nil";
-        }
-        static int basic_type(lua_State* L) {
-            return LUA_TNIL;
+            idx = lua_absindex(L, idx);
+            const void* k = nullptr;
+            if (lua_getupvalue(L, idx, 1))
+            {
+                k = lua_topointer(L, -1);
+                lua_pop(L, 1);
+            }
+            return k ? k : (const void*)lua_tocfunction(L, idx);
         }
-    };
 
-    template<class T> requires std::is_floating_point_v<T>
-    class Stack<T> {
-    public:
-        static int push(lua_State* L, T t)
+        void name(const void* k, string_type name)
         {
-            lua_pushnumber(L, t);
-            return 1;
-        }
-        static bool is(lua_State* L, int index) {
-            return lua_isnumber(L, index);
+            stats[k].name = std::move(name);
         }
-        static T get(lua_State* L, int index, int& offset)
+
+        // pushes the binding registered as name, or nil
+        static void push_binding(lua_State* L, const char* name)
         {
-            return (T)lua_tonumber(L, index+offset);
-        }
-        static const char* type_name(lua_State* L) {
-            return "number";
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "number";
-        }
-        static int basic_type(lua_State* L) {
-            return LUA_TNUMBER;
+            if (lua_rawgetp(L, LUA_REGISTRYINDEX, detail::bindings_key()) != LUA_TTABLE)
+                return;
+            lua_getfield(L, -1, name);
+            lua_remove(L, -2);
         }
-    };
 
-    template<class T> requires std::is_integral_v<T>
-    class Stack<T> {
-    public:
-        static int push(lua_State* L, T t)
+        void set_trace(TraceCall call, TraceDone done, void* ud)
         {
-            lua_pushnumber(L, (double)t);
-            return 1;
+            trace_call = call;
+            trace_done = done;
+            trace_ud = ud;
         }
-        static bool is(lua_State* L, int index) {
-            return lua_isnumber(L, index);
+
+        void set_sampler(Sampler f, void* ud)
+        {
+            sampler = f;
+            sampler_ud = ud;
         }
-        static T get(lua_State* L, int index, int& offset)
+
+        void sample(lua_State* L)
         {
-            return (T)lua_tonumber(L, index+offset);
+            if (sampler)
+                sampler(sampler_ud, L);
         }
-        static const char* type_name(lua_State* L) {
-            return "integer";
+
+        // expires when the counters are destroyed with their lua_State, see Hooks::alive
+        [[nodiscard]] std::weak_ptr<void> alive() const
+        {
+            return token;
         }
-        static const char* basic_type_name(lua_State* L) {
-            return "number";
+
+        [[nodiscard]] bool tracing() const
+        {
+            return trace_call != nullptr;
         }
-        static int basic_type(lua_State* L) {
-            return LUA_TNUMBER;
+
+        uint64_t trace_begin(lua_State* L, const void* k, int args)
+        {
+            return trace_call ? trace_call(trace_ud, L, k, args) : 0;
         }
-    };
 
-    template<class T> requires std::is_same_v<T, char*>
-    class Stack<T> {
-    public:
-        static int push(lua_State* L, T t)
+        void trace_end(uint64_t ticket, std::chrono::nanoseconds time)
         {
-            lua_pushstring(L, t);
-            return 1;
+            if (ticket && trace_done)
+                trace_done(trace_ud, ticket, time);
         }
-        static bool is(lua_State* L, int index) {
-            return lua_isstring(L, index);
+
+        void record(lua_State* L, const void* k, int args, int results, std::chrono::nanoseconds time)
+        {
+            auto& s = stats[k];
+            s.calls++;
+            s.total += time;
+            if (time > s.max)
+                s.max = time;
+            auto us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+            int bucket = 0;
+            while (us && bucket < CallStat::buckets - 1)
+            {
+                us >>= 1;
+                bucket++;
+            }
+            s.histogram[bucket]++;
+            s.bytes_in += string_bytes(L, 1, args);
+            s.bytes_out += string_bytes(L, lua_gettop(L) - results + 1, lua_gettop(L));
         }
-        static T get(lua_State* L, int index, int& offset)
+
+        [[nodiscard]] const std::unordered_map<const void*, CallStat>& entries() const
         {
-            return (T)luaL_tolstring(L, index+offset, nullptr);
+            return stats;
         }
-        static const char* type_name(lua_State* L) {
-            return "string";
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "string";
-        }
-        static int basic_type(lua_State* L) {
-            return LUA_TSTRING;
-        }
-    };
-
-    template<>
-    class Stack<bool> {
-    public:
-        static int push(lua_State* L, bool t)
-        {
-            lua_pushboolean(L, t);
-            return 1;
-        }
-        static bool is(lua_State* L, int) {
-            return true;
-        }
-        static bool get(lua_State* L, int index, int& offset)
-        {
-            return lua_toboolean(L, index+offset);
-        }
-        static const char* type_name(lua_State* L) {
-            return "boolean";
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "boolean";
-        }
-        static int basic_type(lua_State* L) {
-            return LUA_TBOOLEAN;
-        }
-    };
-
-    template<>
-    class Stack<char*> {
-    public:
-        static int push(lua_State* L, char* t)
-        {
-            lua_pushstring(L, t);
-            return 1;
-        }
-        static bool is(lua_State* L, int index) {
-            return lua_isstring(L, index);
-        }
-        static char* get(lua_State* L, int index, int& offset)
-        {
-            return (char*)luaL_tolstring(L, index+offset, nullptr);
-        }
-        static const char* type_name(lua_State* L) {
-            return "string";
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "string";
-        }
-        static int basic_type(lua_State* L) {
-            return LUA_TSTRING;
-        }
-    };
 
-    template<>
-    class Stack<const char*> {
-    public:
-        static int push(lua_State* L, const char* t)
-        {
-            lua_pushstring(L, t);
-            return 1;
-        }
-        static bool is(lua_State* L, int index) {
-            return lua_isstring(L, index);
-        }
-        static const char* get(lua_State* L, int index, int& offset)
+        // clears the counters, names stay
+        void reset()
         {
-            return luaL_tolstring(L, index+offset, nullptr);
-        }
-        static const char* type_name(lua_State* L) {
-            return "string";
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "string";
-        }
-        static int basic_type(lua_State* L) {
-            return LUA_TSTRING;
+            for (auto& [k, s] : stats)
+            {
+                auto name = std::move(s.name);
+                s = CallStat();
+                s.name = std::move(name);
+            }
         }
-    };
 
-    template<>
-    class Stack<string_type> {
-    public:
-        static int push(lua_State* L, string_type t)
+        // lua_CFunction returning { [name] = { calls, total_us, max_us, bytes_in, bytes_out, histogram } }
+        // for the bindings that were called; unnamed ones show up as "?"
+        static int table(lua_State* L)
         {
-            lua_pushlstring(L, t.data(), t.size());
+            lua_newtable(L);
+            auto calls = get(L);
+            if (!calls)
+                return 1;
+            for (auto& [k, s] : calls->stats)
+            {
+                if (!s.calls)
+                    continue;
+                lua_createtable(L, 0, 6);
+                lua_pushnumber(L, (lua_Number)s.calls);
+                lua_setfield(L, -2, "calls");
+                lua_pushnumber(L, (lua_Number)s.total.count() / 1000.0);
+                lua_setfield(L, -2, "total_us");
+                lua_pushnumber(L, (lua_Number)s.max.count() / 1000.0);
+                lua_setfield(L, -2, "max_us");
+                lua_pushnumber(L, (lua_Number)s.bytes_in);
+                lua_setfield(L, -2, "bytes_in");
+                lua_pushnumber(L, (lua_Number)s.bytes_out);
+                lua_setfield(L, -2, "bytes_out");
+                lua_createtable(L, CallStat::buckets, 0);
+                for (int i = 0; i < CallStat::buckets; i++)
+                {
+                    lua_pushnumber(L, (lua_Number)s.histogram[i]);
+                    lua_rawseti(L, -2, i + 1);
+                }
+                lua_setfield(L, -2, "histogram");
+                lua_setfield(L, -2, s.name.empty() ? "?" : s.name.c_str());
+            }
             return 1;
         }
-        static bool is(lua_State* L, int index) {
-            return lua_isstring(L, index);
-        }
-        static string_type get(lua_State* L, int index, int& offset)
-        {
-            size_t len = 0;
-            return { luaL_tolstring(L, index+offset, &len), len };
-        }
-        static const char* type_name(lua_State* L) {
-            return "string";
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "string";
-        }
-        static int basic_type(lua_State* L) {
-            return LUA_TSTRING;
-        }
     };
 
-    template<typename T>
-    class Stack<std::optional<T>> {
-    public:
-        static int push(lua_State* L, std::optional<T> t)
-        {
-            if (t.has_value())
-                detail::push<T>(L, t.value());
-            else
-                lua_pushnil(L);
-            return 1;
-        }
-        static bool is(lua_State* L, int index) {
-            if (lua_isnil(L, index))
-                return true;
-            if constexpr (detail::is_pushable<T>)
+    namespace detail {
+        // the C function each probed<F> wraps, for SymbolMap
+        class ProbedTargets {
+            static std::mutex& lock()
             {
-                return Stack<T>::is(L, index);
+                static std::mutex m;
+                return m;
             }
-            return StackClass<T>::is(L, index);
-        }
-        static std::optional<T> get(lua_State* L, int index, int& offset)
-        {
-            if (lua_isnoneornil(L, index+offset))
-                return std::nullopt;
-            return detail::get<T>(L, index+offset);
-        }
-        static const char* type_name(lua_State* L) {
-            if constexpr (detail::is_pushable<T>)
+
+            static std::unordered_map<lua_CFunction, lua_CFunction>& targets()
             {
-                return Stack<T>::type_name(L);
+                static std::unordered_map<lua_CFunction, lua_CFunction> t;
+                return t;
             }
-            return StackClass<T>::type_name(L);
-        }
-        static const char* basic_type_name(lua_State* L) {
-            if constexpr (detail::is_pushable<T>)
+        public:
+            static void add(lua_CFunction wrapper, lua_CFunction target)
             {
-                return Stack<T>::basic_type_name(L);
+                std::lock_guard guard(lock());
+                targets().emplace(wrapper, target);
             }
-            return StackClass<T>::basic_type_name(L);
-        }
-        static int basic_type(lua_State* L) {
-            if constexpr (detail::is_pushable<T>)
+
+            // the function f wraps, or nullptr
+            static lua_CFunction find(lua_CFunction f)
             {
-                return Stack<T>::basic_type(L);
+                std::lock_guard guard(lock());
+                auto it = targets().find(f);
+                return it == targets().end() ? nullptr : it->second;
             }
-            return StackClass<T>::basic_type(L);
-        }
-    };
-
-    template<typename Param>
-    int snp(lua_State *L, char* buff) {
-        if constexpr (detail::is_pushable<Param>)
-            snprintf(buff, 1000, strlen(buff) > 6 ? "%s, %s" : "%s%s", buff, Stack<Param>::type_name(L));
-        else
-            snprintf(buff, 1000, strlen(buff) > 6 ? "%s, %s" : "%s%s", buff, StackClass<Param>::type_name(L));
-        return 0;
-    };
+        };
 
-    template<typename ...Params>
-    class Stack<std::tuple<Params...>> {
-    public:
-        static int push(lua_State* L, std::tuple<Params...> t)
-        {
-            lua_createtable(L, sizeof...(Params), 0);
-            auto tbl = lua_gettop(L);
-            std::apply([L, tbl](auto &&... args) {
-                (void)std::initializer_list<int>{ detail::push(L, args)... };
-                for (auto i = sizeof...(Params); i > 0; i--)
-                    lua_rawseti(L, tbl, i);
-            }, t);
-            return 1;
-        }
-        static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
+        // wraps a thunk, timing it and counting the string bytes of its arguments and results
+        template<lua_CFunction F>
+        int probed(lua_State* L)
+        {
+            auto k = lua_topointer(L, lua_upvalueindex(1));
+            if (!k)
+                k = (const void*)&probed<F>;
+            auto args = lua_gettop(L);
+            auto& calls = CallStats::of(L);
+            // F may overwrite its arguments, so a trace takes them first
+            auto ticket = calls.trace_begin(L, k, args);
+            auto start = std::chrono::steady_clock::now();
+            auto n = F(L);
+            auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            calls.record(L, k, args, n, time);
+            calls.trace_end(ticket, time);
+            calls.sample(L);
+            return n;
+        }
+
+        // probed<F>, remembering that it runs F
+        template<lua_CFunction F>
+        lua_CFunction probe()
+        {
+            static const bool added = (ProbedTargets::add(probed<F>, F), true);
+            (void)added;
+            return probed<F>;
         }
-        static std::tuple<Params...> get(lua_State* L, int index, int& offset)
-        {
-            auto tbl = lua_absindex(L, index+offset);
-            auto top = lua_gettop(L);
-            for (auto i = 1; i <= sizeof...(Params); i++)
+    }
+#define LUABINDING_THUNK(...) LuaBinding::detail::probe<__VA_ARGS__>()
+#else
+#define LUABINDING_THUNK(...) __VA_ARGS__
+#endif
+
+    namespace detail {
+#if defined(LUABINDING_CALL_STATS) || defined(LUABINDING_SYMBOL_MAP)
+        // names the bound closure at idx as prefix.name, and keeps it under that name for
+        // replays and symbol maps
+        inline void name_call(lua_State* L, int idx, const char* prefix, const char* name)
+        {
+            idx = lua_absindex(L, idx);
+            auto full = prefix ? string_type(prefix) + "." + name : string_type(name);
+#ifdef LUABINDING_CALL_STATS
+            CallStats::of(L).name(CallStats::binding(L, idx), full);
+#endif
+            if (lua_rawgetp(L, LUA_REGISTRYINDEX, bindings_key()) != LUA_TTABLE)
             {
-                lua_geti(L, tbl, i);
+                lua_pop(L, 1);
+                lua_newtable(L);
+                lua_pushvalue(L, -1);
+                lua_rawsetp(L, LUA_REGISTRYINDEX, bindings_key());
             }
-            using ParamList = std::tuple<std::decay_t<Params>...>;
-            ParamList params;
-            assign_tup(L, params, top);
-            lua_pop(L, sizeof...(Params));
-            return params;
-        }
-        static const char* type_name(lua_State* L) {
-            static char buff[1000] = { '\0' };
-            if (buff[0]) return buff;
-            snprintf(buff, 1000, "table{");
-            (void)std::initializer_list<int> { snp<Params>(L, buff)... };
-            snprintf(buff, 1000, "%s}", buff);
-            return buff;
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "table";
-        }
-        static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+            lua_pushvalue(L, idx);
+            lua_setfield(L, -2, full.c_str());
+            lua_pop(L, 1);
         }
-    };
 
-    template<typename K, typename V>
-    class Stack<std::pair<K, V>> {
-    public:
-        static int push(lua_State* L, std::pair<K, V> t)
-        {
-            lua_createtable(L, 2, 0);
-            detail::push<K>(L, t.first);
-            lua_rawseti(L, -2, 1);
-            detail::push<V>(L, t.second);
-            lua_rawseti(L, -2, 2);
-            return 1;
-        }
-        static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
-        }
-        static std::pair<K, V> get(lua_State* L, int index, int& offset)
+        // names an OverloadedFunction at idx, and its overloads after it as name#1, name#2...
+        inline void name_overloads(lua_State* L, int idx, const char* prefix, const char* name)
         {
-            index = lua_absindex(L, index+offset);
-            lua_geti(L, index, 1);
-            lua_geti(L, index, 2);
-            std::pair<K, V> t = { detail::get<K>(L, -2), detail::get<V>(L, -1) };
+            idx = lua_absindex(L, idx);
+            name_call(L, idx, prefix, name);
+            if (!lua_getupvalue(L, idx, 1))
+                return;
+            for (lua_Integer i = 1; lua_rawgeti(L, -1, i) == LUA_TTABLE; i++)
+            {
+                char index[24];
+                snprintf(index, sizeof(index), "#%lld", (long long)i);
+                if (lua_getfield(L, -1, "f") == LUA_TFUNCTION)
+                    name_call(L, -1, prefix, (string_type(name) + index).c_str());
+                lua_pop(L, 2);
+            }
             lua_pop(L, 2);
-            return t;
         }
-        static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
-            if constexpr (detail::is_pushable<K>)
-            {
-                snprintf(buff, 100, "table{%s, ", Stack<K>::type_name(L));
-            } else
-                snprintf(buff, 100, "table{%s, ", StackClass<K>::type_name(L));
-            if constexpr (detail::is_pushable<V>)
-            {
-                snprintf(buff, 100, "%s%s}", buff, Stack<V>::type_name(L));
-            } else
-                snprintf(buff, 100, "%s%s}", buff, StackClass<V>::type_name(L));
-            return buff;
+#else
+        inline void name_call(lua_State*, int, const char*, const char*)
+        {}
+
+        inline void name_overloads(lua_State*, int, const char*, const char*)
+        {}
+#endif
+    }
+}
+
+
+namespace LuaBinding {
+    template<typename C, typename ...Functions>
+    class OverloadedFunction;
+    template<typename T>
+    class Class;
+    class DynClass;
+    class Object;
+    class ObjectRef;
+    class Environment;
+    class State;
+    class IndexProxy;
+    template<typename T>
+    class Stack;
+    template<typename T>
+    class StackClass;
+    template<typename T>
+    class helper;
+
+
+
+    template <class R, class... Params>
+    class Traits;
+    template <class T, class... Params>
+    class TraitsCtor;
+    template <class R, class... Params>
+    class TraitsSTDFunction;
+    template <class T>
+    class TraitsCFunc;
+    template <class R, class T, class... Params>
+    class TraitsClass;
+    template <class R, class T, class... Params>
+    class TraitsFunClass;
+    template <class R, class... Params>
+    class TraitsNClass;
+    template <class T>
+    class TraitsClassNCFunc;
+    template <class T>
+    class TraitsClassFunNCFunc;
+    template <class T>
+    class TraitsClassCFunc;
+    template <class T>
+    class TraitsClassFunCFunc;
+    template <class T>
+    class TraitsClassLCFunc;
+    template <class T>
+    class TraitsClassFunLCFunc;
+    template <class T>
+    class TraitsClassFunNLCFunc;
+    template <class R, class T>
+    class TraitsClassProperty;
+    template <class R, class T>
+    class TraitsClassPropertyNFn;
+    template <class R, class T>
+    class TraitsClassPropertyFn;
+    template <class R, class T>
+    class TraitsClassPropertyNFunFn;
+    template <class R, class T>
+    class TraitsClassPropertyFunFn;
+    template <class R, class T>
+    class TraitsClassPropertyNFunCFn;
+    template <class R, class T>
+    class TraitsClassPropertyNFunLCFn;
+    template <class R, class T>
+    class TraitsClassPropertyFunLCFn;
+    template <class R, class T>
+    class TraitsClassPropertyNFunC;
+    template <class R, class T>
+    class TraitsClassPropertyFunC;
+    template <class R, class T>
+    class TraitsClassPropertyNCFun;
+    template <class R, class T>
+    class TraitsClassPropertyCFun;
+}
+
+
+
+#include <map>
+#include <optional>
+#include <vector>
+#include <set>
+#include <list>
+#include <map>
+#include <queue>
+#include <stack>
+#include <deque>
+#include <unordered_set>
+#include <unordered_map>
+#include <atomic>
+
+namespace LuaBinding {
+    namespace detail {
+        template<typename T>
+        concept is_pushable = requires(T a) {
+            { LuaBinding::Stack<std::decay_t<T>>::is(nullptr, 0) };
+        };
+
+        template<typename T>
+        concept is_atomic = std::is_same_v<T, std::atomic<typename T::value_type>>;
+
+        template<class T> requires is_pushable<T> && (!is_atomic<T>)
+        T get(lua_State* L, int index)
+        {
+            int offset = 0;
+            return Stack<T>::get(L, index, offset);
         }
-        static const char* basic_type_name(lua_State* L) {
-            return "table";
+
+        template<class T> requires (!is_pushable<T>) && (!is_atomic<T>)
+        T get(lua_State* L, int index)
+        {
+            int offset = 0;
+            return StackClass<T>::get(L, index, offset);
         }
-        static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+
+        template<class T> requires is_atomic<T>
+        T::value_type get(lua_State* L, int index)
+        {
+            int offset = 0;
+            return Stack<T>::get(L, index, offset);
         }
-    };
 
-    template<typename T>
-    class Stack<std::vector<T>> {
-    public:
-        static int push(lua_State* L, std::vector<T> t)
+        template<class T> requires is_pushable<T>
+        T extract(lua_State* L, int index)
         {
-            lua_createtable(L, t.size(), 0);
-            for (auto i = 0; i < t.size(); i++)
-            {
-                detail::push<T>(L, t[i]);
-                lua_rawseti(L, -2, i + 1);
-            }
-            return 1;
+            int offset = 0;
+            auto r = Stack<T>::get(L, index, offset);
+            lua_remove(L, index);
+            return r;
         }
-        static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
+
+        template<class T> requires (!is_pushable<T>)
+        T extract(lua_State* L, int index)
+        {
+            int offset = 0;
+            auto r = StackClass<T>::get(L, index, offset);
+            lua_remove(L, index);
+            return r;
         }
-        static std::vector<T> get(lua_State* L, int index, int& offset)
+
+        template<class T> requires is_pushable<T>
+        int push(lua_State* L, T&& t)
         {
-            index = lua_absindex(L, index+offset);
-            size_t len = lua_getlen(L, index);
-            std::vector<T> result;
-            result.reserve(len);
-            for (auto i = 1; i <= len; i++)
-            {
-                lua_geti(L, index, i);
-                result.push_back(detail::get<T>(L, -1));
-                lua_pop(L, 1);
-            }
-            return result;
+            return Stack<T>::push(L, std::move(t));
         }
-        static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
-            if constexpr (detail::is_pushable<T>)
-            {
-                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
-            } else
-                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
-            return buff;
+
+        template<class T> requires is_pushable<T>
+        int push(lua_State* L, T& t)
+        {
+            return Stack<T>::push(L, t);
         }
-        static const char* basic_type_name(lua_State* L) {
-            return "table";
+
+        template<class T> requires (!is_pushable<T> && !std::is_same_v<T, nullptr_t>)
+        int push(lua_State*L, T& t)
+        {
+            return StackClass<T>::push(L, t);
         }
-        static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+
+        template<class T> requires (!is_pushable<T> && !std::is_same_v<T, nullptr_t>)
+        int push(lua_State*L, T&& t)
+        {
+            return StackClass<T>::push(L, t);
         }
-    };
 
-    template<typename T>
-    class Stack<std::atomic<T>> {
-    public:
-        static int push(lua_State* L, std::atomic<T>& t)
+        template<class T> requires (!is_pushable<T> && std::is_same_v<T, nullptr_t>)
+        int push(lua_State* L, T& t)
         {
-            detail::push<T>(L, t.load());
+            lua_pushnil(L);
             return 1;
         }
-        static bool is(lua_State* L, int index) {
-            return Stack<T>::is(L, index);
+
+        template<class T> requires (!is_pushable<T> && std::is_same_v<T, nullptr_t>)
+        int push(lua_State* L, T&& t)
+        {
+            lua_pushnil(L);
+            return 1;
         }
-        static T get(lua_State* L, int index, int& offset)
+
+        template<class T> requires is_pushable<T>
+        bool is(lua_State* L, int index)
         {
-            return detail::get<T>(L, index+offset);
+            return Stack<T>::is(L, index);
         }
-        static const char* type_name(lua_State* L) {
-            return Stack<T>::type_name(L);
+
+        template<class T> requires (!is_pushable<T>)
+        bool is(lua_State* L, int index)
+        {
+            return StackClass<T>::is(L, index);
         }
-        static const char* basic_type_name(lua_State* L) {
+
+        template<class T> requires is_pushable<T>
+        const char* basic_type_name(lua_State* L)
+        {
             return Stack<T>::basic_type_name(L);
         }
-        static int basic_type(lua_State* L) {
-            return Stack<T>::basic_type(L);
+
+        template<class T> requires (!is_pushable<T>)
+        const char* basic_type_name(lua_State* L)
+        {
+            return "userdata";
         }
-    };
 
-    template<typename T>
-    class Stack<std::vector<T>*> {
-    public:
-        static int push(lua_State* L, std::vector<T>* t)
+        template<class T> requires is_pushable<T>
+        int basic_type(lua_State* L)
         {
-            lua_createtable(L, t->size(), 0);
-            for (auto i = 0; i < t->size(); i++)
-            {
-                detail::push<T>(L, t->at(i));
-                lua_rawseti(L, -2, i + 1);
-            }
-            return 1;
-        }
-        static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
+            return Stack<T>::basic_type(L);
         }
-        static std::vector<T>* get(lua_State* L, int index, int& offset)
+
+        template<class T> requires (!is_pushable<T>)
+        int basic_type(lua_State* L)
         {
-            index = lua_absindex(L, index+offset);
-            size_t len = lua_getlen(L, index);
-            auto result = new std::vector<T>();
-            result->reserve(len);
-            for (auto i = 1; i <= len; i++)
-            {
-                lua_geti(L, index, i);
-                result->push_back(detail::get<T>(L, -1));
-                lua_pop(L, 1);
-            }
-            return result;
+            return LUA_TUSERDATA;
+        }
+    }
+
+    template<typename T>
+    class Stack {
+    public:
+        static int push(lua_State* L, T t) {
+            static_assert(sizeof(T) == 0, "Unspecialized use of Stack<T>::push");
+        }
+        static bool is(lua_State* L, int index) = delete;
+        static T get(lua_State* L, int index, int& offset) {
+            static_assert(sizeof(T) == 0, "Unspecialized use of Stack<T>::get");
         }
         static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
-            if constexpr (detail::is_pushable<T>)
-            {
-                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
-            } else
-                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
-            return buff;
+            return "";
         }
         static const char* basic_type_name(lua_State* L) {
-            return "table";
+            return "";
         }
         static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+            return LUA_TNONE;
         }
     };
 
     template<typename T>
-    class Stack<std::list<T>> {
+    class StackClass {
     public:
-        static int push(lua_State* L, std::list<T> t)
+        static int push(lua_State* L, T& t) requires (!std::is_convertible_v<T, void*>)
         {
-            lua_createtable(L, t.size(), 0);
-            auto i = 1;
-            for (auto& el : t)
+            auto _t = new (detail::new_object(L, sizeof(T))) T(t);
+            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
+            *u = _t; *(u + 1) = (void*)0xC0FFEE;
+            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
+            lua_setmetatable(L, -2);
+            detail::report_object(L, _t);
+            return 1;
+        }
+        static int push(lua_State* L, T&& t) requires (!std::is_convertible_v<T, void*>)
+        {
+            auto _t = new (detail::new_object(L, sizeof(T))) T(t);
+            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
+            *u = _t; *(u + 1) = (void*)0xC0FFEE;
+            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
+            lua_setmetatable(L, -2);
+            detail::report_object(L, _t);
+            return 1;
+        }
+        static int push(lua_State* L, T& t) requires std::is_convertible_v<T, void*>
+        {
+            if (t == nullptr)
             {
-                detail::push<T>(L, el);
-                lua_rawseti(L, -2, i++);
+                lua_pushnil(L);
+                return 1;
             }
+            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
+            *u = (void*)t; *(u + 1) = 0;
+
+            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
+            lua_setmetatable(L, -2);
             return 1;
         }
-        static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
-        }
-        static std::list<T> get(lua_State* L, int index, int& offset)
+        static int push(lua_State* L, T&& t) requires std::is_convertible_v<T, void*>
         {
-            index = lua_absindex(L, index+offset);
-            size_t len = lua_getlen(L, index);
-            std::list<T> result;
-            result.reserve(len);
-            for (auto i = 1; i <= len; i++)
+            if (t == nullptr)
             {
-                lua_geti(L, index, i);
-                result.push_back(detail::get<T>(L, -1));
-                lua_pop(L, 1);
+                lua_pushnil(L);
+                return 1;
             }
-            return result;
+            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
+            *u = (void*)t; *(u + 1) = 0;
+            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
+            lua_setmetatable(L, -2);
+            return 1;
+        }
+        static bool is(lua_State* L, int index) requires std::is_same_v<T, void*> {
+#ifdef FLUENT_USERDATA_CHECKS
+            if (!lua_isuserdata(L, index) && !lua_isnumber(L, index)) return false;
+#else
+            if (!lua_isuserdata(L, index)) return false;
+#endif
+            return true;
+        }
+        static bool is(lua_State* L, int index) requires (!std::is_same_v<T, void*>) {
+            if (!lua_isuserdata(L, index)) {
+#ifdef FLUENT_USERDATA_CHECKS
+                if constexpr (std::is_convertible_v<T, uintptr_t>)
+                    if (lua_isnumber(L, index))
+                        return true;
+#endif
+                return false;
+            }
+            lua_getmetatable(L, index);
+            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
+            auto res = lua_compare(L, -1, -2, LUA_OPEQ);
+            lua_pop(L, 2);
+            return res == 1;
         }
         static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
-            if constexpr (detail::is_pushable<T>)
+            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
+            if (luaL_getfield(L, -1, "__name"))
             {
-                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
-            } else
-                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
-            return buff;
+                auto name = lua_tostring(L, -1);
+                lua_pop(L, 2);
+                return name;
+            }
+            lua_pop(L, 2);
+            return typeid(T).name();
         }
         static const char* basic_type_name(lua_State* L) {
-            return "table";
+            return "userdata";
         }
         static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+            return LUA_TUSERDATA;
+        }
+        static T get(lua_State* L, int index, int& offset) requires (std::is_convertible_v<T, void*>)
+        {
+            index += offset;
+            if (!is(L, index))
+            {
+                if constexpr (std::is_convertible_v<T, void*>)
+                    if (lua_isnoneornil(L, index))
+                        return nullptr;
+                luaL_typeerror(L, index, type_name(L));
+            }
+#ifdef FLUENT_USERDATA_CHECKS
+            if (lua_isnumber(L, index))
+                return (T)(uintptr_t)lua_tonumber(L, index);
+#endif
+            return *(T*)lua_touserdata(L, index);
+        }
+        static T get(lua_State* L, int index, int& offset) requires (!std::is_convertible_v<T, void*>)
+        {
+            index += offset;
+            if (!is(L, index))
+            {
+                luaL_typeerror(L, index, type_name(L));
+            }
+#ifdef FLUENT_USERDATA_CHECKS
+            if constexpr (std::is_convertible_v<T, uintptr_t>)
+                if (lua_isnumber(L, index))
+                    return (T)(uintptr_t)lua_tonumber(L, index);
+#endif
+            return **(T**)lua_touserdata(L, index);
         }
     };
 
-    template<typename T>
-    class Stack<std::stack<T>> {
+    template<>
+    class Stack<int> {
     public:
-        static int push(lua_State* L, std::stack<T> t)
+        static int push(lua_State* L, int t)
         {
-            lua_createtable(L, t.size(), 0);
-            auto i = 1;
-            for (auto& el : t)
-            {
-                detail::push<T>(L, el);
-                lua_rawseti(L, -2, i++);
-            }
+            lua_pushnumber(L, (double)t);
             return 1;
         }
         static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
+            return lua_isnumber(L, index);
         }
-        static std::stack<T> get(lua_State* L, int index, int& offset)
+        static int get(lua_State* L, int index, int& offset)
         {
-            index = lua_absindex(L, index+offset);
-            size_t len = lua_getlen(L, index);
-            std::stack<T> result;
-            result.reserve(len);
-            for (auto i = 1; i <= len; i++)
-            {
-                lua_geti(L, index, i);
-                result.push_back(detail::get<T>(L, -1));
-                lua_pop(L, 1);
-            }
-            return result;
+            return (int32_t)lua_tonumber(L, index+offset);
         }
         static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
-            if constexpr (detail::is_pushable<T>)
-            {
-                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
-            } else
-                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
-            return buff;
+            return "integer";
         }
         static const char* basic_type_name(lua_State* L) {
-            return "table";
+            return "number";
         }
         static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+            return LUA_TNUMBER;
         }
     };
 
-    template<typename T>
-    class Stack<std::queue<T>> {
+    template<>
+    class Stack<unsigned int> {
     public:
-        static int push(lua_State* L, std::queue<T> t)
+        static int push(lua_State* L, unsigned int t)
         {
-            lua_createtable(L, t.size(), 0);
-            auto i = 1;
-            for (auto& el : t)
-            {
-                detail::push<T>(L, el);
-                lua_rawseti(L, -2, i++);
-            }
+            lua_pushnumber(L, (double)t);
             return 1;
         }
         static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
+            return lua_isnumber(L, index);
         }
-        static std::queue<T> get(lua_State* L, int index, int& offset)
+        static unsigned int get(lua_State* L, int index, int& offset)
         {
-            index = lua_absindex(L, index+offset);
-            size_t len = lua_getlen(L, index);
-            std::queue<T> result;
-            result.reserve(len);
-            for (auto i = 1; i <= len; i++)
-            {
-                lua_geti(L, index, i);
-                result.push_back(detail::get<T>(L, -1));
-                lua_pop(L, 1);
-            }
-            return result;
+            return lua_touinteger(L, index+offset);
         }
         static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
-            if constexpr (detail::is_pushable<T>)
-            {
-                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
-            } else
-                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
-            return buff;
+            return "unsigned integer";
         }
         static const char* basic_type_name(lua_State* L) {
-            return "table";
+            return "number";
         }
         static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+            return LUA_TNUMBER;
         }
     };
 
-    template<typename T>
-    class Stack<std::deque<T>> {
+    template<>
+    class Stack<void> {
     public:
-        static int push(lua_State* L, std::deque<T> t)
+        static int push(lua_State* L)
         {
-            lua_createtable(L, t.size(), 0);
-            auto i = 1;
-            for (auto& el : t)
-            {
-                detail::push<T>(L, el);
-                lua_rawseti(L, -2, i++);
-            }
+            lua_pushnil(L);
             return 1;
         }
         static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
-        }
-        static std::deque<T> get(lua_State* L, int index, int& offset)
-        {
-            index = lua_absindex(L, index+offset);
-            size_t len = lua_getlen(L, index);
-            std::deque<T> result;
-            result.reserve(len);
-            for (auto i = 1; i <= len; i++)
-            {
-                lua_geti(L, index, i);
-                result.push_back(detail::get<T>(L, -1));
-                lua_pop(L, 1);
-            }
-            return result;
+            return lua_isnoneornil(L, index);
         }
         static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
-            if constexpr (detail::is_pushable<T>)
-            {
-                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
-            } else
-                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
-            return buff;
+            return "nil";
         }
         static const char* basic_type_name(lua_State* L) {
-            return "table";
+            return "nil";
         }
         static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+            return LUA_TNIL;
         }
     };
 
-    template<typename T>
-    class Stack<std::set<T>> {
+    template<class T> requires std::is_floating_point_v<T>
+    class Stack<T> {
     public:
-        static int push(lua_State* L, std::set<T> t)
+        static int push(lua_State* L, T t)
         {
-            lua_createtable(L, t.size(), 0);
-            auto i = 1;
-            for (auto& el : t)
-            {
-                detail::push<T>(L, el);
-                lua_rawseti(L, -2, i++);
-            }
+            lua_pushnumber(L, t);
             return 1;
         }
         static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
+            return lua_isnumber(L, index);
         }
-        static std::set<T> get(lua_State* L, int index, int& offset)
+        static T get(lua_State* L, int index, int& offset)
         {
-            index = lua_absindex(L, index+offset);
-            size_t len = lua_getlen(L, index);
-            std::set<T> result;
-            result.reserve(len);
-            for (auto i = 1; i <= len; i++)
-            {
-                lua_geti(L, index, i);
-                result.push_back(detail::get<T>(L, -1));
-                lua_pop(L, 1);
-            }
-            return result;
+            return (T)lua_tonumber(L, index+offset);
         }
         static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
-            if constexpr (detail::is_pushable<T>)
-            {
-                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
-            } else
-                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
-            return buff;
+            return "number";
         }
         static const char* basic_type_name(lua_State* L) {
-            return "table";
+            return "number";
         }
         static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+            return LUA_TNUMBER;
         }
     };
 
-    template<typename T>
-    class Stack<std::unordered_set<T>> {
+    template<class T> requires std::is_integral_v<T>
+    class Stack<T> {
     public:
-        static int push(lua_State* L, std::unordered_set<T> t)
+        static int push(lua_State* L, T t)
         {
-            lua_createtable(L, t.size(), 0);
-            auto i = 1;
-            for (auto el : t)
-            {
-                detail::push<std::decay_t<T>>(L, el);
-                lua_rawseti(L, -2, i++);
-            }
+            lua_pushnumber(L, (double)t);
             return 1;
         }
         static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
+            return lua_isnumber(L, index);
         }
-        static std::unordered_set<T> get(lua_State* L, int index, int& offset)
+        static T get(lua_State* L, int index, int& offset)
         {
-            index = lua_absindex(L, index+offset);
-            size_t len = lua_getlen(L, index);
-            std::unordered_set<T> result;
-            result.reserve(len);
-            for (auto i = 1; i <= len; i++)
-            {
-                lua_geti(L, index, i);
-                result.insert(detail::get<T>(L, -1));
-                lua_pop(L, 1);
-            }
-            return result;
+            return (T)lua_tonumber(L, index+offset);
         }
         static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
-            if constexpr (detail::is_pushable<T>)
-            {
-                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
-            } else
-                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
-            return buff;
+            return "integer";
         }
         static const char* basic_type_name(lua_State* L) {
-            return "table";
+            return "number";
         }
         static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+            return LUA_TNUMBER;
         }
     };
 
-    template <class T, size_t size>
-    class Stack<std::array <T, size>> {
+    template<class T> requires std::is_same_v<T, char*>
+    class Stack<T> {
     public:
-        static int push(lua_State* L, std::array <T, size> t)
+        static int push(lua_State* L, T t)
         {
-            lua_createtable(L, size, 0);
-            for (auto i = 0; i < size; i++)
-            {
-                detail::push<T>(L, t[i]);
-                lua_rawseti(L, -2, i);
-            }
+            lua_pushstring(L, t);
             return 1;
         }
         static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
+            return lua_isstring(L, index);
         }
-        static std::array <T, size> get(lua_State* L, int index, int& offset)
+        static T get(lua_State* L, int index, int& offset)
         {
-            index = lua_absindex(L, index+offset);
-            std::array <T, size> result;
-            for (auto i = 0; i < size; i++)
-            {
-                lua_geti(L, index, i);
-                result[i] = detail::get<T>(L, -1);
-                lua_pop(L, 1);
-            }
-            return result;
+            return (T)luaL_tolstring(L, index+offset, nullptr);
         }
         static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
-            if constexpr (detail::is_pushable<T>)
-            {
-                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
-            } else
-                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
-            return buff;
+            return "string";
         }
         static const char* basic_type_name(lua_State* L) {
-            return "table";
+            return "string";
         }
         static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+            return LUA_TSTRING;
         }
     };
 
-    template<typename K, typename V>
-    class Stack<std::map<K, V>> {
+    template<>
+    class Stack<bool> {
     public:
-        static int push(lua_State* L, std::map<K, V> t)
+        static int push(lua_State* L, bool t)
         {
-            lua_createtable(L, 0, t.size());
-            for (auto& el : t)
-            {
-                detail::push<std::decay_t<K>>(L, (std::decay_t<K>)el.first);
-                detail::push<V>(L, el.second);
-                lua_settable(L, -3);
-            }
+            lua_pushboolean(L, t);
             return 1;
         }
-        static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
+        static bool is(lua_State* L, int) {
+            return true;
         }
-        static std::map<K, V> get(lua_State* L, int index, int& offset)
+        static bool get(lua_State* L, int index, int& offset)
         {
-            index = lua_absindex(L, index+offset);
-            std::map<K, V> result;
-            lua_pushnil(L);
-            while (lua_next(L, index))
-            {
-                result[detail::get<std::decay_t<K>>(L, -2)] = detail::get<std::decay_t<V>>(L, -1);
-                lua_pop(L, 1);
-            }
-            return result;
+            return lua_toboolean(L, index+offset);
         }
         static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
-            if constexpr (detail::is_pushable<K>)
-            {
-                snprintf(buff, 100, "table{[%s] = ", Stack<K>::type_name(L));
-            } else
-                snprintf(buff, 100, "table{[%s] = ", StackClass<K>::type_name(L));
-            if constexpr (detail::is_pushable<V>)
-            {
-                snprintf(buff, 100, "%s%s}", buff, Stack<V>::type_name(L));
-            } else
-                snprintf(buff, 100, "%s%s}", buff, StackClass<V>::type_name(L));
-            return buff;
+            return "boolean";
         }
         static const char* basic_type_name(lua_State* L) {
-            return "table";
+            return "boolean";
         }
         static int basic_type(lua_State* L) {
-            return LUA_TTABLE;
+            return LUA_TBOOLEAN;
         }
     };
 
-    template<typename K, typename V>
-    class Stack<std::unordered_map<K, V>> {
+    template<>
+    class Stack<char*> {
     public:
-        static int push(lua_State* L, std::unordered_map<K, V> t)
+        static int push(lua_State* L, char* t)
         {
-            lua_createtable(L, 0, t.size());
-            for (auto& el : t)
-            {
-                detail::push<std::decay_t<K>>(L, (std::decay_t<K>)el.first);
-                detail::push<V>(L, el.second);
-                lua_settable(L, -3);
-            }
+            lua_pushstring(L, t);
             return 1;
         }
         static bool is(lua_State* L, int index) {
-            return lua_istable(L, index);
+            return lua_isstring(L, index);
         }
-        static std::unordered_map<K, V> get(lua_State* L, int index, int& offset)
+        static char* get(lua_State* L, int index, int& offset)
         {
-            index = lua_absindex(L, index+offset);
-            std::unordered_map<K, V> result;
-            lua_pushnil(L);
-            while (lua_next(L, index))
-            {
-                result[detail::get<std::decay_t<K>>(L, -2)] = detail::get<std::decay_t<V>>(L, -1);
-                lua_pop(L, 1);
-            }
-            return result;
+            return (char*)luaL_tolstring(L, index+offset, nullptr);
         }
         static const char* type_name(lua_State* L) {
-            static char buff[100] = { '\0' };
-            if (buff[0]) return buff;
+            return "string";
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "string";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TSTRING;
+        }
+    };
+
+    template<>
+    class Stack<const char*> {
+    public:
+        static int push(lua_State* L, const char* t)
+        {
+            lua_pushstring(L, t);
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_isstring(L, index);
+        }
+        static const char* get(lua_State* L, int index, int& offset)
+        {
+            return luaL_tolstring(L, index+offset, nullptr);
+        }
+        static const char* type_name(lua_State* L) {
+            return "string";
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "string";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TSTRING;
+        }
+    };
+
+    template<>
+    class Stack<string_type> {
+    public:
+        static int push(lua_State* L, string_type t)
+        {
+            lua_pushlstring(L, t.data(), t.size());
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_isstring(L, index);
+        }
+        static string_type get(lua_State* L, int index, int& offset)
+        {
+            size_t len = 0;
+            return { luaL_tolstring(L, index+offset, &len), len };
+        }
+        static const char* type_name(lua_State* L) {
+            return "string";
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "string";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TSTRING;
+        }
+    };
+
+    template<typename T>
+    class Stack<std::optional<T>> {
+    public:
+        static int push(lua_State* L, std::optional<T> t)
+        {
+            if (t.has_value())
+                detail::push<T>(L, t.value());
+            else
+                lua_pushnil(L);
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            if (lua_isnil(L, index))
+                return true;
+            if constexpr (detail::is_pushable<T>)
+            {
+                return Stack<T>::is(L, index);
+            }
+            return StackClass<T>::is(L, index);
+        }
+        static std::optional<T> get(lua_State* L, int index, int& offset)
+        {
+            if (lua_isnoneornil(L, index+offset))
+                return std::nullopt;
+            return detail::get<T>(L, index+offset);
+        }
+        static const char* type_name(lua_State* L) {
+            if constexpr (detail::is_pushable<T>)
+            {
+                return Stack<T>::type_name(L);
+            }
+            return StackClass<T>::type_name(L);
+        }
+        static const char* basic_type_name(lua_State* L) {
+            if constexpr (detail::is_pushable<T>)
+            {
+                return Stack<T>::basic_type_name(L);
+            }
+            return StackClass<T>::basic_type_name(L);
+        }
+        static int basic_type(lua_State* L) {
+            if constexpr (detail::is_pushable<T>)
+            {
+                return Stack<T>::basic_type(L);
+            }
+            return StackClass<T>::basic_type(L);
+        }
+    };
+
+    template<typename Param>
+    int snp(lua_State *L, char* buff) {
+        if constexpr (detail::is_pushable<Param>)
+            snprintf(buff, 1000, strlen(buff) > 6 ? "%s, %s" : "%s%s", buff, Stack<Param>::type_name(L));
+        else
+            snprintf(buff, 1000, strlen(buff) > 6 ? "%s, %s" : "%s%s", buff, StackClass<Param>::type_name(L));
+        return 0;
+    };
+
+    template<typename ...Params>
+    class Stack<std::tuple<Params...>> {
+    public:
+        static int push(lua_State* L, std::tuple<Params...> t)
+        {
+            lua_createtable(L, sizeof...(Params), 0);
+            auto tbl = lua_gettop(L);
+            std::apply([L, tbl](auto &&... args) {
+                (void)std::initializer_list<int>{ detail::push(L, args)... };
+                for (auto i = sizeof...(Params); i > 0; i--)
+                    lua_rawseti(L, tbl, i);
+            }, t);
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::tuple<Params...> get(lua_State* L, int index, int& offset)
+        {
+            auto tbl = lua_absindex(L, index+offset);
+            auto top = lua_gettop(L);
+            for (auto i = 1; i <= sizeof...(Params); i++)
+            {
+                lua_geti(L, tbl, i);
+            }
+            using ParamList = std::tuple<std::decay_t<Params>...>;
+            ParamList params;
+            assign_tup(L, params, top);
+            lua_pop(L, sizeof...(Params));
+            return params;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[1000] = { '\0' };
+            if (buff[0]) return buff;
+            snprintf(buff, 1000, "table{");
+            (void)std::initializer_list<int> { snp<Params>(L, buff)... };
+            snprintf(buff, 1000, "%s}", buff);
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+
+    template<typename K, typename V>
+    class Stack<std::pair<K, V>> {
+    public:
+        static int push(lua_State* L, std::pair<K, V> t)
+        {
+            lua_createtable(L, 2, 0);
+            detail::push<K>(L, t.first);
+            lua_rawseti(L, -2, 1);
+            detail::push<V>(L, t.second);
+            lua_rawseti(L, -2, 2);
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::pair<K, V> get(lua_State* L, int index, int& offset)
+        {
+            index = lua_absindex(L, index+offset);
+            lua_geti(L, index, 1);
+            lua_geti(L, index, 2);
+            std::pair<K, V> t = { detail::get<K>(L, -2), detail::get<V>(L, -1) };
+            lua_pop(L, 2);
+            return t;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
             if constexpr (detail::is_pushable<K>)
             {
-                snprintf(buff, 100, "table{[%s] = ", Stack<K>::type_name(L));
+                snprintf(buff, 100, "table{%s, ", Stack<K>::type_name(L));
             } else
-                snprintf(buff, 100, "table{[%s] = ", StackClass<K>::type_name(L));
+                snprintf(buff, 100, "table{%s, ", StackClass<K>::type_name(L));
             if constexpr (detail::is_pushable<V>)
             {
                 snprintf(buff, 100, "%s%s}", buff, Stack<V>::type_name(L));
@@ -1625,2162 +1819,5391 @@ namespace LuaBinding {
             return LUA_TTABLE;
         }
     };
-}
-
-
-
-#include <functional>
-#include <tuple>
-
-namespace LuaBinding {
-    namespace invocable_traits
-    {
-        enum class Error
-        {
-            None,
-            NotAClass,
-            NoCallOperator,
-            IsOverloadedTemplated,
-            OverloadNotResolved,
-            Unknown
-        };
 
-        template <Error E>
-        void issue_error()
+    template<typename T>
+    class Stack<std::vector<T>> {
+    public:
+        static int push(lua_State* L, std::vector<T> t)
         {
-            static_assert(E != Error::NotAClass,
-                "passed type is not a class, and thus cannot have an operator()");
-            static_assert(E != Error::NoCallOperator,
-                "passed type is a class that doesn't have an operator()");
-            static_assert(E != Error::IsOverloadedTemplated,
-                "passed passed type is a class that has an overloaded or templated operator(), specify argument types in invocable_traits invocation to disambiguate the operator() signature you wish to use");
-            static_assert(E != Error::OverloadNotResolved,
-                "passed type is a class that doesn't have an operator() that declares the specified argument types, or some const/ref-qualified combination of the specified argument types");
-            static_assert(E != Error::Unknown,
-                "an unknown error occurred");
-        };
-
-        namespace detail
+            lua_createtable(L, t.size(), 0);
+            for (auto i = 0; i < t.size(); i++)
+            {
+                detail::push<T>(L, t[i]);
+                lua_rawseti(L, -2, i + 1);
+            }
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::vector<T> get(lua_State* L, int index, int& offset)
         {
-            template <bool, std::size_t i, typename... Args>
-            struct invocable_traits_arg_impl
+            index = lua_absindex(L, index+offset);
+            size_t len = lua_getlen(L, index);
+            std::vector<T> result;
+            result.reserve(len);
+            for (auto i = 1; i <= len; i++)
+            {
+                lua_geti(L, index, i);
+                result.push_back(detail::get<T>(L, -1));
+                lua_pop(L, 1);
+            }
+            return result;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
+            if constexpr (detail::is_pushable<T>)
+            {
+                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
+            } else
+                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+
+    template<typename T>
+    class Stack<std::atomic<T>> {
+    public:
+        static int push(lua_State* L, std::atomic<T>& t)
+        {
+            detail::push<T>(L, t.load());
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return Stack<T>::is(L, index);
+        }
+        static T get(lua_State* L, int index, int& offset)
+        {
+            return detail::get<T>(L, index+offset);
+        }
+        static const char* type_name(lua_State* L) {
+            return Stack<T>::type_name(L);
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return Stack<T>::basic_type_name(L);
+        }
+        static int basic_type(lua_State* L) {
+            return Stack<T>::basic_type(L);
+        }
+    };
+
+    template<typename T>
+    class Stack<std::vector<T>*> {
+    public:
+        static int push(lua_State* L, std::vector<T>* t)
+        {
+            lua_createtable(L, t->size(), 0);
+            for (auto i = 0; i < t->size(); i++)
+            {
+                detail::push<T>(L, t->at(i));
+                lua_rawseti(L, -2, i + 1);
+            }
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::vector<T>* get(lua_State* L, int index, int& offset)
+        {
+            index = lua_absindex(L, index+offset);
+            size_t len = lua_getlen(L, index);
+            auto result = new std::vector<T>();
+            result->reserve(len);
+            for (auto i = 1; i <= len; i++)
+            {
+                lua_geti(L, index, i);
+                result->push_back(detail::get<T>(L, -1));
+                lua_pop(L, 1);
+            }
+            return result;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
+            if constexpr (detail::is_pushable<T>)
+            {
+                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
+            } else
+                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+
+    template<typename T>
+    class Stack<std::list<T>> {
+    public:
+        static int push(lua_State* L, std::list<T> t)
+        {
+            lua_createtable(L, t.size(), 0);
+            auto i = 1;
+            for (auto& el : t)
+            {
+                detail::push<T>(L, el);
+                lua_rawseti(L, -2, i++);
+            }
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::list<T> get(lua_State* L, int index, int& offset)
+        {
+            index = lua_absindex(L, index+offset);
+            size_t len = lua_getlen(L, index);
+            std::list<T> result;
+            result.reserve(len);
+            for (auto i = 1; i <= len; i++)
+            {
+                lua_geti(L, index, i);
+                result.push_back(detail::get<T>(L, -1));
+                lua_pop(L, 1);
+            }
+            return result;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
+            if constexpr (detail::is_pushable<T>)
+            {
+                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
+            } else
+                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+
+    template<typename T>
+    class Stack<std::stack<T>> {
+    public:
+        static int push(lua_State* L, std::stack<T> t)
+        {
+            lua_createtable(L, t.size(), 0);
+            auto i = 1;
+            for (auto& el : t)
+            {
+                detail::push<T>(L, el);
+                lua_rawseti(L, -2, i++);
+            }
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::stack<T> get(lua_State* L, int index, int& offset)
+        {
+            index = lua_absindex(L, index+offset);
+            size_t len = lua_getlen(L, index);
+            std::stack<T> result;
+            result.reserve(len);
+            for (auto i = 1; i <= len; i++)
+            {
+                lua_geti(L, index, i);
+                result.push_back(detail::get<T>(L, -1));
+                lua_pop(L, 1);
+            }
+            return result;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
+            if constexpr (detail::is_pushable<T>)
+            {
+                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
+            } else
+                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+
+    template<typename T>
+    class Stack<std::queue<T>> {
+    public:
+        static int push(lua_State* L, std::queue<T> t)
+        {
+            lua_createtable(L, t.size(), 0);
+            auto i = 1;
+            for (auto& el : t)
+            {
+                detail::push<T>(L, el);
+                lua_rawseti(L, -2, i++);
+            }
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::queue<T> get(lua_State* L, int index, int& offset)
+        {
+            index = lua_absindex(L, index+offset);
+            size_t len = lua_getlen(L, index);
+            std::queue<T> result;
+            result.reserve(len);
+            for (auto i = 1; i <= len; i++)
+            {
+                lua_geti(L, index, i);
+                result.push_back(detail::get<T>(L, -1));
+                lua_pop(L, 1);
+            }
+            return result;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
+            if constexpr (detail::is_pushable<T>)
+            {
+                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
+            } else
+                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+
+    template<typename T>
+    class Stack<std::deque<T>> {
+    public:
+        static int push(lua_State* L, std::deque<T> t)
+        {
+            lua_createtable(L, t.size(), 0);
+            auto i = 1;
+            for (auto& el : t)
+            {
+                detail::push<T>(L, el);
+                lua_rawseti(L, -2, i++);
+            }
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::deque<T> get(lua_State* L, int index, int& offset)
+        {
+            index = lua_absindex(L, index+offset);
+            size_t len = lua_getlen(L, index);
+            std::deque<T> result;
+            result.reserve(len);
+            for (auto i = 1; i <= len; i++)
+            {
+                lua_geti(L, index, i);
+                result.push_back(detail::get<T>(L, -1));
+                lua_pop(L, 1);
+            }
+            return result;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
+            if constexpr (detail::is_pushable<T>)
+            {
+                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
+            } else
+                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+
+    template<typename T>
+    class Stack<std::set<T>> {
+    public:
+        static int push(lua_State* L, std::set<T> t)
+        {
+            lua_createtable(L, t.size(), 0);
+            auto i = 1;
+            for (auto& el : t)
+            {
+                detail::push<T>(L, el);
+                lua_rawseti(L, -2, i++);
+            }
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::set<T> get(lua_State* L, int index, int& offset)
+        {
+            index = lua_absindex(L, index+offset);
+            size_t len = lua_getlen(L, index);
+            std::set<T> result;
+            result.reserve(len);
+            for (auto i = 1; i <= len; i++)
+            {
+                lua_geti(L, index, i);
+                result.push_back(detail::get<T>(L, -1));
+                lua_pop(L, 1);
+            }
+            return result;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
+            if constexpr (detail::is_pushable<T>)
+            {
+                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
+            } else
+                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+
+    template<typename T>
+    class Stack<std::unordered_set<T>> {
+    public:
+        static int push(lua_State* L, std::unordered_set<T> t)
+        {
+            lua_createtable(L, t.size(), 0);
+            auto i = 1;
+            for (auto el : t)
+            {
+                detail::push<std::decay_t<T>>(L, el);
+                lua_rawseti(L, -2, i++);
+            }
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::unordered_set<T> get(lua_State* L, int index, int& offset)
+        {
+            index = lua_absindex(L, index+offset);
+            size_t len = lua_getlen(L, index);
+            std::unordered_set<T> result;
+            result.reserve(len);
+            for (auto i = 1; i <= len; i++)
+            {
+                lua_geti(L, index, i);
+                result.insert(detail::get<T>(L, -1));
+                lua_pop(L, 1);
+            }
+            return result;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
+            if constexpr (detail::is_pushable<T>)
+            {
+                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
+            } else
+                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+
+    template <class T, size_t size>
+    class Stack<std::array <T, size>> {
+    public:
+        static int push(lua_State* L, std::array <T, size> t)
+        {
+            lua_createtable(L, size, 0);
+            for (auto i = 0; i < size; i++)
+            {
+                detail::push<T>(L, t[i]);
+                lua_rawseti(L, -2, i);
+            }
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::array <T, size> get(lua_State* L, int index, int& offset)
+        {
+            index = lua_absindex(L, index+offset);
+            std::array <T, size> result;
+            for (auto i = 0; i < size; i++)
+            {
+                lua_geti(L, index, i);
+                result[i] = detail::get<T>(L, -1);
+                lua_pop(L, 1);
+            }
+            return result;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
+            if constexpr (detail::is_pushable<T>)
+            {
+                snprintf(buff, 100, "table{%s}", Stack<T>::type_name(L));
+            } else
+                snprintf(buff, 100, "table{%s}", StackClass<T>::type_name(L));
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+
+    template<typename K, typename V>
+    class Stack<std::map<K, V>> {
+    public:
+        static int push(lua_State* L, std::map<K, V> t)
+        {
+            lua_createtable(L, 0, t.size());
+            for (auto& el : t)
+            {
+                detail::push<std::decay_t<K>>(L, (std::decay_t<K>)el.first);
+                detail::push<V>(L, el.second);
+                lua_settable(L, -3);
+            }
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::map<K, V> get(lua_State* L, int index, int& offset)
+        {
+            index = lua_absindex(L, index+offset);
+            std::map<K, V> result;
+            lua_pushnil(L);
+            while (lua_next(L, index))
+            {
+                result[detail::get<std::decay_t<K>>(L, -2)] = detail::get<std::decay_t<V>>(L, -1);
+                lua_pop(L, 1);
+            }
+            return result;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
+            if constexpr (detail::is_pushable<K>)
+            {
+                snprintf(buff, 100, "table{[%s] = ", Stack<K>::type_name(L));
+            } else
+                snprintf(buff, 100, "table{[%s] = ", StackClass<K>::type_name(L));
+            if constexpr (detail::is_pushable<V>)
+            {
+                snprintf(buff, 100, "%s%s}", buff, Stack<V>::type_name(L));
+            } else
+                snprintf(buff, 100, "%s%s}", buff, StackClass<V>::type_name(L));
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+
+    template<typename K, typename V>
+    class Stack<std::unordered_map<K, V>> {
+    public:
+        static int push(lua_State* L, std::unordered_map<K, V> t)
+        {
+            lua_createtable(L, 0, t.size());
+            for (auto& el : t)
+            {
+                detail::push<std::decay_t<K>>(L, (std::decay_t<K>)el.first);
+                detail::push<V>(L, el.second);
+                lua_settable(L, -3);
+            }
+            return 1;
+        }
+        static bool is(lua_State* L, int index) {
+            return lua_istable(L, index);
+        }
+        static std::unordered_map<K, V> get(lua_State* L, int index, int& offset)
+        {
+            index = lua_absindex(L, index+offset);
+            std::unordered_map<K, V> result;
+            lua_pushnil(L);
+            while (lua_next(L, index))
+            {
+                result[detail::get<std::decay_t<K>>(L, -2)] = detail::get<std::decay_t<V>>(L, -1);
+                lua_pop(L, 1);
+            }
+            return result;
+        }
+        static const char* type_name(lua_State* L) {
+            static char buff[100] = { '\0' };
+            if (buff[0]) return buff;
+            if constexpr (detail::is_pushable<K>)
+            {
+                snprintf(buff, 100, "table{[%s] = ", Stack<K>::type_name(L));
+            } else
+                snprintf(buff, 100, "table{[%s] = ", StackClass<K>::type_name(L));
+            if constexpr (detail::is_pushable<V>)
+            {
+                snprintf(buff, 100, "%s%s}", buff, Stack<V>::type_name(L));
+            } else
+                snprintf(buff, 100, "%s%s}", buff, StackClass<V>::type_name(L));
+            return buff;
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "table";
+        }
+        static int basic_type(lua_State* L) {
+            return LUA_TTABLE;
+        }
+    };
+}
+
+
+
+#include <functional>
+#include <tuple>
+
+namespace LuaBinding {
+    namespace invocable_traits
+    {
+        enum class Error
+        {
+            None,
+            NotAClass,
+            NoCallOperator,
+            IsOverloadedTemplated,
+            OverloadNotResolved,
+            Unknown
+        };
+
+        template <Error E>
+        void issue_error()
+        {
+            static_assert(E != Error::NotAClass,
+                "passed type is not a class, and thus cannot have an operator()");
+            static_assert(E != Error::NoCallOperator,
+                "passed type is a class that doesn't have an operator()");
+            static_assert(E != Error::IsOverloadedTemplated,
+                "passed passed type is a class that has an overloaded or templated operator(), specify argument types in invocable_traits invocation to disambiguate the operator() signature you wish to use");
+            static_assert(E != Error::OverloadNotResolved,
+                "passed type is a class that doesn't have an operator() that declares the specified argument types, or some const/ref-qualified combination of the specified argument types");
+            static_assert(E != Error::Unknown,
+                "an unknown error occurred");
+        };
+
+        namespace detail
+        {
+            template <bool, std::size_t i, typename... Args>
+            struct invocable_traits_arg_impl
             {
                 using type = std::tuple_element_t<i, std::tuple<Args...>>;
             };
-            template <std::size_t i, typename... Args>
-            struct invocable_traits_arg_impl<false, i, Args...>
+            template <std::size_t i, typename... Args>
+            struct invocable_traits_arg_impl<false, i, Args...>
+            {
+                static_assert(i < sizeof...(Args), "Argument index out of bounds (queried callable does not declare this many arguments)");
+
+                // to reduce excessive compiler error output
+                using type = void;
+            };
+
+            template <
+                typename Rd, typename Ri, typename C,
+                bool IsConst, bool isVolatile, bool isNoexcept, bool IsVariadic,
+                typename... Args>
+            struct invocable_traits_class
+            {
+                static constexpr std::size_t arity = sizeof...(Args);
+                static constexpr auto is_const    = IsConst;
+                static constexpr auto is_volatile = isVolatile;
+                static constexpr auto is_noexcept = isNoexcept;
+                static constexpr auto is_variadic = IsVariadic;
+
+                using declared_result_t = Rd;   // return type as declared in function
+                using invoke_result_t   = Ri;   // return type of std::invoke() expression
+                using class_t           = C;
+
+                template <std::size_t i>
+                using arg_t = typename invocable_traits_arg_impl<i < sizeof...(Args), i, Args...>::type;
+                using function_type = std::function<Rd(Args...)>;
+
+                static constexpr Error error      = Error::None;
+            };
+
+            template <
+                typename Rd, typename Ri,
+                bool IsConst, bool isVolatile, bool isNoexcept, bool IsVariadic,
+                typename... Args>
+            struct invocable_traits_free : public invocable_traits_class<Rd, Ri, void, IsConst, isVolatile, isNoexcept, IsVariadic, Args...> {};
+
+
+            // machinery to extract exact function signature and qualifications
+            template <typename, typename...>
+            struct invocable_traits_impl;
+
+            // pointers to data members
+            template <typename C, typename R>
+            struct invocable_traits_impl<R C::*>
+                : public invocable_traits_class<R,
+                                                std::invoke_result_t<R C::*, C>,
+                                                C,
+                                                false, false, false, false
+                                            > {};
+
+            // pointers to functions
+            template <typename R, typename... Args>
+            struct invocable_traits_impl<R(*)(Args...)>                 : public invocable_traits_impl<R(Args...)> {};
+            template <typename R, typename... Args>
+            struct invocable_traits_impl<R(*)(Args...) noexcept>        : public invocable_traits_impl<R(Args...) noexcept> {};
+            template <typename R, typename... Args>
+            struct invocable_traits_impl<R(*)(Args..., ...)>            : public invocable_traits_impl<R(Args..., ...)> {};
+            template <typename R, typename... Args>
+            struct invocable_traits_impl<R(*)(Args..., ...) noexcept>   : public invocable_traits_impl<R(Args..., ...) noexcept> {};
+
+            template <typename...>
+            struct typelist {};
+
+        #   define IS_NONEMPTY(...) 0 __VA_OPT__(+1)
+        #   define MAKE_CONST(...)    __VA_OPT__(const)
+        #   define MAKE_VOLATILE(...) __VA_OPT__(volatile)
+        #   define MAKE_NOEXCEPT(...) __VA_OPT__(noexcept)
+        #   define MAKE_VARIADIC(...) __VA_OPT__(, ...)
+
+            // functions, pointers to member functions and machinery to select a specific overloaded operator()
+        #   define INVOCABLE_TRAITS_SPEC(c,vo,e,va)                                             \
+            /* functions */                                                                     \
+            template <typename R, typename... Args>                                             \
+            struct invocable_traits_impl<R(Args... MAKE_VARIADIC(va))                           \
+                                        MAKE_CONST(c) MAKE_VOLATILE(vo) MAKE_NOEXCEPT(e)>      \
+                : public invocable_traits_free<                                                 \
+                    R,                                                                          \
+                    std::invoke_result_t<R(Args... MAKE_VARIADIC(va))                           \
+                                        MAKE_CONST(c) MAKE_VOLATILE(vo) MAKE_NOEXCEPT(e), Args...>,    \
+                    IS_NONEMPTY(c),                                                             \
+                    IS_NONEMPTY(vo),                                                            \
+                    IS_NONEMPTY(e),                                                             \
+                    IS_NONEMPTY(va),                                                            \
+                    Args...> {};                                                                \
+            /* pointers to member functions */                                                  \
+            template <typename C, typename R, typename... Args>                                 \
+            struct invocable_traits_impl<R(C::*)(Args... MAKE_VARIADIC(va))                     \
+                                        MAKE_CONST(c) MAKE_VOLATILE(vo) MAKE_NOEXCEPT(e)>      \
+                : public invocable_traits_class<                                                \
+                    R,                                                                          \
+                    std::invoke_result_t<R(C::*)(Args...MAKE_VARIADIC(va))                      \
+                                        MAKE_CONST(c) MAKE_VOLATILE(vo) MAKE_NOEXCEPT(e), C, Args...>, \
+                    C,                                                                          \
+                    IS_NONEMPTY(c),                                                             \
+                    IS_NONEMPTY(vo),                                                            \
+                    IS_NONEMPTY(e),                                                             \
+                    IS_NONEMPTY(va),                                                            \
+                    Args...> {};                                                                \
+            /* machinery to select a specific overloaded operator() */                          \
+            template <typename C, typename... OverloadArgs>                                     \
+            auto invocable_traits_resolve_overload(std::invoke_result_t<C, OverloadArgs...>         \
+                                                (C::*func)(OverloadArgs... MAKE_VARIADIC(va))    \
+                                                MAKE_CONST(c) MAKE_VOLATILE(vo) MAKE_NOEXCEPT(e),\
+                                                typelist<OverloadArgs...>)\
+            { return func; };
+
+            // cover all const, volatile and noexcept permutations
+            INVOCABLE_TRAITS_SPEC( ,  , ,  )
+            INVOCABLE_TRAITS_SPEC( ,Va, ,  )
+            INVOCABLE_TRAITS_SPEC( ,  ,E,  )
+            INVOCABLE_TRAITS_SPEC( ,Va,E,  )
+            INVOCABLE_TRAITS_SPEC( ,  , ,Vo)
+            INVOCABLE_TRAITS_SPEC( ,Va, ,Vo)
+            INVOCABLE_TRAITS_SPEC( ,  ,E,Vo)
+            INVOCABLE_TRAITS_SPEC( ,Va,E,Vo)
+            INVOCABLE_TRAITS_SPEC(C,  , ,  )
+            INVOCABLE_TRAITS_SPEC(C,Va, ,  )
+            INVOCABLE_TRAITS_SPEC(C,  ,E,  )
+            INVOCABLE_TRAITS_SPEC(C,Va,E,  )
+            INVOCABLE_TRAITS_SPEC(C,  , ,Vo)
+            INVOCABLE_TRAITS_SPEC(C,Va, ,Vo)
+            INVOCABLE_TRAITS_SPEC(C,  ,E,Vo)
+            INVOCABLE_TRAITS_SPEC(C,Va,E,Vo)
+            // clean up
+        #   undef INVOCABLE_TRAITS_SPEC
+        #   undef IS_NONEMPTY
+        #   undef MAKE_CONST
+        #   undef MAKE_VOLATILE
+        #   undef MAKE_NOEXCEPT
+        #   undef MAKE_VARIADIC
+
+            // check if passed type has an operator(), can be true for struct/class, includes lambdas
+            // from https://stackoverflow.com/a/70699109/3103767
+            // logic: test if &Tester<C>::operator() is a valid expression. It is only valid if
+            // C did not have an operator(), because else &Tester<C>::operator() would be ambiguous
+            // and thus invalid. To test if C has an operator(), we just check that
+            // &Tester<C>::operator() fails, which implies that C has an operator() declared.
+            // This trick does not work for final classes, at least detect non-overloaded
+            // operator() for those.
+            struct Fake { void operator()(); };
+            template <typename T> struct Tester : T, Fake { };
+
+            template <typename C>
+            concept HasCallOperator = std::is_class_v<C> and (
+                requires(C)                 // checks if non-overloaded operator() exists
+                {
+                    &C::operator();
+                } or
+                not requires(Tester<C>)     // checks overloaded/templated operator(), but doesn't work on final classes
+                {
+                    &Tester<C>::operator();
+                }
+            );
+            // check if we can get operator().
+            // If it fails (and assuming above HasCallOperator does pass),
+            // this is because the operator is overloaded or templated
+            // NB: can't simply do requires(C t){ &C::operator(); } because
+            // that is too lenient on clang: it also succeeds for
+            // overloaded/templated operator() where it shouldn't
+            template <typename T>
+            concept CanGetCallOperator = requires
+            {
+                invocable_traits_impl<
+                    decltype(
+                        &T::operator()
+                    )>();
+            };
+            // check if we can get an operator() that takes the specified arguments types.
+            // If it fails (and assuming above HasCallOperator does pass),
+            // an operator() with this specified cv- and ref-qualified argument types does
+            // not exist.
+            template <typename C, typename... OverloadArgs>
+            concept HasSpecificCallOperator = requires
+            {
+                invocable_traits_resolve_overload<C>(
+                    &C::operator(),
+                    typelist<OverloadArgs...>{}
+                );
+            };
+            namespace try_harder
+            {
+                // cartesian product of type lists, from https://stackoverflow.com/a/59422700/3103767
+                template <typename... Ts>
+                typelist<typelist<Ts>...> layered(typelist<Ts...>);
+
+                template <typename... Ts, typename... Us>
+                auto operator+(typelist<Ts...>, typelist<Us...>)
+                    ->typelist<Ts..., Us...>;
+
+                template <typename T, typename... Us>
+                auto operator*(typelist<T>, typelist<Us...>)
+                    ->typelist<decltype(T{} + Us{})...>;
+
+                template <typename... Ts, typename TL>
+                auto operator^(typelist<Ts...>, TL tl)
+                    -> decltype(((typelist<Ts>{} *tl) + ...));
+
+                template <typename... TLs>
+                using product_t = decltype((layered(TLs{}) ^ ...));
+
+                // adapter to make cartesian product of a list of typelists
+                template <typename... Ts>
+                auto list_product(typelist<Ts...>)
+                    ->product_t<Ts...>;
+
+                template <typename T>
+                using list_product_t = decltype(list_product(T{}));
+
+                // code to turn input argument type T into all possible const/ref-qualified versions
+                template <typename T> struct type_maker_impl;
+                // T* -> T*, T* const
+                template <typename T>
+                    requires std::is_pointer_v<T>
+                struct type_maker_impl<T>
+                {
+                    using type = typelist<T, const T>;
+                };
+                // T -> T, T&, const T&, T&&, const T&& (NB: const on const T is ignored, so that type is not included)
+                template <typename T>
+                    requires (!std::is_pointer_v<T>)
+                struct type_maker_impl<T>
+                {
+                    using type = typelist<T, T&, const T&, T&&, const T&&>;
+                };
+
+                template <typename T>
+                struct type_maker : type_maker_impl<std::remove_cvref_t<T>> {};
+
+                template <typename T>
+                using type_maker_t = typename type_maker<T>::type;
+
+                template <typename ...Ts>
+                struct type_maker_for_typelist
+                {
+                    using type = typelist<type_maker_t<Ts>...>;
+                };
+
+                // code to filter out combinations of qualified input arguments that do not
+                // resolve to a declared overload
+                template <typename, typename> struct concat;
+                template <typename T, typename ...Args>
+                struct concat<T, typelist<Args...>>
+                {
+                    using type = typelist<T, Args...>;
+                };
+
+                template <typename...> struct check;
+                template <typename C, typename... Args>
+                struct check<C, typelist<Args...>>
+                {
+                    static constexpr bool value = HasSpecificCallOperator<C, Args...>;
+                };
+
+                template <typename...> struct filter;
+                template <typename C>
+                struct filter<C, typelist<>>
+                {
+                    using type = typelist<>;
+                };
+                template <typename C, typename Head, typename ...Tail>
+                struct filter<C, typelist<Head, Tail...>>
+                {
+                    using type = std::conditional_t<check<C, Head>::value,
+                        typename concat<Head, typename filter<C, typelist<Tail...>>::type>::type,
+                        typename filter<C, typelist<Tail...>>::type
+                    >;
+                };
+
+                // extract first element from a typelist
+                template <typename, typename...> struct get_head;
+                template <typename Head, typename ...Tail>
+                struct get_head<typelist<Head, Tail...>>
+                {
+                    using type = Head;
+                };
+            }
+
+            // to reduce excessive compiler error output
+            struct invocable_traits_error
+            {
+                static constexpr std::size_t arity       = 0;
+                static constexpr auto        is_const    = false;
+                static constexpr auto        is_volatile = false;
+                static constexpr auto        is_noexcept = false;
+                static constexpr auto        is_variadic = false;
+                using declared_result_t                  = void;
+                using invoke_result_t                    = void;
+                using class_t                            = void;
+                template <size_t i>
+                using arg_t                              = void;
+            };
+            struct invocable_traits_error_overload
+            {
+                static constexpr std::size_t num_matched_overloads = 0;
+                static constexpr auto        is_exact_match        = false;
+                template <size_t i>
+                using matched_overload                             = invocable_traits_error;
+            };
+
+            template <typename T, bool hasOverloadArgs>
+            constexpr Error get_error()
+            {
+                if constexpr (!std::is_class_v<T>)
+                    return Error::NotAClass;
+                else if constexpr (!HasCallOperator<T>)
+                    return Error::NoCallOperator;
+                else if constexpr (hasOverloadArgs)
+                    return Error::OverloadNotResolved;
+                else if constexpr (!hasOverloadArgs && !CanGetCallOperator<T>)
+                    return Error::IsOverloadedTemplated;
+
+                return Error::Unknown;
+            }
+
+            template <typename C, typename Head>
+            struct get_overload_info
+            {
+                using type =
+                    invocable_traits_impl<
+                        std::decay_t<
+                            decltype(
+                                invocable_traits_resolve_overload<C>(
+                                    &C::operator(),
+                                    Head{}
+                                )
+                            )
+                        >
+                    > ;
+            };
+            template <typename C, typename Head>
+            using get_overload_info_t = typename get_overload_info<C, Head>::type;
+
+            template <bool, std::size_t i, typename C, typename... Args>
+            struct invocable_traits_overload_info_impl
+            {
+                using type = get_overload_info_t<C, std::tuple_element_t<i, std::tuple<Args...>>>;
+            };
+            template <std::size_t i, typename C, typename... Args>
+            struct invocable_traits_overload_info_impl<false, i, C, Args...>
+            {
+                static_assert(i < sizeof...(Args), "Argument index out of bounds (queried callable does not have this many matching overloads)");
+
+                // to reduce excessive compiler error output
+                using type = void;
+            };
+
+            template <typename C, bool B, typename... Args> struct invocable_traits_overload_info;
+            template <typename C, bool B, typename... Args>
+            struct invocable_traits_overload_info<C, B, typelist<Args...>>
+            {
+                static constexpr std::size_t num_matched_overloads  = sizeof...(Args);
+                static constexpr auto        is_exact_match         = B;
+
+                template <std::size_t i>
+                using matched_overload = typename invocable_traits_overload_info_impl<
+                    i < sizeof...(Args),
+                    i,
+                    C,
+                    Args...
+                >::type;
+            };
+
+            // found at least one overload taking a const/ref qualified version of the specified argument types
+            // that is different from those provided by the library user
+            template <typename C, typename List>
+            struct invocable_traits_extract_try_harder :
+                invocable_traits_impl<              // instantiate for the first matched overload
+                    std::decay_t<
+                        decltype(
+                            invocable_traits_resolve_overload<C>(
+                                &C::operator(),
+                                typename try_harder::get_head<List>::type{}
+                            )
+                        )
+                    >
+                > ,
+                invocable_traits_overload_info<     // but expose all matched overloads
+                    C,
+                    false,
+                    List
+                >
+            {};
+
+            // failed to find any overload taking the specified argument types or some const/ref qualified version of them
+            template <typename T>
+            struct invocable_traits_extract_try_harder<T, typelist<>> : // empty list -> no combination of arguments matched an overload
+                invocable_traits_error,
+                invocable_traits_error_overload
+            {
+                static constexpr Error error = get_error<T, true>();
+            };
+
+            // specific overloaded operator() is available, use it for analysis
+            template <typename C, bool, typename... OverloadArgs>
+            struct invocable_traits_extract :
+                invocable_traits_impl<
+                    std::decay_t<
+                        decltype(
+                            invocable_traits_resolve_overload<C>(
+                                &C::operator(),
+                                typelist<OverloadArgs...>{}
+                            )
+                        )
+                    >
+                >,
+                invocable_traits_overload_info<
+                    C,
+                    true,
+                    typelist<typelist<OverloadArgs...>> // expose matched overload through this interface also, for consistency, even though matching procedure was not run
+                >
+            {};
+
+            // unambiguous operator() is available, use it for analysis
+            template <typename C, bool B>
+            struct invocable_traits_extract<C, B> :
+                invocable_traits_impl<
+                    decltype(
+                        &C::operator()
+                    )
+                > {};
+
+            // no specific overloaded operator() taking the specified arguments is available, try harder
+            // to see if one can be found that takes some other const/reference qualified version of the
+            // input arguments.
+            template <typename T, typename... OverloadArgs>
+            struct invocable_traits_extract<T, false, OverloadArgs...> :
+                invocable_traits_extract_try_harder<
+                    T,
+                    typename try_harder::filter<T,                          // filter list of all argument combinations: leave only resolvable overloads
+                        try_harder::list_product_t<                         // cartesian product of these lists
+                            typename try_harder::type_maker_for_typelist<   // produce list with all const/ref combinations of each argument
+                                OverloadArgs...
+                            >::type
+                        >
+                    >::type
+                > {};
+
+            template <typename T>
+            struct invocable_traits_extract<T, false> : invocable_traits_error
+            {
+                static constexpr Error error = get_error<T, false>();
+            };
+
+            // catch all that doesn't match the various function signatures above
+            // If T has an operator(), we go with that. Else, issue error message.
+            template <typename T>
+            struct invocable_traits_impl<T> :
+                invocable_traits_extract<
+                    T,
+                    HasCallOperator<T>&& CanGetCallOperator<T>
+                > {};
+
+            // if overload argument types are provided and needed, use them
+            template <typename T, bool B, typename... OverloadArgs>
+            struct invocable_traits_overload_impl :
+                invocable_traits_extract<
+                    T, 
+                    HasCallOperator<T> && HasSpecificCallOperator<T, OverloadArgs...>,
+                    OverloadArgs...
+                > {};
+
+            // if they are provided but not needed, ignore them
+            template <typename T, typename... OverloadArgs>
+            struct invocable_traits_overload_impl<T, false, OverloadArgs...> :
+                invocable_traits_impl<
+                    T
+                > {};
+        }
+
+        template <typename T, typename... OverloadArgs>
+        struct get :
+            detail::invocable_traits_overload_impl<
+                std::remove_reference_t<T>,
+                detail::HasCallOperator<std::decay_t<T>> && !detail::CanGetCallOperator<std::decay_t<T>>,
+                OverloadArgs...
+            > {};
+
+        template <typename T, typename... OverloadArgs>
+        struct get<std::reference_wrapper<T>, OverloadArgs...> :
+            detail::invocable_traits_overload_impl<
+                std::remove_reference_t<T>,
+                detail::HasCallOperator<std::decay_t<T>> && !detail::CanGetCallOperator<std::decay_t<T>>,
+                OverloadArgs...
+            > {};
+
+        template <typename T>
+        struct get<T> :
+            detail::invocable_traits_impl<
+                std::decay_t<T>
+            > {};
+
+        template <typename T>
+        struct get<std::reference_wrapper<T>> :
+            detail::invocable_traits_impl<
+                std::decay_t<T>
+            > {};
+    }
+
+    template <typename F>
+    using function_type_t = invocable_traits::get<F>::function_type;
+
+    namespace Function {
+        template <class R, class... Params>
+        void fun(lua_State *L, R(* func)(Params...))
+        {
+            using FnType = decltype (func);
+            new (lua_newuserdata(L, sizeof(func))) FnType(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsNClass<R, Params...>::f), 1);
+        }
+
+        template <class T, class R, class... Params>
+        void fun(lua_State *L, R(T::* func)(Params...))
+        {
+            using FnType = decltype (func);
+            new (lua_newuserdata(L, sizeof(func))) FnType(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClass<R, T, Params...>::f), 1);
+        }
+
+        template <class T, class R, class... Params>
+        void fun(lua_State *L, R(T::* func)(Params...) const)
+        {
+            using FnType = std::decay_t<decltype (func)>;
+            new (lua_newuserdata(L, sizeof(func))) FnType(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClass<R, T, Params...>::f), 1);
+        }
+
+        template <class T, class R, class... Params>
+        void fun(lua_State *L, std::function<R(Params...)> func)
+        {
+            using FnType = decltype (func);
+            new (lua_newuserdata(L, sizeof(func))) FnType(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsFunClass<R, T, Params...>::f), 1);
+        }
+
+        template <class T, class R, class... Params>
+        void fun(lua_State *L, std::function<R(Params...) const> func)
+        {
+            using FnType = std::decay_t<decltype (func)>;
+            new (lua_newuserdata(L, sizeof(func))) FnType(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsFunClass<R, T, Params...>::f), 1);
+        }
+
+        template <class T, class R> requires std::is_integral_v<R>
+        void cfun(lua_State *L, R(T::*func)(lua_State*))
+        {
+            using func_t = decltype (func);
+            new (lua_newuserdata(L, sizeof(func))) func_t(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassLCFunc<T>::f), 1);
+        }
+
+        template <class T, class R> requires std::is_integral_v<R>
+        void cfun(lua_State *L, std::function<R(T*, lua_State*)> func)
+        {
+            using FnType = decltype (func);
+            new (lua_newuserdata(L, sizeof(func))) FnType(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassFunLCFunc<T>::f), 1);
+        }
+
+        template <class T, class R> requires std::is_integral_v<R>
+        void cfun(lua_State *L, R(*func)(lua_State*))
+        {
+            lua_pushcclosure(L, func, 0);
+        }
+
+        template <class T, class R> requires std::is_integral_v<R>
+        void cfun(lua_State *L, std::function<R(lua_State*)> func)
+        {
+            using FnType = decltype (func);
+            new (lua_newuserdata(L, sizeof(func))) FnType(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassFunNLCFunc<T>::f), 1);
+        }
+
+        template <class T, class R, class U> requires std::is_integral_v<R>
+        void cfun(lua_State *L, R(T::*func)(U))
+        {
+            using func_t = decltype (func);
+            new (lua_newuserdata(L, sizeof(func))) func_t(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassCFunc<T>::f), 1);
+        }
+
+        template <class T, class R, class U> requires std::is_integral_v<R>
+        void cfun(lua_State *L, R(*func)(T*, U))
+        {
+            using func_t = decltype (func);
+            new (lua_newuserdata(L, sizeof(func))) func_t(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassCFunc<T>::f), 1);
+        }
+
+        template <class T, class R, class U> requires std::is_integral_v<R>
+        void cfun(lua_State *L, R(*func)(U))
+        {
+            lua_pushlightuserdata(L, reinterpret_cast<void*>(func));
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsCFunc<T>::f), 1);
+        }
+
+        template <class T, class R, class U> requires std::is_integral_v<R>
+        void cfun(lua_State *L, std::function<R(U)> func)
+        {
+            using FnType = decltype (func);
+            new (lua_newuserdata(L, sizeof(func))) FnType(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassFunNCFunc<T>::f), 1);
+        }
+
+        template <class T, class R, class U> requires std::is_integral_v<R>
+        void cfun(lua_State *L, std::function<R(T*, U)> func)
+        {
+            using FnType = decltype (func);
+            new (lua_newuserdata(L, sizeof(func))) FnType(func);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassFunCFunc<T>::f), 1);
+        }
+        
+        template <class T, class F>
+        void fun(lua_State *L, F& func)
+        {
+            fun<T>(L, static_cast<function_type_t<std::decay_t<F>>>(func));
+        }
+
+        template <class T, class F>
+        void cfun(lua_State *L, F& func)
+        {
+            cfun<T>(L, static_cast<function_type_t<std::decay_t<F>>>(func));
+        }
+        
+        template <class T, class F>
+        void fun(lua_State *L, F&& func)
+        {
+            fun<T>(L, static_cast<function_type_t<std::decay_t<F>>>(func));
+        }
+
+        template <class T, class F>
+        void cfun(lua_State *L, F&& func)
+        {
+            cfun<T>(L, static_cast<function_type_t<std::decay_t<F>>>(func));
+        }
+    }
+
+    template<typename T>
+    struct disect_function;
+
+    template<typename R, typename ...Args>
+    struct disect_function<R(Args...)>
+    {
+        static constexpr size_t nargs = sizeof...(Args);
+        static constexpr bool isClass = false;
+
+        template <size_t i>
+        struct arg
+        {
+            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
+        };
+    };
+
+    template<typename R, typename ...Args>
+    struct disect_function<R(Args...) const>
+    {
+        static constexpr size_t nargs = sizeof...(Args);
+        static constexpr bool isClass = false;
+
+        template <size_t i>
+        struct arg
+        {
+            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
+        };
+    };
+
+    template<typename R, typename ...Args>
+    struct disect_function<R(*)(Args...)>
+    {
+        static constexpr size_t nargs = sizeof...(Args);
+        static constexpr bool isClass = false;
+
+        template <size_t i>
+        struct arg
+        {
+            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
+        };
+    };
+
+    template<typename R, typename T, typename ...Args>
+    struct disect_function<R(T::*)(Args...)>
+    {
+        static constexpr size_t nargs = sizeof...(Args);
+        static constexpr bool isClass = true;
+        static constexpr T* classT = nullptr;
+
+        template <size_t i>
+        struct arg
+        {
+            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
+        };
+    };
+
+    template<typename R, typename T, typename ...Args>
+    struct disect_function<R(T::*)(Args...) const>
+    {
+        static constexpr size_t nargs = sizeof...(Args);
+        static constexpr bool isClass = true;
+        static constexpr T* classT = nullptr;
+
+        template <size_t i>
+        struct arg
+        {
+            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
+        };
+    };
+
+    template<typename R, typename ...Args>
+    struct disect_function<std::function<R(Args...)>>
+    {
+        static constexpr size_t nargs = sizeof...(Args);
+        static constexpr bool isClass = false;
+
+        template <size_t i>
+        struct arg
+        {
+            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
+        };
+    };
+
+    template <typename F, size_t N = 0, size_t J = 1>
+    void LoopTupleT(lua_State *L)
+    {
+        if constexpr (N == 0)
+        {
+            if constexpr(!std::is_same_v<State, std::decay_t<disect_function<F>::template arg<0>::type>> && !std::is_same_v<Environment, std::decay_t<disect_function<F>::template arg<0>::type>>)
+            {
+                lua_pushinteger(L, detail::basic_type<std::decay_t<disect_function<F>::template arg<0>::type>>(L));
+                lua_rawseti(L, -2, J + (disect_function<F>::isClass ? 1 : 0));
+                LoopTupleT<F, 1, J + 1>(L);
+            } else if constexpr(std::is_same_v<Object, std::decay_t<disect_function<F>::template arg<0>::type>> || std::is_same_v<ObjectRef, std::decay_t<disect_function<F>::template arg<0>::type>>)
+            {
+                lua_pushinteger(L, -2);
+                lua_rawseti(L, -2, J + (disect_function<F>::isClass ? 1 : 0));
+                LoopTupleT<F, 1, J + 1>(L);
+            } else
+                LoopTupleT<F, 1, J>(L);
+        } else if constexpr(N < disect_function<F>::nargs) {
+            if constexpr(!std::is_same_v<State, std::decay_t<disect_function<F>::template arg<N-1>::type>> && !std::is_same_v<Environment, std::decay_t<disect_function<F>::template arg<N-1>::type>>)
+            {
+                lua_pushinteger(L, detail::basic_type<std::decay_t<disect_function<F>::template arg<N-1>::type>>(L));
+                lua_rawseti(L, -2, J + (disect_function<F>::isClass ? 1 : 0));
+                LoopTupleT<F, N + 1, J + 1>(L);
+            } else if constexpr(std::is_same_v<Object, std::decay_t<disect_function<F>::template arg<N-1>::type>> || std::is_same_v<ObjectRef, std::decay_t<disect_function<F>::template arg<N-1>::type>>)
+            {
+                lua_pushinteger(L, -2);
+                lua_rawseti(L, -2, J + (disect_function<F>::isClass ? 1 : 0));
+                LoopTupleT<F, N + 1, J + 1>(L);
+            } else
+                LoopTupleT<F, N + 1, J>(L);
+        }
+    }
+
+    template<typename C, typename ...Functions>
+    class OverloadedFunction {
+        lua_State* L = nullptr;
+    public:
+        OverloadedFunction(lua_State *L, Functions... functions) {
+            this->L = L;
+            lua_newtable(L);
+            auto fun_index = 1;
+            auto push_fun = [&fun_index](lua_State* L, auto f) {
+                lua_newtable(L);
+
+                lua_newtable(L);
+                if constexpr(disect_function<decltype(f)>::isClass) {
+                    lua_pushinteger(L, LUA_TUSERDATA);
+                    lua_rawseti(L, -2, 1);
+                }
+
+                if constexpr(disect_function<decltype(f)>::nargs > 0)
+                    LoopTupleT<decltype(f)>(L);
+
+                lua_pushinteger(L, lua_getlen(L, -1));
+                lua_setfield(L, -3, "nargs");
+
+                lua_setfield(L, -2, "argl");
+
+                Function::fun<C>(L, f);
+                lua_setfield(L, -2, "f");
+
+                lua_pushstring(L, typeid(f).name());
+                lua_setfield(L, -2, "typeid");
+
+                lua_rawseti(L, -2, fun_index++);
+
+                return 0;
+            };
+            (push_fun(L, functions), ...);
+            lua_pushcclosure(L, LUABINDING_THUNK(call), 1);
+        }
+        static int call(lua_State* L) {
+            auto argn = lua_gettop(L);
+
+            lua_pushvalue(L, lua_upvalueindex(1));
+
+            lua_pushnil(L);
+            while(lua_next(L, -2) != 0) {
+                lua_getfield(L, -1, "nargs");
+                if (lua_tointeger(L, -1) != argn)
+                {
+                    lua_pop(L, 2);
+                    continue;
+                }
+                lua_pop(L, 1);
+
+                bool valid = true;
+
+                lua_getfield(L, -1, "argl");
+                lua_pushnil(L);
+                while(lua_next(L, -2) != 0) {
+                    if (lua_tointeger(L, -1) == -2 || lua_tointeger(L, -1) != lua_type(L, lua_tointeger(L, -2)))
+                        valid = false;
+                    lua_pop(L, 1);
+                }
+                lua_pop(L, 1);
+
+                if (valid) {
+                    lua_getfield(L, -1, "f");
+                    lua_insert(L, 1);
+                    lua_pop(L, 3);
+                    return LuaBinding::pcall(L, argn, LUA_MULTRET);
+                }
+
+                lua_pop(L, 1);
+            }
+
+            luaL_error(L, "no matching overload with %d args and input values", argn);
+
+            return 0;
+        }
+    };
+
+    namespace detail {
+        namespace _resolve {
+            template <typename Sig, typename C>
+            inline Sig C::* resolve_v(std::false_type, Sig C::* mem_func_ptr) {
+                return mem_func_ptr;
+            }
+
+            template <typename Sig, typename C>
+            inline Sig C::* resolve_v(std::true_type, Sig C::* mem_variable_ptr) {
+                return mem_variable_ptr;
+            }
+        }
+
+        template <typename... Args, typename R>
+        inline auto resolve(R fun_ptr(Args...))->R(*)(Args...) {
+            return fun_ptr;
+        }
+
+        template <typename Sig>
+        inline Sig* resolve(Sig* fun_ptr) {
+            return fun_ptr;
+        }
+
+        template <typename... Args, typename R, typename C>
+        inline auto resolve(R(C::* mem_ptr)(Args...))->R(C::*)(Args...) {
+            return mem_ptr;
+        }
+
+        template <typename Sig, typename C>
+        inline Sig C::* resolve(Sig C::* mem_ptr) {
+            return _resolve::resolve_v(std::is_member_object_pointer<Sig C::*>(), mem_ptr);
+        }
+
+        template<typename F>
+        concept has_call_operator = requires (F) {
+            &F::operator();
+        };
+
+        template<typename F>
+        concept is_cfun_style = std::is_invocable_v<F, State> || std::is_invocable_v<F, lua_State*>;
+        
+        template <typename T>
+        concept is_pushable_ref_fun = requires (T &t) {
+            { Function::fun(nullptr, t) };
+        };
+
+        template <typename T>
+        concept is_pushable_forward_fun = requires (T &&t) {
+            { Function::fun(nullptr, t) };
+        };
+
+        template <typename T>
+        concept is_pushable_ref_cfun = requires (T &t) {
+            { Function::cfun(nullptr, t) };
+        };
+
+        template <typename T>
+        concept is_pushable_forward_cfun = requires (T &&t) {
+            { Function::cfun(nullptr, t) };
+        };
+
+        template <typename T>
+        concept is_pushable_fun =
+            is_pushable_ref_fun<std::decay_t<T>> || is_pushable_forward_fun<std::decay_t<T>>;
+
+        template <typename T>
+        concept is_pushable_cfun =
+            (is_pushable_ref_cfun<std::decay_t<T>> || is_pushable_forward_cfun<std::decay_t<T>>) && is_cfun_style<std::decay_t<T>>;
+    }
+}
+
+#include <vector>
+
+#include <atomic>
+#ifdef LUABINDING_TRACK_REFS
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <source_location>
+#include <string_view>
+#include <vector>
+// extra constructor parameter recording where a ref was taken
+#define LUABINDING_REF_SITE , std::source_location where = std::source_location::current()
+#define LUABINDING_REF_WHERE , where
+#else
+#define LUABINDING_REF_SITE
+#define LUABINDING_REF_WHERE
+#endif
+
+namespace LuaBinding {
+#ifdef LUABINDING_TRACK_REFS
+    struct RefSite {
+        lua_State* L;
+        int ref;
+        std::source_location where;
+    };
+#endif
+
+    // Registry slots held by ObjectRef, Environment and Path, across all States. live() is a
+    // relaxed atomic counter; with LUABINDING_TRACK_REFS each slot also keeps where it was taken,
+    // for the ObjectRef constructors that is the caller, and refs stored by assignment are put
+    // down where the assigned ObjectRef was declared. Refs still held when their State closes
+    // stay counted, so check before closing.
+    class RegistryRefs {
+        static std::atomic<size_t>& counter()
+        {
+            static std::atomic<size_t> n{ 0 };
+            return n;
+        }
+#ifdef LUABINDING_TRACK_REFS
+        static std::mutex& lock()
+        {
+            static std::mutex m;
+            return m;
+        }
+
+        static std::map<std::pair<lua_State*, int>, std::source_location>& tracked()
+        {
+            static std::map<std::pair<lua_State*, int>, std::source_location> sites;
+            return sites;
+        }
+
+        // refs are shared by the threads of a state
+        static lua_State* main_thread(lua_State* L)
+        {
+#if LUA_VERSION_NUM >= 502
+            lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+            auto main = lua_tothread(L, -1);
+            lua_pop(L, 1);
+            return main;
+#else
+            return L;
+#endif
+        }
+#endif
+    public:
+        // luaL_ref of the value on top of the stack, popping it
+#ifdef LUABINDING_TRACK_REFS
+        static int ref(lua_State* L, std::source_location where = std::source_location::current())
+#else
+        static int ref(lua_State* L)
+#endif
+        {
+            auto r = luaL_ref(L, LUA_REGISTRYINDEX);
+            if (r == LUA_REFNIL || r == LUA_NOREF)
+                return r;
+            counter().fetch_add(1, std::memory_order_relaxed);
+#ifdef LUABINDING_TRACK_REFS
+            std::lock_guard guard(lock());
+            tracked().insert_or_assign({ main_thread(L), r }, where);
+#endif
+            return r;
+        }
+
+        static void unref(lua_State* L, int r)
+        {
+            if (r == LUA_REFNIL || r == LUA_NOREF)
+                return;
+            luaL_unref(L, LUA_REGISTRYINDEX, r);
+            counter().fetch_sub(1, std::memory_order_relaxed);
+#ifdef LUABINDING_TRACK_REFS
+            std::lock_guard guard(lock());
+            tracked().erase({ main_thread(L), r });
+#endif
+        }
+
+        [[nodiscard]] static size_t live()
+        {
+            return counter().load(std::memory_order_relaxed);
+        }
+
+#ifdef LUABINDING_TRACK_REFS
+        // the live refs of L, or of all States
+        [[nodiscard]] static std::vector<RefSite> sites(lua_State* L = nullptr)
+        {
+            auto main = L ? main_thread(L) : nullptr;
+            std::vector<RefSite> out;
+            std::lock_guard guard(lock());
+            for (auto& [k, where] : tracked())
+                if (!main || k.first == main)
+                    out.push_back({ k.first, k.second, where });
+            return out;
+        }
+
+        // one "file:line function" line per live ref, counted per site
+        static void report(FILE* f, lua_State* L = nullptr)
+        {
+            std::map<std::pair<std::string_view, unsigned>, std::pair<const char*, size_t>> counts;
+            for (auto& s : sites(L))
+            {
+                auto& c = counts[{ s.where.file_name(), s.where.line() }];
+                c.first = s.where.function_name();
+                c.second++;
+            }
+            for (auto& [k, c] : counts)
+                fprintf(f, "%zu ref(s) from %.*s:%u %s\n", c.second, (int)k.first.size(), k.first.data(), k.second, c.first);
+        }
+#endif
+    };
+}
+
+namespace LuaBinding {
+    // Keys of a lookup chain. An interned Path holds a registry ref of its lua_State, so it must be
+    // released or destroyed before that State closes; copies take their own ref.
+    class Path {
+        struct Key {
+            string_type str;
+            lua_Integer num = 0;
+            bool is_str = false;
+        };
+        std::vector<Key> keys;
+        lua_State* L = nullptr;
+        int interned = LUA_NOREF;
+
+        void add(const char* key)
+        {
+            keys.push_back({ key, 0, true });
+        }
+
+        void add(const string_type& key)
+        {
+            keys.push_back({ key, 0, true });
+        }
+
+        template<class K> requires std::is_integral_v<K>
+        void add(K key)
+        {
+            keys.push_back({ {}, (lua_Integer)key, false });
+        }
+
+        static bool indexable(lua_State* L, int index)
+        {
+            auto t = lua_type(L, index);
+            return t == LUA_TTABLE || t == LUA_TUSERDATA;
+        }
+
+        void copy_interned(const Path& other)
+        {
+            if (!other.L || other.interned == LUA_NOREF)
+                return;
+            lua_rawgeti(other.L, LUA_REGISTRYINDEX, other.interned);
+            interned = RegistryRefs::ref(other.L);
+            L = other.L;
+        }
+
+        int push_names(lua_State* S) const
+        {
+            if (interned == LUA_NOREF || S != L)
+                return 0;
+            lua_rawgeti(S, LUA_REGISTRYINDEX, interned);
+            return lua_gettop(S);
+        }
+
+        // pushes (top)[keys[i]]
+        void fetch(lua_State* S, size_t i, int names) const
+        {
+            if (names)
+            {
+                lua_rawgeti(S, names, (int)i + 1);
+                lua_gettable(S, -2);
+            } else if (keys[i].is_str)
+                lua_getfield(S, -1, keys[i].str.c_str());
+            else
+                lua_geti(S, lua_gettop(S), keys[i].num);
+        }
+
+        // (-2)[keys[i]] = (top), pops the value
+        void store(lua_State* S, size_t i, int names) const
+        {
+            if (names)
+            {
+                lua_rawgeti(S, names, (int)i + 1);
+                lua_insert(S, -2);
+                lua_settable(S, -3);
+            } else if (keys[i].is_str)
+                lua_setfield(S, -2, keys[i].str.c_str());
+            else
+            {
+                lua_pushinteger(S, keys[i].num);
+                lua_insert(S, -2);
+                lua_settable(S, -3);
+            }
+        }
+    public:
+        Path() = default;
+
+        template<class ...Keys> requires (sizeof...(Keys) > 0) && ((std::is_convertible_v<Keys, const char*> || std::is_convertible_v<Keys, string_type> || std::is_integral_v<Keys>) && ...)
+        explicit Path(Keys... k)
+        {
+            keys.reserve(sizeof...(Keys));
+            (add(k), ...);
+        }
+
+        Path(const Path& other) : keys(other.keys)
+        {
+            copy_interned(other);
+        }
+
+        Path(Path&& other) noexcept : keys(std::move(other.keys)), L(other.L), interned(other.interned)
+        {
+            other.L = nullptr;
+            other.interned = LUA_NOREF;
+        }
+
+        Path& operator=(const Path& other)
+        {
+            if (this != &other)
+            {
+                release();
+                keys = other.keys;
+                copy_interned(other);
+            }
+            return *this;
+        }
+
+        Path& operator=(Path&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                keys = std::move(other.keys);
+                L = other.L;
+                interned = other.interned;
+                other.L = nullptr;
+                other.interned = LUA_NOREF;
+            }
+            return *this;
+        }
+
+        ~Path()
+        {
+            release();
+        }
+
+        static Path parse(const char* dotted)
+        {
+            Path path;
+            auto str = string_type(dotted);
+            size_t start = 0, dot;
+            while ((dot = str.find('.', start)) != string_type::npos)
+            {
+                path.add(str.substr(start, dot - start));
+                start = dot + 1;
+            }
+            path.add(str.substr(start));
+            return path;
+        }
+
+        // keeps the keys as lua values in the registry so lookups skip string interning
+        Path& intern(lua_State* S)
+        {
+            release();
+            lua_createtable(S, (int)keys.size(), 0);
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                if (keys[i].is_str)
+                    lua_pushlstring(S, keys[i].str.data(), keys[i].str.size());
+                else
+                    lua_pushinteger(S, keys[i].num);
+                lua_rawseti(S, -2, (int)i + 1);
+            }
+            interned = RegistryRefs::ref(S);
+            L = S;
+            return *this;
+        }
+
+        void release()
+        {
+            if (L && interned != LUA_NOREF)
+                RegistryRefs::unref(L, interned);
+            L = nullptr;
+            interned = LUA_NOREF;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return keys.size();
+        }
+
+        int push(lua_State* S, int index) const
+        {
+            index = lua_absindex(S, index);
+            auto names = push_names(S);
+            lua_pushvalue(S, index);
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                if (!indexable(S, -1))
+                {
+                    lua_pop(S, 1);
+                    lua_pushnil(S);
+                    break;
+                }
+                fetch(S, i, names);
+                lua_replace(S, -2);
+            }
+            if (names)
+                lua_remove(S, names);
+            return 1;
+        }
+
+        int push(lua_State* S) const
+        {
+            lua_pushglobaltable(S);
+            push(S, -1);
+            lua_remove(S, -2);
+            return 1;
+        }
+
+        template<typename T>
+        bool set(lua_State* S, int index, T&& value) const
+        {
+            if (keys.empty())
+                return false;
+            auto top = lua_gettop(S);
+            index = lua_absindex(S, index);
+            auto names = push_names(S);
+            lua_pushvalue(S, index);
+            for (size_t i = 0; i + 1 < keys.size(); i++)
+            {
+                if (!indexable(S, -1))
+                {
+                    lua_settop(S, top);
+                    return false;
+                }
+                fetch(S, i, names);
+                if (lua_isnil(S, -1))
+                {
+                    lua_pop(S, 1);
+                    lua_newtable(S);
+                    lua_insert(S, -2);
+                    lua_pushvalue(S, -2);
+                    store(S, i, names);
+                    lua_pop(S, 1);
+                } else
+                    lua_replace(S, -2);
+            }
+            if (!indexable(S, -1))
+            {
+                lua_settop(S, top);
+                return false;
+            }
+            detail::push(S, value);
+            store(S, keys.size() - 1, names);
+            lua_settop(S, top);
+            return true;
+        }
+
+        template<typename T>
+        bool set(lua_State* S, T&& value) const
+        {
+            lua_pushglobaltable(S);
+            auto result = set(S, -1, std::forward<T>(value));
+            lua_pop(S, 1);
+            return result;
+        }
+
+        template<typename T>
+        T get(lua_State* S, int index) const
+        {
+            auto top = lua_gettop(S);
+            push(S, index);
+            auto result = detail::get<T>(S, -1);
+            lua_settop(S, top);
+            return result;
+        }
+
+        template<typename T>
+        T get(lua_State* S) const
+        {
+            auto top = lua_gettop(S);
+            push(S);
+            auto result = detail::get<T>(S, -1);
+            lua_settop(S, top);
+            return result;
+        }
+    };
+}
+
+
+namespace LuaBinding {
+    // Restores the stack top with a single lua_settop when it goes out of scope.
+    // Owned Objects created above the frame base are treated as views, so temporaries
+    // no longer lua_remove themselves one by one.
+    class StackFrame {
+        lua_State* L = nullptr;
+        int base = 0;
+        int results = 0;
+        StackFrame* prev = nullptr;
+
+        static StackFrame*& innermost()
+        {
+            static thread_local StackFrame* frame = nullptr;
+            return frame;
+        }
+    public:
+        explicit StackFrame(lua_State* L) : L(L), base(lua_gettop(L)), prev(innermost())
+        {
+            innermost() = this;
+        }
+        StackFrame(const StackFrame&) = delete;
+        StackFrame& operator=(const StackFrame&) = delete;
+        ~StackFrame()
+        {
+            auto top = lua_gettop(L);
+            if (results > top - base)
+                results = top - base;
+            for (int i = 1; i <= results; i++)
+            {
+                lua_pushvalue(L, top - results + i);
+                lua_replace(L, base + i);
+            }
+            lua_settop(L, base + results);
+            innermost() = prev;
+        }
+
+        // keeps the top n values, they end up right above the frame base
+        void keep(int n)
+        {
+            results = n;
+        }
+
+        [[nodiscard]] int bottom() const
+        {
+            return base;
+        }
+
+        [[nodiscard]] int n() const
+        {
+            return lua_gettop(L) - base;
+        }
+
+        static bool covers(lua_State* L, int idx)
+        {
+            for (auto frame = innermost(); frame; frame = frame->prev)
+                if (frame->L == L && idx > frame->base)
+                    return true;
+            return false;
+        }
+    };
+}
+
+#include <memory>
+
+namespace LuaBinding {
+    template<typename T>
+    class TableIter
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        TableIter(lua_State* L, int index, int base) : L(L), index(index), base(base) { }
+        TableIter operator++() { index++; return *this; }
+        std::pair<int, T> operator*() { lua_rawgeti(L, base, index); return { index, T(L, -1, false) }; }
+        bool operator!=(const TableIter& rhs) { return index != rhs.index; }
+    private:
+        lua_State* L;
+        int index;
+        int base;
+    };
+
+    template<typename K, typename V>
+    class TablePairs
+    {
+    public:
+        class iterator
+        {
+        public:
+            typedef std::input_iterator_tag iterator_category;
+            iterator(lua_State* L, int table) : L(L), table(table)
+            {
+                if (L)
+                {
+                    lua_pushnil(L);
+                    next();
+                }
+            }
+            iterator& operator++() { lua_pop(L, 1); next(); return *this; }
+            std::pair<K, V> operator*()
+            {
+                auto top = lua_gettop(L);
+                if constexpr (std::is_same_v<K, Object>)
+                {
+                    std::pair<K, V> result = { detail::get<K>(L, top - 1), detail::get<V>(L, top) };
+                    lua_settop(L, top);
+                    return result;
+                } else {
+                    // convert a copy, lua_tostring on the key itself would confuse lua_next
+                    lua_pushvalue(L, top - 1);
+                    std::pair<K, V> result = { detail::get<K>(L, top + 1), detail::get<V>(L, top) };
+                    lua_settop(L, top);
+                    return result;
+                }
+            }
+            bool operator!=(const iterator& rhs) const { return table != rhs.table; }
+        private:
+            void next() { if (!lua_next(L, table)) table = 0; }
+            lua_State* L;
+            int table;
+        };
+
+        TablePairs(lua_State* L, int table, int top) : L(L), table(table), top(top) { }
+        TablePairs(const TablePairs&) = delete;
+        TablePairs& operator=(const TablePairs&) = delete;
+        ~TablePairs() { lua_settop(L, top); }
+
+        iterator begin() { return iterator(L, table); }
+        iterator end() { return iterator(nullptr, 0); }
+    private:
+        lua_State* L;
+        int table;
+        int top;
+    };
+
+    template<typename V>
+    class TableIPairs
+    {
+    public:
+        class iterator
+        {
+        public:
+            typedef std::input_iterator_tag iterator_category;
+            iterator(lua_State* L, int table, int index, int last) : L(L), table(table), index(index), last(last)
+            {
+                if (index <= last)
+                    lua_rawgeti(L, table, index);
+            }
+            iterator& operator++()
+            {
+                lua_pop(L, 1);
+                if (++index <= last)
+                    lua_rawgeti(L, table, index);
+                return *this;
+            }
+            std::pair<int, V> operator*()
+            {
+                auto top = lua_gettop(L);
+                std::pair<int, V> result = { index, detail::get<V>(L, top) };
+                lua_settop(L, top);
+                return result;
+            }
+            bool operator!=(const iterator& rhs) const { return index != rhs.index; }
+        private:
+            lua_State* L;
+            int table;
+            int index;
+            int last;
+        };
+
+        TableIPairs(lua_State* L, int table, int top) : L(L), table(table), top(top), last(lua_getlen(L, table)) { }
+        TableIPairs(const TableIPairs&) = delete;
+        TableIPairs& operator=(const TableIPairs&) = delete;
+        ~TableIPairs() { lua_settop(L, top); }
+
+        iterator begin() { return iterator(L, table, 1, last); }
+        iterator end() { return iterator(L, table, last + 1, last); }
+    private:
+        lua_State* L;
+        int table;
+        int top;
+        int last;
+    };
+
+    template <typename T>
+    concept has_lua_state = requires(T t)
+    {
+        { t.lua_state() } -> std::convertible_to<void*>;
+    };
+
+    namespace detail {
+        inline int push_field(lua_State* L, int index, const char* key)
+        {
+            return luaL_getfield(L, index, key);
+        }
+
+        template<class K> requires std::is_integral_v<K>
+        int push_field(lua_State* L, int index, K key)
+        {
+            lua_geti(L, index, (lua_Integer)key);
+            return lua_type(L, -1);
+        }
+
+        inline int push_field(lua_State* L, int index, const Path& path)
+        {
+            path.push(L, index);
+            return lua_type(L, -1);
+        }
+
+        // pushes t[k1][k2]...[kn], or nil as soon as a step hits something that cannot be indexed
+        template<class ...Keys>
+        int push_path(lua_State* L, int index, Keys... keys)
+        {
+            lua_pushvalue(L, index);
+            auto step = [L](auto key) {
+                auto t = lua_type(L, -1);
+                if (t != LUA_TTABLE && t != LUA_TUSERDATA)
+                {
+                    lua_pop(L, 1);
+                    lua_pushnil(L);
+                    return false;
+                }
+                push_field(L, lua_gettop(L), key);
+                lua_replace(L, -2);
+                return true;
+            };
+            (void)(step(keys) && ...);
+            return lua_type(L, -1);
+        }
+
+        template<class T>
+        T get_or(lua_State* L, int index, T def)
+        {
+            if (lua_isnoneornil(L, index) || !detail::is<T>(L, index))
+                return def;
+            return detail::get<T>(L, index);
+        }
+    }
+
+    // Shared accessors of Object, ObjectRef and IndexProxy, resolved at compile time.
+    // Derived provides push()/pop() and acquire()/release(): acquire returns a stack index
+    // holding the value (pushing it if it does not live on the stack) and release undoes it.
+    template<class Derived>
+    class BasicObject {
+    protected:
+        int idx = LUA_REFNIL;
+        lua_State* L = nullptr;
+
+        Derived& self()
+        {
+            return static_cast<Derived&>(*this);
+        }
+
+        const Derived& self() const
+        {
+            return static_cast<const Derived&>(*this);
+        }
+    public:
+        const char* tostring() const
+        {
+            auto i = self().acquire();
+            auto result = lua_tostring(L, i);
+            self().release();
+            return result;
+        }
+
+        const char* tolstring() const
+        {
+            auto top = lua_gettop(L);
+            auto i = self().acquire();
+            auto result = luaL_tolstring(L, i, nullptr);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T>
+        T as() const
+        {
+            auto i = self().acquire();
+            auto result = detail::get<T>(L, i);
+            self().release();
+            return result;
+        }
+
+        template<typename T>
+        T extract()
+        {
+            auto result = as<T>();
+            self().pop();
+            return result;
+        }
+
+        template<typename T>
+        bool is() const
+        {
+            auto i = self().acquire();
+            bool result;
+            if constexpr (std::is_same_v<T, void>)
+                result = lua_isnoneornil(L, i);
+            else
+                result = detail::is<T>(L, i);
+            self().release();
+            return result;
+        }
+
+        bool is(int t) const
+        {
+            return type() == t;
+        }
+
+        [[nodiscard]] const void* topointer() const
+        {
+            auto i = self().acquire();
+            auto result = lua_topointer(L, i);
+            self().release();
+            return result;
+        }
+
+        template<typename T, typename K>
+        T get(const K& key) const
+        {
+            static_assert(!std::is_same_v<T, Object>, "get<Object> would point at a popped stack slot, use get<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            detail::push_field(L, self().acquire(), key);
+            auto result = detail::get<T>(L, -1);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T, typename K>
+        T get_or(const K& key, T def) const
+        {
+            static_assert(!std::is_same_v<T, Object>, "get_or<Object> would point at a popped stack slot, use get_or<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            detail::push_field(L, self().acquire(), key);
+            auto result = detail::get_or<T>(L, -1, def);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T, typename ...Keys>
+        T get_path(Keys... keys) const
+        {
+            static_assert(!std::is_same_v<T, Object>, "get_path<Object> would point at a popped stack slot, use get_path<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            detail::push_path(L, self().acquire(), keys...);
+            auto result = detail::get<T>(L, -1);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T, typename ...Keys>
+        T get_path_or(T def, Keys... keys) const
+        {
+            static_assert(!std::is_same_v<T, Object>, "get_path_or<Object> would point at a popped stack slot, use get_path_or<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            detail::push_path(L, self().acquire(), keys...);
+            auto result = detail::get_or<T>(L, -1, def);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename R>
+        R call() {
+            self().push();
+            if constexpr (std::is_same_v<void, R>) {
+                if (LuaBinding::pcall(L, 0, 0))
+                {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+                }
+            } else {
+                if (LuaBinding::pcall(L, 0, 1))
+                {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+                }
+                auto result = LuaBinding::detail::get<R>(L, -1);
+                lua_pop(L, 1);
+                return result;
+            }
+        }
+
+        template<int R>
+        void call() {
+            self().push();
+            if (LuaBinding::pcall(L, 0, R))
             {
-                static_assert(i < sizeof...(Args), "Argument index out of bounds (queried callable does not declare this many arguments)");
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+        }
+
+        template<typename R, typename ...Params> requires (sizeof...(Params) > 0 && !std::is_same_v<std::tuple_element_t<0, std::tuple<Params...>>, Environment>)
+        R call(Params... param) {
+            self().push();
+            if constexpr (sizeof...(param) > 0)
+                (void)std::initializer_list<int>{ detail::push(L, param)... };
+            if constexpr (std::is_same_v<void, R>) {
+                if (LuaBinding::pcall(L, sizeof...(param), 0))
+                {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+                }
+            } else {
+                if (LuaBinding::pcall(L, sizeof...(param), 1))
+                {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+                }
+                auto result = LuaBinding::detail::get<R>(L, -1);
+                lua_pop(L, 1);
+                return result;
+            }
+        }
+
+        template<int R, typename ...Params> requires (sizeof...(Params) > 0 && !std::is_same_v<std::tuple_element_t<0, std::tuple<Params...>>, Environment>)
+        void call(Params... param) {
+            self().push();
+            if constexpr (sizeof...(param) > 0)
+                (void)std::initializer_list<int>{ detail::push(L, param)... };
+            if (LuaBinding::pcall(L, sizeof...(param), R))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+        }
+
+        template<typename R, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
+        R call(const Env& env, Params... param) {
+            self().push();
+            if constexpr (sizeof...(param) > 0)
+                (void)std::initializer_list<int>{ detail::push(L, param)... };
+            if constexpr (std::is_same_v<void, R>) {
+                if (env.pcall(sizeof...(param), 0))
+                {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+                }
+            } else {
+                if (env.pcall(sizeof...(param), 1))
+                {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+                }
+                auto result = LuaBinding::detail::get<R>(L, -1);
+                lua_pop(L, 1);
+                return result;
+            }
+        }
+
+        template<int R, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
+        void call(const Env& env, Params... param) {
+            self().push();
+            if constexpr (sizeof...(param) > 0)
+                (void)std::initializer_list<int>{ detail::push(L, param)... };
+            if (env.pcall(sizeof...(param), R))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+        }
+
+        template<typename Ref = ObjectRef> requires std::is_base_of_v<ObjectRef, Ref>
+        Ref operator() () {
+            self().push();
+            if (LuaBinding::pcall(L, 0, 1))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return Ref(L, -1, false);
+        }
+
+        template<typename Ref = ObjectRef, typename ...Params> requires (std::is_base_of_v<ObjectRef, Ref>) && (sizeof...(Params) > 0 && !std::is_same_v<std::tuple_element_t<0, std::tuple<Params...>>, Environment>)
+        Ref operator() (Params... param) {
+            self().push();
+            if constexpr (sizeof...(param) > 0)
+                (void)std::initializer_list<int>{ detail::push(L, param)... };
+            if (LuaBinding::pcall(L, sizeof...(param), 1))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return Ref(L, -1, false);
+        }
+
+        template<typename Ref = ObjectRef, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
+        Ref operator()(const Env& env, Params... param) {
+            self().push();
+            if constexpr (sizeof...(param) > 0)
+                (void)std::initializer_list<int>{ detail::push(L, param)... };
+            if (env.pcall(sizeof...(param), 1))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return Ref(L, -1, false);
+        }
 
-                // to reduce excessive compiler error output
-                using type = void;
-            };
+        template <typename T>
+        void set(const char* index, T&& other)
+        {
+            auto i = self().acquire();
+            detail::push(L, other);
+            lua_setfield(L, i, index);
+            self().release();
+        }
 
-            template <
-                typename Rd, typename Ri, typename C,
-                bool IsConst, bool isVolatile, bool isNoexcept, bool IsVariadic,
-                typename... Args>
-            struct invocable_traits_class
-            {
-                static constexpr std::size_t arity = sizeof...(Args);
-                static constexpr auto is_const    = IsConst;
-                static constexpr auto is_volatile = isVolatile;
-                static constexpr auto is_noexcept = isNoexcept;
-                static constexpr auto is_variadic = IsVariadic;
+        template <typename T>
+        void set(int index, T&& other)
+        {
+            auto i = self().acquire();
+            lua_pushinteger(L, index);
+            detail::push(L, other);
+            lua_settable(L, i);
+            self().release();
+        }
 
-                using declared_result_t = Rd;   // return type as declared in function
-                using invoke_result_t   = Ri;   // return type of std::invoke() expression
-                using class_t           = C;
+        template <typename T>
+        bool set(const Path& path, T&& other)
+        {
+            auto i = self().acquire();
+            auto result = path.set(L, i, other);
+            self().release();
+            return result;
+        }
 
-                template <std::size_t i>
-                using arg_t = typename invocable_traits_arg_impl<i < sizeof...(Args), i, Args...>::type;
-                using function_type = std::function<Rd(Args...)>;
+        void unset(const char* index)
+        {
+            auto i = self().acquire();
+            lua_pushnil(L);
+            lua_setfield(L, i, index);
+            self().release();
+        }
 
-                static constexpr Error error      = Error::None;
-            };
+        void unset(int index)
+        {
+            auto i = self().acquire();
+            lua_pushinteger(L, index);
+            lua_pushnil(L);
+            lua_settable(L, i);
+            self().release();
+        }
 
-            template <
-                typename Rd, typename Ri,
-                bool IsConst, bool isVolatile, bool isNoexcept, bool IsVariadic,
-                typename... Args>
-            struct invocable_traits_free : public invocable_traits_class<Rd, Ri, void, IsConst, isVolatile, isNoexcept, IsVariadic, Args...> {};
+        template <typename T>
+        void fun(int index, T&& other)
+        {
+            auto i = self().acquire();
+            Function::fun<void>(L, other);
+            lua_rawseti(L, i, index);
+            self().release();
+        }
 
+        template <typename T>
+        void cfun(int index, T&& other)
+        {
+            auto i = self().acquire();
+            Function::cfun<void>(L, other);
+            lua_rawseti(L, i, index);
+            self().release();
+        }
 
-            // machinery to extract exact function signature and qualifications
-            template <typename, typename...>
-            struct invocable_traits_impl;
+        template <typename T>
+        void fun(const char* index, T&& other)
+        {
+            auto i = self().acquire();
+            Function::fun<void>(L, other);
+            lua_setfield(L, i, index);
+            self().release();
+        }
 
-            // pointers to data members
-            template <typename C, typename R>
-            struct invocable_traits_impl<R C::*>
-                : public invocable_traits_class<R,
-                                                std::invoke_result_t<R C::*, C>,
-                                                C,
-                                                false, false, false, false
-                                            > {};
+        template <typename T>
+        void cfun(const char* index, T&& other)
+        {
+            auto i = self().acquire();
+            Function::cfun<void>(L, other);
+            lua_setfield(L, i, index);
+            self().release();
+        }
 
-            // pointers to functions
-            template <typename R, typename... Args>
-            struct invocable_traits_impl<R(*)(Args...)>                 : public invocable_traits_impl<R(Args...)> {};
-            template <typename R, typename... Args>
-            struct invocable_traits_impl<R(*)(Args...) noexcept>        : public invocable_traits_impl<R(Args...) noexcept> {};
-            template <typename R, typename... Args>
-            struct invocable_traits_impl<R(*)(Args..., ...)>            : public invocable_traits_impl<R(Args..., ...)> {};
-            template <typename R, typename... Args>
-            struct invocable_traits_impl<R(*)(Args..., ...) noexcept>   : public invocable_traits_impl<R(Args..., ...) noexcept> {};
+        [[nodiscard]] int index() const
+        {
+            return idx;
+        }
 
-            template <typename...>
-            struct typelist {};
+        lua_State* lua_state() const
+        {
+            return L;
+        }
 
-        #   define IS_NONEMPTY(...) 0 __VA_OPT__(+1)
-        #   define MAKE_CONST(...)    __VA_OPT__(const)
-        #   define MAKE_VOLATILE(...) __VA_OPT__(volatile)
-        #   define MAKE_NOEXCEPT(...) __VA_OPT__(noexcept)
-        #   define MAKE_VARIADIC(...) __VA_OPT__(, ...)
+        int type() const
+        {
+            auto i = self().acquire();
+            auto result = lua_type(L, i);
+            self().release();
+            return result;
+        }
 
-            // functions, pointers to member functions and machinery to select a specific overloaded operator()
-        #   define INVOCABLE_TRAITS_SPEC(c,vo,e,va)                                             \
-            /* functions */                                                                     \
-            template <typename R, typename... Args>                                             \
-            struct invocable_traits_impl<R(Args... MAKE_VARIADIC(va))                           \
-                                        MAKE_CONST(c) MAKE_VOLATILE(vo) MAKE_NOEXCEPT(e)>      \
-                : public invocable_traits_free<                                                 \
-                    R,                                                                          \
-                    std::invoke_result_t<R(Args... MAKE_VARIADIC(va))                           \
-                                        MAKE_CONST(c) MAKE_VOLATILE(vo) MAKE_NOEXCEPT(e), Args...>,    \
-                    IS_NONEMPTY(c),                                                             \
-                    IS_NONEMPTY(vo),                                                            \
-                    IS_NONEMPTY(e),                                                             \
-                    IS_NONEMPTY(va),                                                            \
-                    Args...> {};                                                                \
-            /* pointers to member functions */                                                  \
-            template <typename C, typename R, typename... Args>                                 \
-            struct invocable_traits_impl<R(C::*)(Args... MAKE_VARIADIC(va))                     \
-                                        MAKE_CONST(c) MAKE_VOLATILE(vo) MAKE_NOEXCEPT(e)>      \
-                : public invocable_traits_class<                                                \
-                    R,                                                                          \
-                    std::invoke_result_t<R(C::*)(Args...MAKE_VARIADIC(va))                      \
-                                        MAKE_CONST(c) MAKE_VOLATILE(vo) MAKE_NOEXCEPT(e), C, Args...>, \
-                    C,                                                                          \
-                    IS_NONEMPTY(c),                                                             \
-                    IS_NONEMPTY(vo),                                                            \
-                    IS_NONEMPTY(e),                                                             \
-                    IS_NONEMPTY(va),                                                            \
-                    Args...> {};                                                                \
-            /* machinery to select a specific overloaded operator() */                          \
-            template <typename C, typename... OverloadArgs>                                     \
-            auto invocable_traits_resolve_overload(std::invoke_result_t<C, OverloadArgs...>         \
-                                                (C::*func)(OverloadArgs... MAKE_VARIADIC(va))    \
-                                                MAKE_CONST(c) MAKE_VOLATILE(vo) MAKE_NOEXCEPT(e),\
-                                                typelist<OverloadArgs...>)\
-            { return func; };
+        bool valid() const
+        {
+            return L && this->idx != LUA_REFNIL;
+        }
 
-            // cover all const, volatile and noexcept permutations
-            INVOCABLE_TRAITS_SPEC( ,  , ,  )
-            INVOCABLE_TRAITS_SPEC( ,Va, ,  )
-            INVOCABLE_TRAITS_SPEC( ,  ,E,  )
-            INVOCABLE_TRAITS_SPEC( ,Va,E,  )
-            INVOCABLE_TRAITS_SPEC( ,  , ,Vo)
-            INVOCABLE_TRAITS_SPEC( ,Va, ,Vo)
-            INVOCABLE_TRAITS_SPEC( ,  ,E,Vo)
-            INVOCABLE_TRAITS_SPEC( ,Va,E,Vo)
-            INVOCABLE_TRAITS_SPEC(C,  , ,  )
-            INVOCABLE_TRAITS_SPEC(C,Va, ,  )
-            INVOCABLE_TRAITS_SPEC(C,  ,E,  )
-            INVOCABLE_TRAITS_SPEC(C,Va,E,  )
-            INVOCABLE_TRAITS_SPEC(C,  , ,Vo)
-            INVOCABLE_TRAITS_SPEC(C,Va, ,Vo)
-            INVOCABLE_TRAITS_SPEC(C,  ,E,Vo)
-            INVOCABLE_TRAITS_SPEC(C,Va,E,Vo)
-            // clean up
-        #   undef INVOCABLE_TRAITS_SPEC
-        #   undef IS_NONEMPTY
-        #   undef MAKE_CONST
-        #   undef MAKE_VOLATILE
-        #   undef MAKE_NOEXCEPT
-        #   undef MAKE_VARIADIC
+        bool valid(lua_State *S) const
+        {
+            return L && L == S && this->idx != LUA_REFNIL;
+        }
 
-            // check if passed type has an operator(), can be true for struct/class, includes lambdas
-            // from https://stackoverflow.com/a/70699109/3103767
-            // logic: test if &Tester<C>::operator() is a valid expression. It is only valid if
-            // C did not have an operator(), because else &Tester<C>::operator() would be ambiguous
-            // and thus invalid. To test if C has an operator(), we just check that
-            // &Tester<C>::operator() fails, which implies that C has an operator() declared.
-            // This trick does not work for final classes, at least detect non-overloaded
-            // operator() for those.
-            struct Fake { void operator()(); };
-            template <typename T> struct Tester : T, Fake { };
+        template <typename T>
+        bool valid(T *S) const requires has_lua_state<T>
+        {
+            return L && S && L == S->lua_state() && this->idx != LUA_REFNIL;
+        }
 
-            template <typename C>
-            concept HasCallOperator = std::is_class_v<C> and (
-                requires(C)                 // checks if non-overloaded operator() exists
-                {
-                    &C::operator();
-                } or
-                not requires(Tester<C>)     // checks overloaded/templated operator(), but doesn't work on final classes
-                {
-                    &Tester<C>::operator();
-                }
-            );
-            // check if we can get operator().
-            // If it fails (and assuming above HasCallOperator does pass),
-            // this is because the operator is overloaded or templated
-            // NB: can't simply do requires(C t){ &C::operator(); } because
-            // that is too lenient on clang: it also succeeds for
-            // overloaded/templated operator() where it shouldn't
-            template <typename T>
-            concept CanGetCallOperator = requires
-            {
-                invocable_traits_impl<
-                    decltype(
-                        &T::operator()
-                    )>();
-            };
-            // check if we can get an operator() that takes the specified arguments types.
-            // If it fails (and assuming above HasCallOperator does pass),
-            // an operator() with this specified cv- and ref-qualified argument types does
-            // not exist.
-            template <typename C, typename... OverloadArgs>
-            concept HasSpecificCallOperator = requires
-            {
-                invocable_traits_resolve_overload<C>(
-                    &C::operator(),
-                    typelist<OverloadArgs...>{}
-                );
-            };
-            namespace try_harder
-            {
-                // cartesian product of type lists, from https://stackoverflow.com/a/59422700/3103767
-                template <typename... Ts>
-                typelist<typelist<Ts>...> layered(typelist<Ts...>);
+        template <typename T>
+        bool valid(std::shared_ptr<T> S) const requires has_lua_state<T>
+        {
+            return L && S && L == S->lua_state() && this->idx != LUA_REFNIL;
+        }
+
+        bool valid(int ltype) const
+        {
+            return L && this->idx != LUA_REFNIL && type() == ltype;
+        }
+
+        bool valid(lua_State *S, int ltype) const
+        {
+            return L && L == S && this->idx != LUA_REFNIL && type() == ltype;
+        }
+
+        template <typename T>
+        bool valid(T *S, int ltype) const requires has_lua_state<T>
+        {
+            return L && L == S->lua_state() && this->idx != LUA_REFNIL && type() == ltype;
+        }
 
-                template <typename... Ts, typename... Us>
-                auto operator+(typelist<Ts...>, typelist<Us...>)
-                    ->typelist<Ts..., Us...>;
+        const char* type_name() const
+        {
+            return lua_typename(L, type());
+        }
 
-                template <typename T, typename... Us>
-                auto operator*(typelist<T>, typelist<Us...>)
-                    ->typelist<decltype(T{} + Us{})...>;
+        void invalidate()
+        {
+            L = nullptr;
+            this->idx = LUA_REFNIL;
+        }
 
-                template <typename... Ts, typename TL>
-                auto operator^(typelist<Ts...>, TL tl)
-                    -> decltype(((typelist<Ts>{} *tl) + ...));
+        int len() const
+        {
+            auto i = self().acquire();
+            auto result = lua_getlen(L, i);
+            self().release();
+            return result;
+        }
 
-                template <typename... TLs>
-                using product_t = decltype((layered(TLs{}) ^ ...));
+        template<typename K = Object, typename V = Object>
+        TablePairs<K, V> pairs() const
+        {
+            auto top = lua_gettop(L);
+            return TablePairs<K, V>(L, self().acquire(), top);
+        }
 
-                // adapter to make cartesian product of a list of typelists
-                template <typename... Ts>
-                auto list_product(typelist<Ts...>)
-                    ->product_t<Ts...>;
+        template<typename V = Object>
+        TableIPairs<V> ipairs() const
+        {
+            auto top = lua_gettop(L);
+            return TableIPairs<V>(L, self().acquire(), top);
+        }
+    };
 
-                template <typename T>
-                using list_product_t = decltype(list_product(T{}));
+    class Object : public BasicObject<Object> {
+        friend class BasicObject<Object>;
+    protected:
+        bool owned = false;
 
-                // code to turn input argument type T into all possible const/ref-qualified versions
-                template <typename T> struct type_maker_impl;
-                // T* -> T*, T* const
-                template <typename T>
-                    requires std::is_pointer_v<T>
-                struct type_maker_impl<T>
-                {
-                    using type = typelist<T, const T>;
-                };
-                // T -> T, T&, const T&, T&&, const T&& (NB: const on const T is ignored, so that type is not included)
-                template <typename T>
-                    requires (!std::is_pointer_v<T>)
-                struct type_maker_impl<T>
-                {
-                    using type = typelist<T, T&, const T&, T&&, const T&&>;
-                };
+        int acquire() const
+        {
+            return idx;
+        }
 
-                template <typename T>
-                struct type_maker : type_maker_impl<std::remove_cvref_t<T>> {};
+        void release() const
+        {}
+    public:
+        Object() = default;
+        Object(lua_State* L, int idx)
+        {
+            this->L = L;
+            this->idx = lua_absindex(L, idx);
+        }
+        Object(lua_State* L, int idx, bool owned)
+        {
+            this->L = L;
+            this->idx = lua_absindex(L, idx);
+            this->owned = owned && !StackFrame::covers(L, this->idx);
+        }
+        Object(const Object& other) : owned(false)
+        {
+            this->L = other.L;
+            this->idx = other.idx;
+        }
+        Object(Object&& other) noexcept : owned(other.owned)
+        {
+            this->L = other.L;
+            this->idx = other.idx;
+            other.idx = LUA_REFNIL;
+            other.owned = false;
+        }
+        Object& operator=(const Object& other)
+        {
+            this->L = other.L;
+            this->idx = other.idx;
+            this->owned = false;
+            return *this;
+        }
+        ~Object() {
+            if (owned)
+                pop();
+        }
 
-                template <typename T>
-                using type_maker_t = typename type_maker<T>::type;
+        template <class T>
+        operator T () const requires (!std::is_same_v<T, ObjectRef>)
+        {
+            return as <T> ();
+        }
 
-                template <typename ...Ts>
-                struct type_maker_for_typelist
-                {
-                    using type = typelist<type_maker_t<Ts>...>;
-                };
+        int push(int i = -1) const
+        {
+            lua_pushvalue(L, idx);
+            if (i != -1)
+                lua_insert(L, i);
+            return 1;
+        }
 
-                // code to filter out combinations of qualified input arguments that do not
-                // resolve to a declared overload
-                template <typename, typename> struct concat;
-                template <typename T, typename ...Args>
-                struct concat<T, typelist<Args...>>
-                {
-                    using type = typelist<T, Args...>;
-                };
+        void pop() {
+            lua_remove(L, idx);
+            this->idx = LUA_REFNIL;
+            this->owned = false;
+        }
 
-                template <typename...> struct check;
-                template <typename C, typename... Args>
-                struct check<C, typelist<Args...>>
-                {
-                    static constexpr bool value = HasSpecificCallOperator<C, Args...>;
-                };
+        template<typename Ref = ObjectRef> requires std::is_base_of_v<ObjectRef, Ref>
+        Ref operator[](size_t index)
+        {
+            lua_geti(L, this->idx, index);
+            return Ref(L, lua_gettop(L), false);
+        }
 
-                template <typename...> struct filter;
-                template <typename C>
-                struct filter<C, typelist<>>
-                {
-                    using type = typelist<>;
-                };
-                template <typename C, typename Head, typename ...Tail>
-                struct filter<C, typelist<Head, Tail...>>
-                {
-                    using type = std::conditional_t<check<C, Head>::value,
-                        typename concat<Head, typename filter<C, typelist<Tail...>>::type>::type,
-                        typename filter<C, typelist<Tail...>>::type
-                    >;
-                };
+        template<typename Ref = ObjectRef> requires std::is_base_of_v<ObjectRef, Ref>
+        Ref operator[](const char* index)
+        {
+            lua_getfield(L, this->idx, index);
+            return Ref(L, lua_gettop(L), false);
+        }
 
-                // extract first element from a typelist
-                template <typename, typename...> struct get_head;
-                template <typename Head, typename ...Tail>
-                struct get_head<typelist<Head, Tail...>>
-                {
-                    using type = Head;
-                };
-            }
+        template<typename T>
+        Object& operator=(T value)
+        {
+            detail::push(L, value);
+            lua_replace(L, idx);
+            return *this;
+        }
 
-            // to reduce excessive compiler error output
-            struct invocable_traits_error
-            {
-                static constexpr std::size_t arity       = 0;
-                static constexpr auto        is_const    = false;
-                static constexpr auto        is_volatile = false;
-                static constexpr auto        is_noexcept = false;
-                static constexpr auto        is_variadic = false;
-                using declared_result_t                  = void;
-                using invoke_result_t                    = void;
-                using class_t                            = void;
-                template <size_t i>
-                using arg_t                              = void;
-            };
-            struct invocable_traits_error_overload
-            {
-                static constexpr std::size_t num_matched_overloads = 0;
-                static constexpr auto        is_exact_match        = false;
-                template <size_t i>
-                using matched_overload                             = invocable_traits_error;
-            };
+        TableIter<ObjectRef> begin() const
+        {
+            return TableIter<ObjectRef>(L, 1, this->idx);
+        }
+        TableIter<ObjectRef> end() const
+        {
+            return TableIter<ObjectRef>(L, lua_getlen(L, idx) + 1, this->idx);
+        }
+    };
 
-            template <typename T, bool hasOverloadArgs>
-            constexpr Error get_error()
-            {
-                if constexpr (!std::is_class_v<T>)
-                    return Error::NotAClass;
-                else if constexpr (!HasCallOperator<T>)
-                    return Error::NoCallOperator;
-                else if constexpr (hasOverloadArgs)
-                    return Error::OverloadNotResolved;
-                else if constexpr (!hasOverloadArgs && !CanGetCallOperator<T>)
-                    return Error::IsOverloadedTemplated;
+    class ObjectRef : public BasicObject<ObjectRef> {
+        friend class BasicObject<ObjectRef>;
+    protected:
+#ifdef LUABINDING_TRACK_REFS
+        // where this ref was declared or taken; operator= cannot default a source_location,
+        // so the refs it stores are recorded here
+        std::source_location site;
+#endif
 
-                return Error::Unknown;
-            }
+        int acquire() const
+        {
+            push();
+            return lua_gettop(L);
+        }
 
-            template <typename C, typename Head>
-            struct get_overload_info
-            {
-                using type =
-                    invocable_traits_impl<
-                        std::decay_t<
-                            decltype(
-                                invocable_traits_resolve_overload<C>(
-                                    &C::operator(),
-                                    Head{}
-                                )
-                            )
-                        >
-                    > ;
-            };
-            template <typename C, typename Head>
-            using get_overload_info_t = typename get_overload_info<C, Head>::type;
+        void release() const
+        {
+            lua_pop(L, 1);
+        }
 
-            template <bool, std::size_t i, typename C, typename... Args>
-            struct invocable_traits_overload_info_impl
+        // refs other, then drops the held ref
+        template<typename T>
+        void assign(const T& other)
+        {
+            auto from = other.lua_state();
+            int ref = LUA_REFNIL;
+            if (other.valid(from))
+            {
+                other.push();
+#ifdef LUABINDING_TRACK_REFS
+                ref = RegistryRefs::ref(from, site);
+#else
+                ref = RegistryRefs::ref(from);
+#endif
+            }
+            if (valid(L))
+                RegistryRefs::unref(L, idx);
+            this->L = from;
+            this->idx = ref;
+        }
+    public:
+#ifdef LUABINDING_TRACK_REFS
+        ObjectRef(std::source_location where = std::source_location::current()) : site(where) {}
+#else
+        ObjectRef() = default;
+#endif
+        ObjectRef(lua_State* L, int idx, bool copy = true LUABINDING_REF_SITE)
+        {
+            this->L = L;
+            if (copy || idx != -1 && idx != lua_gettop(L))
+                lua_pushvalue(L, idx);
+            this->idx = RegistryRefs::ref(L LUABINDING_REF_WHERE);
+#ifdef LUABINDING_TRACK_REFS
+            site = where;
+#endif
+        }
+        template<typename T> requires std::is_same_v<IndexProxy, T>
+        ObjectRef(const T& other LUABINDING_REF_SITE)
+        {
+#ifdef LUABINDING_TRACK_REFS
+            site = where;
+#endif
+            this->L = other.lua_state();
+            if (other.valid(L))
             {
-                using type = get_overload_info_t<C, std::tuple_element_t<i, std::tuple<Args...>>>;
-            };
-            template <std::size_t i, typename C, typename... Args>
-            struct invocable_traits_overload_info_impl<false, i, C, Args...>
+                other.push();
+                this->idx = RegistryRefs::ref(L LUABINDING_REF_WHERE);
+            }
+        }
+        template<typename T> requires std::is_same_v<IndexProxy, T>
+        ObjectRef& operator=(T&& other) noexcept
+        {
+            assign(other);
+            return *this;
+        }
+        ObjectRef(const Object& other LUABINDING_REF_SITE)
+        {
+#ifdef LUABINDING_TRACK_REFS
+            site = where;
+#endif
+            this->L = other.lua_state();
+            if (other.valid(L))
             {
-                static_assert(i < sizeof...(Args), "Argument index out of bounds (queried callable does not have this many matching overloads)");
-
-                // to reduce excessive compiler error output
-                using type = void;
-            };
-
-            template <typename C, bool B, typename... Args> struct invocable_traits_overload_info;
-            template <typename C, bool B, typename... Args>
-            struct invocable_traits_overload_info<C, B, typelist<Args...>>
+                other.push();
+                this->idx = RegistryRefs::ref(L LUABINDING_REF_WHERE);
+            }
+        }
+        ObjectRef& operator=(Object&& other) noexcept {
+            assign(other);
+            return *this;
+        }
+        ObjectRef(const ObjectRef& other LUABINDING_REF_SITE)
+        {
+#ifdef LUABINDING_TRACK_REFS
+            site = where;
+#endif
+            this->L = other.lua_state();
+            if (other.valid(L))
             {
-                static constexpr std::size_t num_matched_overloads  = sizeof...(Args);
-                static constexpr auto        is_exact_match         = B;
-
-                template <std::size_t i>
-                using matched_overload = typename invocable_traits_overload_info_impl<
-                    i < sizeof...(Args),
-                    i,
-                    C,
-                    Args...
-                >::type;
-            };
-
-            // found at least one overload taking a const/ref qualified version of the specified argument types
-            // that is different from those provided by the library user
-            template <typename C, typename List>
-            struct invocable_traits_extract_try_harder :
-                invocable_traits_impl<              // instantiate for the first matched overload
-                    std::decay_t<
-                        decltype(
-                            invocable_traits_resolve_overload<C>(
-                                &C::operator(),
-                                typename try_harder::get_head<List>::type{}
-                            )
-                        )
-                    >
-                > ,
-                invocable_traits_overload_info<     // but expose all matched overloads
-                    C,
-                    false,
-                    List
-                >
-            {};
-
-            // failed to find any overload taking the specified argument types or some const/ref qualified version of them
-            template <typename T>
-            struct invocable_traits_extract_try_harder<T, typelist<>> : // empty list -> no combination of arguments matched an overload
-                invocable_traits_error,
-                invocable_traits_error_overload
+                other.push();
+                this->idx = RegistryRefs::ref(L LUABINDING_REF_WHERE);
+            }
+        }
+        ObjectRef(ObjectRef&& other) noexcept
+        {
+#ifdef LUABINDING_TRACK_REFS
+            site = other.site;
+#endif
+            this->L = other.L;
+            this->idx = other.idx;
+            other.idx = LUA_REFNIL;
+        }
+        ObjectRef& operator=(ObjectRef&& other) noexcept {
+            if (this == &other)
+                return *this;
+            if (valid(L))
+                RegistryRefs::unref(L, idx);
+#ifdef LUABINDING_TRACK_REFS
+            site = other.site;
+#endif
+            this->L = other.L;
+            this->idx = other.idx;
+            other.idx = LUA_REFNIL;
+            return *this;
+        }
+        ~ObjectRef() {
+            if (valid(L))
             {
-                static constexpr Error error = get_error<T, true>();
-            };
+                RegistryRefs::unref(L, idx);
+                idx = LUA_REFNIL;
+                L = nullptr;
+            }
+        }
 
-            // specific overloaded operator() is available, use it for analysis
-            template <typename C, bool, typename... OverloadArgs>
-            struct invocable_traits_extract :
-                invocable_traits_impl<
-                    std::decay_t<
-                        decltype(
-                            invocable_traits_resolve_overload<C>(
-                                &C::operator(),
-                                typelist<OverloadArgs...>{}
-                            )
-                        )
-                    >
-                >,
-                invocable_traits_overload_info<
-                    C,
-                    true,
-                    typelist<typelist<OverloadArgs...>> // expose matched overload through this interface also, for consistency, even though matching procedure was not run
-                >
-            {};
+        // a stack copy owning its slot, for code taking Object
+        operator Object () const
+        {
+            push();
+            return Object(L, -1, true);
+        }
 
-            // unambiguous operator() is available, use it for analysis
-            template <typename C, bool B>
-            struct invocable_traits_extract<C, B> :
-                invocable_traits_impl<
-                    decltype(
-                        &C::operator()
-                    )
-                > {};
+        template <class T> requires (!std::is_same_v<T, Object>)
+        operator T () const
+        {
+            return as <T> ();
+        }
 
-            // no specific overloaded operator() taking the specified arguments is available, try harder
-            // to see if one can be found that takes some other const/reference qualified version of the
-            // input arguments.
-            template <typename T, typename... OverloadArgs>
-            struct invocable_traits_extract<T, false, OverloadArgs...> :
-                invocable_traits_extract_try_harder<
-                    T,
-                    typename try_harder::filter<T,                          // filter list of all argument combinations: leave only resolvable overloads
-                        try_harder::list_product_t<                         // cartesian product of these lists
-                            typename try_harder::type_maker_for_typelist<   // produce list with all const/ref combinations of each argument
-                                OverloadArgs...
-                            >::type
-                        >
-                    >::type
-                > {};
+        Object get() {
+            push();
+            return Object(L, -1, true);
+        }
 
-            template <typename T>
-            struct invocable_traits_extract<T, false> : invocable_traits_error
-            {
-                static constexpr Error error = get_error<T, false>();
-            };
+        using BasicObject<ObjectRef>::get;
 
-            // catch all that doesn't match the various function signatures above
-            // If T has an operator(), we go with that. Else, issue error message.
-            template <typename T>
-            struct invocable_traits_impl<T> :
-                invocable_traits_extract<
-                    T,
-                    HasCallOperator<T>&& CanGetCallOperator<T>
-                > {};
+        template<typename IP = IndexProxy> requires std::is_base_of_v<IP, IndexProxy>
+        IP operator[](size_t idx)
+        {
+            return IP(*this, idx);
+        }
 
-            // if overload argument types are provided and needed, use them
-            template <typename T, bool B, typename... OverloadArgs>
-            struct invocable_traits_overload_impl :
-                invocable_traits_extract<
-                    T, 
-                    HasCallOperator<T> && HasSpecificCallOperator<T, OverloadArgs...>,
-                    OverloadArgs...
-                > {};
+        template<typename IP = IndexProxy> requires std::is_base_of_v<IP, IndexProxy>
+        IP operator[](const char* idx)
+        {
+            return IP(*this, idx);
+        }
 
-            // if they are provided but not needed, ignore them
-            template <typename T, typename... OverloadArgs>
-            struct invocable_traits_overload_impl<T, false, OverloadArgs...> :
-                invocable_traits_impl<
-                    T
-                > {};
+        int push(int i = -1) const
+        {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
+            if (i != -1)
+                lua_insert(L, i);
+            return 1;
         }
 
-        template <typename T, typename... OverloadArgs>
-        struct get :
-            detail::invocable_traits_overload_impl<
-                std::remove_reference_t<T>,
-                detail::HasCallOperator<std::decay_t<T>> && !detail::CanGetCallOperator<std::decay_t<T>>,
-                OverloadArgs...
-            > {};
+        void pop()
+        {
+            RegistryRefs::unref(L, idx);
+            this->idx = LUA_REFNIL;
+        }
+    };
 
-        template <typename T, typename... OverloadArgs>
-        struct get<std::reference_wrapper<T>, OverloadArgs...> :
-            detail::invocable_traits_overload_impl<
-                std::remove_reference_t<T>,
-                detail::HasCallOperator<std::decay_t<T>> && !detail::CanGetCallOperator<std::decay_t<T>>,
-                OverloadArgs...
-            > {};
+    class IndexProxy : public BasicObject<IndexProxy> {
+        friend class BasicObject<IndexProxy>;
+    protected:
+        // the value is looked up through root, through parent for chained proxies,
+        // or in the globals table when both are null
+        const ObjectRef* root = nullptr;
+        const IndexProxy* parent = nullptr;
+        const char* str_index;
+        int int_index;
 
-        template <typename T>
-        struct get<T> :
-            detail::invocable_traits_impl<
-                std::decay_t<T>
-            > {};
+        int acquire() const
+        {
+            push();
+            return lua_gettop(L);
+        }
 
-        template <typename T>
-        struct get<std::reference_wrapper<T>> :
-            detail::invocable_traits_impl<
-                std::decay_t<T>
-            > {};
-    }
+        void release() const
+        {
+            lua_pop(L, 1);
+        }
 
-    template <typename F>
-    using function_type_t = invocable_traits::get<F>::function_type;
+        void push_container() const
+        {
+            if (parent)
+                parent->push();
+            else if (root)
+                root->push();
+            else
+                lua_pushglobaltable(L);
+        }
 
-    namespace Function {
-        template <class R, class... Params>
-        void fun(lua_State *L, R(* func)(Params...))
+        // (-2)[index] = (top), pops the value
+        void store(bool raw) const
         {
-            using FnType = decltype (func);
-            new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsNClass<R, Params...>::f, 1);
+            if (str_index)
+                lua_setfield(L, -2, str_index);
+            else if (raw)
+                lua_rawseti(L, -2, int_index);
+            else
+            {
+                lua_pushinteger(L, int_index);
+                lua_insert(L, -2);
+                lua_settable(L, -3);
+            }
         }
 
-        template <class T, class R, class... Params>
-        void fun(lua_State *L, R(T::* func)(Params...))
+        template <typename T>
+        void assign(const T& rhs)
         {
-            using FnType = decltype (func);
-            new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClass<R, T, Params...>::f, 1);
+            push_container();
+            if constexpr (detail::is_pushable_cfun<T>) {
+                Function::cfun<void>(L, rhs);
+                store(true);
+            } else if constexpr (detail::is_pushable_fun<T>) {
+                Function::fun<void>(L, rhs);
+                store(true);
+            } else if constexpr (std::is_same_v<T, IndexProxy>) {
+                rhs.push();
+                store(false);
+            } else {
+                detail::push(L, rhs);
+                store(false);
+            }
+            lua_pop(L, 1);
         }
-
-        template <class T, class R, class... Params>
-        void fun(lua_State *L, R(T::* func)(Params...) const)
-        {
-            using FnType = std::decay_t<decltype (func)>;
-            new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClass<R, T, Params...>::f, 1);
+    public:
+        // proxies own no slot, idx only marks them as valid
+        IndexProxy(lua_State* L, const char* str_index) : str_index(str_index), int_index(-1) {
+            this->L = L;
+            this->idx = LUA_NOREF;
+        }
+        IndexProxy(const ObjectRef& el, const char* str_index) : root(&el), str_index(str_index), int_index(-1) {
+            this->L = el.lua_state();
+            this->idx = LUA_NOREF;
+        }
+        IndexProxy(const ObjectRef& el, int int_index) : root(&el), str_index(nullptr), int_index(int_index) {
+            this->L = el.lua_state();
+            this->idx = LUA_NOREF;
+        }
+        IndexProxy(const IndexProxy& el, const char* str_index) : parent(&el), str_index(str_index), int_index(-1) {
+            this->L = el.lua_state();
+            this->idx = LUA_NOREF;
+        }
+        IndexProxy(const IndexProxy& el, int int_index) : parent(&el), str_index(nullptr), int_index(int_index) {
+            this->L = el.lua_state();
+            this->idx = LUA_NOREF;
         }
 
-        template <class T, class R, class... Params>
-        void fun(lua_State *L, std::function<R(Params...)> func)
-        {
-            using FnType = decltype (func);
-            new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsFunClass<R, T, Params...>::f, 1);
+        operator ObjectRef () const {
+            push();
+            return ObjectRef(L, -1, false);
         }
 
-        template <class T, class R, class... Params>
-        void fun(lua_State *L, std::function<R(Params...) const> func)
+        // a stack copy owning its slot, for code taking Object
+        operator Object () const
         {
-            using FnType = std::decay_t<decltype (func)>;
-            new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsFunClass<R, T, Params...>::f, 1);
+            push();
+            return Object(L, -1, true);
         }
 
-        template <class T, class R> requires std::is_integral_v<R>
-        void cfun(lua_State *L, R(T::*func)(lua_State*))
+        template <class T> requires (!std::is_same_v<T, ObjectRef> && !std::is_same_v<T, Object>)
+        operator T () const
         {
-            using func_t = decltype (func);
-            new (lua_newuserdata(L, sizeof(func))) func_t(func);
-            lua_pushcclosure(L, TraitsClassLCFunc<T>::f, 1);
+            return as <T> ();
         }
 
-        template <class T, class R> requires std::is_integral_v<R>
-        void cfun(lua_State *L, std::function<R(T*, lua_State*)> func)
+        IndexProxy operator[](size_t index) const
         {
-            using FnType = decltype (func);
-            new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClassFunLCFunc<T>::f, 1);
+            return IndexProxy(*this, (int)index);
         }
 
-        template <class T, class R> requires std::is_integral_v<R>
-        void cfun(lua_State *L, R(*func)(lua_State*))
+        IndexProxy operator[](const char* index) const
         {
-            lua_pushcclosure(L, func, 0);
+            return IndexProxy(*this, index);
         }
 
-        template <class T, class R> requires std::is_integral_v<R>
-        void cfun(lua_State *L, std::function<R(lua_State*)> func)
+        int push(int i = -1) const
         {
-            using FnType = decltype (func);
-            new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClassFunNLCFunc<T>::f, 1);
+            push_container();
+            if (str_index)
+                lua_getfield(L, -1, str_index);
+            else
+                lua_rawgeti(L, -1, int_index);
+            lua_remove(L, -2);
+            if (i != -1)
+                lua_insert(L, i);
+            return 1;
         }
 
-        template <class T, class R, class U> requires std::is_integral_v<R>
-        void cfun(lua_State *L, R(T::*func)(U))
+        void pop()
         {
-            using func_t = decltype (func);
-            new (lua_newuserdata(L, sizeof(func))) func_t(func);
-            lua_pushcclosure(L, TraitsClassCFunc<T>::f, 1);
+            push_container();
+            lua_pushnil(L);
+            store(true);
+            lua_pop(L, 1);
         }
 
-        template <class T, class R, class U> requires std::is_integral_v<R>
-        void cfun(lua_State *L, R(*func)(T*, U))
-        {
-            using func_t = decltype (func);
-            new (lua_newuserdata(L, sizeof(func))) func_t(func);
-            lua_pushcclosure(L, TraitsClassCFunc<T>::f, 1);
+        IndexProxy& operator=(const IndexProxy& rhs) {
+            assign(rhs);
+            return *this;
         }
 
-        template <class T, class R, class U> requires std::is_integral_v<R>
-        void cfun(lua_State *L, R(*func)(U))
-        {
-            lua_pushlightuserdata(L, reinterpret_cast<void*>(func));
-            lua_pushcclosure(L, TraitsCFunc<T>::f, 1);
+        template <typename T>
+        IndexProxy& operator=(const T& rhs) {
+            assign(rhs);
+            return *this;
         }
 
-        template <class T, class R, class U> requires std::is_integral_v<R>
-        void cfun(lua_State *L, std::function<R(U)> func)
-        {
-            using FnType = decltype (func);
-            new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClassFunNCFunc<T>::f, 1);
+        template <typename T>
+        IndexProxy& operator=(const T&& rhs) {
+            assign(rhs);
+            return *this;
         }
+    };
 
-        template <class T, class R, class U> requires std::is_integral_v<R>
-        void cfun(lua_State *L, std::function<R(T*, U)> func)
+    template<>
+    class Stack<Object> {
+    public:
+        static int push(lua_State* L, Object t)
         {
-            using FnType = decltype (func);
-            new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClassFunCFunc<T>::f, 1);
+            return t.push();
         }
-        
-        template <class T, class F>
-        void fun(lua_State *L, F& func)
+        static bool is(lua_State*, int ) {
+            return true;
+        }
+        static Object get(lua_State* L, int index, int& offset)
         {
-            fun<T>(L, static_cast<function_type_t<std::decay_t<F>>>(func));
+            return Object(L, index + offset);
         }
+        static const char* basic_type_name(lua_State* L) {
+            return "object";
+        }
+        static int basic_type(lua_State* L) {
+            return -2;
+        }
+    };
 
-        template <class T, class F>
-        void cfun(lua_State *L, F& func)
+    template<>
+    class Stack<Object*> {
+    public:
+        static int push(lua_State* L, Object* t)
         {
-            cfun<T>(L, static_cast<function_type_t<std::decay_t<F>>>(func));
+            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
+            return 0;
         }
-        
-        template <class T, class F>
-        void fun(lua_State *L, F&& func)
+        static bool is(lua_State* L, int index) {
+            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
+            return false;
+        }
+        static Object* get(lua_State* L, int index, int& offset)
         {
-            fun<T>(L, static_cast<function_type_t<std::decay_t<F>>>(func));
+            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
+            return nullptr;
         }
+    };
 
-        template <class T, class F>
-        void cfun(lua_State *L, F&& func)
+    template<>
+    class Stack<ObjectRef> {
+    public:
+        static int push(lua_State* L, ObjectRef t)
         {
-            cfun<T>(L, static_cast<function_type_t<std::decay_t<F>>>(func));
+            return t.push();
         }
-    }
-
-    template<typename T>
-    struct disect_function;
-
-    template<typename R, typename ...Args>
-    struct disect_function<R(Args...)>
-    {
-        static constexpr size_t nargs = sizeof...(Args);
-        static constexpr bool isClass = false;
-
-        template <size_t i>
-        struct arg
+        static bool is(lua_State*, int ) {
+            return true;
+        }
+        static ObjectRef get(lua_State* L, int index, int& offset)
         {
-            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
-        };
+            return {L, index+offset, true};
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "object";
+        }
+        static int basic_type(lua_State* L) {
+            return -2;
+        }
     };
 
-    template<typename R, typename ...Args>
-    struct disect_function<R(Args...) const>
-    {
-        static constexpr size_t nargs = sizeof...(Args);
-        static constexpr bool isClass = false;
-
-        template <size_t i>
-        struct arg
+    template<>
+    class Stack<ObjectRef*> {
+    public:
+        static int push(lua_State* L, ObjectRef* t)
         {
-            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
-        };
+            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
+            return 0;
+        }
+        static bool is(lua_State* L, int index) {
+            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
+            return false;
+        }
+        static ObjectRef* get(lua_State* L, int index, int& offset)
+        {
+            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
+            return nullptr;
+        }
     };
 
-    template<typename R, typename ...Args>
-    struct disect_function<R(*)(Args...)>
-    {
-        static constexpr size_t nargs = sizeof...(Args);
-        static constexpr bool isClass = false;
-
-        template <size_t i>
-        struct arg
+    template<>
+    class Stack<IndexProxy> {
+    public:
+        static int push(lua_State* L, IndexProxy t)
         {
-            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
-        };
+            return t.push();
+        }
+        static bool is(lua_State*, int ) {
+            return true;
+        }
+        static IndexProxy get(lua_State* L, int index, int& offset)
+        {
+            static_assert(true, "Cannot get IndexProxy from lua stack");
+        }
+        static const char* basic_type_name(lua_State* L) {
+            return "object";
+        }
+        static int basic_type(lua_State* L) {
+            return -2;
+        }
     };
 
-    template<typename R, typename T, typename ...Args>
-    struct disect_function<R(T::*)(Args...)>
-    {
-        static constexpr size_t nargs = sizeof...(Args);
-        static constexpr bool isClass = true;
-        static constexpr T* classT = nullptr;
-
-        template <size_t i>
-        struct arg
+    template<>
+    class Stack<IndexProxy*> {
+    public:
+        static int push(lua_State* L, IndexProxy* t)
         {
-            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
-        };
+            static_assert(true, "Use IndexProxy or IndexProxy& instead of IndexProxy*");
+            return 0;
+        }
+        static bool is(lua_State* L, int index) {
+            static_assert(true, "Use IndexProxy or IndexProxy& instead of IndexProxy*");
+            return false;
+        }
+        static IndexProxy* get(lua_State* L, int index, int& offset)
+        {
+            static_assert(true, "Use IndexProxy or IndexProxy& instead of IndexProxy*");
+            return nullptr;
+        }
     };
+}
 
-    template<typename R, typename T, typename ...Args>
-    struct disect_function<R(T::*)(Args...) const>
-    {
-        static constexpr size_t nargs = sizeof...(Args);
-        static constexpr bool isClass = true;
-        static constexpr T* classT = nullptr;
+#include <vector>
 
-        template <size_t i>
-        struct arg
-        {
-            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
+#include <cstdlib>
+#include <unordered_map>
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+
+
+namespace LuaBinding {
+    // Shares the single lua_Hook of a lua_State between several users. Count hooks run at the
+    // gcd of the requested counts and fire each callback at its own rate. Only the main thread
+    // and coroutines created after a change see it, like lua_sethook; debug.sethook replaces it.
+    // Callbacks may raise Lua errors but must not add or remove hooks.
+    class Hooks {
+    public:
+        using Callback = std::function<void(lua_State*, lua_Debug*)>;
+    private:
+        struct Entry {
+            int id;
+            int mask;
+            int count;
+            int left;
+            Callback f;
+            std::atomic<bool> pending{ false };
         };
-    };
 
-    template<typename R, typename ...Args>
-    struct disect_function<std::function<R(Args...)>>
-    {
-        static constexpr size_t nargs = sizeof...(Args);
-        static constexpr bool isClass = false;
+        lua_State* L;
+        std::vector<std::unique_ptr<Entry>> entries;
+        std::atomic<bool> armed{ false };
+        int next_id = 0;
+        int step = 0;
+        std::shared_ptr<void> token = std::make_shared<char>();
 
-        template <size_t i>
-        struct arg
+        static char* key()
         {
-            typedef typename std::tuple_element<i, std::tuple<Args...>>::type type;
-        };
-    };
+            static char k;
+            return &k;
+        }
 
-    template <typename F, size_t N = 0, size_t J = 1>
-    void LoopTupleT(lua_State *L)
-    {
-        if constexpr (N == 0)
+        static int gcd(int a, int b)
         {
-            if constexpr(!std::is_same_v<State, std::decay_t<disect_function<F>::template arg<0>::type>> && !std::is_same_v<Environment, std::decay_t<disect_function<F>::template arg<0>::type>>)
+            while (b)
             {
-                lua_pushinteger(L, detail::basic_type<std::decay_t<disect_function<F>::template arg<0>::type>>(L));
-                lua_rawseti(L, -2, J + (disect_function<F>::isClass ? 1 : 0));
-                LoopTupleT<F, 1, J + 1>(L);
-            } else if constexpr(std::is_same_v<Object, std::decay_t<disect_function<F>::template arg<0>::type>> || std::is_same_v<ObjectRef, std::decay_t<disect_function<F>::template arg<0>::type>>)
+                auto t = a % b;
+                a = b;
+                b = t;
+            }
+            return a;
+        }
+
+        static int event_mask(int event)
+        {
+            switch (event)
             {
-                lua_pushinteger(L, -2);
-                lua_rawseti(L, -2, J + (disect_function<F>::isClass ? 1 : 0));
-                LoopTupleT<F, 1, J + 1>(L);
-            } else
-                LoopTupleT<F, 1, J>(L);
-        } else if constexpr(N < disect_function<F>::nargs) {
-            if constexpr(!std::is_same_v<State, std::decay_t<disect_function<F>::template arg<N-1>::type>> && !std::is_same_v<Environment, std::decay_t<disect_function<F>::template arg<N-1>::type>>)
+            case LUA_HOOKCALL:
+                return LUA_MASKCALL;
+            case LUA_HOOKRET:
+                return LUA_MASKRET;
+            case LUA_HOOKLINE:
+                return LUA_MASKLINE;
+            case LUA_HOOKCOUNT:
+                return LUA_MASKCOUNT;
+            default:
+                // tail calls, and tail returns of 5.1
+#if LUA_VERSION_NUM < 502
+                return LUA_MASKRET;
+#else
+                return LUA_MASKCALL;
+#endif
+            }
+        }
+
+        void install()
+        {
+            int mask = 0;
+            int count = 0;
+            for (auto& e : entries)
             {
-                lua_pushinteger(L, detail::basic_type<std::decay_t<disect_function<F>::template arg<N-1>::type>>(L));
-                lua_rawseti(L, -2, J + (disect_function<F>::isClass ? 1 : 0));
-                LoopTupleT<F, N + 1, J + 1>(L);
-            } else if constexpr(std::is_same_v<Object, std::decay_t<disect_function<F>::template arg<N-1>::type>> || std::is_same_v<ObjectRef, std::decay_t<disect_function<F>::template arg<N-1>::type>>)
+                mask |= e->mask;
+                if (e->mask & LUA_MASKCOUNT)
+                    count = gcd(count, e->count);
+            }
+            if (armed)
             {
-                lua_pushinteger(L, -2);
-                lua_rawseti(L, -2, J + (disect_function<F>::isClass ? 1 : 0));
-                LoopTupleT<F, N + 1, J + 1>(L);
-            } else
-                LoopTupleT<F, N + 1, J>(L);
+                mask |= LUA_MASKCOUNT;
+                count = 1;
+            }
+            step = count;
+            lua_sethook(L, mask ? dispatch : nullptr, mask, count);
         }
-    }
-
-    template<typename C, typename ...Functions>
-    class OverloadedFunction {
-        lua_State* L = nullptr;
-    public:
-        OverloadedFunction(lua_State *L, Functions... functions) {
-            this->L = L;
-            lua_newtable(L);
-            auto fun_index = 1;
-            auto push_fun = [&fun_index](lua_State* L, auto f) {
-                lua_newtable(L);
-
-                lua_newtable(L);
-                if constexpr(disect_function<decltype(f)>::isClass) {
-                    lua_pushinteger(L, LUA_TUSERDATA);
-                    lua_rawseti(L, -2, 1);
-                }
-
-                if constexpr(disect_function<decltype(f)>::nargs > 0)
-                    LoopTupleT<decltype(f)>(L);
-
-                lua_pushinteger(L, lua_getlen(L, -1));
-                lua_setfield(L, -3, "nargs");
-
-                lua_setfield(L, -2, "argl");
-
-                Function::fun<C>(L, f);
-                lua_setfield(L, -2, "f");
-
-                lua_pushstring(L, typeid(f).name());
-                lua_setfield(L, -2, "typeid");
 
-                lua_rawseti(L, -2, fun_index++);
-
-                return 0;
-            };
-            (push_fun(L, functions), ...);
-            lua_pushcclosure(L, call, 1);
+        static void dispatch(lua_State* L, lua_Debug* ar)
+        {
+            if (auto hooks = detail::state_data<Hooks>(L, key()))
+                hooks->run(L, ar);
         }
-        static int call(lua_State* L) {
-            auto argn = lua_gettop(L);
 
-            lua_pushvalue(L, lua_upvalueindex(1));
-
-            lua_pushnil(L);
-            while(lua_next(L, -2) != 0) {
-                lua_getfield(L, -1, "nargs");
-                if (lua_tointeger(L, -1) != argn)
-                {
-                    lua_pop(L, 2);
+        void run(lua_State* T, lua_Debug* ar)
+        {
+            auto mask = event_mask(ar->event);
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                auto e = entries[i].get();
+                if (!(e->mask & mask))
                     continue;
+                if (mask == LUA_MASKCOUNT)
+                {
+                    e->left -= step;
+                    if (e->left > 0)
+                        continue;
+                    e->left += e->count;
                 }
-                lua_pop(L, 1);
-
-                bool valid = true;
-
-                lua_getfield(L, -1, "argl");
-                lua_pushnil(L);
-                while(lua_next(L, -2) != 0) {
-                    if (lua_tointeger(L, -1) == -2 || lua_tointeger(L, -1) != lua_type(L, lua_tointeger(L, -2)))
-                        valid = false;
-                    lua_pop(L, 1);
-                }
-                lua_pop(L, 1);
-
-                if (valid) {
-                    lua_getfield(L, -1, "f");
-                    lua_insert(L, 1);
-                    lua_pop(L, 3);
-                    return LuaBinding::pcall(L, argn, LUA_MULTRET);
+                e->f(T, ar);
+            }
+            if (mask != LUA_MASKCOUNT || !armed.exchange(false))
+                return;
+            Entry* hit = nullptr;
+            for (auto& e : entries)
+            {
+                if (hit)
+                {
+                    if (e->pending)
+                        armed = true;
                 }
-
-                lua_pop(L, 1);
+                else if (e->pending.exchange(false))
+                    hit = e.get();
             }
+            install();
+            if (hit)
+                hit->f(T, ar);
+        }
+    public:
+        explicit Hooks(lua_State* L) : L(L)
+        {}
+        Hooks(const Hooks&) = delete;
+        Hooks& operator=(const Hooks&) = delete;
 
-            luaL_error(L, "no matching overload with %d args and input values", argn);
+        static Hooks* get(lua_State* L)
+        {
+            return detail::state_data<Hooks>(L, key());
+        }
 
-            return 0;
+        // created on first use, lives as long as the lua_State
+        static Hooks& of(lua_State* L)
+        {
+            if (auto hooks = get(L))
+                return *hooks;
+            return *detail::make_state_data<Hooks>(L, key(), L);
         }
-    };
 
-    namespace detail {
-        namespace _resolve {
-            template <typename Sig, typename C>
-            inline Sig C::* resolve_v(std::false_type, Sig C::* mem_func_ptr) {
-                return mem_func_ptr;
-            }
+        // mask of LUA_MASKCALL, LUA_MASKRET, LUA_MASKLINE, LUA_MASKCOUNT; count is for LUA_MASKCOUNT.
+        // A mask of 0 adds a callback that only runs through fire(id).
+        int add(int mask, int count, Callback f)
+        {
+            if (count < 1)
+                count = 1;
+            auto e = std::make_unique<Entry>();
+            e->id = ++next_id;
+            e->mask = mask;
+            e->count = count;
+            e->left = count;
+            e->f = std::move(f);
+            entries.push_back(std::move(e));
+            install();
+            return next_id;
+        }
 
-            template <typename Sig, typename C>
-            inline Sig C::* resolve_v(std::true_type, Sig C::* mem_variable_ptr) {
-                return mem_variable_ptr;
+        void remove(int id)
+        {
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+            {
+                if ((*it)->id == id)
+                {
+                    entries.erase(it);
+                    install();
+                    return;
+                }
             }
         }
 
-        template <typename... Args, typename R>
-        inline auto resolve(R fun_ptr(Args...))->R(*)(Args...) {
-            return fun_ptr;
+        // runs the callback before the next instruction. Touches no Lua memory, so it can be
+        // called from a lua_Alloc, or from another thread while no hooks are added or removed.
+        void fire(int id)
+        {
+            for (auto& e : entries)
+            {
+                if (e->id == id)
+                {
+                    e->pending = true;
+                    armed = true;
+                    step = 1;
+                    lua_sethook(L, dispatch, LUA_MASKCOUNT | lua_gethookmask(L), 1);
+                    return;
+                }
+            }
         }
 
-        template <typename Sig>
-        inline Sig* resolve(Sig* fun_ptr) {
-            return fun_ptr;
+        [[nodiscard]] size_t size() const
+        {
+            return entries.size();
         }
 
-        template <typename... Args, typename R, typename C>
-        inline auto resolve(R(C::* mem_ptr)(Args...))->R(C::*)(Args...) {
-            return mem_ptr;
+        // expires when the hooks are destroyed with their lua_State, for owners that may outlive it
+        [[nodiscard]] std::weak_ptr<void> alive() const
+        {
+            return token;
         }
+    };
+}
 
-        template <typename Sig, typename C>
-        inline Sig C::* resolve(Sig C::* mem_ptr) {
-            return _resolve::resolve_v(std::is_member_object_pointer<Sig C::*>(), mem_ptr);
+namespace LuaBinding {
+    namespace detail {
+        // the allocator luaL_newstate uses
+        inline void* default_alloc(void*, void* ptr, size_t, size_t nsize)
+        {
+            if (!nsize)
+            {
+                free(ptr);
+                return nullptr;
+            }
+            return realloc(ptr, nsize);
         }
+    }
 
-        template<typename F>
-        concept has_call_operator = requires (F) {
-            &F::operator();
-        };
-
-        template<typename F>
-        concept is_cfun_style = std::is_invocable_v<F, State> || std::is_invocable_v<F, lua_State*>;
-        
-        template <typename T>
-        concept is_pushable_ref_fun = requires (T &t) {
-            { Function::fun(nullptr, t) };
-        };
+    // Accounting lua_Alloc wrapped around another allocator, one per State. Growing past the
+    // hard limit fails the allocation, so Lua raises its "not enough memory" error which pcall
+    // catches. Crossing the soft limit raises "memory soft limit exceeded" before the next
+    // instruction, once per crossing. Memory is attributed to the Environment whose pcall, or
+    // function from Environment::load/bind, is running; frees done by the collector meanwhile
+    // are credited to it too, so per env numbers are an estimate.
+    class MemoryQuota {
+    public:
+        struct Usage {
+            size_t allocated = 0;
+            size_t freed = 0;
+            size_t limit = 0;
 
-        template <typename T>
-        concept is_pushable_forward_fun = requires (T &&t) {
-            { Function::fun(nullptr, t) };
+            [[nodiscard]] size_t used() const
+            {
+                return allocated > freed ? allocated - freed : 0;
+            }
         };
 
-        template <typename T>
-        concept is_pushable_ref_cfun = requires (T &t) {
-            { Function::cfun(nullptr, t) };
+        // attributes allocations to env until destroyed, restoring the previous env
+        class Scope {
+            MemoryQuota* quota;
+            Usage* previous = nullptr;
+        public:
+            Scope(lua_State* L, int env) : quota(MemoryQuota::get(L))
+            {
+                if (!quota)
+                    return;
+                previous = quota->current;
+                quota->current = &quota->envs[env];
+            }
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+            ~Scope()
+            {
+                if (quota)
+                    quota->current = previous;
+            }
         };
+    private:
+        lua_Alloc inner;
+        void* inner_ud;
+        size_t hard;
+        size_t soft;
+        size_t in_use = 0;
+        size_t high = 0;
+        bool over_soft = false;
+        Hooks* hooks = nullptr;
+        int soft_hook = 0;
+        std::unordered_map<int, Usage> envs;
+        Usage* current = nullptr;
+
+        void* reallocate(void* ptr, size_t osize, size_t nsize)
+        {
+            if (!ptr)
+                osize = 0;
+            if (nsize > osize)
+            {
+                auto grow = nsize - osize;
+                if (hard && in_use + grow > hard)
+                    return nullptr;
+                if (current && current->limit && current->used() + grow > current->limit)
+                    return nullptr;
+            }
+            auto p = inner(inner_ud, ptr, osize, nsize);
+            if (!p && nsize)
+                return nullptr;
+            in_use += nsize - osize;
+            if (in_use > high)
+                high = in_use;
+            if (current)
+            {
+                if (nsize > osize)
+                    current->allocated += nsize - osize;
+                else
+                    current->freed += osize - nsize;
+            }
+            if (soft && in_use > soft)
+            {
+                if (!over_soft && hooks)
+                    hooks->fire(soft_hook);
+                over_soft = true;
+            }
+            else
+                over_soft = false;
+            return p;
+        }
 
-        template <typename T>
-        concept is_pushable_forward_cfun = requires (T &&t) {
-            { Function::cfun(nullptr, t) };
-        };
+        static void soft_limit_hit(lua_State* L, lua_Debug*)
+        {
+            luaL_error(L, "memory soft limit exceeded");
+        }
+    public:
+        // limits of 0 are off; inner defaults to realloc/free, or pass PoolAllocator::alloc
+        explicit MemoryQuota(size_t hard = 0, size_t soft = 0, lua_Alloc inner = nullptr, void* ud = nullptr)
+            : inner(inner ? inner : detail::default_alloc), inner_ud(ud), hard(hard), soft(soft)
+        {}
+        MemoryQuota(const MemoryQuota&) = delete;
+        MemoryQuota& operator=(const MemoryQuota&) = delete;
 
-        template <typename T>
-        concept is_pushable_fun =
-            is_pushable_ref_fun<std::decay_t<T>> || is_pushable_forward_fun<std::decay_t<T>>;
+        // the lua_Alloc, ud is the MemoryQuota
+        static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+        {
+            return ((MemoryQuota*)ud)->reallocate(ptr, osize, nsize);
+        }
 
-        template <typename T>
-        concept is_pushable_cfun =
-            (is_pushable_ref_cfun<std::decay_t<T>> || is_pushable_forward_cfun<std::decay_t<T>>) && is_cfun_style<std::decay_t<T>>;
-    }
-}
-#include <memory>
+        // the quota L allocates through, if any
+        static MemoryQuota* get(lua_State* L)
+        {
+            void* ud;
+            return lua_getallocf(L, &ud) == alloc ? (MemoryQuota*)ud : nullptr;
+        }
 
-namespace LuaBinding {
-    template<typename T>
-    class TableIter
-    {
-    public:
-        typedef std::forward_iterator_tag iterator_category;
-        TableIter(lua_State* L, int index, int base) : L(L), index(index), base(base) { }
-        TableIter operator++() { index++; return *this; }
-        std::pair<int, T> operator*() { lua_rawgeti(L, base, index); return { index, T(L, -1, false) }; }
-        bool operator!=(const TableIter& rhs) { return index != rhs.index; }
-    private:
-        lua_State* L;
-        int index;
-        int base;
-    };
+        // registers the soft limit hook, done by State(quota, ...)
+        void attach(lua_State* L)
+        {
+            hooks = &Hooks::of(L);
+            soft_hook = hooks->add(0, 0, soft_limit_hit);
+        }
 
-    template <typename T>
-    concept has_lua_state = requires(T t)
-    {
-        { t.lua_state() } -> std::convertible_to<void*>;
-    };
+        void set_limits(size_t hard, size_t soft = 0)
+        {
+            this->hard = hard;
+            this->soft = soft;
+            over_soft = soft && in_use > soft;
+        }
 
-    class Object {
-    protected:
-        int idx = LUA_REFNIL;
-        lua_State* L = nullptr;
-        bool owned = false;
-    public:
-        Object() = default;
-        Object(lua_State* L, int idx) : L(L)
+        // caps the memory the env gains while it runs, 0 removes the cap
+        void set_limit(const ObjectRef& env, size_t bytes)
         {
-            this->idx = lua_absindex(L, idx);
+            envs[env.index()].limit = bytes;
         }
-        Object(lua_State* L, int idx, bool owned) : L(L)
+
+        [[nodiscard]] Usage usage(const ObjectRef& env) const
         {
-            this->idx = lua_absindex(L, idx);
-            this->owned = owned;
+            auto it = envs.find(env.index());
+            return it == envs.end() ? Usage() : it->second;
         }
-        Object(const Object& other) : L(other.L), idx(other.idx), owned(false)
-        {}
-        Object(Object&& other) noexcept : L(other.L), idx(other.idx), owned(other.owned)
+
+        // drops the numbers of an env, its registry ref may be reused by a later one
+        void forget(const ObjectRef& env)
         {
-            other.idx = LUA_REFNIL;
-            other.owned = false;
+            auto it = envs.find(env.index());
+            if (it != envs.end() && &it->second != current)
+                envs.erase(it);
         }
-        Object& operator=(const Object& other)
+
+        [[nodiscard]] size_t used() const
         {
-            this->L = other.L;
-            this->idx = other.idx;
-            this->owned = false;
-            return *this;
+            return in_use;
         }
-        ~Object() {
-            if (owned)
-                pop();
+
+        [[nodiscard]] size_t peak() const
+        {
+            return high;
         }
 
-        virtual const char* tostring()
+        void reset_peak()
         {
-            return lua_tostring(L, idx);
+            high = in_use;
         }
 
-        virtual const char* tolstring()
+        [[nodiscard]] size_t limit() const
         {
-            return luaL_tolstring(L, -1, nullptr);
+            return hard;
         }
 
-        template<typename T>
-        T as()
+        [[nodiscard]] size_t soft_limit() const
         {
-            return detail::get<T>(L, idx);
+            return soft;
         }
+    };
+}
 
-        template<typename T>
-        T extract()
+namespace LuaBinding {
+    class Environment : public ObjectRef {
+        friend class EnvironmentPool;
+    protected:
+        // calls upvalue 2 in the quota scope of the env in upvalue 1, whose registry ref is
+        // upvalue 3; the env comes first so Environment::pcall rebinding it changes nothing
+        static int quota_call(lua_State* L)
         {
-            auto res = detail::get<T>(L, idx);
-            pop();
-            return res;
+            auto env = (int)lua_tointeger(L, lua_upvalueindex(3));
+            lua_rawgeti(L, LUA_REGISTRYINDEX, env);
+            auto alive = lua_rawequal(L, -1, lua_upvalueindex(1));
+            lua_pop(L, 1);
+            lua_pushvalue(L, lua_upvalueindex(2));
+            lua_insert(L, 1);
+            // the ref was released and may belong to another env now
+            if (!alive)
+            {
+                lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+                return lua_gettop(L);
+            }
+            int status;
+            {
+                MemoryQuota::Scope scope(L, env);
+                status = lua_pcall(L, lua_gettop(L) - 1, LUA_MULTRET, 0);
+            }
+            if (status)
+                return lua_error(L);
+            return lua_gettop(L);
         }
 
-        template <class T>
-        operator T () const requires (!std::is_same_v<T, ObjectRef>)
+        static int lookup_global(lua_State* L)
         {
-            return as <T> ();
+            lua_pushvalue(L, -2);
+            lua_pushvalue(L, -2);
+            lua_rawget(L, -2);
+            if (!lua_isnoneornil(L, -1))
+                return 1;
+            lua_pop(L, 1);
+#if LUA_VERSION_NUM < 502
+            lua_rawget(L, LUA_GLOBALSINDEX);
+#else
+            lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
+#endif
+            return !lua_isnoneornil(L, -1);
         }
 
-        template <class T> requires (!std::is_same_v<T, ObjectRef>)
-        operator T ()
+        // pushes the value at index, as a shallow copy for tables when snapshot is set;
+        // the globals table itself becomes env
+        static void push_global_copy(lua_State* L, int index, int env, bool snapshot)
         {
-            return as <T> ();
+            index = lua_absindex(L, index);
+            lua_pushglobaltable(L);
+            auto is_globals = lua_rawequal(L, index, -1);
+            lua_pop(L, 1);
+            if (is_globals)
+                lua_pushvalue(L, env);
+            else if (snapshot && lua_type(L, index) == LUA_TTABLE)
+            {
+                lua_newtable(L);
+                lua_pushnil(L);
+                while (lua_next(L, index))
+                {
+                    lua_pushvalue(L, -2);
+                    lua_insert(L, -2);
+                    lua_rawset(L, -4);
+                }
+                if (lua_getmetatable(L, index))
+                    lua_setmetatable(L, -2);
+            } else
+                lua_pushvalue(L, index);
         }
 
-        template<typename T>
-        bool is()
+        // copies the listed globals (all of them when empty) into the table at env
+        static void populate(lua_State* L, int env, const std::vector<const char*>& globals, bool snapshot)
         {
-            if constexpr (std::is_same_v<T, void>)
+            env = lua_absindex(L, env);
+            lua_pushglobaltable(L);
+            auto g = lua_gettop(L);
+            if (globals.empty())
             {
-                return lua_isnoneornil(L, idx);
+                lua_pushnil(L);
+                while (lua_next(L, g))
+                {
+                    lua_pushvalue(L, -2);
+                    push_global_copy(L, -2, env, snapshot);
+                    lua_rawset(L, env);
+                    lua_pop(L, 1);
+                }
             } else {
-                return detail::is<T>(L, idx);
+                for (auto name : globals)
+                {
+                    lua_getfield(L, g, name);
+                    push_global_copy(L, -1, env, snapshot);
+                    lua_setfield(L, env, name);
+                    lua_pop(L, 1);
+                }
             }
+            lua_pop(L, 1);
         }
+    public:
+        Environment() = default;
+        explicit Environment(lua_State* L)
+        {
+            this->L = L;
+            lua_newtable(L);
+
+            lua_newtable(L);
+            lua_getglobal(L, "_G");
+            lua_setfield(L, -2, "__index");
+            lua_setmetatable(L, -2);
 
-        virtual bool is(int t)
+            this->idx = RegistryRefs::ref(L);
+        }
+        // Flattened env: the listed globals (all of them when empty) are copied in, so lookups
+        // hit the env table directly. Writes land in the env only; snapshot also copies tables
+        // one level deep so writes like math.x stay in the sandbox. Names that were not copied
+        // resolve through _G only with fallback.
+        Environment(lua_State* L, const std::vector<const char*>& globals, bool snapshot = false, bool fallback = false)
+        {
+            this->L = L;
+            lua_createtable(L, 0, (int)globals.size());
+            populate(L, -1, globals, snapshot);
+            if (fallback)
+            {
+                lua_newtable(L);
+                lua_pushglobaltable(L);
+                lua_setfield(L, -2, "__index");
+                lua_setmetatable(L, -2);
+            }
+            this->idx = RegistryRefs::ref(L);
+        }
+        explicit Environment(lua_State* L, int findex)
+        {
+            this->L = L;
+#if LUA_VERSION_NUM < 502
+            lua_getfenv(L, findex);
+#else
+            lua_getupvalue(L, findex, 1);
+#endif
+            this->idx = RegistryRefs::ref(L);
+        }
+        explicit Environment(lua_State* L, bool)
+        {
+            this->L = L;
+#if LUA_VERSION_NUM < 502
+            lua_getfenv(L, lua_upvalueindex(1));
+#else
+            lua_getupvalue(L, lua_upvalueindex(1), 1);
+#endif
+            this->idx = RegistryRefs::ref(L);
+        }
+        // binds the env of the function at findex once, later calls through LuaBinding::pcall or
+        // ObjectRef::call need no Environment. With a MemoryQuota the function at findex is
+        // replaced by a wrapper running it in the env's quota scope; calls through it cannot yield.
+        void bind(int findex) const
         {
-            return lua_type(L, idx) == t;
+            findex = lua_absindex(L, findex);
+            lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
+#if LUA_VERSION_NUM < 502
+            lua_setfenv(L, findex);
+#else
+            if (!lua_setupvalue(L, findex, 1))
+                lua_pop(L, 1);
+#endif
+            if (MemoryQuota::get(L))
+            {
+                lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
+                lua_pushvalue(L, findex);
+                lua_pushinteger(L, idx);
+                lua_pushcclosure(L, quota_call, 3);
+                lua_replace(L, findex);
+            }
         }
 
-        [[nodiscard]] virtual const void* topointer() const
+        // compiles a fresh chunk bound to this env, the result can be called any number of times
+        ObjectRef load(const char* code, size_t len, const char* chunkname = "=") const
         {
-            return lua_topointer(L, idx);
+            if (luaL_loadbuffer(L, code, len, chunkname))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+                lua_pop(L, 1);
+                return {};
+            }
+            bind(-1);
+            return ObjectRef(L, -1, false);
         }
 
-        virtual int push(int i = -1) const
+        ObjectRef load(const char* code) const
         {
-            lua_pushvalue(L, idx);
-            if (i != -1)
-                lua_insert(L, i);
-            return 1;
+            return load(code, strlen(code), code);
+        }
+
+        int pcall(int narg = 0, int nres = 0) const {
+            MemoryQuota::Scope scope(L, idx);
+            lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
+#if LUA_VERSION_NUM < 502
+            lua_setfenv(L, lua_gettop(L) - narg - 1);
+#else
+            lua_setupvalue(L, lua_gettop(L) - narg - 1, 1);
+#endif
+            int errindex = lua_gettop(L) - narg;
+            lua_pushcclosure(L, tack_on_traceback, 0);
+            lua_insert(L, errindex);
+            auto status = lua_pcall(L, narg, nres, errindex);
+            lua_remove(L, errindex);
+            return status;
         }
+    };
+}
+
+#ifdef LUABINDING_DYN_CLASSES
+
+#ifdef LUABINDING_DYN_CLASSES
+#include <functional>
+#include <cassert>
+
+#ifdef LUABINDING_DYN_CLASSES
+namespace LuaBinding {
+    enum MemoryType {
+        _char = -0x1,
+        _int = -0x2,
+        _float = -0x4,
+        _bool = -0x8,
+        _double = -0x10,
+        ptr = -0x20,
+        vec2 = -0x40,
+        vec3 = -0x80,
+        _array = -0x200,
+        _short = -0x400,
+        _byte = -0x800,
+        uint = -0x2000,
+        ushort = -0x4000,
+        string = -0x8000,
+        null = -0x10000,
+        cstruct = -0x20000,
+        vector = -0x40000,
+        point = -0x100000,
+        udata = -0x200000,
+
+        stdstring = -0x400000,
+        stringptr = -0x800000,
+    };
+    int lua_pushmemtype(lua_State* L, MemoryType type, void* data);
+    int lua_pullmemtype(lua_State* L, MemoryType type, void* addr);
+    unsigned int get_type_size(MemoryType mt);
+}
+#endif
+
+namespace LuaBinding {
+
+    class DynClass {
+        lua_State* L = nullptr;
+        const char* class_name;
+    public:
+        DynClass(lua_State* L, const char* name) : L(L), class_name(name)
+        {
+            push_metatable(L, this);
+
+            lua_pushcclosure(L, lua_CGCFunction, 0);
+            lua_setfield(L, -2, "__gc");
+
+            lua_pushcclosure(L, lua_CIndexFunction, 0);
+            lua_setfield(L, -2, "__index");
+
+            lua_pushcclosure(L, lua_EQFunction, 0);
+            lua_setfield(L, -2, "__eq");
+
+            lua_pushcclosure(L, lua_CNewIndexFunction, 0);
+            lua_setfield(L, -2, "__newindex");
+
+            lua_newtable(L);
+            lua_setfield(L, -2, "__pindex");
+
+            lua_newtable(L);
+            lua_setfield(L, -2, "__findex");
+
+            lua_pushstring(L, name);
+            lua_setfield(L, -2, "__name");
+
+            lua_pushstring(L, name);
+            lua_pushcclosure(L, tostring, 1);
+            lua_setfield(L, -2, "__tostring");
+
+            lua_pushlightuserdata(L, this);
+            lua_setfield(L, -2, "__key");
+
+            ExternalMemory::of(L).name(this, name);
+
+            lua_pushcfunction(L, dyn_call);
+            lua_setfield(L, -2, "New");
+
+            lua_pushcfunction(L, dyn_prop);
+            lua_setfield(L, -2, "Prop");
+
+            lua_pushcfunction(L, dyn_read);
+            lua_setfield(L, -2, "Read");
+
+            lua_pushcfunction(L, dyn_cast);
+            lua_setfield(L, -2, "Cast");
 
-        virtual int push(int i = -1)
-        {
-            lua_pushvalue(L, idx);
-            if (i != -1)
-                lua_insert(L, i);
-            return 1;
-        }
+            push_property_index();
+            lua_pushcfunction(L, get_ptr);
+            lua_setfield(L, -2, "ptr");
 
-        virtual void pop() {
-            lua_remove(L, idx);
-            this->idx = LUA_REFNIL;
-        }
+            lua_pushcfunction(L, get_vtable);
+            lua_setfield(L, -2, "vTable");
 
-        template<typename Ref = ObjectRef> requires std::is_base_of_v<ObjectRef, Ref>
-        Ref operator[](size_t index)
-        {
-            lua_geti(L, this->idx, index);
-            return Ref(L, lua_gettop(L), false);
-        }
+            lua_pop(L, 1);
 
-        template<typename Ref = ObjectRef> requires std::is_base_of_v<ObjectRef, Ref>
-        Ref operator[](const char* index)
-        {
-            lua_getfield(L, this->idx, index);
-            return Ref(L, lua_gettop(L), false);
-        }
+            push_property_newindex();
+            lua_pushcfunction(L, set_ptr);
+            lua_setfield(L, -2, "ptr");
 
-        template<typename T>
-        Object& operator=(T value)
-        {
-            detail::push(L, value);
-            lua_replace(L, idx);
-            return *this;
+            lua_pop(L, 1);
         }
-
-        template<typename R>
-        R call() {
-            push();
-            if constexpr (std::is_same_v<void, R>) {
-                if (LuaBinding::pcall(L, 0, 0))
-                {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
-#endif
-                }
-            } else {
-                if (LuaBinding::pcall(L, 0, 1))
-                {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
+    private:
+        static int tostring(lua_State* S)
+        {
+            char asdf[128] = { 0 };
+#ifdef ENV32
+            snprintf(asdf, sizeof(asdf), "%s{%X}", lua_tostring(S, lua_upvalueindex(1)), (uintptr_t)topointer(S, 1));
+#elifdef ENV64
+            snprintf(asdf, sizeof(asdf), "%s{%llX}", lua_tostring(S, lua_upvalueindex(1)), (uintptr_t)topointer(S, 1));
 #endif
-                }
-                auto result = LuaBinding::detail::get<R>(L, -1);
-                lua_pop(L, 1);
-                return result;
-            }
+            lua_pushstring(S, asdf);
+            return 1;
         }
-
-        template<int R>
-        void call() {
-            push();
-            if (LuaBinding::pcall(L, 0, R))
+        static int lua_CGCFunction(lua_State* S)
+        {
+            if (luaL_getmetafield(S, 1, "__cgc"))
             {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
-#endif
+                lua_pushvalue(S, 1);
+                pcall(S, 1, 0);
             }
-        }
-
-        template<typename R, typename ...Params> requires (sizeof...(Params) > 0 && !std::is_same_v<std::tuple_element_t<0, std::tuple<Params...>>, Environment>)
-        R call(Params... param) {
-            push();
-            if constexpr (sizeof...(param) > 0)
-                (void)std::initializer_list<int>{ detail::push(L, param)... };
-            if constexpr (std::is_same_v<void, R>) {
-                if (LuaBinding::pcall(L, sizeof...(param), 0))
-                {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
-#endif
-                }
-            } else {
-                if (LuaBinding::pcall(L, sizeof...(param), 1))
+            auto u = (void**)lua_touserdata(S, 1);
+            if (*(u + 1) == (void*)0xC0FFEE) {
+                const void* c = nullptr;
+                if (luaL_getmetafield(S, 1, "__key"))
                 {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
-#endif
+                    c = lua_touserdata(S, -1);
+                    lua_pop(S, 1);
                 }
-                auto result = LuaBinding::detail::get<R>(L, -1);
-                lua_pop(L, 1);
-                return result;
+                detail::free_object(S, *u, c);
             }
+            return 0;
         }
-
-        template<int R, typename ...Params> requires (sizeof...(Params) > 0 && !std::is_same_v<std::tuple_element_t<0, std::tuple<Params...>>, Environment>)
-        void call(Params... param) {
-            push();
-            if constexpr (sizeof...(param) > 0)
-                (void)std::initializer_list<int>{ detail::push(L, param)... };
-            if (LuaBinding::pcall(L, sizeof...(param), R))
-            {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
-#endif
-            }
+        static int lua_EQFunction(lua_State* S)
+        {
+            if (!lua_isuserdata(S, 1) || !lua_isuserdata(S, 2))
+                lua_pushboolean(S, false);
+            else
+                lua_pushboolean(S, *(uintptr_t*)lua_touserdata(S, 1) == *(uintptr_t*)lua_touserdata(S, 2));
+            return 1;
         }
-
-        template<typename R, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
-        R call(Env env, Params... param) {
-            push();
-            if constexpr (sizeof...(param) > 0)
-                (void)std::initializer_list<int>{ detail::push(L, param)... };
-            if constexpr (std::is_same_v<void, R>) {
-                if (env.pcall(sizeof...(param), 0))
+        static int lua_CIndexFunction(lua_State* S)
+        {
+            if (strcmp(lua_tostring(S, 2), "ptr") != 0
+             && strcmp(lua_tostring(S, 2), "isValid") != 0
+             && luaL_getmetafield(S, 1, "__valid"))
+            {
+                auto success = false;
+                lua_pushvalue(S, 1);
+                lua_call(S, 1, 1);
+                success = lua_toboolean(S, -1);
+                if (!success)
                 {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
+                    lua_pushvalue(S, 1);
+                    if (luaL_getmetafield(S, 1, "__name")) {
+                        char asdf[128] = { 0 };
+#ifdef ENV32
+                        snprintf(asdf, sizeof(asdf), "%s{%X}", lua_tostring(S, -1), (uintptr_t)topointer(S, 1));
+#elifdef ENV64
+                        snprintf(asdf, sizeof(asdf), "%s{%llX}", lua_tostring(S, -1), (uintptr_t)topointer(S, 1));
 #endif
+                        lua_pop(S, 1);
+
+                        luaL_error(S, "Tried to access invalid %s (property '%s')", asdf, lua_tostring(S, 2));
+                    } else {
+                        lua_pop(S, 1);
+                        luaL_error(S, "Tried to access invalid unknown object (property '%s')", lua_tostring(S, 2));
+                    }
+                    return 0; // ??
                 }
-            } else {
-                if (env.pcall(sizeof...(param), 1))
+                lua_settop(S, 3);
+            }
+            if (luaL_getmetafield(S, 1, "__pindex"))
+            {
+                lua_pushvalue(S, 2);
+                if (luaL_gettable(S, -2))
                 {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
-#endif
+                    lua_remove(S, -2);
+                    lua_insert(S, 1);
+                    lua_call(S, lua_gettop(S) - 1, LUA_MULTRET);
+                    return lua_gettop(S);
                 }
-                auto result = LuaBinding::detail::get<R>(L, -1);
-                lua_pop(L, 1);
-                return result;
+                else lua_pop(S, 1);
             }
-        }
-
-        template<int R, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
-        void call(Env env, Params... param) {
-            push();
-            if constexpr (sizeof...(param) > 0)
-                (void)std::initializer_list<int>{ detail::push(L, param)... };
-            if (env.pcall(sizeof...(param), R))
+            if (luaL_getmetafield(S, 1, "__findex"))
             {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
-#endif
+                lua_pushvalue(S, 2);
+                if (luaL_gettable(S, -2))
+                    return 1;
+                else lua_pop(S, 1);
             }
-        }
-
-        template<typename Ref = ObjectRef> requires std::is_base_of_v<ObjectRef, Ref>
-        Ref operator() () {
-            push();
-            if (LuaBinding::pcall(L, 0, 1))
+            if (luaL_getmetafield(S, 1, lua_tostring(S, 2)))
+                return 1;
+            if (luaL_getmetafield(S, 1, "__cindex"))
             {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
-#endif
+                lua_insert(S, 1);
+                lua_call(S, lua_gettop(S) - 1, LUA_MULTRET);
+                return lua_gettop(S);
             }
-            return Ref(L, -1, false);
+            return 0;
         }
-
-        template<typename Ref = ObjectRef, typename ...Params> requires (std::is_base_of_v<ObjectRef, Ref>) && (sizeof...(Params) > 0 && !std::is_same_v<std::tuple_element_t<0, std::tuple<Params...>>, Environment>)
-        Ref operator() (Params... param) {
-            push();
-            if constexpr (sizeof...(param) > 0)
-                (void)std::initializer_list<int>{ detail::push(L, param)... };
-            if (LuaBinding::pcall(L, sizeof...(param), 1))
+        static int lua_CNewIndexFunction(lua_State* S)
+        {
+            if (luaL_getmetafield(S, 1, "__pnewindex"))
             {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
-#endif
+                lua_pushvalue(S, 2);
+                if (luaL_gettable(S, -2))
+                {
+                    lua_pushvalue(S, 1);
+                    lua_pushvalue(S, 2);
+                    lua_pushvalue(S, 3);
+                    lua_call(S, 3, 0);
+                    return 0;
+                }
+                else lua_pop(S, 1);
             }
-            return Ref(L, -1, false);
+            if (luaL_getmetafield(S, 1, "__cnewindex"))
+            {
+                lua_pushvalue(S, 1);
+                lua_pushvalue(S, 2);
+                lua_pushvalue(S, 3);
+                lua_call(S, 3, 0);
+                return 0;
+            }
+            lua_getmetatable(S, 1);
+            lua_pushvalue(S, 2);
+            lua_pushvalue(S, 3);
+            lua_settable(S, -3);
+            return 0;
         }
-
-        template<typename Ref = ObjectRef, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
-        Ref operator()(Env env, Params... param) {
-            push();
-            if constexpr (sizeof...(param) > 0)
-                (void)std::initializer_list<int>{ detail::push(L, param)... };
-            if (env.pcall(sizeof...(param), 1))
+    public:
+        static int push_metatable(lua_State *L, void* _this, bool assert = false)
+        {
+            lua_getglobal(L, "__METASTORE");
+            if (lua_rawgetp(L, -1, _this))
             {
-#ifndef NOEXCEPTIONS
-                    throw std::exception(lua_tostring(L, -1));
+                lua_remove(L, -2);
+                return 0;
+            }
+            if (assert)
+            {
+#ifdef ENV32
+                luaL_error(L, "metatable not found in __METASTORE for %X", _this);
+#elifdef ENV64
+                luaL_error(L, "metatable not found in __METASTORE for %llX", _this);
 #endif
             }
-            return Ref(L, -1, false);
+            lua_pop(L, 1);
+            lua_newtable(L);
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, -3, _this);
+            lua_remove(L, -2);
+            return 1;
         }
-
-        template <typename T>
-        void set(const char* index, T&& other)
+    private:
+        void set_size(unsigned int size)
         {
-            detail::push(L, other);
-            lua_setfield(L, idx, index);
+            push_metatable(L, this);
+            lua_pushinteger(L, size);
+            lua_setfield(L, -2, "__size");
+            lua_pop(L, 1);
         }
-
-        template <typename T>
-        void set(int index, T&& other)
+        size_t get_size()
         {
-            lua_pushinteger(L, index);
-            detail::push(L, other);
-            lua_settable(L, idx);
+            push_metatable(L, this);
+            lua_getfield(L, -1, "__size");
+            auto result = lua_tointeger(L, -1);
+            lua_pop(L, 2);
+            return result;
         }
-
-        void unset(const char* index)
+        void push_property_index()
         {
-            lua_pushnil(L);
-            lua_setfield(L, idx, index);
+            push_metatable(L, this);
+            lua_pushstring(L, "__pindex");
+            if (!luaL_gettable(L, -2))
+            {
+                lua_pop(L, 1);
+                lua_newtable(L);
+                lua_pushvalue(L, -1);
+                lua_setfield(L, -3, "__pindex");
+            }
+            lua_remove(L, -2);
         }
-
-        void unset(int index)
+        void push_property_newindex()
         {
-            lua_pushinteger(L, index);
-            lua_pushnil(L);
-            lua_settable(L, idx);
+            push_metatable(L, this);
+            lua_pushstring(L, "__pnewindex");
+            if (!luaL_gettable(L, -2))
+            {
+                lua_pop(L, 1);
+                lua_newtable(L);
+                lua_pushvalue(L, -1);
+                lua_setfield(L, -3, "__pnewindex");
+            }
+            lua_remove(L, -2);
         }
-
-        template <typename T>
-        void fun(int index, T& other)
+        static int get_vtable(lua_State *L)
         {
-            Function::fun<void>(L, other);
-            lua_rawseti(L, idx, index);
+            lua_pushnumber(L, (double)**(uintptr_t**)lua_touserdata(L, 1));
+            return 1;
         }
-
-        template <typename T>
-        void fun(int index, T&& other)
+        static void* topointer(lua_State *L, int idx)
         {
-            Function::fun<void>(L, other);
-            lua_rawseti(L, idx, index);
+            return *(void**)lua_touserdata(L, idx);
         }
-
-        template <typename T>
-        void cfun(int index, T& other)
+        static int get_ptr(lua_State *L)
         {
-            Function::cfun<void>(L, other);
-            lua_rawseti(L, idx, index);
+            lua_pushnumber(L, (double)*(uintptr_t*)lua_touserdata(L, 1));
+            return 1;
         }
-
-        template <typename T>
-        void cfun(int index, T&& other)
+        static int set_ptr(lua_State *L)
         {
-            Function::cfun<void>(L, other);
-            lua_rawseti(L, idx, index);
+            *(uintptr_t*)lua_touserdata(L, 1) = (uintptr_t)lua_tonumber(L, 3);
+            return 0;
         }
-
-        template <typename T>
-        void fun(const char* index, T& other)
+        static int get_prop(lua_State *L)
         {
-            Function::fun<void>(L, other);
-            lua_setfield(L, idx, index);
-        }
+            auto offset = lua_tointeger(L, lua_upvalueindex(1));
+            auto type = lua_tointeger(L, lua_upvalueindex(2));
 
-        template <typename T>
-        void fun(const char* index, T&& other)
-        {
-            Function::fun<void>(L, other);
-            lua_setfield(L, idx, index);
-        }
+            auto p = *(uintptr_t*)lua_touserdata(L, 1);
 
-        template <typename T>
-        void cfun(const char* index, T& other)
-        {
-            Function::cfun<void>(L, other);
-            lua_setfield(L, idx, index);
+            return lua_pushmemtype(L, MemoryType(type), (void*)(p + offset));
         }
-
-        template <typename T>
-        void cfun(const char* index, T&& other)
+        static int get_prop_struct(lua_State *L)
         {
-            Function::cfun<void>(L, other);
-            lua_setfield(L, idx, index);
-        }
+            auto offset = lua_tointeger(L, lua_upvalueindex(1));
 
-        [[nodiscard]] int index() const
-        {
-            return idx;
-        }
+            lua_getfield(L, lua_upvalueindex(2), "__key");
+            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
+            lua_pop(L, 1);
 
-        lua_State* lua_state() const
-        {
-            return L;
-        }
+            auto p = *(uintptr_t*)lua_touserdata(L, 1);
 
-        lua_State* lua_state()
-        {
-            return L;
-        }
+            if (*(void**)(p + offset) == nullptr)
+            {
+                lua_pushnil(L);
+                return 1;
+            }
 
-        virtual int type()
-        {
-            return lua_type(L, idx);
+            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
+            *u = *(void**)(p + offset); *(u + 1) = 0;
+
+            push_metatable(L, c, true);
+            lua_setmetatable(L, -2);
+
+            return 1;
         }
+        static int get_prop_struct_cast(lua_State *L)
+        {
+            auto offset = lua_tointeger(L, lua_upvalueindex(1));
+
+            lua_getfield(L, lua_upvalueindex(2), "__key");
+            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
+            lua_pop(L, 1);
+
+            auto p = *(uintptr_t*)lua_touserdata(L, 1);
+            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
+            *u = (void*)(p + offset); *(u + 1) = 0;
+
+            push_metatable(L, c, true);
+            lua_setmetatable(L, -2);
 
-        virtual int type() const
+            return 1;
+        }
+        static int set_prop(lua_State *L)
         {
-            return lua_type(L, idx);
+            auto offset = lua_tointeger(L, lua_upvalueindex(1));
+            auto type = lua_tointeger(L, lua_upvalueindex(2));
+
+            auto p = *(uintptr_t*)lua_touserdata(L, 1);
+
+            lua_pullmemtype(L, MemoryType(type), (void*)(p + offset));
+            return 0;
         }
+        static int dyn_prop(lua_State *L)
+        {
+            lua_getfield(L, 1, "__key");
+            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
+            lua_pop(L, 1);
+
+            if (lua_isnoneornil(L, 3))
+            {
+                lua_getglobal(L, "print");
+                static char buff[100] = { '\0' };
+                snprintf(buff, 100, "[Warning] %s.%s offset is nil, assuming '0'", c->class_name, lua_tolstring(L, 2, nullptr));
+                lua_pushstring(L, buff);
+                lua_call(L, 1, 0);
+            }
+
+            auto flag = lua_tointeger(L, 5);
+
+            if (lua_type(L, 4) == LUA_TTABLE)
+            {
+                c->push_property_index();
+                lua_pushvalue(L, 3);
+                lua_pushvalue(L, 4);
+                if (flag == 2)
+                    lua_pushcclosure(L, get_prop_struct_cast, 2);
+                else
+                    lua_pushcclosure(L, get_prop_struct, 2);
+                lua_setfield(L, -2, lua_tolstring(L, 2, nullptr));
+                lua_pop(L, 1);
+
+                if (!flag) {
+                    c->push_property_newindex();
+                    lua_pushvalue(L, 3);
+                    lua_pushinteger(L, -0x20 /**type.ptr**/);
+                    lua_pushcclosure(L, set_prop, 2);
+                    lua_setfield(L, -2, lua_tolstring(L, 2, nullptr));
+                    lua_pop(L, 1);
+                }
+            } else {
+                c->push_property_index();
+                lua_pushvalue(L, 3);
+                lua_pushvalue(L, 4);
+                lua_pushcclosure(L, get_prop, 2);
+                lua_setfield(L, -2, lua_tolstring(L, 2, nullptr));
+                lua_pop(L, 1);
+
+                if (!flag) {
+                    c->push_property_newindex();
+                    lua_pushvalue(L, 3);
+                    lua_pushvalue(L, 4);
+                    lua_pushcclosure(L, set_prop, 2);
+                    lua_setfield(L, -2, lua_tolstring(L, 2, nullptr));
+                    lua_pop(L, 1);
+                }
+
+                c->set_size(lua_tointeger(L, 3) + get_type_size((MemoryType)lua_tointeger(L, 4)));
+            }
 
-        bool valid()
+            return 0;
+        }
+        static int dyn_call(lua_State *L)
         {
-            return L && this->idx != LUA_REFNIL;
+            lua_getfield(L, 1, "__key");
+            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
+
+            auto size = lua_isinteger(L, 2) ? lua_tointeger(L, 2) : c->get_size();
+
+            auto udata = detail::new_object(L, size);
+            memset(udata, 0, size);
+            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
+            *u = udata; *(u + 1) = (void*)0xC0FFEE;
+
+            push_metatable(L, c, true);
+            lua_setmetatable(L, -2);
+            detail::report_object(L, udata, size, c);
+
+            return 1;
         }
+        static int dyn_read(lua_State *L)
+        {
+            auto p = (void**)(uintptr_t)lua_tonumber(L, 2);
+            if (p == nullptr || *p == nullptr)
+            {
+                lua_pushnil(L);
+                return 1;
+            }
+
+            lua_getfield(L, 1, "__key");
+            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
 
-        bool valid() const
-        {
-            return L && this->idx != LUA_REFNIL;
-        }
+            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
+            *u = *p; *(u + 1) = 0;
 
-        bool valid(lua_State *S)
-        {
-            return L && L == S && this->idx != LUA_REFNIL;
-        }
+            push_metatable(L, c, true);
+            lua_setmetatable(L, -2);
 
-        bool valid(lua_State *S) const
-        {
-            return L && L == S && this->idx != LUA_REFNIL;
+            return 1;
         }
-
-        template <typename T>
-        bool valid(T *S) requires has_lua_state<T>
+        static int dyn_cast(lua_State *L)
         {
-            return L && S && L == S->lua_state() && this->idx != LUA_REFNIL;
-        }
+            auto p = (void*)(uintptr_t)lua_tonumber(L, 2);
+            if (p == 0)
+            {
+                lua_pushnil(L);
+                return 1;
+            }
 
-        template <typename T>
-        bool valid(T *S) const requires has_lua_state<T>
-        {
-            return L && S && L == S->lua_state() && this->idx != LUA_REFNIL;
-        }
+            lua_getfield(L, 1, "__key");
+            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
 
-        template <typename T>
-        bool valid(std::shared_ptr<T> S) requires has_lua_state<T>
-        {
-            return L && S && L == S->lua_state() && this->idx != LUA_REFNIL;
-        }
+            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
+            *u = p; *(u + 1) = 0;
 
-        template <typename T>
-        bool valid(std::shared_ptr<T> S) const requires has_lua_state<T>
-        {
-            return L && S && L == S->lua_state() && this->idx != LUA_REFNIL;
-        }
+            push_metatable(L, c, true);
+            lua_setmetatable(L, -2);
 
-        bool valid(int ltype)
-        {
-            return L && this->idx != LUA_REFNIL && type() == ltype;
+            return 1;
         }
+    };
+}
+#endif
+#endif
 
-        bool valid(int ltype) const
-        {
-            return L && this->idx != LUA_REFNIL && type() == ltype;
-        }
 
-        bool valid(lua_State *S, int ltype)
-        {
-            return L && L == S && this->idx != LUA_REFNIL && type() == ltype;
-        }
+#include <cstdint>
 
-        bool valid(lua_State *S, int ltype) const
-        {
-            return L && L == S && this->idx != LUA_REFNIL && type() == ltype;
-        }
+namespace LuaBinding {
+    // Standard libraries for State(open, lazy), combined with |
+    enum class Lib : uint32_t {
+        None = 0,
+        Base = 1 << 0,
+        Package = 1 << 1,
+        Coroutine = 1 << 2,
+        Table = 1 << 3,
+        IO = 1 << 4,
+        OS = 1 << 5,
+        String = 1 << 6,
+        Math = 1 << 7,
+        UTF8 = 1 << 8,
+        Debug = 1 << 9,
+        Bit = 1 << 10,
+        JIT = 1 << 11,
+        FFI = 1 << 12,
+        All = 0xFFFFFFFF
+    };
 
-        template <typename T>
-        bool valid(T *S, int ltype) requires has_lua_state<T>
-        {
-            return L && L == S->lua_state() && this->idx != LUA_REFNIL && type() == ltype;
-        }
+    constexpr Lib operator|(Lib a, Lib b)
+    {
+        return (Lib)((uint32_t)a | (uint32_t)b);
+    }
 
-        template <typename T>
-        bool valid(T *S, int ltype) const requires has_lua_state<T>
-        {
-            return L && L == S->lua_state() && this->idx != LUA_REFNIL && type() == ltype;
-        }
+    constexpr Lib operator&(Lib a, Lib b)
+    {
+        return (Lib)((uint32_t)a & (uint32_t)b);
+    }
 
-        const char* type_name()
-        {
-            return lua_typename(L, type());
-        }
+    constexpr Lib operator~(Lib a)
+    {
+        return (Lib)~(uint32_t)a;
+    }
 
-        void invalidate()
-        {
-            L = nullptr;
-            this->idx = LUA_REFNIL;
-        }
+    namespace detail {
+        struct LibEntry {
+            Lib lib;
+            const char* name;
+            lua_CFunction open;
+        };
 
-        virtual int len()
+        // libraries this interpreter has, in luaL_openlibs order; missing ones are skipped
+        inline const LibEntry* lib_entries()
         {
-            return lua_getlen(L, idx);
+            static const LibEntry entries[] = {
+                { Lib::Base, "_G", luaopen_base },
+                { Lib::Package, LUA_LOADLIBNAME, luaopen_package },
+#if LUA_VERSION_NUM >= 502
+                { Lib::Coroutine, LUA_COLIBNAME, luaopen_coroutine },
+#endif
+                { Lib::Table, LUA_TABLIBNAME, luaopen_table },
+                { Lib::IO, LUA_IOLIBNAME, luaopen_io },
+                { Lib::OS, LUA_OSLIBNAME, luaopen_os },
+                { Lib::String, LUA_STRLIBNAME, luaopen_string },
+                { Lib::Math, LUA_MATHLIBNAME, luaopen_math },
+#if LUA_VERSION_NUM >= 503
+                { Lib::UTF8, LUA_UTF8LIBNAME, luaopen_utf8 },
+#endif
+                { Lib::Debug, LUA_DBLIBNAME, luaopen_debug },
+#if defined(LUA_BITLIBNAME) && !defined(LUAJIT_VERSION_NUM)
+                { Lib::Bit, LUA_BITLIBNAME, luaopen_bit32 },
+#endif
+#ifdef LUAJIT_VERSION_NUM
+                { Lib::Bit, LUA_BITLIBNAME, luaopen_bit },
+                { Lib::JIT, LUA_JITLIBNAME, luaopen_jit },
+                { Lib::FFI, LUA_FFILIBNAME, luaopen_ffi },
+#endif
+                { Lib::None, nullptr, nullptr }
+            };
+            return entries;
         }
 
-        virtual int len() const
+        inline void open_lib(lua_State* L, const LibEntry& e)
         {
-            return lua_getlen(L, idx);
+#if LUA_VERSION_NUM >= 502
+            luaL_requiref(L, e.name, e.open, 1);
+            lua_pop(L, 1);
+#else
+            lua_pushcfunction(L, e.open);
+            lua_pushstring(L, e.name);
+            lua_call(L, 1, 0);
+#endif
         }
 
-        TableIter<ObjectRef> begin()
-        {
-            return TableIter<ObjectRef>(L, 1, this->idx);
-        }
-        TableIter<ObjectRef> end()
-        {
-            return TableIter<ObjectRef>(L, lua_getlen(L, idx) + 1, this->idx);
-        }
-        TableIter<ObjectRef> begin() const
-        {
-            return TableIter<ObjectRef>(L, 1, this->idx);
-        }
-        TableIter<ObjectRef> end() const
+        // package.preload loader, also sets the global like the eager libraries do
+        inline int open_lazy_lib(lua_State* L)
         {
-            return TableIter<ObjectRef>(L, lua_getlen(L, idx) + 1, this->idx);
+            auto name = luaL_checkstring(L, 1);
+            lua_pushcfunction(L, lua_tocfunction(L, lua_upvalueindex(1)));
+            lua_pushstring(L, name);
+            lua_call(L, 1, 1);
+            lua_pushvalue(L, -1);
+            lua_setglobal(L, name);
+            return 1;
         }
-    };
 
-    class ObjectRef : public Object {
-    public:
-        ObjectRef() = default;
-        ObjectRef(lua_State* L, int idx, bool copy = true)
-        {
-            this->L = L;
-            if (copy || idx != -1 && idx != lua_gettop(L))
-                lua_pushvalue(L, idx);
-            this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-        }
-        template<typename T> requires std::is_same_v<IndexProxy, T>
-        ObjectRef(const T& other)
-        {
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
-        }
-        template<typename T> requires std::is_same_v<IndexProxy, T>
-        ObjectRef& operator=(T&& other) noexcept
-        {
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
-            return *this;
-        }
-        ObjectRef(const Object& other)
-        {
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
-        }
-        ObjectRef& operator=(Object&& other) noexcept {
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
-            return *this;
-        }
-        ObjectRef(const ObjectRef& other)
+        // opens the libraries in open, lazy ones go to package.preload and start on first require.
+        // Lazy libraries need package, so it is opened with them; base cannot be lazy.
+        inline void open_libs(lua_State* L, Lib open, Lib lazy)
         {
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
-        }
-        ObjectRef& operator=(ObjectRef&& other) noexcept {
-            if (valid(other.lua_state()))
-            {
-                luaL_unref(L, LUA_REGISTRYINDEX, idx);
-                idx = LUA_REFNIL;
-                L = nullptr;
-            }
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
-            return *this;
-        }
-        ~ObjectRef() {
-            if (valid(L))
+            if ((lazy & ~(open | Lib::Base)) != Lib::None)
+                open = open | Lib::Package;
+            lazy = lazy & ~(open | Lib::Base);
+            auto entries = lib_entries();
+            for (auto e = entries; e->name; e++)
+                if ((open & e->lib) != Lib::None)
+                    open_lib(L, *e);
+            if (lazy == Lib::None)
+                return;
+            lua_getglobal(L, LUA_LOADLIBNAME);
+            lua_getfield(L, -1, "preload");
+            for (auto e = entries; e->name; e++)
             {
-                luaL_unref(L, LUA_REGISTRYINDEX, idx);
-                idx = LUA_REFNIL;
-                L = nullptr;
+                if ((lazy & e->lib) == Lib::None)
+                    continue;
+                lua_pushcfunction(L, e->open);
+                lua_pushcclosure(L, open_lazy_lib, 1);
+                lua_setfield(L, -2, e->name);
             }
+            lua_pop(L, 2);
         }
+    }
+}
 
-        const char* tostring() override
-        {
-            push();
-            auto result = lua_tostring(L, -1);
-            lua_pop(L, 1);
-            return result;
-        }
 
-        const char* tolstring() override
-        {
-            push();
-            auto result = luaL_tolstring(L, -1, nullptr);
-            lua_pop(L, 1);
-            return result;
-        }
 
-        template <class T>
-        operator T () const
-        {
-            return as <T> ();
-        }
+#include <chrono>
 
-        template <class T>
-        operator T ()
-        {
-            return as <T> ();
-        }
 
-        template<typename T>
-        T as()
-        {
-            push();
-            auto t = detail::get<T>(L, -1);
-            lua_pop(L, 1);
-            return t;
-        }
+namespace LuaBinding {
+    // Explicit collector work of a State, measured by GarbageCollector. Automatic steps taken
+    // while Lua allocates are not included.
+    struct GCStats {
+        size_t steps = 0;
+        size_t cycles = 0;
+        size_t collections = 0;
+        std::chrono::microseconds last_pause{ 0 };
+        std::chrono::microseconds max_pause{ 0 };
+        std::chrono::microseconds total{ 0 };
+        // set by GarbageCollector::generational/incremental, mode switches done from Lua are not seen
+        bool generational = false;
+    };
 
-        template<typename T>
-        bool is()
+    // Collector control of a lua_State, from State::gc()
+    class GarbageCollector {
+        using clock = std::chrono::steady_clock;
+        lua_State* L;
+
+        static char* key()
         {
-            if constexpr (std::is_same_v<T, void>)
-            {
-                push();
-                auto t = lua_isnoneornil(L, -1);
-                lua_pop(L, 1);
-                return t;
-            } else {
-                push();
-                auto t = detail::is<T>(L, -1);
-                lua_pop(L, 1);
-                return t;
-            }
+            static char k;
+            return &k;
         }
 
-        bool is(int t) override
+        GCStats& data()
         {
-            push();
-            auto b = lua_type(L, -1) == t;
-            lua_pop(L, 1);
-            return b;
+            if (auto stats = detail::state_data<GCStats>(L, key()))
+                return *stats;
+            return *detail::make_state_data<GCStats>(L, key());
         }
 
-        template <typename T>
-        void set(const char* index, T&& other)
+        void record(clock::time_point start)
         {
-            push();
-            detail::push(L, other);
-            lua_setfield(L, -2, index);
-            lua_pop(L, 1);
+            auto pause = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start);
+            auto& stats = data();
+            stats.last_pause = pause;
+            if (pause > stats.max_pause)
+                stats.max_pause = pause;
+            stats.total += pause;
         }
+    public:
+        explicit GarbageCollector(lua_State* L) : L(L)
+        {}
 
-        template <typename T>
-        void set(int index, T&& other)
+        // pause and stepmul in percent, 0 keeps the current value; stepsize is log2 bytes (5.4)
+        void incremental(int pause = 0, int stepmul = 0, int stepsize = 0)
         {
-            push();
-            lua_pushinteger(L, index);
-            detail::push(L, other);
-            lua_settable(L, -3);
-            lua_pop(L, 1);
+            data().generational = false;
+#if LUA_VERSION_NUM >= 504
+            lua_gc(L, LUA_GCINC, pause, stepmul, stepsize);
+#else
+            (void)stepsize;
+#if LUA_VERSION_NUM == 502
+            lua_gc(L, LUA_GCINC, 0);
+#endif
+            if (pause)
+                lua_gc(L, LUA_GCSETPAUSE, pause);
+            if (stepmul)
+                lua_gc(L, LUA_GCSETSTEPMUL, stepmul);
+#endif
         }
 
-        void unset(const char* index)
+        // false when the interpreter has no generational mode (5.2 and 5.4 have one)
+        bool generational(int minormul = 0, int majormul = 0)
         {
-            push();
-            lua_pushnil(L);
-            lua_setfield(L, -2, index);
-            lua_pop(L, 1);
+#if LUA_VERSION_NUM >= 504
+            lua_gc(L, LUA_GCGEN, minormul, majormul);
+            data().generational = true;
+            return true;
+#elif LUA_VERSION_NUM == 502
+            (void)minormul; (void)majormul;
+            lua_gc(L, LUA_GCGEN, 0);
+            return true;
+#else
+            (void)minormul; (void)majormul;
+            return false;
+#endif
         }
 
-        void unset(int index)
+        // returns the previous value
+        int set_pause(int percent)
         {
-            push();
-            lua_pushinteger(L, index);
-            lua_pushnil(L);
-            lua_settable(L, -3);
-            lua_pop(L, 1);
+            return lua_gc(L, LUA_GCSETPAUSE, percent);
         }
 
-        template <typename T>
-        void fun(int index, T& other)
+        int set_stepmul(int percent)
         {
-            push();
-            Function::fun<void>(L, other);
-            lua_rawseti(L, -2, index);
-            lua_pop(L, 1);
+            return lua_gc(L, LUA_GCSETSTEPMUL, percent);
         }
 
-        template <typename T>
-        void fun(int index, T&& other)
+        void stop()
         {
-            push();
-            Function::fun<void>(L, other);
-            lua_rawseti(L, -2, index);
-            lua_pop(L, 1);
+            lua_gc(L, LUA_GCSTOP, 0);
         }
 
-        template <typename T>
-        void cfun(int index, T& other)
+        void restart()
         {
-            push();
-            Function::cfun<void>(L, other);
-            lua_rawseti(L, -2, index);
-            lua_pop(L, 1);
+            lua_gc(L, LUA_GCRESTART, 0);
         }
 
-        template <typename T>
-        void cfun(int index, T&& other)
+#if LUA_VERSION_NUM >= 502
+        [[nodiscard]] bool running()
         {
-            push();
-            Function::cfun<void>(L, other);
-            lua_rawseti(L, -2, index);
-            lua_pop(L, 1);
+            return lua_gc(L, LUA_GCISRUNNING, 0);
         }
+#endif
 
-        template <typename T>
-        void fun(const char* index, T& other)
+        // bytes in use by Lua
+        [[nodiscard]] size_t count()
         {
-            push();
-            Function::fun<void>(L, other);
-            lua_setfield(L, -2, index);
-            lua_pop(L, 1);
+            return (size_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
         }
 
-        template <typename T>
-        void fun(const char* index, T&& other)
+        void collect()
         {
-            push();
-            Function::fun<void>(L, other);
-            lua_setfield(L, -2, index);
-            lua_pop(L, 1);
+            auto start = clock::now();
+            lua_gc(L, LUA_GCCOLLECT, 0);
+            record(start);
+            data().collections++;
         }
 
-        template <typename T>
-        void cfun(const char* index, T& other)
+        // one step, as if kb were allocated (0 is a basic step); true when a cycle finished
+        bool step(int kb = 0)
         {
-            push();
-            Function::cfun<void>(L, other);
-            lua_setfield(L, -2, index);
-            lua_pop(L, 1);
+            auto start = clock::now();
+            auto finished = lua_gc(L, LUA_GCSTEP, kb) != 0;
+            record(start);
+            auto& stats = data();
+            stats.steps++;
+            if (finished)
+                stats.cycles++;
+            return finished;
         }
 
-        template <typename T>
-        void cfun(const char* index, T&& other)
+        // steps until a cycle finished or the budget is spent, overrunning it by at most one step;
+        // the atomic phase is always a single step, a smaller stepsize in incremental() makes the
+        // others finer. Meant for idle time, usually with the automatic collector stopped.
+        // True when a cycle finished. In the 5.4 generational mode a step is a whole young
+        // collection that never reports an end, so that mode takes one step and returns true.
+        bool collect_for(std::chrono::microseconds budget, int kb = 0)
         {
-            push();
-            Function::cfun<void>(L, other);
-            lua_setfield(L, -2, index);
-            lua_pop(L, 1);
+            auto start = clock::now();
+            auto& stats = data();
+#if LUA_VERSION_NUM >= 504
+            if (stats.generational)
+            {
+                lua_gc(L, LUA_GCSTEP, kb);
+                stats.steps++;
+                stats.cycles++;
+                record(start);
+                return true;
+            }
+#endif
+            auto finished = false;
+            do
+            {
+                finished = lua_gc(L, LUA_GCSTEP, kb) != 0;
+                stats.steps++;
+            } while (!finished && clock::now() - start < budget);
+            if (finished)
+                stats.cycles++;
+            record(start);
+            return finished;
         }
 
-        Object get() {
-            push();
-            return Object(L, -1, true);
+        [[nodiscard]] GCStats stats()
+        {
+            return data();
         }
 
-        template<typename IP = IndexProxy> requires std::is_base_of_v<IP, IndexProxy>
-        IP operator[](size_t idx)
+        void reset_stats()
         {
-            return IP(*this, idx);
+            data() = GCStats();
         }
+    };
+}
 
-        template<typename IP = IndexProxy> requires std::is_base_of_v<IP, IndexProxy>
-        IP operator[](const char* idx)
+
+#ifdef LUABINDING_CALL_STATS
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+
+
+namespace LuaBinding {
+    namespace detail {
+        // trace file: "LBTRACE" and a version byte, then records. 'N' id name names a binding the
+        // first time it is called, 'C' id argc args... is a call as it starts, 'T' n nanoseconds
+        // is the time of the nth call once it returned. Numbers are LEB128, args are a type byte
+        // followed by a value for nil, booleans, numbers and strings.
+        constexpr char trace_magic[8] = { 'L', 'B', 'T', 'R', 'A', 'C', 'E', 2 };
+        enum : unsigned char { trace_name = 'N', trace_call = 'C', trace_time = 'T', trace_integer = 0x80 | LUA_TNUMBER };
+
+        inline void put_varint(std::vector<unsigned char>& out, uint64_t v)
         {
-            return IP(*this, idx);
+            while (v >= 0x80)
+            {
+                out.push_back((unsigned char)(v | 0x80));
+                v >>= 7;
+            }
+            out.push_back((unsigned char)v);
         }
 
-        [[nodiscard]] const void* topointer() const override
+        inline bool get_varint(const unsigned char*& p, const unsigned char* end, uint64_t& v)
         {
-            push();
-            auto t = lua_topointer(L, -1);
-            lua_pop(L, 1);
-            return t;
+            v = 0;
+            for (int shift = 0; p < end && shift < 64; shift += 7)
+            {
+                auto b = *p++;
+                v |= (uint64_t)(b & 0x7F) << shift;
+                if (!(b & 0x80))
+                    return true;
+            }
+            return false;
         }
+    }
+
+    // Logs every call of a named binding, with its arguments and time, to a binary trace file
+    // while it lives. Arguments are logged before the binding runs, tables, functions and
+    // userdata by type only. Needs LUABINDING_CALL_STATS; one recorder per State.
+    class TraceRecorder {
+        lua_State* L;
+        FILE* f;
+        std::weak_ptr<void> calls_alive;
+        std::unordered_map<const void*, uint64_t> ids;
+        std::vector<unsigned char> buffer;
+        uint64_t started = 0;
+        size_t count = 0;
 
-        int push(int i = -1) const override
+        static uint64_t trace_call(void* ud, lua_State* L, const void* k, int args)
         {
-            lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
-            if (i != -1)
-                lua_insert(L, i);
-            return 1;
+            return ((TraceRecorder*)ud)->write_call(L, k, args);
         }
 
-        int push(int i = -1) override
+        static void trace_done(void* ud, uint64_t ticket, std::chrono::nanoseconds time)
         {
-            lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
-            if (i != -1)
-                lua_insert(L, i);
-            return 1;
+            ((TraceRecorder*)ud)->write_time(ticket, time);
         }
 
-        void pop() override
+        // returns the number of the call, 0 for an unnamed binding
+        uint64_t write_call(lua_State* L, const void* k, int args)
         {
-            luaL_unref(L, LUA_REGISTRYINDEX, idx);
-            this->idx = LUA_REFNIL;
+            buffer.clear();
+            auto it = ids.find(k);
+            if (it == ids.end())
+            {
+                auto& entries = CallStats::of(L).entries();
+                auto name = entries.find(k);
+                if (name == entries.end() || name->second.name.empty())
+                    return 0;
+                it = ids.emplace(k, ids.size()).first;
+                buffer.push_back(detail::trace_name);
+                detail::put_varint(buffer, it->second);
+                detail::put_varint(buffer, name->second.name.size());
+                buffer.insert(buffer.end(), name->second.name.begin(), name->second.name.end());
+            }
+            buffer.push_back(detail::trace_call);
+            detail::put_varint(buffer, it->second);
+            detail::put_varint(buffer, (uint64_t)args);
+            for (int i = 1; i <= args; i++)
+            {
+                auto type = lua_type(L, i);
+                if (type == LUA_TBOOLEAN)
+                {
+                    buffer.push_back((unsigned char)type);
+                    buffer.push_back((unsigned char)lua_toboolean(L, i));
+                }
+                else if (type == LUA_TNUMBER && lua_isinteger(L, i))
+                {
+                    buffer.push_back(detail::trace_integer);
+                    auto v = (int64_t)lua_tointeger(L, i);
+                    detail::put_varint(buffer, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+                }
+                else if (type == LUA_TNUMBER)
+                {
+                    buffer.push_back((unsigned char)type);
+                    double v = (double)lua_tonumber(L, i);
+                    unsigned char bytes[sizeof(double)];
+                    memcpy(bytes, &v, sizeof(double));
+                    buffer.insert(buffer.end(), bytes, bytes + sizeof(double));
+                }
+                else if (type == LUA_TSTRING)
+                {
+                    buffer.push_back((unsigned char)type);
+                    size_t len;
+                    auto s = lua_tolstring(L, i, &len);
+                    detail::put_varint(buffer, len);
+                    buffer.insert(buffer.end(), s, s + len);
+                }
+                else
+                    buffer.push_back((unsigned char)type);
+            }
+            fwrite(buffer.data(), 1, buffer.size(), f);
+            return ++started;
         }
 
-        int type() override
+        void write_time(uint64_t ticket, std::chrono::nanoseconds time)
         {
-            push();
-            auto t = lua_type(L, -1);
-            lua_pop(L, 1);
-            return t;
+            buffer.clear();
+            buffer.push_back(detail::trace_time);
+            detail::put_varint(buffer, ticket);
+            detail::put_varint(buffer, (uint64_t)time.count());
+            fwrite(buffer.data(), 1, buffer.size(), f);
+            count++;
+        }
+    public:
+        TraceRecorder(lua_State* L, const char* path) : L(L), f(fopen(path, "wb"))
+        {
+            if (!f)
+                return;
+            fwrite(detail::trace_magic, 1, sizeof(detail::trace_magic), f);
+            auto& calls = CallStats::of(L);
+            calls.set_trace(trace_call, trace_done, this);
+            calls_alive = calls.alive();
+        }
+        TraceRecorder(const TraceRecorder&) = delete;
+        TraceRecorder& operator=(const TraceRecorder&) = delete;
+        ~TraceRecorder()
+        {
+            if (!f)
+                return;
+            // the State may have been closed first
+            if (!calls_alive.expired())
+                CallStats::of(L).set_trace(nullptr, nullptr, nullptr);
+            fclose(f);
         }
 
-        int type() const override
+        // false when the file could not be created
+        [[nodiscard]] bool valid() const
         {
-            push();
-            auto t = lua_type(L, -1);
-            lua_pop(L, 1);
-            return t;
+            return f != nullptr;
         }
 
-        int len() override
+        [[nodiscard]] size_t calls() const
         {
-            push();
-            auto t = lua_getlen(L, -1);
-            lua_pop(L, 1);
-            return t;
+            return count;
         }
 
-        int len() const override
+        void flush()
         {
-            push();
-            auto t = lua_getlen(L, -1);
-            lua_pop(L, 1);
-            return t;
+            if (f)
+                fflush(f);
         }
     };
 
-    class IndexProxy : public ObjectRef {
-    protected:
-        ObjectRef& element;
-        const char* str_index;
-        int int_index;
+    struct ReplayStats {
+        size_t calls = 0;
+        size_t failed = 0;
+        size_t missing = 0;
+        size_t skipped = 0;
+        std::chrono::nanoseconds recorded{ 0 };
+        std::chrono::nanoseconds elapsed{ 0 };
+    };
 
-    public:
-        IndexProxy(ObjectRef& el, const char* str_index) : element(el), str_index(str_index), int_index(-1) {
-            this->L = el.lua_state();
-        }
-        IndexProxy(ObjectRef& el, int int_index) : element(el), str_index(nullptr), int_index(int_index) {
-            this->L = el.lua_state();
+    // Drives the bindings of a State through the calls of a trace, as a benchmark of its free
+    // functions. Bindings are looked up by their registered name. Calls with an argument logged
+    // by type only cannot be rebuilt and are skipped, which is every method and property call
+    // since self is userdata; calls raising errors are counted.
+    // Calls that raised an error while recorded have no time and are left out.
+    class TraceReplay {
+        struct Arg {
+            int type;
+            bool boolean = false;
+            lua_Integer integer = 0;
+            lua_Number number = 0;
+            string_type str{};
+        };
+        struct Call {
+            uint64_t id;
+            std::chrono::nanoseconds time{ 0 };
+            std::vector<Arg> args{};
+            bool complete = true;
+            bool returned = false;
+        };
+        std::vector<string_type> names;
+        std::vector<Call> trace;
+        bool ok = false;
+
+        bool parse(const unsigned char* p, const unsigned char* end)
+        {
+            if (end - p < (ptrdiff_t)sizeof(detail::trace_magic) || memcmp(p, detail::trace_magic, sizeof(detail::trace_magic)))
+                return false;
+            p += sizeof(detail::trace_magic);
+            while (p < end)
+            {
+                auto tag = *p++;
+                uint64_t id, n;
+                if (!detail::get_varint(p, end, id))
+                    return false;
+                if (tag == detail::trace_name)
+                {
+                    if (!detail::get_varint(p, end, n) || (uint64_t)(end - p) < n)
+                        return false;
+                    if (names.size() <= id)
+                        names.resize(id + 1);
+                    names[id] = string_type((const char*)p, n);
+                    p += n;
+                    continue;
+                }
+                if (tag == detail::trace_time)
+                {
+                    if (!detail::get_varint(p, end, n))
+                        return false;
+                    if (id >= 1 && id <= trace.size())
+                    {
+                        trace[id - 1].time = std::chrono::nanoseconds(n);
+                        trace[id - 1].returned = true;
+                    }
+                    continue;
+                }
+                if (tag != detail::trace_call || id >= names.size())
+                    return false;
+                uint64_t argc;
+                if (!detail::get_varint(p, end, argc))
+                    return false;
+                Call call{ .id = id };
+                for (uint64_t i = 0; i < argc; i++)
+                {
+                    if (p >= end)
+                        return false;
+                    Arg arg{ .type = *p++ };
+                    if (arg.type == LUA_TBOOLEAN)
+                    {
+                        if (p >= end)
+                            return false;
+                        arg.boolean = *p++ != 0;
+                    }
+                    else if (arg.type == detail::trace_integer)
+                    {
+                        if (!detail::get_varint(p, end, n))
+                            return false;
+                        arg.integer = (lua_Integer)(int64_t)((n >> 1) ^ (~(n & 1) + 1));
+                    }
+                    else if (arg.type == LUA_TNUMBER)
+                    {
+                        if (end - p < (ptrdiff_t)sizeof(double))
+                            return false;
+                        double v;
+                        memcpy(&v, p, sizeof(double));
+                        arg.number = (lua_Number)v;
+                        p += sizeof(double);
+                    }
+                    else if (arg.type == LUA_TSTRING)
+                    {
+                        if (!detail::get_varint(p, end, n) || (uint64_t)(end - p) < n)
+                            return false;
+                        arg.str = string_type((const char*)p, n);
+                        p += n;
+                    }
+                    else if (arg.type != LUA_TNIL)
+                        call.complete = false;
+                    call.args.push_back(std::move(arg));
+                }
+                trace.push_back(std::move(call));
+            }
+            std::erase_if(trace, [](const Call& call) { return !call.returned; });
+            return true;
         }
 
-        operator ObjectRef () const {
-            element.push();
-            if (str_index)
-                lua_getfield(L, -1, str_index);
-            else
-                lua_rawgeti(L, -1, int_index);
-            lua_remove(L, -2);
-            return ObjectRef(L, -1, false);
+        static void push(lua_State* L, const Arg& arg)
+        {
+            switch (arg.type)
+            {
+            case LUA_TBOOLEAN:
+                lua_pushboolean(L, arg.boolean);
+                break;
+            case detail::trace_integer:
+                lua_pushinteger(L, arg.integer);
+                break;
+            case LUA_TNUMBER:
+                lua_pushnumber(L, arg.number);
+                break;
+            case LUA_TSTRING:
+                lua_pushlstring(L, arg.str.data(), arg.str.size());
+                break;
+            default:
+                lua_pushnil(L);
+            }
+        }
+    public:
+        explicit TraceReplay(const char* path)
+        {
+            auto f = fopen(path, "rb");
+            if (!f)
+                return;
+            std::vector<unsigned char> data;
+            unsigned char chunk[64 * 1024];
+            size_t n;
+            while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+                data.insert(data.end(), chunk, chunk + n);
+            fclose(f);
+            ok = parse(data.data(), data.data() + data.size());
         }
 
-        int push(int i = -1) const override
+        // false when the file is missing or malformed
+        [[nodiscard]] bool valid() const
         {
-            element.push();
-            if (str_index)
-                lua_getfield(L, -1, str_index);
-            else
-                lua_rawgeti(L, -1, int_index);
-            lua_remove(L, -2);
-            if (i != -1)
-                lua_insert(L, i);
-            return 1;
+            return ok;
         }
 
-        int push(int i = -1) override
+        [[nodiscard]] size_t size() const
         {
-            element.push();
-            if (str_index)
-                lua_getfield(L, -1, str_index);
-            else
-                lua_rawgeti(L, -1, int_index);
-            lua_remove(L, -2);
-            if (i != -1)
-                lua_insert(L, i);
-            return 1;
+            return trace.size();
         }
 
-        void pop() override
+        // replays the trace repeat times; recorded is the time the replayed calls took when traced
+        ReplayStats run(lua_State* L, int repeat = 1)
         {
-            element.push();
-            lua_pushnil(L);
-            if (str_index)
-                lua_setfield(L, -2, str_index);
-            else
-                lua_rawseti(L, -2, int_index);
-            lua_pop(L, 1);
+            ReplayStats stats;
+            auto top = lua_gettop(L);
+            luaL_checkstack(L, (int)names.size() + LUA_MINSTACK, "trace replay");
+            for (auto& name : names)
+                CallStats::push_binding(L, name.c_str());
+            auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repeat; r++)
+            {
+                for (auto& call : trace)
+                {
+                    auto f = top + 1 + (int)call.id;
+                    if (!lua_isfunction(L, f))
+                    {
+                        stats.missing++;
+                        continue;
+                    }
+                    if (!call.complete)
+                    {
+                        stats.skipped++;
+                        continue;
+                    }
+                    stats.recorded += call.time;
+                    lua_pushvalue(L, f);
+                    for (auto& arg : call.args)
+                        push(L, arg);
+                    if (lua_pcall(L, (int)call.args.size(), 0, 0))
+                    {
+                        lua_pop(L, 1);
+                        stats.failed++;
+                    }
+                    stats.calls++;
+                }
+            }
+            stats.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            lua_settop(L, top);
+            return stats;
         }
+    };
+}
+#endif
 
-        template <typename T>
-        IndexProxy& operator=(const T& rhs) {
-            if constexpr (detail::is_pushable_cfun<T>) {
-                if (str_index)
-                    element.cfun(str_index, rhs);
-                else
-                    element.cfun(int_index, rhs);
-            } else if constexpr (detail::is_pushable_fun<T>) {
-                if (str_index)
-                    element.fun(str_index, rhs);
-                else
-                    element.fun(int_index, rhs);
-            } else {
-                if (str_index)
-                    element.set(str_index, rhs);
-                else
-                    element.set(int_index, rhs);
+#if defined(LUABINDING_CALL_STATS) || defined(LUABINDING_SYMBOL_MAP)
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+#if defined(__linux__) || defined(__APPLE__)
+#include <dlfcn.h>
+#endif
+
+
+namespace LuaBinding {
+    // Writes "symbol<TAB>name,name..." lines mapping the native symbols of the binding thunks to
+    // their Lua names, to annotate the output of perf script --no-demangle or other native
+    // profilers. A thunk serves every binding of one signature, so its line lists all of them;
+    // with LUABINDING_CALL_STATS the timing wrapper and the thunk it runs both get a line.
+    // Symbols come from dladdr, so functions of an executable only resolve when it is linked
+    // with -rdynamic; the others are written as module+0xoffset for addr2line -f. Needs
+    // LUABINDING_CALL_STATS or LUABINDING_SYMBOL_MAP, which keep the names at registration.
+    class SymbolMap {
+        static string_type symbol(lua_CFunction f)
+        {
+            char buffer[32];
+#if defined(__linux__) || defined(__APPLE__)
+            Dl_info info;
+            if (dladdr((void*)f, &info))
+            {
+                // dladdr falls back to the nearest symbol before f, which is not f
+                if (info.dli_sname && info.dli_saddr == (void*)f)
+                    return info.dli_sname;
+                if (info.dli_fname)
+                {
+                    auto module = strrchr(info.dli_fname, '/');
+                    snprintf(buffer, sizeof(buffer), "+0x%llx", (unsigned long long)((uintptr_t)f - (uintptr_t)info.dli_fbase));
+                    return string_type(module ? module + 1 : info.dli_fname) + buffer;
+                }
             }
-            return *this;
+#endif
+            snprintf(buffer, sizeof(buffer), "0x%llx", (unsigned long long)(uintptr_t)f);
+            return buffer;
+        }
+    public:
+        // overwrites path; call once after registering
+        static bool write(lua_State* L, const char* path)
+        {
+            std::map<lua_CFunction, std::vector<string_type>> thunks;
+            if (lua_rawgetp(L, LUA_REGISTRYINDEX, detail::bindings_key()) == LUA_TTABLE)
+            {
+                lua_pushnil(L);
+                while (lua_next(L, -2))
+                {
+                    auto f = lua_tocfunction(L, -1);
+                    if (f && lua_type(L, -2) == LUA_TSTRING)
+                    {
+                        thunks[f].push_back(lua_tostring(L, -2));
+#ifdef LUABINDING_CALL_STATS
+                        if (auto target = detail::ProbedTargets::find(f))
+                            thunks[target].push_back(lua_tostring(L, -2));
+#endif
+                    }
+                    lua_pop(L, 1);
+                }
+            }
+            lua_pop(L, 1);
+            std::map<string_type, string_type> lines;
+            for (auto& [f, names] : thunks)
+            {
+                std::sort(names.begin(), names.end());
+                auto& line = lines[symbol(f)];
+                for (auto& name : names)
+                {
+                    if (!line.empty())
+                        line += ",";
+                    line += name;
+                }
+            }
+            auto f = fopen(path, "wb");
+            if (!f)
+                return false;
+            for (auto& [sym, names] : lines)
+                fprintf(f, "%s\t%s\n", sym.c_str(), names.c_str());
+            return !fclose(f);
         }
+    };
+}
+#endif
 
-        template <typename T>
-        IndexProxy& operator=(const T&& rhs) {
-            if constexpr (detail::is_pushable_cfun<T>) {
-                if (str_index)
-                    element.cfun(str_index, rhs);
-                else
-                    element.cfun(int_index, rhs);
-            } else if constexpr (detail::is_pushable_fun<T>) {
-                if (str_index)
-                    element.fun(str_index, rhs);
-                else
-                    element.fun(int_index, rhs);
-            } else {
-                if (str_index)
-                    element.set(str_index, rhs);
-                else
-                    element.set(int_index, rhs);
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+
+namespace LuaBinding {
+    // Sampling profiler on a count hook, aggregating Lua call stacks into folded stacks for
+    // flamegraph.pl / speedscope. Samples are taken every n VM instructions, or when a timer
+    // thread flags that interval has passed. Hooks only run inside Lua code, so C++ functions
+    // appear in stacks only while Lua code they called is running, except with the timer and
+    // LUABINDING_CALL_STATS: a bound function returning after the interval passed is sampled
+    // as the leaf. Bound functions are named after their call site, or after their registration
+    // with LUABINDING_CALL_STATS. It may outlive its State: once the State is closed, stop() and
+    // the destructor no longer touch it.
+    class Profiler {
+        lua_State* L;
+        std::unordered_map<string_type, uint64_t> stacks;
+        uint64_t count = 0;
+        int hook = 0;
+        Hooks* hooks = nullptr;
+        std::weak_ptr<void> hooks_alive;
+        int depth;
+        std::vector<string_type> frames;
+        std::thread timer;
+        std::atomic<bool> due{ false };
+        std::atomic<bool> stopping{ false };
+
+        static string_type frame_name([[maybe_unused]] lua_State* T, lua_Debug& ar)
+        {
+            string_type frame;
+            if (ar.name)
+                frame = ar.name;
+#ifdef LUABINDING_CALL_STATS
+            if (*ar.what == 'C' && frame.empty())
+            {
+                if (auto calls = CallStats::get(T))
+                {
+                    lua_getinfo(T, "f", &ar);
+                    auto it = calls->entries().find(CallStats::binding(T, -1));
+                    lua_pop(T, 1);
+                    if (it != calls->entries().end())
+                        frame = it->second.name;
+                }
             }
-            return *this;
+#endif
+            if (*ar.what == 'm')
+                frame = "main chunk";
+            else if (frame.empty())
+                frame = "?";
+            if (*ar.what == 'C')
+                frame += " [C]";
+            else
+            {
+                char where[64];
+                snprintf(where, sizeof(where), ":%d)", ar.linedefined);
+                frame += " (";
+                frame += ar.short_src;
+                frame += where;
+            }
+            // ';' separates frames and the last space separates the count
+            for (auto& c : frame)
+                if (c == ';' || c == '\n')
+                    c = ',';
+            return frame;
         }
-    };
 
-    template<>
-    class Stack<Object> {
-    public:
-        static int push(lua_State* L, Object t)
+        void sample(lua_State* T)
         {
-            return t.push();
-        }
-        static bool is(lua_State*, int ) {
-            return true;
+            frames.clear();
+            lua_Debug ar;
+            for (int level = 0; level < depth && lua_getstack(T, level, &ar); level++)
+            {
+                lua_getinfo(T, "Sn", &ar);
+                frames.push_back(frame_name(T, ar));
+            }
+            if (frames.empty())
+                return;
+            // outermost frame first
+            string_type stack;
+            for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+            {
+                if (!stack.empty())
+                    stack += ';';
+                stack += *it;
+            }
+            stacks[stack]++;
+            count++;
         }
-        static Object get(lua_State* L, int index, int& offset)
+#ifdef LUABINDING_CALL_STATS
+        static void sample_due(void* ud, lua_State* T)
         {
-            return Object(L, index + offset);
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "object";
-        }
-        static int basic_type(lua_State* L) {
-            return -2;
+            auto profiler = (Profiler*)ud;
+            if (profiler->due.exchange(false) && lua_checkstack(T, 2))
+                profiler->sample(T);
         }
-    };
+#endif
 
-    template<>
-    class Stack<Object*> {
-    public:
-        static int push(lua_State* L, Object* t)
+        void attach()
         {
-            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
-            return 0;
-        }
-        static bool is(lua_State* L, int index) {
-            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
-            return false;
+            hooks = &Hooks::of(L);
+            hooks_alive = hooks->alive();
         }
-        static Object* get(lua_State* L, int index, int& offset)
+    public:
+        explicit Profiler(lua_State* L, int depth = 64) : L(L), depth(depth)
+        {}
+        Profiler(const Profiler&) = delete;
+        Profiler& operator=(const Profiler&) = delete;
+        ~Profiler()
         {
-            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
-            return nullptr;
+            stop();
         }
-    };
 
-    template<>
-    class Stack<ObjectRef> {
-    public:
-        static int push(lua_State* L, ObjectRef t)
+        // samples every n VM instructions
+        void start(int instructions = 1000)
         {
-            return t.push();
-        }
-        static bool is(lua_State*, int ) {
-            return true;
+            stop();
+            attach();
+            hook = hooks->add(LUA_MASKCOUNT, instructions, [this](lua_State* T, lua_Debug*) {
+                sample(T);
+            });
         }
-        static ObjectRef get(lua_State* L, int index, int& offset)
+
+        // samples once per interval of wall clock time, checked every `check` instructions
+        void start(std::chrono::microseconds interval, int check = 100)
         {
-            return {L, index+offset, true};
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "object";
-        }
-        static int basic_type(lua_State* L) {
-            return -2;
+            stop();
+            stopping = false;
+            attach();
+            hook = hooks->add(LUA_MASKCOUNT, check, [this](lua_State* T, lua_Debug*) {
+                if (due.exchange(false))
+                    sample(T);
+            });
+#ifdef LUABINDING_CALL_STATS
+            CallStats::of(L).set_sampler(sample_due, this);
+#endif
+            timer = std::thread([this, interval] {
+                while (!stopping)
+                {
+                    std::this_thread::sleep_for(interval);
+                    due = true;
+                }
+            });
         }
-    };
 
-    template<>
-    class Stack<ObjectRef*> {
-    public:
-        static int push(lua_State* L, ObjectRef* t)
+        void stop()
         {
-            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
-            return 0;
-        }
-        static bool is(lua_State* L, int index) {
-            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
-            return false;
+            if (hook && !hooks_alive.expired())
+            {
+                hooks->remove(hook);
+#ifdef LUABINDING_CALL_STATS
+                if (auto calls = CallStats::get(L))
+                    calls->set_sampler(nullptr, nullptr);
+#endif
+            }
+            hook = 0;
+            stopping = true;
+            if (timer.joinable())
+                timer.join();
+            due = false;
         }
-        static ObjectRef* get(lua_State* L, int index, int& offset)
+
+        [[nodiscard]] bool running() const
         {
-            static_assert(true, "Use ObjectRef or ObjectRef& instead of ObjectRef*");
-            return nullptr;
+            return hook != 0;
         }
-    };
 
-    template<>
-    class Stack<IndexProxy> {
-    public:
-        static int push(lua_State* L, IndexProxy t)
+        // "outer;inner count" lines
+        [[nodiscard]] string_type folded() const
         {
-            return t.push();
-        }
-        static bool is(lua_State*, int ) {
-            return true;
+            string_type out;
+            for (auto& [stack, n] : stacks)
+            {
+                char num[24];
+                snprintf(num, sizeof(num), " %llu\n", (unsigned long long)n);
+                out += stack;
+                out += num;
+            }
+            return out;
         }
-        static IndexProxy get(lua_State* L, int index, int& offset)
+
+        bool write(const char* path) const
         {
-            static_assert(true, "Cannot get IndexProxy from lua stack");
-        }
-        static const char* basic_type_name(lua_State* L) {
-            return "object";
-        }
-        static int basic_type(lua_State* L) {
-            return -2;
+            auto f = fopen(path, "wb");
+            if (!f)
+                return false;
+            auto out = folded();
+            auto ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+            return !fclose(f) && ok;
         }
-    };
 
-    template<>
-    class Stack<IndexProxy*> {
-    public:
-        static int push(lua_State* L, IndexProxy* t)
+        [[nodiscard]] uint64_t samples() const
         {
-            static_assert(true, "Use IndexProxy or IndexProxy& instead of IndexProxy*");
-            return 0;
+            return count;
         }
-        static bool is(lua_State* L, int index) {
-            static_assert(true, "Use IndexProxy or IndexProxy& instead of IndexProxy*");
-            return false;
-        }
-        static IndexProxy* get(lua_State* L, int index, int& offset)
+
+        void clear()
         {
-            static_assert(true, "Use IndexProxy or IndexProxy& instead of IndexProxy*");
-            return nullptr;
+            stacks.clear();
+            count = 0;
         }
     };
 }
 
+#include <chrono>
+
 
 namespace LuaBinding {
-    class Environment : public ObjectRef {
-    protected:
-        static int lookup_global(lua_State* L)
-        {
-            lua_pushvalue(L, -2);
-            lua_pushvalue(L, -2);
-            lua_rawget(L, -2);
-            if (!lua_isnoneornil(L, -1))
-                return 1;
-            lua_pop(L, 1);
-#if LUA_VERSION_NUM < 502
-            lua_rawget(L, LUA_GLOBALSINDEX);
-#else
-            lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_GLOBALS);
-#endif
-            return !lua_isnoneornil(L, -1);
+    // Bounds the Lua code run while it lives, in VM instructions and wall clock time, checked
+    // every `check` instructions. Past either limit each check raises Budget::message, so a
+    // script cannot swallow it with pcall; exec/call report it like any Lua error and tripped()
+    // tells it apart. C++ functions and coroutines created before it are not interrupted. On
+    // LuaJIT count hooks do not fire inside compiled traces, so the JIT is flushed and switched
+    // off while a budget lives, and switched back on after it if it was on.
+    class Budget {
+        using clock = std::chrono::steady_clock;
+        lua_State* L;
+        int hook = 0;
+        uint64_t instructions;
+        uint64_t executed = 0;
+        clock::time_point deadline;
+        bool timed;
+        bool hit = false;
+#ifdef LUAJIT_VERSION_NUM
+        bool jit_was_on = false;
+
+        // jit.status() when the jit library is loaded, the engine is on by default otherwise
+        static bool jit_enabled(lua_State* L)
+        {
+            auto on = true;
+            lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+            lua_getfield(L, -1, "jit");
+            if (lua_istable(L, -1))
+            {
+                lua_getfield(L, -1, "status");
+                if (lua_isfunction(L, -1) && !lua_pcall(L, 0, 1, 0))
+                    on = lua_toboolean(L, -1);
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 2);
+            return on;
         }
+#endif
     public:
-        Environment() = default;
-        explicit Environment(lua_State* L)
-        {
-            this->L = L;
-            lua_newtable(L);
-
-            lua_newtable(L);
-            lua_getglobal(L, "_G");
-            lua_setfield(L, -2, "__index");
-            lua_setmetatable(L, -2);
+        static constexpr const char* message = "execution budget exceeded";
 
-            this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-        }
-        explicit Environment(lua_State* L, int findex)
+        // 0 instructions or time is no limit
+        Budget(lua_State* L, uint64_t instructions, std::chrono::microseconds time = std::chrono::microseconds(0), int check = 1000)
+            : L(L), instructions(instructions), deadline(clock::now() + time), timed(time.count() > 0)
         {
-            this->L = L;
-#if LUA_VERSION_NUM < 502
-            lua_getfenv(L, findex);
-#else
-            lua_getupvalue(L, findex, 1);
+            if (check < 1)
+                check = 1;
+#ifdef LUAJIT_VERSION_NUM
+            jit_was_on = jit_enabled(L);
+            if (jit_was_on)
+            {
+                luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_FLUSH);
+                luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+            }
+#endif
+            hook = Hooks::of(L).add(LUA_MASKCOUNT, check, [this, check](lua_State* T, lua_Debug*) {
+                executed += check;
+                if (!hit && ((this->instructions && executed >= this->instructions) || (timed && clock::now() >= deadline)))
+                    hit = true;
+                if (hit)
+                    luaL_error(T, message);
+            });
+        }
+        Budget(const Budget&) = delete;
+        Budget& operator=(const Budget&) = delete;
+        ~Budget()
+        {
+            if (hook)
+                Hooks::of(L).remove(hook);
+#ifdef LUAJIT_VERSION_NUM
+            if (jit_was_on)
+                luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_ON);
 #endif
-            this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
         }
-        explicit Environment(lua_State* L, bool)
+
+        // true once a limit was hit
+        [[nodiscard]] bool tripped() const
         {
-            this->L = L;
-#if LUA_VERSION_NUM < 502
-            lua_getfenv(L, lua_upvalueindex(1));
-#else
-            lua_getupvalue(L, lua_upvalueindex(1), 1);
-#endif
-            this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
+            return hit;
         }
-        int pcall(int narg = 0, int nres = 0) {
-            lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
-#if LUA_VERSION_NUM < 502
-            lua_setfenv(L, lua_gettop(L) - narg - 1);
-#else
-            lua_setupvalue(L, lua_gettop(L) - narg - 1, 1);
-#endif
-            int errindex = lua_gettop(L) - narg;
-            lua_pushcclosure(L, tack_on_traceback, 0);
-            lua_insert(L, errindex);
-            auto status = lua_pcall(L, narg, nres, errindex);
-            lua_remove(L, errindex);
-            return status;
+
+        // instructions run so far, rounded up to the check interval
+        [[nodiscard]] uint64_t used() const
+        {
+            return executed;
         }
     };
 }
 
-#ifdef LUABINDING_DYN_CLASSES
 
-#ifdef LUABINDING_DYN_CLASSES
 #include <functional>
-#include <cassert>
 
-#ifdef LUABINDING_DYN_CLASSES
+
 namespace LuaBinding {
-    enum MemoryType {
-        _char = -0x1,
-        _int = -0x2,
-        _float = -0x4,
-        _bool = -0x8,
-        _double = -0x10,
-        ptr = -0x20,
-        vec2 = -0x40,
-        vec3 = -0x80,
-        _array = -0x200,
-        _short = -0x400,
-        _byte = -0x800,
-        uint = -0x2000,
-        ushort = -0x4000,
-        string = -0x8000,
-        null = -0x10000,
-        cstruct = -0x20000,
-        vector = -0x40000,
-        point = -0x100000,
-        udata = -0x200000,
 
-        stdstring = -0x400000,
-        stringptr = -0x800000,
+    template<class T>
+    class helper {
+    public:
+        static void const* key() { static char value; return &value; }
+        static bool push_metatable(lua_State * L) {
+            lua_getglobal(L, "__METASTORE");
+            if (lua_rawgetp(L, -1, key()))
+            {
+                lua_remove(L, -2);
+                return false;
+            }
+            lua_pop(L, 1);
+            lua_newtable(L);
+            lua_pushvalue(L, -1);
+            lua_rawsetp(L, -3, key());
+            lua_remove(L, -2);
+            return true;
+        }
     };
-    int lua_pushmemtype(lua_State* L, MemoryType type, void* data);
-    int lua_pullmemtype(lua_State* L, MemoryType type, void* addr);
-    unsigned int get_type_size(MemoryType mt);
-}
-#endif
-
-namespace LuaBinding {
 
-    class DynClass {
+    template<typename T>
+    class Class {
         lua_State* L = nullptr;
         const char* class_name;
     public:
-        DynClass(lua_State* L, const char* name) : L(L), class_name(name)
+        using value_type = T;
+        Class(lua_State* L, const char* name) : L(L), class_name(name)
         {
-            push_metatable(L, this);
+            if (!push_metatable())
+            {
+                lua_pop(L, 1);
+                return;
+            }
 
             lua_pushcclosure(L, lua_CGCFunction, 0);
             lua_setfield(L, -2, "__gc");
@@ -3791,14 +7214,8 @@ namespace LuaBinding {
             lua_pushcclosure(L, lua_EQFunction, 0);
             lua_setfield(L, -2, "__eq");
 
-            lua_pushcclosure(L, lua_CNewIndexFunction, 0);
-            lua_setfield(L, -2, "__newindex");
-
-            lua_newtable(L);
-            lua_setfield(L, -2, "__pindex");
-
-            lua_newtable(L);
-            lua_setfield(L, -2, "__findex");
+            lua_pushcclosure(L, lua_CNewIndexFunction, 0);
+            lua_setfield(L, -2, "__newindex");
 
             lua_pushstring(L, name);
             lua_setfield(L, -2, "__name");
@@ -3807,48 +7224,33 @@ namespace LuaBinding {
             lua_pushcclosure(L, tostring, 1);
             lua_setfield(L, -2, "__tostring");
 
-            lua_pushlightuserdata(L, this);
-            lua_setfield(L, -2, "__key");
-
-            lua_pushcfunction(L, dyn_call);
-            lua_setfield(L, -2, "New");
-
-            lua_pushcfunction(L, dyn_prop);
-            lua_setfield(L, -2, "Prop");
+            ExternalMemory::of(L).name(detail::type_key<T>(), name);
 
+#ifdef LUABINDING_DYN_CLASSES
             lua_pushcfunction(L, dyn_read);
             lua_setfield(L, -2, "Read");
 
             lua_pushcfunction(L, dyn_cast);
             lua_setfield(L, -2, "Cast");
+#endif
+
+            lua_pop(L, 1);
 
             push_property_index();
             lua_pushcfunction(L, get_ptr);
             lua_setfield(L, -2, "ptr");
-
+#ifdef LUABINDING_DYN_CLASSES
             lua_pushcfunction(L, get_vtable);
             lua_setfield(L, -2, "vTable");
-
             lua_pop(L, 1);
 
             push_property_newindex();
             lua_pushcfunction(L, set_ptr);
             lua_setfield(L, -2, "ptr");
-
+#endif
             lua_pop(L, 1);
         }
     private:
-        static int tostring(lua_State* S)
-        {
-            char asdf[128] = { 0 };
-#ifdef ENV32
-            snprintf(asdf, sizeof(asdf), "%s{%X}", lua_tostring(S, lua_upvalueindex(1)), (uintptr_t)topointer(S, 1));
-#elifdef ENV64
-            snprintf(asdf, sizeof(asdf), "%s{%llX}", lua_tostring(S, lua_upvalueindex(1)), (uintptr_t)topointer(S, 1));
-#endif
-            lua_pushstring(S, asdf);
-            return 1;
-        }
         static int lua_CGCFunction(lua_State* S)
         {
             if (luaL_getmetafield(S, 1, "__cgc"))
@@ -3858,14 +7260,43 @@ namespace LuaBinding {
             }
             auto u = (void**)lua_touserdata(S, 1);
             if (*(u + 1) == (void*)0xC0FFEE) {
-                free(*u);
+                detail::free_object(S, *u, detail::type_key<T>());
             }
             return 0;
         }
+        static int get_vtable(lua_State *L)
+        {
+            lua_pushnumber(L, (double)**(uintptr_t**)lua_touserdata(L, 1));
+            return 1;
+        }
+        static int get_ptr(lua_State* L)
+        {
+            lua_pushnumber(L, (double)*(uintptr_t*)lua_touserdata(L, 1));
+            return 1;
+        }
+        static int set_ptr(lua_State *L)
+        {
+            *(uintptr_t*)lua_touserdata(L, 1) = (uintptr_t)lua_tonumber(L, 3);
+            return 0;
+        }
+        static int tostring(lua_State* S)
+        {
+            char asdf[128] = { 0 };
+#ifdef ENV32
+                snprintf(asdf, sizeof(asdf), "%s{%X}", lua_tostring(S, lua_upvalueindex(1)), (uintptr_t)topointer(S, 1));
+#elifdef ENV64
+                snprintf(asdf, sizeof(asdf), "%s{%llX}", lua_tostring(S, lua_upvalueindex(1)), (uintptr_t)topointer(S, 1));
+#endif
+            lua_pushstring(S, asdf);
+            return 1;
+        }
+        static void* topointer(lua_State *L, int idx)
+        {
+            return *(void**)lua_touserdata(L, idx);
+        }
         static int lua_EQFunction(lua_State* S)
         {
-            if (!lua_isuserdata(S, 1) || !lua_isuserdata(S, 2))
-                lua_pushboolean(S, false);
+            if (!lua_isuserdata(S, 1) || !lua_isuserdata(S, 2)) lua_pushboolean(S, false);
             else
                 lua_pushboolean(S, *(uintptr_t*)lua_touserdata(S, 1) == *(uintptr_t*)lua_touserdata(S, 2));
             return 1;
@@ -3873,22 +7304,20 @@ namespace LuaBinding {
         static int lua_CIndexFunction(lua_State* S)
         {
             if (strcmp(lua_tostring(S, 2), "ptr") != 0
-             && strcmp(lua_tostring(S, 2), "isValid") != 0
-             && luaL_getmetafield(S, 1, "__valid"))
+                && strcmp(lua_tostring(S, 2), "valid") != 0
+                && luaL_getmetafield(S, 1, "__valid"))
             {
-                auto success = false;
                 lua_pushvalue(S, 1);
                 lua_call(S, 1, 1);
-                success = lua_toboolean(S, -1);
-                if (!success)
+                if (!lua_toboolean(S, -1))
                 {
                     lua_pushvalue(S, 1);
                     if (luaL_getmetafield(S, 1, "__name")) {
                         char asdf[128] = { 0 };
 #ifdef ENV32
-                        snprintf(asdf, sizeof(asdf), "%s{%X}", lua_tostring(S, -1), (uintptr_t)topointer(S, 1));
+                            snprintf(asdf, sizeof(asdf), "%s{%X}", lua_tostring(S, -1), (uintptr_t)topointer(S, 1));
 #elifdef ENV64
-                        snprintf(asdf, sizeof(asdf), "%s{%llX}", lua_tostring(S, -1), (uintptr_t)topointer(S, 1));
+                            snprintf(asdf, sizeof(asdf), "%s{%llX}", lua_tostring(S, -1), (uintptr_t)topointer(S, 1));
 #endif
                         lua_pop(S, 1);
 
@@ -3899,7 +7328,7 @@ namespace LuaBinding {
                     }
                     return 0; // ??
                 }
-                lua_settop(S, 3);
+                lua_pop(S, 1);
             }
             if (luaL_getmetafield(S, 1, "__pindex"))
             {
@@ -3959,49 +7388,27 @@ namespace LuaBinding {
             lua_settable(S, -3);
             return 0;
         }
-    public:
-        static int push_metatable(lua_State *L, void* _this, bool assert = false)
-        {
-            lua_getglobal(L, "__METASTORE");
-            if (lua_rawgetp(L, -1, _this))
-            {
-                lua_remove(L, -2);
-                return 0;
-            }
-            if (assert)
-            {
-#ifdef ENV32
-                luaL_error(L, "metatable not found in __METASTORE for %X", _this);
-#elifdef ENV64
-                luaL_error(L, "metatable not found in __METASTORE for %llX", _this);
-#endif
-            }
-            lua_pop(L, 1);
-            lua_newtable(L);
-            lua_pushvalue(L, -1);
-            lua_rawsetp(L, -3, _this);
-            lua_remove(L, -2);
-            return 1;
-        }
     private:
-        void set_size(unsigned int size)
+        bool push_metatable()
         {
-            push_metatable(L, this);
-            lua_pushinteger(L, size);
-            lua_setfield(L, -2, "__size");
-            lua_pop(L, 1);
+            return helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
         }
-        size_t get_size()
+        void push_function_index()
         {
-            push_metatable(L, this);
-            lua_getfield(L, -1, "__size");
-            auto result = lua_tointeger(L, -1);
-            lua_pop(L, 2);
-            return result;
+            push_metatable();
+            lua_pushstring(L, "__findex");
+            if (!luaL_gettable(L, -2))
+            {
+                lua_pop(L, 1);
+                lua_newtable(L);
+                lua_pushvalue(L, -1);
+                lua_setfield(L, -3, "__findex");
+            }
+            lua_remove(L, -2);
         }
         void push_property_index()
         {
-            push_metatable(L, this);
+            push_metatable();
             lua_pushstring(L, "__pindex");
             if (!luaL_gettable(L, -2))
             {
@@ -4012,1073 +7419,1528 @@ namespace LuaBinding {
             }
             lua_remove(L, -2);
         }
-        void push_property_newindex()
+        void push_property_newindex()
+        {
+            push_metatable();
+            lua_pushstring(L, "__pnewindex");
+            if (!luaL_gettable(L, -2))
+            {
+                lua_pop(L, 1);
+                lua_newtable(L);
+                lua_pushvalue(L, -1);
+                lua_setfield(L, -3, "__pnewindex");
+            }
+            lua_remove(L, -2);
+        }
+
+        // names the property accessor on top of the stack Class.name:get or Class.name:set
+        void name_accessor([[maybe_unused]] const char* name, [[maybe_unused]] const char* kind)
+        {
+#ifdef LUABINDING_CALL_STATS
+            detail::name_call(L, -1, class_name, (string_type(name) + ":" + kind).c_str());
+#endif
+        }
+    public:
+        template<typename F>
+        Class<T>& idx_cfun(F func)
+        {
+            push_metatable();
+            lua_pushstring(L, "__cindex");
+            lua_pushcclosure(L, reinterpret_cast<lua_CFunction>(func), 0);
+            lua_settable(L, -3);
+            lua_pop(L, 1);
+            return *this;
+        }
+        
+        template<class... Params>
+        Class<T>& ctor()
+        {
+            auto str = string_type(class_name);
+            if (str.find('.') != string_type::npos)
+            {
+                auto enclosing_table = str.substr(0, str.find('.'));
+                auto real_class_name = str.substr(str.find('.') + 1);
+                if (!luaL_getglobal(L, enclosing_table.c_str()))
+                {
+                    lua_pop(L, 1);
+                    lua_newtable(L);
+                    lua_pushvalue(L, -1);
+                    lua_setglobal(L, enclosing_table.c_str());
+                }
+                lua_getfield(L, -1, real_class_name.c_str());
+                if (lua_isnil(L, -1))
+                {
+                    lua_pop(L, 1);
+                    push_metatable();
+                }
+
+                lua_createtable(L, 0, 1);
+                lua_pushstring(L, "__call");
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsCtor<T, Params...>::f), 0);
+                detail::name_call(L, -1, class_name, "new");
+                lua_settable(L, -3);
+                //lua_pushcclosure(L, lua_CGCProtector, 0);
+                //lua_setfield(L, -2, "__newindex");
+
+                lua_setmetatable(L, -2);
+
+                lua_setfield(L, -2, real_class_name.c_str());
+
+                return *this;
+            } else {
+                if (!luaL_getglobal(L, class_name))
+                {
+                    lua_pop(L, 1);
+                    push_metatable();
+                }
+
+                lua_createtable(L, 0, 1);
+                lua_pushstring(L, "__call");
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsCtor<T, Params...>::f), 0);
+                detail::name_call(L, -1, class_name, "new");
+                lua_settable(L, -3);
+                //lua_pushcclosure(L, lua_CGCProtector, 0);
+                //lua_setfield(L, -2, "__newindex");
+
+                lua_setmetatable(L, -2);
+
+                lua_setglobal(L, class_name);
+
+                return *this;
+            }
+        }
+
+        Class<T>& make_visible()
+        {
+            if (!luaL_getglobal(L, class_name))
+            {
+                lua_pop(L, 1);
+                push_metatable();
+                lua_setglobal(L, class_name);
+            } else lua_pop(L, 1);
+            return *this;
+        }
+
+        // bytes an instance owns outside Lua, reported to the collector when it is boxed;
+        // shared by all States
+        Class<T>& external_size(size_t(*size)(const T&))
+        {
+            ExternalSize<T>::size = size;
+            return *this;
+        }
+
+        template<typename ...Funcs>
+        Class<T>& overload(const char* name, Funcs... functions) {
+            push_function_index();
+            OverloadedFunction<T, Funcs...>(L, functions...);
+            detail::name_overloads(L, -1, class_name, name);
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
+        }
+
+        template <class F>
+        Class<T>& fun(const char* name, F& func)
+        {
+            push_function_index();
+            Function::fun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
+        }
+
+        template <class F>
+        Class<T>& fun(const char* name, F&& func)
+        {
+            push_function_index();
+            Function::fun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
+        }
+
+        template <class F>
+        Class<T>& sfun(const char* name, F&& func)
+        {
+            fun(name, std::forward<F>(func));
+            make_visible();
+            lua_getglobal(L, class_name);
+            push_function_index();
+            lua_pushstring(L, name);
+            lua_rawget(L, -2);
+            lua_remove(L, -2);
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
+        }
+
+        template <class F>
+        Class<T>& vfun(const char* name, F&& func)
         {
-            push_metatable(L, this);
-            lua_pushstring(L, "__pnewindex");
-            if (!luaL_gettable(L, -2))
-            {
-                lua_pop(L, 1);
-                lua_newtable(L);
-                lua_pushvalue(L, -1);
-                lua_setfield(L, -3, "__pnewindex");
-            }
+            prop_fun(name, std::forward<F>(func));
+            push_metatable();
+            lua_pushstring(L, "__valid");
+            push_property_index();
+            lua_pushstring(L, name);
+            lua_rawget(L, -2);
             lua_remove(L, -2);
+            lua_settable(L, -3);
+            lua_pop(L, 1);
+            return *this;
         }
-        static int get_vtable(lua_State *L)
+
+        template <class F>
+        Class<T>& vcfun(const char* name, F&& func)
         {
-            lua_pushnumber(L, (double)**(uintptr_t**)lua_touserdata(L, 1));
-            return 1;
+            prop_cfun(name, std::forward<F>(func));
+            push_metatable();
+            lua_pushstring(L, "__valid");
+            push_property_index();
+            lua_pushstring(L, name);
+            lua_rawget(L, -2);
+            lua_remove(L, -2);
+            lua_settable(L, -3);
+            lua_pop(L, 1);
+            return *this;
         }
-        static void* topointer(lua_State *L, int idx)
+
+        template <class F>
+        Class<T>& cfun(const char* name, F& func)
         {
-            return *(void**)lua_touserdata(L, idx);
+            push_function_index();
+            Function::cfun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
         }
-        static int get_ptr(lua_State *L)
+
+        template <class F>
+        Class<T>& cfun(const char* name, F&& func)
         {
-            lua_pushnumber(L, (double)*(uintptr_t*)lua_touserdata(L, 1));
-            return 1;
+            push_function_index();
+            Function::cfun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
         }
-        static int set_ptr(lua_State *L)
+
+        template <class F>
+        Class<T>& scfun(const char* name, F&& func)
         {
-            *(uintptr_t*)lua_touserdata(L, 1) = (uintptr_t)lua_tonumber(L, 3);
-            return 0;
+            cfun(name, std::forward<F>(func));
+            make_visible();
+            lua_getglobal(L, class_name);
+            push_function_index();
+            lua_pushstring(L, name);
+            lua_rawget(L, -2);
+            lua_remove(L, -2);
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
         }
-        static int get_prop(lua_State *L)
-        {
-            auto offset = lua_tointeger(L, lua_upvalueindex(1));
-            auto type = lua_tointeger(L, lua_upvalueindex(2));
-
-            auto p = *(uintptr_t*)lua_touserdata(L, 1);
 
-            return lua_pushmemtype(L, MemoryType(type), (void*)(p + offset));
-        }
-        static int get_prop_struct(lua_State *L)
+        template <class F>
+        Class<T>& meta_fun(const char* name, F func)
         {
-            auto offset = lua_tointeger(L, lua_upvalueindex(1));
-
-            lua_getfield(L, lua_upvalueindex(2), "__key");
-            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
+            if (strcmp(name, "__gc") == 0) {
+                return meta_fun("__cgc", std::forward<decltype(func)>(func));
+            }
+            using FnType = decltype (func);
+            push_metatable();
+            Function::fun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
+            lua_setfield(L, -2, name);
             lua_pop(L, 1);
+            return *this;
+        }
 
-            auto p = *(uintptr_t*)lua_touserdata(L, 1);
-
-            if (*(void**)(p + offset) == nullptr)
-            {
-                lua_pushnil(L);
-                return 1;
+        template <class F>
+        Class<T>& meta_cfun(const char* name, F func)
+        {
+            if (strcmp(name, "__gc") == 0) {
+                return meta_cfun("__cgc", std::forward<decltype(func)>(func));
             }
-
-            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
-            *u = *(void**)(p + offset); *(u + 1) = 0;
-
-            push_metatable(L, c, true);
-            lua_setmetatable(L, -2);
-
-            return 1;
+            using func_t = decltype (func);
+            push_metatable();
+            Function::cfun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
         }
-        static int get_prop_struct_cast(lua_State *L)
+
+        template<class R, class Base> requires std::is_base_of_v<Base, T>
+        Class<T>& prop(const char* name, R(Base::* prop))
         {
-            auto offset = lua_tointeger(L, lua_upvalueindex(1));
+            using PropType = decltype (prop);
 
-            lua_getfield(L, lua_upvalueindex(2), "__key");
-            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
+            // each accessor gets its own copy, so their call stats stay apart
+            push_property_newindex();
+            new (lua_newuserdata(L, sizeof(prop))) PropType(prop);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassProperty<std::decay_t<R>, std::decay_t<Base>>::set), 1);
+            name_accessor(name, "set");
+            lua_setfield(L, -2, name);
             lua_pop(L, 1);
 
-            auto p = *(uintptr_t*)lua_touserdata(L, 1);
-            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
-            *u = (void*)(p + offset); *(u + 1) = 0;
-
-            push_metatable(L, c, true);
-            lua_setmetatable(L, -2);
-
-            return 1;
+            push_property_index();
+            new (lua_newuserdata(L, sizeof(prop))) PropType(prop);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassProperty<std::decay_t<R>, std::decay_t<Base>>::get), 1);
+            name_accessor(name, "get");
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
         }
-        static int set_prop(lua_State *L)
-        {
-            auto offset = lua_tointeger(L, lua_upvalueindex(1));
-            auto type = lua_tointeger(L, lua_upvalueindex(2));
 
-            auto p = *(uintptr_t*)lua_touserdata(L, 1);
-
-            lua_pullmemtype(L, MemoryType(type), (void*)(p + offset));
-            return 0;
-        }
-        static int dyn_prop(lua_State *L)
+        template<class R>
+        Class<T>& prop_fun(const char* name, R(* get)(), void(* set)(R) = nullptr)
         {
-            lua_getfield(L, 1, "__key");
-            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
-            lua_pop(L, 1);
+            using get_t = decltype(get);
+            using set_t = decltype(set);
 
-            if (lua_isnoneornil(L, 3))
+            if (set)
             {
-                lua_getglobal(L, "print");
-                static char buff[100] = { '\0' };
-                snprintf(buff, 100, "[Warning] %s.%s offset is nil, assuming '0'", c->class_name, lua_tolstring(L, 2, nullptr));
-                lua_pushstring(L, buff);
-                lua_call(L, 1, 0);
+                push_property_newindex();
+                new (lua_newuserdata(L, sizeof(set))) set_t(set);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFn<R, T>::set), 1);
+                name_accessor(name, "set");
+                lua_setfield(L, -2, name);
+                lua_pop(L, 1);
             }
 
-            auto flag = lua_tointeger(L, 5);
+            push_property_index();
+            new (lua_newuserdata(L, sizeof(get))) get_t(get);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFn<R, T>::get), 1);
+            name_accessor(name, "get");
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
+        }
 
-            if (lua_type(L, 4) == LUA_TTABLE)
+        template<class R, class Base> requires std::is_base_of_v<Base, T>
+        Class<T>& prop_fun(const char* name, R(Base::* get)(), void(Base::* set)(R) = nullptr)
+        {
+            using get_t = decltype (get);
+            using set_t = decltype (set);
+
+            if (set)
             {
-                c->push_property_index();
-                lua_pushvalue(L, 3);
-                lua_pushvalue(L, 4);
-                if (flag == 2)
-                    lua_pushcclosure(L, get_prop_struct_cast, 2);
-                else
-                    lua_pushcclosure(L, get_prop_struct, 2);
-                lua_setfield(L, -2, lua_tolstring(L, 2, nullptr));
+                push_property_newindex();
+                new (lua_newuserdata(L, sizeof(set))) set_t(set);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFn<R, Base>::set), 1);
+                name_accessor(name, "set");
+                lua_setfield(L, -2, name);
                 lua_pop(L, 1);
+            }
 
-                if (!flag) {
-                    c->push_property_newindex();
-                    lua_pushvalue(L, 3);
-                    lua_pushinteger(L, -0x20 /**type.ptr**/);
-                    lua_pushcclosure(L, set_prop, 2);
-                    lua_setfield(L, -2, lua_tolstring(L, 2, nullptr));
-                    lua_pop(L, 1);
-                }
-            } else {
-                c->push_property_index();
-                lua_pushvalue(L, 3);
-                lua_pushvalue(L, 4);
-                lua_pushcclosure(L, get_prop, 2);
-                lua_setfield(L, -2, lua_tolstring(L, 2, nullptr));
-                lua_pop(L, 1);
+            push_property_index();
+            new (lua_newuserdata(L, sizeof(get))) get_t(get);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFn<R, Base>::get), 1);
+            name_accessor(name, "get");
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
+        }
 
-                if (!flag) {
-                    c->push_property_newindex();
-                    lua_pushvalue(L, 3);
-                    lua_pushvalue(L, 4);
-                    lua_pushcclosure(L, set_prop, 2);
-                    lua_setfield(L, -2, lua_tolstring(L, 2, nullptr));
-                    lua_pop(L, 1);
-                }
+        template<class R, class Base> requires std::is_base_of_v<Base, T>
+        Class<T>& prop_fun(const char* name, R(Base::* get)() const, void(Base::* set)(R) const = nullptr)
+        {
+            using get_t = std::decay_t<decltype (get)>;
+            using set_t = std::decay_t<decltype (set)>;
 
-                c->set_size(lua_tointeger(L, 3) + get_type_size((MemoryType)lua_tointeger(L, 4)));
+            if (set)
+            {
+                push_property_newindex();
+                new (lua_newuserdata(L, sizeof(set))) set_t(set);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFn<R, Base>::set), 1);
+                name_accessor(name, "set");
+                lua_setfield(L, -2, name);
+                lua_pop(L, 1);
             }
 
-            return 0;
+            push_property_index();
+            new (lua_newuserdata(L, sizeof(get))) get_t(get);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFn<R, Base>::get), 1);
+            name_accessor(name, "get");
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
         }
-        static int dyn_call(lua_State *L)
-        {
-            lua_getfield(L, 1, "__key");
-            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
-
-            auto size = lua_isinteger(L, 2) ? lua_tointeger(L, 2) : c->get_size();
 
-            auto udata = (void*)malloc(size);
-            memset(udata, 0, size);
-            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
-            *u = udata; *(u + 1) = (void*)0xC0FFEE;
+        template <class R>
+        Class<T>& prop_fun(const char* name, std::function<R()> get, std::function<void(R)> set = nullptr)
+        {
+            using get_t = decltype (get);
+            using set_t = decltype (set);
 
-            push_metatable(L, c, true);
-            lua_setmetatable(L, -2);
+            if (set)
+            {
+                push_property_newindex();
+                new (lua_newuserdata(L, sizeof(set))) set_t(set);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunFn<R, T>::set), 1);
+                name_accessor(name, "set");
+                lua_setfield(L, -2, name);
+                lua_pop(L, 1);
+            }
 
-            return 1;
+            push_property_index();
+            new (lua_newuserdata(L, sizeof(get))) get_t(get);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunFn<R, T>::get), 1);
+            name_accessor(name, "get");
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
         }
-        static int dyn_read(lua_State *L)
+
+        template<class R, class Base> requires std::is_base_of_v<Base, T>
+        Class<T>& prop_fun(const char* name, std::function<R(Base*)> get, std::function<void(Base*, R)> set = nullptr)
         {
-            auto p = (void**)(uintptr_t)lua_tonumber(L, 2);
-            if (p == nullptr || *p == nullptr)
+            using get_t = decltype (get);
+            using set_t = decltype (set);
+
+            if (set)
             {
-                lua_pushnil(L);
-                return 1;
+                push_property_newindex();
+                new (lua_newuserdata(L, sizeof(set))) set_t(set);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunFn<R, Base>::set), 1);
+                name_accessor(name, "set");
+                lua_setfield(L, -2, name);
+                lua_pop(L, 1);
             }
 
-            lua_getfield(L, 1, "__key");
-            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
-
-            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
-            *u = *p; *(u + 1) = 0;
+            push_property_index();
+            new (lua_newuserdata(L, sizeof(get))) get_t(get);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunFn<R, Base>::get), 1);
+            name_accessor(name, "get");
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
+        }
 
-            push_metatable(L, c, true);
-            lua_setmetatable(L, -2);
+        template <class F, class G>
+        Class<T>& prop_fun(const char* name, F&& get, G&& set)
+        {
+            prop_fun(name, static_cast<function_type_t<std::decay_t<F>>>(get), static_cast<function_type_t<std::decay_t<G>>>(set));
+            return *this;
+        }
 
-            return 1;
+        template <class F>
+        Class<T>& prop_fun(const char* name, F&& get)
+        {
+            prop_fun(name, static_cast<function_type_t<std::decay_t<F>>>(get));
+            return *this;
         }
-        static int dyn_cast(lua_State *L)
+
+        template <class R, class U> requires std::is_integral_v<R> && (std::is_same_v<U, State> || std::is_same_v<U, lua_State*>)
+        Class<T>& prop_cfun(const char* name, R(*get)(U), R(*set)(U) = nullptr)
         {
-            auto p = (void*)(uintptr_t)lua_tonumber(L, 2);
-            if (p == 0)
+            using get_t = decltype (get);
+            using set_t = decltype (set);
+
+            if (set)
             {
-                lua_pushnil(L);
-                return 1;
+                push_property_newindex();
+                if constexpr (std::is_same_v<U, lua_State*>)
+                {
+                    lua_pushcclosure(L, set, 1);
+                }
+                else if constexpr (std::is_same_v<U, State>)
+                {
+                    new (lua_newuserdata(L, sizeof(set))) set_t(set);
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNCFun<R, T>::set), 1);
+                    name_accessor(name, "set");
+                }
+                lua_setfield(L, -2, name);
+                lua_pop(L, 1);
             }
 
-            lua_getfield(L, 1, "__key");
-            DynClass* c = static_cast<DynClass *>(lua_touserdata(L, -1));
+            push_property_index();
+            if constexpr (std::is_same_v<U, lua_State*>)
+            {
+                lua_pushcclosure(L, get, 1);
+            }
+            else if constexpr (std::is_same_v<U, State>)
+            {
+                new (lua_newuserdata(L, sizeof(get))) get_t(get);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNCFun<R, T>::get), 1);
+                name_accessor(name, "get");
+            }
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
+        }
 
-            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
-            *u = p; *(u + 1) = 0;
+        template <class R, class U, class Base> requires std::is_integral_v<R> && (std::is_same_v<U, State> || std::is_same_v<U, lua_State*>) && std::is_base_of_v<Base, T>
+        Class<T>& prop_cfun(const char* name, R(Base::*get)(U), R(Base::*set)(U) = nullptr)
+        {
+            using get_t = decltype (get);
+            using set_t = decltype (set);
 
-            push_metatable(L, c, true);
-            lua_setmetatable(L, -2);
+            if (set)
+            {
+                push_property_newindex();
+                new (lua_newuserdata(L, sizeof(set))) set_t(set);
+                if constexpr (std::is_same_v<U, lua_State*>)
+                {
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyCFunL<R, Base>::set), 1);
+                    name_accessor(name, "set");
+                }
+                else if constexpr (std::is_same_v<U, State>)
+                {
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyCFunS<R, Base>::set), 1);
+                    name_accessor(name, "set");
+                }
+                lua_setfield(L, -2, name);
+                lua_pop(L, 1);
+            }
 
-            return 1;
+            push_property_index();
+            new (lua_newuserdata(L, sizeof(get))) get_t(get);
+            if constexpr (std::is_same_v<U, lua_State*>)
+            {
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyCFunL<R, Base>::get), 1);
+                name_accessor(name, "get");
+            }
+            else if constexpr (std::is_same_v<U, State>)
+            {
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyCFunS<R, Base>::get), 1);
+                name_accessor(name, "get");
+            }
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
         }
-    };
-}
-#endif
-#endif
 
+        template <class R, class U> requires std::is_integral_v<R> && (std::is_same_v<U, State> || std::is_same_v<U, lua_State*>)
+        Class<T>& prop_cfun(const char* name, std::function<R(U)> get, std::function<R(U)> set = nullptr)
+        {
+            using get_t = decltype (get);
+            using set_t = decltype (set);
 
+            if (set)
+            {
+                push_property_newindex();
+                new (lua_newuserdata(L, sizeof(set))) set_t(set);
+                if constexpr (std::is_same_v<U, lua_State*>)
+                {
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunLCFn<R, T>::set), 1);
+                    name_accessor(name, "set");
+                }
+                else if constexpr (std::is_same_v<U, State>)
+                {
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunCFn<R, T>::set), 1);
+                    name_accessor(name, "set");
+                }
+                lua_setfield(L, -2, name);
+                lua_pop(L, 1);
+            }
 
-#include <functional>
+            push_property_index();
+            new (lua_newuserdata(L, sizeof(get))) get_t(get);
+            if constexpr (std::is_same_v<U, lua_State*>)
+            {
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunLCFn<R, T>::get), 1);
+                name_accessor(name, "get");
+            }
+            else if constexpr (std::is_same_v<U, State>)
+            {
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunCFn<R, T>::get), 1);
+                name_accessor(name, "get");
+            }
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
+            return *this;
+        }
 
+        template <class R, class U, class Base> requires std::is_integral_v<R> && (std::is_same_v<U, State> || std::is_same_v<U, lua_State*>) && std::is_base_of_v<Base, T>
+        Class<T>& prop_cfun(const char* name, std::function<R(Base*, U)> get, std::function<R(Base*, U)> set = nullptr)
+        {
+            using get_t = decltype (get);
+            using set_t = decltype (set);
 
-namespace LuaBinding {
+            if (set)
+            {
+                push_property_newindex();
+                new (lua_newuserdata(L, sizeof(set))) set_t(set);
+                if constexpr (std::is_same_v<U, lua_State*>)
+                {
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunLCFn<R, Base>::set), 1);
+                    name_accessor(name, "set");
+                }
+                else if constexpr (std::is_same_v<U, State>)
+                {
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunC<R, Base>::set), 1);
+                    name_accessor(name, "set");
+                }
+                lua_setfield(L, -2, name);
+                lua_pop(L, 1);
+            }
 
-    template<class T>
-    class helper {
-    public:
-        static void const* key() { static char value; return &value; }
-        static bool push_metatable(lua_State * L) {
-            lua_getglobal(L, "__METASTORE");
-            if (lua_rawgetp(L, -1, key()))
+            push_property_index();
+            new (lua_newuserdata(L, sizeof(get))) get_t(get);
+            if constexpr (std::is_same_v<U, lua_State*>)
             {
-                lua_remove(L, -2);
-                return false;
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunLCFn<R, Base>::get), 1);
+                name_accessor(name, "get");
+            }
+            else if constexpr (std::is_same_v<U, State>)
+            {
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunC<R, Base>::get), 1);
+                name_accessor(name, "get");
             }
+            lua_setfield(L, -2, name);
             lua_pop(L, 1);
-            lua_newtable(L);
-            lua_pushvalue(L, -1);
-            lua_rawsetp(L, -3, key());
-            lua_remove(L, -2);
-            return true;
+            return *this;
         }
-    };
 
-    template<typename T>
-    class Class {
-        lua_State* L = nullptr;
-        const char* class_name;
-    public:
-        using value_type = T;
-        Class(lua_State* L, const char* name) : L(L), class_name(name)
+        template <class F, class G>
+        Class<T>& prop_cfun(const char* name, F&& get, G&& set)
+        {
+            prop_cfun(name, static_cast<function_type_t<std::decay_t<F>>>(get), static_cast<function_type_t<std::decay_t<G>>>(set));
+            return *this;
+        }
+
+        template <class F>
+        Class<T>& prop_cfun(const char* name, F&& get)
+        {
+            prop_cfun(name, static_cast<function_type_t<std::decay_t<F>>>(get));
+            return *this;
+        }
+
+        static int dyn_read(lua_State *L)
+        {
+            auto p = (void**)(uintptr_t)lua_tonumber(L, 2);
+            if (p == nullptr || *p == nullptr)
+            {
+                lua_pushnil(L);
+                return 1;
+            }
+
+            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
+            *u = *p; *(u + 1) = 0;
+
+            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
+            lua_setmetatable(L, -2);
+
+            return 1;
+        }
+        static int dyn_cast(lua_State *L)
         {
-            if (!push_metatable())
+            auto p = (void*)(uintptr_t)lua_tonumber(L, 2);
+            if (p == 0)
             {
-                lua_pop(L, 1);
-                return;
+                lua_pushnil(L);
+                return 1;
             }
 
-            lua_pushcclosure(L, lua_CGCFunction, 0);
-            lua_setfield(L, -2, "__gc");
 
-            lua_pushcclosure(L, lua_CIndexFunction, 0);
-            lua_setfield(L, -2, "__index");
+            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
+            *u = p; *(u + 1) = 0;
 
-            lua_pushcclosure(L, lua_EQFunction, 0);
-            lua_setfield(L, -2, "__eq");
+            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
+            lua_setmetatable(L, -2);
 
-            lua_pushcclosure(L, lua_CNewIndexFunction, 0);
-            lua_setfield(L, -2, "__newindex");
+            return 1;
+        }
+    };
+}
 
-            lua_pushstring(L, name);
-            lua_setfield(L, -2, "__name");
 
-            lua_pushstring(L, name);
-            lua_pushcclosure(L, tostring, 1);
-            lua_setfield(L, -2, "__tostring");
 
-#ifdef LUABINDING_DYN_CLASSES
-            lua_pushcfunction(L, dyn_read);
-            lua_setfield(L, -2, "Read");
 
-            lua_pushcfunction(L, dyn_cast);
-            lua_setfield(L, -2, "Cast");
-#endif
+namespace LuaBinding {
+    class StackIter
+    {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        StackIter(lua_State* L, int index) : L(L), index(index) { }
+        StackIter operator++() { index++; return *this; }
+        std::pair<int, Object> operator*() { return { index, Object(L, index) }; }
+        bool operator!=(const StackIter& rhs) { return index != rhs.index; }
+    private:
+        lua_State* L;
+        int index;
+    };
+}
 
-            lua_pop(L, 1);
 
-            push_property_index();
-            lua_pushcfunction(L, get_ptr);
-            lua_setfield(L, -2, "ptr");
-#ifdef LUABINDING_DYN_CLASSES
-            lua_pushcfunction(L, get_vtable);
-            lua_setfield(L, -2, "vTable");
-            lua_pop(L, 1);
+#include <vector>
 
-            push_property_newindex();
-            lua_pushcfunction(L, set_ptr);
-            lua_setfield(L, -2, "ptr");
-#endif
-            lua_pop(L, 1);
-        }
-    private:
-        static int lua_CGCFunction(lua_State* S)
-        {
-            if (luaL_getmetafield(S, 1, "__cgc"))
-            {
-                lua_pushvalue(S, 1);
-                pcall(S, 1, 0);
-            }
-            auto u = (void**)lua_touserdata(S, 1);
-            if (*(u + 1) == (void*)0xC0FFEE) {
-                free(*u);
+
+namespace LuaBinding {
+    // Prebuilt Environments handed out per request. Keys a script adds to its env are recorded by
+    // a __newindex hook and cleared when the env comes back, copied globals are written again,
+    // so reuse costs a few rawsets instead of a new table, metatable and registry ref.
+    // Writes through rawset bypass the hook and are not cleared.
+    class EnvironmentPool {
+        lua_State* L;
+        std::vector<string_type> names;
+        std::vector<const char*> globals;
+        bool flatten;
+        bool snapshot;
+        bool fallback;
+        std::vector<Environment> free;
+
+        // __newindex(env, key, value) with the set of dirty keys as upvalue
+        static int track(lua_State* L)
+        {
+            lua_settop(L, 3);
+            lua_pushvalue(L, 2);
+            lua_pushvalue(L, 3);
+            lua_rawset(L, 1);
+            if (!lua_isnil(L, 3))
+            {
+                lua_pushvalue(L, 2);
+                lua_pushboolean(L, 1);
+                lua_rawset(L, lua_upvalueindex(1));
             }
             return 0;
         }
-        static int get_vtable(lua_State *L)
-        {
-            lua_pushnumber(L, (double)**(uintptr_t**)lua_touserdata(L, 1));
-            return 1;
-        }
-        static int get_ptr(lua_State* L)
-        {
-            lua_pushnumber(L, (double)*(uintptr_t*)lua_touserdata(L, 1));
-            return 1;
-        }
-        static int set_ptr(lua_State *L)
-        {
-            *(uintptr_t*)lua_touserdata(L, 1) = (uintptr_t)lua_tonumber(L, 3);
-            return 0;
-        }
-        static int tostring(lua_State* S)
-        {
-            char asdf[128] = { 0 };
-#ifdef ENV32
-                snprintf(asdf, sizeof(asdf), "%s{%X}", lua_tostring(S, lua_upvalueindex(1)), (uintptr_t)topointer(S, 1));
-#elifdef ENV64
-                snprintf(asdf, sizeof(asdf), "%s{%llX}", lua_tostring(S, lua_upvalueindex(1)), (uintptr_t)topointer(S, 1));
-#endif
-            lua_pushstring(S, asdf);
-            return 1;
-        }
-        static void* topointer(lua_State *L, int idx)
-        {
-            return *(void**)lua_touserdata(L, idx);
-        }
-        static int lua_EQFunction(lua_State* S)
+
+        Environment create()
         {
-            if (!lua_isuserdata(S, 1) || !lua_isuserdata(S, 2)) lua_pushboolean(S, false);
-            else
-                lua_pushboolean(S, *(uintptr_t*)lua_touserdata(S, 1) == *(uintptr_t*)lua_touserdata(S, 2));
-            return 1;
+            lua_newtable(L);
+            if (flatten)
+                Environment::populate(L, -1, globals, snapshot);
+            lua_newtable(L);
+            if (fallback)
+            {
+                lua_pushglobaltable(L);
+                lua_setfield(L, -2, "__index");
+            }
+            lua_newtable(L);
+            lua_pushcclosure(L, track, 1);
+            lua_setfield(L, -2, "__newindex");
+            lua_setmetatable(L, -2);
+            Environment env;
+            env.L = L;
+            env.idx = RegistryRefs::ref(L);
+            return env;
         }
-        static int lua_CIndexFunction(lua_State* S)
+
+        // false when the script replaced the metatable or its tracker, the env cannot be reused then
+        bool reset(const Environment& env)
         {
-            if (strcmp(lua_tostring(S, 2), "ptr") != 0
-                && strcmp(lua_tostring(S, 2), "valid") != 0
-                && luaL_getmetafield(S, 1, "__valid"))
+            env.push();
+            auto t = lua_gettop(L);
+            if (!lua_istable(L, t) || !lua_getmetatable(L, t))
             {
-                lua_pushvalue(S, 1);
-                lua_call(S, 1, 1);
-                if (!lua_toboolean(S, -1))
-                {
-                    lua_pushvalue(S, 1);
-                    if (luaL_getmetafield(S, 1, "__name")) {
-                        char asdf[128] = { 0 };
-#ifdef ENV32
-                            snprintf(asdf, sizeof(asdf), "%s{%X}", lua_tostring(S, -1), (uintptr_t)topointer(S, 1));
-#elifdef ENV64
-                            snprintf(asdf, sizeof(asdf), "%s{%llX}", lua_tostring(S, -1), (uintptr_t)topointer(S, 1));
-#endif
-                        lua_pop(S, 1);
-
-                        luaL_error(S, "Tried to access invalid %s (property '%s')", asdf, lua_tostring(S, 2));
-                    } else {
-                        lua_pop(S, 1);
-                        luaL_error(S, "Tried to access invalid unknown object (property '%s')", lua_tostring(S, 2));
-                    }
-                    return 0; // ??
-                }
-                lua_pop(S, 1);
+                lua_settop(L, t - 1);
+                return false;
             }
-            if (luaL_getmetafield(S, 1, "__pindex"))
+            lua_getfield(L, -1, "__newindex");
+            if (lua_tocfunction(L, -1) != track || !lua_getupvalue(L, -1, 1) || !lua_istable(L, -1))
             {
-                lua_pushvalue(S, 2);
-                if (luaL_gettable(S, -2))
-                {
-                    lua_remove(S, -2);
-                    lua_insert(S, 1);
-                    lua_call(S, lua_gettop(S) - 1, LUA_MULTRET);
-                    return lua_gettop(S);
-                }
-                else lua_pop(S, 1);
+                lua_settop(L, t - 1);
+                return false;
             }
-            if (luaL_getmetafield(S, 1, "__findex"))
+            auto dirty = lua_gettop(L);
+            lua_pushnil(L);
+            while (lua_next(L, dirty))
             {
-                lua_pushvalue(S, 2);
-                if (luaL_gettable(S, -2))
-                    return 1;
-                else lua_pop(S, 1);
+                lua_pop(L, 1);
+                lua_pushvalue(L, -1);
+                lua_pushnil(L);
+                lua_rawset(L, t);
             }
-            if (luaL_getmetafield(S, 1, lua_tostring(S, 2)))
-                return 1;
-            if (luaL_getmetafield(S, 1, "__cindex"))
+            // a fresh set, so one busy lease does not leave a large table behind
+            lua_newtable(L);
+            lua_setupvalue(L, dirty - 1, 1);
+            if (flatten)
+                Environment::populate(L, t, globals, snapshot);
+            lua_settop(L, t - 1);
+            return true;
+        }
+    public:
+        class Lease {
+            EnvironmentPool* pool = nullptr;
+            Environment env;
+        public:
+            Lease(EnvironmentPool* pool, Environment&& env) : pool(pool), env(std::move(env))
+            {}
+            Lease(const Lease&) = delete;
+            Lease& operator=(const Lease&) = delete;
+            Lease(Lease&& other) noexcept : pool(other.pool), env(std::move(other.env))
             {
-                lua_insert(S, 1);
-                lua_call(S, lua_gettop(S) - 1, LUA_MULTRET);
-                return lua_gettop(S);
+                other.pool = nullptr;
             }
-            return 0;
-        }
-        static int lua_CNewIndexFunction(lua_State* S)
-        {
-            if (luaL_getmetafield(S, 1, "__pnewindex"))
+            ~Lease()
             {
-                lua_pushvalue(S, 2);
-                if (luaL_gettable(S, -2))
-                {
-                    lua_pushvalue(S, 1);
-                    lua_pushvalue(S, 2);
-                    lua_pushvalue(S, 3);
-                    lua_call(S, 3, 0);
-                    return 0;
-                }
-                else lua_pop(S, 1);
+                if (pool)
+                    pool->release(std::move(env));
             }
-            if (luaL_getmetafield(S, 1, "__cnewindex"))
+
+            const Environment& get() const
             {
-                lua_pushvalue(S, 1);
-                lua_pushvalue(S, 2);
-                lua_pushvalue(S, 3);
-                lua_call(S, 3, 0);
-                return 0;
+                return env;
             }
-            lua_getmetatable(S, 1);
-            lua_pushvalue(S, 2);
-            lua_pushvalue(S, 3);
-            lua_settable(S, -3);
-            return 0;
-        }
-    private:
-        bool push_metatable()
-        {
-            return helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
-        }
-        void push_function_index()
-        {
-            push_metatable();
-            lua_pushstring(L, "__findex");
-            if (!luaL_gettable(L, -2))
+
+            operator const Environment& () const
             {
-                lua_pop(L, 1);
-                lua_newtable(L);
-                lua_pushvalue(L, -1);
-                lua_setfield(L, -3, "__findex");
+                return env;
             }
-            lua_remove(L, -2);
-        }
-        void push_property_index()
-        {
-            push_metatable();
-            lua_pushstring(L, "__pindex");
-            if (!luaL_gettable(L, -2))
+
+            const Environment* operator->() const
             {
-                lua_pop(L, 1);
-                lua_newtable(L);
-                lua_pushvalue(L, -1);
-                lua_setfield(L, -3, "__pindex");
+                return &env;
             }
-            lua_remove(L, -2);
+        };
+
+        // empty globals: plain envs reading through _G, otherwise flattened like Environment(L, globals, ...)
+        explicit EnvironmentPool(lua_State* L, const std::vector<const char*>& globals = {}, bool snapshot = false, bool fallback = true, size_t prebuilt = 0)
+            : L(L), names(globals.begin(), globals.end()), flatten(!globals.empty()), snapshot(snapshot), fallback(fallback || globals.empty())
+        {
+            for (auto& name : names)
+                this->globals.push_back(name.c_str());
+            free.reserve(prebuilt);
+            for (size_t i = 0; i < prebuilt; i++)
+                free.push_back(create());
         }
-        void push_property_newindex()
+        EnvironmentPool(const EnvironmentPool&) = delete;
+        EnvironmentPool& operator=(const EnvironmentPool&) = delete;
+
+        Lease acquire()
         {
-            push_metatable();
-            lua_pushstring(L, "__pnewindex");
-            if (!luaL_gettable(L, -2))
-            {
-                lua_pop(L, 1);
-                lua_newtable(L);
-                lua_pushvalue(L, -1);
-                lua_setfield(L, -3, "__pnewindex");
-            }
-            lua_remove(L, -2);
+            if (free.empty())
+                return Lease(this, create());
+            auto env = std::move(free.back());
+            free.pop_back();
+            return Lease(this, std::move(env));
         }
-    public:
-        template<typename F>
-        Class<T>& idx_cfun(F func)
+
+        // an env whose tracking was tampered with is dropped, acquire builds a new one
+        void release(Environment&& env)
         {
-            push_metatable();
-            lua_pushstring(L, "__cindex");
-            lua_pushcclosure(L, reinterpret_cast<lua_CFunction>(func), 0);
-            lua_settable(L, -3);
-            lua_pop(L, 1);
-            return *this;
+            if (!env.valid(L) || !reset(env))
+                return;
+            free.push_back(std::move(env));
         }
-        
-        template<class... Params>
-        Class<T>& ctor()
+
+        [[nodiscard]] size_t available() const
         {
-            auto str = string_type(class_name);
-            if (str.find('.') != string_type::npos)
-            {
-                auto enclosing_table = str.substr(0, str.find('.'));
-                auto real_class_name = str.substr(str.find('.') + 1);
-                if (!luaL_getglobal(L, enclosing_table.c_str()))
-                {
-                    lua_pop(L, 1);
-                    lua_newtable(L);
-                    lua_pushvalue(L, -1);
-                    lua_setglobal(L, enclosing_table.c_str());
-                }
-                lua_getfield(L, -1, real_class_name.c_str());
-                if (lua_isnil(L, -1))
-                {
-                    lua_pop(L, 1);
-                    push_metatable();
-                }
+            return free.size();
+        }
+    };
+}
 
-                lua_createtable(L, 0, 1);
-                lua_pushstring(L, "__call");
-                lua_pushcclosure(L, TraitsCtor<T, Params...>::f, 0);
-                lua_settable(L, -3);
-                //lua_pushcclosure(L, lua_CGCProtector, 0);
-                //lua_setfield(L, -2, "__newindex");
 
-                lua_setmetatable(L, -2);
+#include <deque>
+#include <cstring>
 
-                lua_setfield(L, -2, real_class_name.c_str());
 
-                return *this;
-            } else {
-                if (!luaL_getglobal(L, class_name))
-                {
-                    lua_pop(L, 1);
-                    push_metatable();
-                }
+namespace LuaBinding {
+    namespace detail {
+        inline uint64_t fnv1a(const char* data, size_t len, uint64_t hash = 0xcbf29ce484222325ull)
+        {
+            for (size_t i = 0; i < len; i++)
+            {
+                hash ^= (unsigned char)data[i];
+                hash *= 0x100000001b3ull;
+            }
+            return hash;
+        }
 
-                lua_createtable(L, 0, 1);
-                lua_pushstring(L, "__call");
-                lua_pushcclosure(L, TraitsCtor<T, Params...>::f, 0);
-                lua_settable(L, -3);
-                //lua_pushcclosure(L, lua_CGCProtector, 0);
-                //lua_setfield(L, -2, "__newindex");
+        inline int write_string(lua_State*, const void* p, size_t size, void* ud)
+        {
+            ((string_type*)ud)->append((const char*)p, size);
+            return 0;
+        }
 
-                lua_setmetatable(L, -2);
+        // lua_dump of the function on top of the stack
+        inline int dump(lua_State* L, lua_Writer writer, void* ud, bool strip = true)
+        {
+#if LUA_VERSION_NUM >= 503
+            return lua_dump(L, writer, ud, strip);
+#else
+            return lua_dump(L, writer, ud);
+#endif
+        }
 
-                lua_setglobal(L, class_name);
+        struct BufferReader {
+            const char* data;
+            size_t size;
+        };
 
-                return *this;
-            }
+        inline const char* read_buffer(lua_State*, void* ud, size_t* size)
+        {
+            auto reader = (BufferReader*)ud;
+            *size = reader->size;
+            reader->size = 0;
+            return *size ? reader->data : nullptr;
         }
 
-        Class<T>& make_visible()
+        // loads precompiled bytecode only, text is rejected
+        inline int load_bytecode(lua_State* L, const char* data, size_t size, const char* chunkname)
         {
-            if (!luaL_getglobal(L, class_name))
+            BufferReader reader = { data, size };
+#if LUA_VERSION_NUM >= 502
+            return lua_load(L, read_buffer, &reader, chunkname, "b");
+#else
+            if (!size || data[0] != LUA_SIGNATURE[0])
             {
-                lua_pop(L, 1);
-                push_metatable();
-                lua_setglobal(L, class_name);
-            } else lua_pop(L, 1);
-            return *this;
+                lua_pushliteral(L, "not a precompiled chunk");
+                return LUA_ERRSYNTAX;
+            }
+            return lua_load(L, read_buffer, &reader, chunkname);
+#endif
         }
+    }
 
-        template<typename ...Funcs>
-        Class<T>& overload(const char* name, Funcs... functions) {
-            push_function_index();
-            OverloadedFunction<T, Funcs...>(L, functions...);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+    // Compiled chunks of a lua_State, keyed by source and chunkname or by a caller supplied name;
+    // a named chunk keeps the chunkname it was first compiled with until it is invalidated. Entries keep the bytecode in a registry table and every hit loads a fresh
+    // closure from it, so runs in different Environments never share upvalues; loading bytecode
+    // still skips the parser. The oldest entry is dropped once limit is reached.
+    class ChunkCache {
+        std::deque<string_type> order;
+        size_t limit;
+        int chunks;
+
+        static char* key()
+        {
+            static char k;
+            return &k;
+        }
+
+        // '#' + 8 byte source hash + chunkname, or '@' + name. Hash keys also keep the source in
+        // their entry and compare it on a hit. Chunknames longer than LUA_IDSIZE, like the code
+        // itself passed by exec, are replaced by '\0' + their 8 byte hash to keep keys short.
+        static string_type make_key(const char* code, size_t len, const char* chunkname, const char* name)
+        {
+            if (name)
+                return string_type("@") + name;
+            auto hash = detail::fnv1a(code, len);
+            auto chunkname_len = strlen(chunkname);
+            if (chunkname_len <= LUA_IDSIZE)
+            {
+                string_type result(1 + sizeof(hash), '#');
+                memcpy(result.data() + 1, &hash, sizeof(hash));
+                return result + chunkname;
+            }
+            auto chunkname_hash = chunkname == code && chunkname_len == len ? hash : detail::fnv1a(chunkname, chunkname_len);
+            string_type result(2 + 2 * sizeof(hash), '#');
+            memcpy(result.data() + 1, &hash, sizeof(hash));
+            result[1 + sizeof(hash)] = '\0';
+            memcpy(result.data() + 2 + sizeof(hash), &chunkname_hash, sizeof(hash));
+            return result;
         }
 
-        template <class F>
-        Class<T>& fun(const char* name, F& func)
+        void erase(lua_State* L, const string_type& k)
         {
-            push_function_index();
-            Function::fun<T>(L, func);
-            lua_setfield(L, -2, name);
+            lua_rawgeti(L, LUA_REGISTRYINDEX, chunks);
+            lua_pushlstring(L, k.data(), k.size());
+            lua_pushnil(L);
+            lua_rawset(L, -3);
             lua_pop(L, 1);
-            return *this;
+            for (auto it = order.begin(); it != order.end(); ++it)
+            {
+                if (*it == k)
+                {
+                    order.erase(it);
+                    break;
+                }
+            }
+        }
+    public:
+        ChunkCache(lua_State* L, size_t limit) : limit(limit)
+        {
+            lua_newtable(L);
+            chunks = luaL_ref(L, LUA_REGISTRYINDEX);
         }
+        ChunkCache(const ChunkCache&) = delete;
+        ChunkCache& operator=(const ChunkCache&) = delete;
 
-        template <class F>
-        Class<T>& fun(const char* name, F&& func)
+        static ChunkCache* get(lua_State* L)
         {
-            push_function_index();
-            Function::fun<T>(L, func);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+            return detail::state_data<ChunkCache>(L, key());
         }
 
-        template <class F>
-        Class<T>& sfun(const char* name, F&& func)
+        static ChunkCache* enable(lua_State* L, size_t limit)
         {
-            fun(name, std::forward<F>(func));
-            make_visible();
-            lua_getglobal(L, class_name);
-            push_function_index();
-            lua_pushstring(L, name);
-            lua_rawget(L, -2);
-            lua_remove(L, -2);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+            disable(L);
+            if (!limit)
+                return nullptr;
+            return detail::make_state_data<ChunkCache>(L, key(), L, limit);
         }
 
-        template <class F>
-        Class<T>& vfun(const char* name, F&& func)
+        static void disable(lua_State* L)
         {
-            prop_fun(name, std::forward<F>(func));
-            push_metatable();
-            lua_pushstring(L, "__valid");
-            push_property_index();
-            lua_pushstring(L, name);
-            lua_rawget(L, -2);
-            lua_remove(L, -2);
-            lua_settable(L, -3);
-            lua_pop(L, 1);
-            return *this;
+            if (auto cache = get(L))
+            {
+                cache->clear(L);
+                luaL_unref(L, LUA_REGISTRYINDEX, cache->chunks);
+                detail::drop_state_data(L, key());
+            }
         }
 
-        template <class F>
-        Class<T>& vcfun(const char* name, F&& func)
+        // pushes a fresh closure of the cached chunk and returns true, or returns false with the stack untouched
+        bool fetch(lua_State* L, const char* code, size_t len, const char* chunkname = "=", const char* name = nullptr)
         {
-            prop_cfun(name, std::forward<F>(func));
-            push_metatable();
-            lua_pushstring(L, "__valid");
-            push_property_index();
-            lua_pushstring(L, name);
+            auto k = make_key(code, len, chunkname, name);
+            auto top = lua_gettop(L);
+            lua_rawgeti(L, LUA_REGISTRYINDEX, chunks);
+            lua_pushlstring(L, k.data(), k.size());
             lua_rawget(L, -2);
-            lua_remove(L, -2);
-            lua_settable(L, -3);
-            lua_pop(L, 1);
-            return *this;
+            if (!lua_istable(L, -1))
+            {
+                lua_settop(L, top);
+                return false;
+            }
+            if (!name)
+            {
+                lua_rawgeti(L, -1, 2);
+                size_t source_len;
+                auto source = lua_tolstring(L, -1, &source_len);
+                auto same = source && source_len == len && !memcmp(source, code, len);
+                lua_pop(L, 1);
+                if (!same)
+                {
+                    lua_settop(L, top);
+                    return false;
+                }
+            }
+            lua_rawgeti(L, -1, 1);
+            size_t size;
+            auto bytecode = lua_tolstring(L, -1, &size);
+            if (!bytecode || detail::load_bytecode(L, bytecode, size, chunkname))
+            {
+                lua_settop(L, top);
+                return false;
+            }
+            lua_replace(L, top + 1);
+            lua_settop(L, top + 1);
+            return true;
         }
 
-        template <class F>
-        Class<T>& cfun(const char* name, F& func)
+        // caches the function on top of the stack, leaving it there
+        void insert(lua_State* L, const char* code, size_t len, const char* chunkname = "=", const char* name = nullptr)
         {
-            push_function_index();
-            Function::cfun<T>(L, func);
-            lua_setfield(L, -2, name);
+            string_type bytecode;
+            if (detail::dump(L, detail::write_string, &bytecode, false))
+                return;
+            auto k = make_key(code, len, chunkname, name);
+            erase(L, k);
+            lua_rawgeti(L, LUA_REGISTRYINDEX, chunks);
+            if (order.size() >= limit)
+            {
+                lua_pushlstring(L, order.front().data(), order.front().size());
+                lua_pushnil(L);
+                lua_rawset(L, -3);
+                order.pop_front();
+            }
+            order.push_back(k);
+            lua_pushlstring(L, k.data(), k.size());
+            lua_createtable(L, 2, 0);
+            lua_pushlstring(L, bytecode.data(), bytecode.size());
+            lua_rawseti(L, -2, 1);
+            if (!name)
+            {
+                lua_pushlstring(L, code, len);
+                lua_rawseti(L, -2, 2);
+            }
+            lua_rawset(L, -3);
             lua_pop(L, 1);
-            return *this;
         }
 
-        template <class F>
-        Class<T>& cfun(const char* name, F&& func)
+        void invalidate(lua_State* L, const char* name)
         {
-            push_function_index();
-            Function::cfun<T>(L, func);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+            erase(L, make_key(nullptr, 0, nullptr, name));
         }
 
-        template <class F>
-        Class<T>& scfun(const char* name, F&& func)
+        void invalidate(lua_State* L, const char* code, size_t len, const char* chunkname = "=")
         {
-            cfun(name, std::forward<F>(func));
-            make_visible();
-            lua_getglobal(L, class_name);
-            push_function_index();
-            lua_pushstring(L, name);
-            lua_rawget(L, -2);
-            lua_remove(L, -2);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+            erase(L, make_key(code, len, chunkname, nullptr));
         }
 
-        template <class F>
-        Class<T>& meta_fun(const char* name, F func)
+        void clear(lua_State* L)
         {
-            if (strcmp(name, "__gc") == 0) {
-                return meta_fun("__cgc", std::forward<decltype(func)>(func));
-            }
-            using FnType = decltype (func);
-            push_metatable();
-            Function::fun<T>(L, func);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+            lua_newtable(L);
+            lua_rawseti(L, LUA_REGISTRYINDEX, chunks);
+            order.clear();
         }
 
-        template <class F>
-        Class<T>& meta_cfun(const char* name, F func)
+        [[nodiscard]] size_t size() const
         {
-            if (strcmp(name, "__gc") == 0) {
-                return meta_cfun("__cgc", std::forward<decltype(func)>(func));
-            }
-            using func_t = decltype (func);
-            push_metatable();
-            Function::cfun<T>(L, func);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+            return order.size();
         }
 
-        template<class R, class Base> requires std::is_base_of_v<Base, T>
-        Class<T>& prop(const char* name, R(Base::* prop))
+        [[nodiscard]] size_t capacity() const
         {
-            using PropType = decltype (prop);
-
-            push_property_index();
+            return limit;
+        }
+    };
+}
 
-            push_property_newindex();
-            new (lua_newuserdata(L, sizeof(prop))) PropType(prop);
-            lua_pushvalue(L, -1);
-            lua_pushcclosure(L, TraitsClassProperty<std::decay_t<R>, std::decay_t<Base>>::set, 1);
-            lua_setfield(L, -3, name);
-            lua_remove(L, -2);
+#include <cstdio>
+#include <cstring>
 
-            lua_pushcclosure(L, TraitsClassProperty<std::decay_t<R>, std::decay_t<Base>>::get, 1);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
-        }
 
-        template<class R>
-        Class<T>& prop_fun(const char* name, R(* get)(), void(* set)(R) = nullptr)
-        {
-            using get_t = decltype(get);
-            using set_t = decltype(set);
 
-            if (set)
-            {
-                push_property_newindex();
-                new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                lua_pushcclosure(L, TraitsClassPropertyNFn<R, T>::set, 1);
-                lua_setfield(L, -2, name);
-                lua_pop(L, 1);
-            }
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 
-            push_property_index();
-            new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            lua_pushcclosure(L, TraitsClassPropertyNFn<R, T>::get, 1);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+namespace LuaBinding {
+    // Read-only view of a whole file, mapped instead of copied
+    class MappedFile {
+        const char* ptr = nullptr;
+        size_t len = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#endif
+    public:
+        MappedFile() = default;
+        explicit MappedFile(const char* path)
+        {
+            open(path);
         }
-
-        template<class R, class Base> requires std::is_base_of_v<Base, T>
-        Class<T>& prop_fun(const char* name, R(Base::* get)(), void(Base::* set)(R) = nullptr)
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other) noexcept
         {
-            using get_t = decltype (get);
-            using set_t = decltype (set);
-
-            if (set)
+            *this = std::move(other);
+        }
+        MappedFile& operator=(MappedFile&& other) noexcept
+        {
+            if (this != &other)
             {
-                push_property_newindex();
-                new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                lua_pushcclosure(L, TraitsClassPropertyFn<R, Base>::set, 1);
-                lua_setfield(L, -2, name);
-                lua_pop(L, 1);
+                close();
+                std::swap(ptr, other.ptr);
+                std::swap(len, other.len);
+#ifdef _WIN32
+                std::swap(file, other.file);
+                std::swap(mapping, other.mapping);
+#endif
             }
-
-            push_property_index();
-            new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            lua_pushcclosure(L, TraitsClassPropertyFn<R, Base>::get, 1);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
             return *this;
         }
-
-        template<class R, class Base> requires std::is_base_of_v<Base, T>
-        Class<T>& prop_fun(const char* name, R(Base::* get)() const, void(Base::* set)(R) const = nullptr)
+        ~MappedFile()
         {
-            using get_t = std::decay_t<decltype (get)>;
-            using set_t = std::decay_t<decltype (set)>;
+            close();
+        }
 
-            if (set)
+        bool open(const char* path)
+        {
+            close();
+#ifdef _WIN32
+            file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                return false;
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(file, &size))
             {
-                push_property_newindex();
-                new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                lua_pushcclosure(L, TraitsClassPropertyFn<R, Base>::set, 1);
-                lua_setfield(L, -2, name);
-                lua_pop(L, 1);
+                close();
+                return false;
             }
-
-            push_property_index();
-            new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            lua_pushcclosure(L, TraitsClassPropertyFn<R, Base>::get, 1);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+            len = (size_t)size.QuadPart;
+            if (!len)
+            {
+                ptr = "";
+                return true;
+            }
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping)
+                ptr = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+            auto fd = ::open(path, O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st))
+            {
+                ::close(fd);
+                return false;
+            }
+            len = (size_t)st.st_size;
+            if (!len)
+            {
+                ::close(fd);
+                ptr = "";
+                return true;
+            }
+            auto view = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (view != MAP_FAILED)
+                ptr = (const char*)view;
+#endif
+            if (!ptr)
+                close();
+            return ptr != nullptr;
         }
 
-        template <class R>
-        Class<T>& prop_fun(const char* name, std::function<R()> get, std::function<void(R)> set = nullptr)
+        void close()
         {
-            using get_t = decltype (get);
-            using set_t = decltype (set);
-
-            if (set)
+            if (ptr && len)
             {
-                push_property_newindex();
-                new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                lua_pushcclosure(L, TraitsClassPropertyNFunFn<R, T>::set, 1);
-                lua_setfield(L, -2, name);
-                lua_pop(L, 1);
+#ifdef _WIN32
+                UnmapViewOfFile(ptr);
+#else
+                munmap((void*)ptr, len);
+#endif
             }
+#ifdef _WIN32
+            if (mapping)
+                CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE)
+                CloseHandle(file);
+            mapping = nullptr;
+            file = INVALID_HANDLE_VALUE;
+#endif
+            ptr = nullptr;
+            len = 0;
+        }
 
-            push_property_index();
-            new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            lua_pushcclosure(L, TraitsClassPropertyNFunFn<R, T>::get, 1);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+        [[nodiscard]] const char* data() const
+        {
+            return ptr;
         }
 
-        template<class R, class Base> requires std::is_base_of_v<Base, T>
-        Class<T>& prop_fun(const char* name, std::function<R(Base*)> get, std::function<void(Base*, R)> set = nullptr)
+        [[nodiscard]] size_t size() const
         {
-            using get_t = decltype (get);
-            using set_t = decltype (set);
+            return len;
+        }
 
-            if (set)
+        [[nodiscard]] bool valid() const
+        {
+            return ptr != nullptr;
+        }
+    };
+}
+
+namespace LuaBinding {
+    namespace detail {
+        // skips a leading "#!" style line like luaL_loadfile, keeping its newline for line numbers
+        inline void skip_shebang(const char*& data, size_t& size)
+        {
+            if (!size || data[0] != '#')
+                return;
+            while (size && *data != '\n')
             {
-                push_property_newindex();
-                new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                lua_pushcclosure(L, TraitsClassPropertyFunFn<R, Base>::set, 1);
-                lua_setfield(L, -2, name);
-                lua_pop(L, 1);
+                data++;
+                size--;
             }
-
-            push_property_index();
-            new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            lua_pushcclosure(L, TraitsClassPropertyFunFn<R, Base>::get, 1);
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
         }
+    }
 
-        template <class F, class G>
-        Class<T>& prop_fun(const char* name, F&& get, G&& set)
+    // Bytecode of compiled chunks kept in a directory across runs. Files are named after the
+    // source hash and the interpreter build, so a different Lua/LuaJIT never sees them. Each file
+    // starts with the build tag, the source length and a second source hash, checked before
+    // loading; a file that does not match or fails to load is recompiled and rewritten.
+    // Stripped bytecode loses line numbers, so only strip when warm and cold runs may differ in
+    // their error messages.
+    class BytecodeCache {
+        string_type dir;
+        bool strip;
+
+        static char* key()
         {
-            prop_fun(name, static_cast<function_type_t<std::decay_t<F>>>(get), static_cast<function_type_t<std::decay_t<G>>>(set));
-            return *this;
+            static char k;
+            return &k;
         }
 
-        template <class F>
-        Class<T>& prop_fun(const char* name, F&& get)
+        string_type path(const char* code, size_t len, const char* chunkname) const
         {
-            prop_fun(name, static_cast<function_type_t<std::decay_t<F>>>(get));
-            return *this;
+            auto hash = detail::fnv1a(code, len);
+            hash = detail::fnv1a(chunkname, strlen(chunkname), hash);
+            char name[64];
+            snprintf(name, sizeof(name), "%016llx-%s.luac", (unsigned long long)hash, version());
+            return dir + "/" + name;
         }
 
-        template <class R, class U> requires std::is_integral_v<R> && (std::is_same_v<U, State> || std::is_same_v<U, lua_State*>)
-        Class<T>& prop_cfun(const char* name, R(*get)(U), R(*set)(U) = nullptr)
+        // build tag, '\0', source length and a hash independent of the file name one
+        static string_type header(const char* code, size_t len)
         {
-            using get_t = decltype (get);
-            using set_t = decltype (set);
-
-            if (set)
-            {
-                push_property_newindex();
-                if constexpr (std::is_same_v<U, lua_State*>)
-                {
-                    lua_pushcclosure(L, set, 1);
-                }
-                else if constexpr (std::is_same_v<U, State>)
-                {
-                    new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                    lua_pushcclosure(L, TraitsClassPropertyNCFun<R, T>::set, 1);
-                }
-                lua_setfield(L, -2, name);
-                lua_pop(L, 1);
-            }
+            string_type result(version());
+            result += '\0';
+            uint64_t words[2] = { (uint64_t)len, detail::fnv1a(code, len, 0x84222325cbf29ce4ull) };
+            result.append((const char*)words, sizeof(words));
+            return result;
+        }
 
-            push_property_index();
-            if constexpr (std::is_same_v<U, lua_State*>)
-            {
-                lua_pushcclosure(L, get, 1);
-            }
-            else if constexpr (std::is_same_v<U, State>)
+        bool write(const string_type& file, const string_type& bytecode) const
+        {
+            auto tmp = file + ".tmp";
+            auto f = fopen(tmp.c_str(), "wb");
+            if (!f)
+                return false;
+            auto ok = fwrite(bytecode.data(), 1, bytecode.size(), f) == bytecode.size();
+            ok = !fclose(f) && ok;
+            if (ok)
             {
-                new (lua_newuserdata(L, sizeof(get))) get_t(get);
-                lua_pushcclosure(L, TraitsClassPropertyNCFun<R, T>::get, 1);
+#ifdef _WIN32
+                remove(file.c_str());
+#endif
+                ok = !rename(tmp.c_str(), file.c_str());
             }
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+            if (!ok)
+                remove(tmp.c_str());
+            return ok;
         }
+    public:
+        BytecodeCache(string_type dir, bool strip) : dir(std::move(dir)), strip(strip)
+        {}
 
-        template <class R, class U, class Base> requires std::is_integral_v<R> && (std::is_same_v<U, State> || std::is_same_v<U, lua_State*>) && std::is_base_of_v<Base, T>
-        Class<T>& prop_cfun(const char* name, R(Base::*get)(U), R(Base::*set)(U) = nullptr)
+        static BytecodeCache* get(lua_State* L)
         {
-            using get_t = decltype (get);
-            using set_t = decltype (set);
+            return detail::state_data<BytecodeCache>(L, key());
+        }
 
-            if (set)
-            {
-                push_property_newindex();
-                new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                if constexpr (std::is_same_v<U, lua_State*>)
-                {
-                    lua_pushcclosure(L, TraitsClassPropertyCFunL<R, Base>::set, 1);
-                }
-                else if constexpr (std::is_same_v<U, State>)
-                {
-                    lua_pushcclosure(L, TraitsClassPropertyCFunS<R, Base>::set, 1);
-                }
-                lua_setfield(L, -2, name);
-                lua_pop(L, 1);
-            }
+        static BytecodeCache* enable(lua_State* L, const char* dir, bool strip = false)
+        {
+            disable(L);
+            return detail::make_state_data<BytecodeCache>(L, key(), string_type(dir), strip);
+        }
 
-            push_property_index();
-            new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            if constexpr (std::is_same_v<U, lua_State*>)
-            {
-                lua_pushcclosure(L, TraitsClassPropertyCFunL<R, Base>::get, 1);
-            }
-            else if constexpr (std::is_same_v<U, State>)
-            {
-                lua_pushcclosure(L, TraitsClassPropertyCFunS<R, Base>::get, 1);
-            }
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+        static void disable(lua_State* L)
+        {
+            if (get(L))
+                detail::drop_state_data(L, key());
         }
 
-        template <class R, class U> requires std::is_integral_v<R> && (std::is_same_v<U, State> || std::is_same_v<U, lua_State*>)
-        Class<T>& prop_cfun(const char* name, std::function<R(U)> get, std::function<R(U)> set = nullptr)
+        // interpreter build the bytecode belongs to, part of every file name
+        static const char* version()
         {
-            using get_t = decltype (get);
-            using set_t = decltype (set);
+            static const string_type tag = [] {
+                char buf[48];
+#ifdef LUAJIT_VERSION_NUM
+                snprintf(buf, sizeof(buf), "jit%d-p%d-n%d", LUAJIT_VERSION_NUM, (int)sizeof(void*), (int)sizeof(lua_Number));
+#else
+                snprintf(buf, sizeof(buf), "lua%d-p%d-n%d", LUA_VERSION_NUM, (int)sizeof(void*), (int)sizeof(lua_Number));
+#endif
+                return string_type(buf);
+            }();
+            return tag.c_str();
+        }
 
-            if (set)
+        // pushes the compiled chunk from disk, or compiles it and stores the bytecode
+        int load(lua_State* L, const char* code, size_t len, const char* chunkname)
+        {
+            auto file = path(code, len, chunkname);
+            auto head = header(code, len);
             {
-                push_property_newindex();
-                new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                if constexpr (std::is_same_v<U, lua_State*>)
-                {
-                    lua_pushcclosure(L, TraitsClassPropertyNFunLCFn<R, T>::set, 1);
-                }
-                else if constexpr (std::is_same_v<U, State>)
+                MappedFile mapped(file.c_str());
+                if (mapped.valid() && mapped.size() > head.size() && !memcmp(mapped.data(), head.data(), head.size()))
                 {
-                    lua_pushcclosure(L, TraitsClassPropertyNFunCFn<R, T>::set, 1);
+                    if (!detail::load_bytecode(L, mapped.data() + head.size(), mapped.size() - head.size(), chunkname))
+                        return 0;
+                    lua_pop(L, 1);
                 }
-                lua_setfield(L, -2, name);
-                lua_pop(L, 1);
             }
+            auto status = luaL_loadbuffer(L, code, len, chunkname);
+            if (status)
+                return status;
+            if (!detail::dump(L, detail::write_string, &head, strip))
+                write(file, head);
+            return 0;
+        }
 
-            push_property_index();
-            new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            if constexpr (std::is_same_v<U, lua_State*>)
-            {
-                lua_pushcclosure(L, TraitsClassPropertyNFunLCFn<R, T>::get, 1);
-            }
-            else if constexpr (std::is_same_v<U, State>)
-            {
-                lua_pushcclosure(L, TraitsClassPropertyNFunCFn<R, T>::get, 1);
-            }
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+        bool invalidate(const char* code, size_t len, const char* chunkname)
+        {
+            return !remove(path(code, len, chunkname).c_str());
         }
 
-        template <class R, class U, class Base> requires std::is_integral_v<R> && (std::is_same_v<U, State> || std::is_same_v<U, lua_State*>) && std::is_base_of_v<Base, T>
-        Class<T>& prop_cfun(const char* name, std::function<R(Base*, U)> get, std::function<R(Base*, U)> set = nullptr)
+        [[nodiscard]] const string_type& directory() const
         {
-            using get_t = decltype (get);
-            using set_t = decltype (set);
+            return dir;
+        }
+    };
+}
 
-            if (set)
-            {
-                push_property_newindex();
-                new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                if constexpr (std::is_same_v<U, lua_State*>)
-                {
-                    lua_pushcclosure(L, TraitsClassPropertyFunLCFn<R, Base>::set, 1);
-                }
-                else if constexpr (std::is_same_v<U, State>)
-                {
-                    lua_pushcclosure(L, TraitsClassPropertyFunC<R, Base>::set, 1);
-                }
-                lua_setfield(L, -2, name);
-                lua_pop(L, 1);
-            }
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
 
-            push_property_index();
-            new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            if constexpr (std::is_same_v<U, lua_State*>)
-            {
-                lua_pushcclosure(L, TraitsClassPropertyFunLCFn<R, Base>::get, 1);
-            }
-            else if constexpr (std::is_same_v<U, State>)
-            {
-                lua_pushcclosure(L, TraitsClassPropertyFunC<R, Base>::get, 1);
-            }
-            lua_setfield(L, -2, name);
-            lua_pop(L, 1);
-            return *this;
+
+
+namespace LuaBinding {
+    // Result of a background compile, loaded into a State with State::load(bytecode)
+    struct Bytecode {
+        string_type chunkname;
+        string_type code;
+        string_type error;
+
+        [[nodiscard]] bool ok() const
+        {
+            return error.empty();
         }
+    };
+
+    // Compiles chunks to bytecode on worker threads, each owning a scratch lua_State.
+    // Callbacks run on the worker thread; hand the Bytecode over to the thread owning the State.
+    class Compiler {
+        using Job = std::function<void(lua_State*)>;
+        std::vector<std::thread> workers;
+        std::deque<Job> jobs;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stopping = false;
+        bool strip;
 
-        template <class F, class G>
-        Class<T>& prop_cfun(const char* name, F&& get, G&& set)
+        void run()
         {
-            prop_cfun(name, static_cast<function_type_t<std::decay_t<F>>>(get), static_cast<function_type_t<std::decay_t<G>>>(set));
-            return *this;
+            lua_State* L = nullptr;
+            for (;;)
+            {
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this] { return stopping || !jobs.empty(); });
+                    if (jobs.empty())
+                        break;
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                // without a state the job fails, the next one tries again
+                if (!L)
+                    L = luaL_newstate();
+                job(L);
+                if (L)
+                    lua_settop(L, 0);
+            }
+            if (L)
+                lua_close(L);
         }
 
-        template <class F>
-        Class<T>& prop_cfun(const char* name, F&& get)
+        void post(Job job)
         {
-            prop_cfun(name, static_cast<function_type_t<std::decay_t<F>>>(get));
-            return *this;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(std::move(job));
+            }
+            cv.notify_one();
         }
 
-        static int dyn_read(lua_State *L)
+        static Bytecode build(lua_State* L, const char* code, size_t len, string_type chunkname, bool strip)
         {
-            auto p = (void**)(uintptr_t)lua_tonumber(L, 2);
-            if (p == nullptr || *p == nullptr)
+            Bytecode result;
+            result.chunkname = std::move(chunkname);
+            if (!L)
+                result.error = "not enough memory";
+            else if (luaL_loadbuffer(L, code, len, result.chunkname.c_str()))
             {
-                lua_pushnil(L);
-                return 1;
+                size_t size = 0;
+                auto error = lua_tolstring(L, -1, &size);
+                result.error = error ? string_type(error, size) : string_type("compile error");
             }
-
-            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
-            *u = *p; *(u + 1) = 0;
-
-            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
-            lua_setmetatable(L, -2);
-
-            return 1;
+            else if (detail::dump(L, detail::write_string, &result.code, strip))
+                result.error = "unable to dump given function";
+            return result;
         }
-        static int dyn_cast(lua_State *L)
+    public:
+        explicit Compiler(size_t threads = 1, bool strip = false) : strip(strip)
+        {
+            if (!threads)
+                threads = 1;
+            workers.reserve(threads);
+            for (size_t i = 0; i < threads; i++)
+                workers.emplace_back([this] { run(); });
+        }
+        Compiler(const Compiler&) = delete;
+        Compiler& operator=(const Compiler&) = delete;
+        // finishes the queued jobs before returning
+        ~Compiler()
         {
-            auto p = (void*)(uintptr_t)lua_tonumber(L, 2);
-            if (p == 0)
             {
-                lua_pushnil(L);
-                return 1;
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
             }
+            cv.notify_all();
+            for (auto& worker : workers)
+                worker.join();
+        }
 
-
-            auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
-            *u = p; *(u + 1) = 0;
-
-            helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
-            lua_setmetatable(L, -2);
-
-            return 1;
+        void compile(string_type source, string_type chunkname, std::function<void(Bytecode)> done)
+        {
+            post([this, source = std::move(source), chunkname = std::move(chunkname), done = std::move(done)](lua_State* L) mutable {
+                done(build(L, source.data(), source.size(), std::move(chunkname), strip));
+            });
         }
-    };
-}
 
+        std::future<Bytecode> compile(string_type source, string_type chunkname = "=")
+        {
+            auto promise = std::make_shared<std::promise<Bytecode>>();
+            auto future = promise->get_future();
+            compile(std::move(source), std::move(chunkname), [promise](Bytecode bytecode) {
+                promise->set_value(std::move(bytecode));
+            });
+            return future;
+        }
 
+        // the file is mapped on the worker, chunkname is "@path"
+        void compile_file(string_type path, std::function<void(Bytecode)> done)
+        {
+            post([this, path = std::move(path), done = std::move(done)](lua_State* L) mutable {
+                MappedFile file(path.c_str());
+                if (!file.valid())
+                {
+                    Bytecode result;
+                    result.chunkname = "@" + path;
+                    result.error = "cannot open " + path;
+                    done(std::move(result));
+                    return;
+                }
+                auto data = file.data();
+                auto size = file.size();
+                detail::skip_shebang(data, size);
+                done(build(L, data, size, "@" + path, strip));
+            });
+        }
 
+        std::future<Bytecode> compile_file(string_type path)
+        {
+            auto promise = std::make_shared<std::promise<Bytecode>>();
+            auto future = promise->get_future();
+            compile_file(std::move(path), [promise](Bytecode bytecode) {
+                promise->set_value(std::move(bytecode));
+            });
+            return future;
+        }
 
-namespace LuaBinding {
-    class StackIter
-    {
-    public:
-        typedef std::forward_iterator_tag iterator_category;
-        StackIter(lua_State* L, int index) : L(L), index(index) { }
-        StackIter operator++() { index++; return *this; }
-        std::pair<int, Object> operator*() { return { index, Object(L, index) }; }
-        bool operator!=(const StackIter& rhs) { return index != rhs.index; }
-    private:
-        lua_State* L;
-        int index;
+        [[nodiscard]] size_t pending()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return jobs.size();
+        }
     };
 }
-
-
+#include <cstdio>
 #include <vector>
 #include <stdexcept>
 
 namespace LuaBinding {
+    namespace detail {
+        // what luaL_newstate installs, lua_newstate leaves the panic function unset
+        inline int panic(lua_State* L)
+        {
+            auto msg = lua_tostring(L, -1);
+            fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", msg ? msg : "error object is not a string");
+            fflush(stderr);
+            return 0;
+        }
+
+        // reader(size_t* size) -> const char*, lua objects convert to anything and would match too
+        template<typename F>
+        concept is_chunk_reader = std::is_invocable_r_v<const char*, F&, size_t*> && !std::is_convertible_v<std::remove_cvref_t<F>, ObjectRef>;
+    }
+
     template< class T >
     inline constexpr bool is_state_v = std::is_same<T, State*>::value;
 
@@ -5096,16 +8958,40 @@ namespace LuaBinding {
         }
 #endif
 
-        ObjectRef& globals() {
-            static ObjectRef globals = at("_G");
-            return globals;
-        }
-
     public:
         State() = default;
-        State(bool) {
-            L = luaL_newstate();
-            luaL_openlibs(L);
+        State(bool) : State(Lib::All) {}
+        // opens only the libraries in open, the ones in lazy load on their first require
+        State(Lib open, Lib lazy = Lib::None) : State(nullptr, nullptr, open, lazy) {}
+        // allocator must outlive the State, it is not thread safe
+        State(PoolAllocator& allocator, Lib open = Lib::All, Lib lazy = Lib::None) : State(PoolAllocator::alloc, &allocator, open, lazy) {}
+        // quota must outlive the State
+        State(MemoryQuota& quota, Lib open = Lib::All, Lib lazy = Lib::None) : State(MemoryQuota::alloc, &quota, open, lazy) {
+            if (L)
+                quota.attach(L);
+        }
+        // lua_newstate with a custom allocator, nullptr uses the default one
+        State(lua_Alloc alloc, void* ud, Lib open = Lib::All, Lib lazy = Lib::None) {
+            if (alloc)
+            {
+                L = lua_newstate(alloc, ud);
+                if (L)
+                    lua_atpanic(L, detail::panic);
+            }
+            else
+                L = luaL_newstate();
+            if (!L)
+            {
+                view = true;
+#ifndef NOEXCEPTIONS
+                throw std::exception("cannot create lua_State");
+#endif
+                return;
+            }
+            if (open == Lib::All && lazy == Lib::None)
+                luaL_openlibs(L);
+            else
+                detail::open_libs(L, open, lazy);
             lua_newtable(L);
             lua_setglobal(L, "__METASTORE");
 #ifdef LUABINDING_DYN_CLASSES
@@ -5151,11 +9037,7 @@ namespace LuaBinding {
         }
 
         ~State() {
-            if (view) {
-                if (globals().valid(this))
-                    globals().pop();
-            } else {
-                globals().invalidate();
+            if (!view) {
 #ifdef LUABINDING_DYN_CLASSES
                 for (auto& c : *get_dynamic_classes())
                     delete c;
@@ -5202,6 +9084,11 @@ namespace LuaBinding {
             return Environment(L);
         }
 
+        Environment addEnv(const std::vector<const char*>& globals, bool snapshot = false, bool fallback = false)
+        {
+            return Environment(L, globals, snapshot, fallback);
+        }
+
         void pop(int n = 1)
         {
             lua_pop(L, n);
@@ -5217,23 +9104,25 @@ namespace LuaBinding {
         template<class T, class ...Params> requires std::is_constructible_v<T, Params...>
         T* alloc(Params... params)
         {
-            auto t = new (malloc(sizeof(T))) T(params...);
+            auto t = new (detail::new_object(L, sizeof(T))) T(params...);
             auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
             *u = t; *(u + 1) = (void*)0xC0FFEE;
             helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
             lua_setmetatable(L, -2);
+            detail::report_object(L, t);
             return t;
         }
 
         template<class T, class ...Params> requires (!std::is_constructible_v<T, Params...>)
         T* alloc()
         {
-            auto t = (T*)malloc(sizeof(T));
+            auto t = (T*)detail::new_object(L, sizeof(T));
             memset(t, 0, sizeof(T));
             auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
             *u = t; *(u + 1) = (void*)0xC0FFEE;
             helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
             lua_setmetatable(L, -2);
+            detail::report_object(L, t);
             return t;
         }
 
@@ -5259,113 +9148,332 @@ namespace LuaBinding {
                     lua_setglobal(L, enclosing_table.c_str());
                 }
                 fun(func);
+                detail::name_call(L, -1, nullptr, name);
+                lua_setfield(L, -2, real_class_name.c_str());
+                lua_pop(L, 1);
+            } else {
+                fun(func);
+                detail::name_call(L, -1, nullptr, name);
+                lua_setglobal(L, name);
+            }
+        }
+
+        template <class F>
+        void fun(F&& func)
+        {
+            Function::fun<void>(L, func);
+        }
+
+        template <class F>
+        void fun(const char* name, F&& func)
+        {
+            auto str = string_type(name);
+            if (str.find('.') != string_type::npos)
+            {
+                auto enclosing_table = str.substr(0, str.find('.'));
+                auto real_class_name = str.substr(str.find('.') + 1);
+                if (!luaL_getglobal(L, enclosing_table.c_str()))
+                {
+                    lua_pop(L, 1);
+                    lua_newtable(L);
+                    lua_pushvalue(L, -1);
+                    lua_setglobal(L, enclosing_table.c_str());
+                }
+                fun(func);
+                detail::name_call(L, -1, nullptr, name);
                 lua_setfield(L, -2, real_class_name.c_str());
                 lua_pop(L, 1);
             } else {
                 fun(func);
+                detail::name_call(L, -1, nullptr, name);
+                lua_setglobal(L, name);
+            }
+        }
+
+        template <class F>
+        void cfun(F& func)
+        {
+            Function::cfun<void>(L, func);
+        }
+
+        template <class F>
+        void cfun(const char* name, F& func)
+        {
+            auto str = string_type(name);
+            if (str.find('.') != string_type::npos)
+            {
+                auto enclosing_table = str.substr(0, str.find('.'));
+                auto real_class_name = str.substr(str.find('.') + 1);
+                if (!luaL_getglobal(L, enclosing_table.c_str()))
+                {
+                    lua_pop(L, 1);
+                    lua_newtable(L);
+                    lua_pushvalue(L, -1);
+                    lua_setglobal(L, enclosing_table.c_str());
+                }
+                cfun(func);
+                detail::name_call(L, -1, nullptr, name);
+                lua_setfield(L, -2, real_class_name.c_str());
+                lua_pop(L, 1);
+            } else {
+                cfun(func);
+                detail::name_call(L, -1, nullptr, name);
+                lua_setglobal(L, name);
+            }
+        }
+
+        template <class F>
+        void cfun(F&& func)
+        {
+            Function::cfun<void>(L, func);
+        }
+
+        template <class F>
+        void cfun(const char* name, F&& func)
+        {
+            auto str = string_type(name);
+            if (str.find('.') != string_type::npos)
+            {
+                auto enclosing_table = str.substr(0, str.find('.'));
+                auto real_class_name = str.substr(str.find('.') + 1);
+                if (!luaL_getglobal(L, enclosing_table.c_str()))
+                {
+                    lua_pop(L, 1);
+                    lua_newtable(L);
+                    lua_pushvalue(L, -1);
+                    lua_setglobal(L, enclosing_table.c_str());
+                }
+                cfun(func);
+                detail::name_call(L, -1, nullptr, name);
+                lua_setfield(L, -2, real_class_name.c_str());
+                lua_pop(L, 1);
+            } else {
+                cfun(func);
+                detail::name_call(L, -1, nullptr, name);
                 lua_setglobal(L, name);
             }
         }
 
-        template <class F>
-        void fun(F&& func)
+        template<typename ...Funcs>
+        void overload(const char* name, Funcs... functions) {
+            OverloadedFunction<void, Funcs...>(L, functions...);
+            detail::name_overloads(L, -1, nullptr, name);
+            lua_setglobal(L, name);
+        }
+
+        GarbageCollector gc()
+        {
+            return GarbageCollector(L);
+        }
+
+        // Budget budget = S.budget(...); bounds the Lua code run until it goes out of scope
+        Budget budget(uint64_t instructions, std::chrono::microseconds time = std::chrono::microseconds(0), int check = 1000)
+        {
+            return Budget(L, instructions, time, check);
+        }
+
+        // bytes held by boxed C++ objects, paced into the collector every step bytes
+        size_t external_memory()
+        {
+            auto memory = ExternalMemory::get(L);
+            return memory ? memory->size() : 0;
+        }
+
+        void external_step(size_t bytes)
+        {
+            ExternalMemory::of(L).set_step_size(bytes);
+        }
+
+        // boxed objects of T created and collected so far
+        template<class T>
+        InstanceStats instances()
+        {
+            auto memory = ExternalMemory::get(L);
+            if (!memory)
+                return InstanceStats();
+            auto it = memory->instances().find(detail::type_key<T>());
+            return it == memory->instances().end() ? InstanceStats() : it->second;
+        }
+
+        // of every class that had objects or a Class registration, unnamed ones were never registered
+        std::vector<InstanceStats> instances()
+        {
+            std::vector<InstanceStats> out;
+            if (auto memory = ExternalMemory::get(L))
+                for (auto& [type, stats] : memory->instances())
+                    out.push_back(stats);
+            return out;
+        }
+
+        ChunkCache* cache_chunks(size_t limit = 256)
+        {
+            return ChunkCache::enable(L, limit);
+        }
+
+        void uncache_chunks()
+        {
+            ChunkCache::disable(L);
+        }
+
+        BytecodeCache* cache_bytecode(const char* dir, bool strip = false)
+        {
+            return BytecodeCache::enable(L, dir, strip);
+        }
+
+        void uncache_bytecode()
+        {
+            BytecodeCache::disable(L);
+        }
+
+        void invalidate_chunk(const char* name)
+        {
+            if (auto cache = ChunkCache::get(L))
+                cache->invalidate(L, name);
+        }
+
+        // pushes the compiled chunk, served from the chunk cache when it is enabled
+        int load(const char* code, size_t len, const char* chunkname = "=", const char* name = nullptr)
+        {
+            auto cache = ChunkCache::get(L);
+            if (cache && cache->fetch(L, code, len, chunkname, name))
+                return 0;
+            auto bytecode = BytecodeCache::get(L);
+            auto status = bytecode ? bytecode->load(L, code, len, chunkname) : luaL_loadbuffer(L, code, len, chunkname);
+            if (!status && cache)
+                cache->insert(L, code, len, chunkname, name);
+            return status;
+        }
+
+        int load(const MappedFile& file, const char* chunkname = "=", const char* name = nullptr)
+        {
+            return load(file.data(), file.size(), chunkname, name);
+        }
+
+        // maps the file instead of reading it into memory, chunkname is "@path" like luaL_loadfile
+        int load_file(const char* path, const char* name = nullptr)
+        {
+            MappedFile file(path);
+            if (!file.valid())
+            {
+                lua_pushfstring(L, "cannot open %s", path);
+                return LUA_ERRFILE;
+            }
+            auto data = file.data();
+            auto size = file.size();
+            detail::skip_shebang(data, size);
+            auto chunkname = "@" + string_type(path);
+            return load(data, size, chunkname.c_str(), name);
+        }
+
+        // loads the output of a Compiler, pushing its error message if compiling failed
+        int load(const Bytecode& bytecode)
+        {
+            if (!bytecode.ok())
+            {
+                lua_pushlstring(L, bytecode.error.data(), bytecode.error.size());
+                return LUA_ERRSYNTAX;
+            }
+            return detail::load_bytecode(L, bytecode.code.data(), bytecode.code.size(), bytecode.chunkname.c_str());
+        }
+
+        int load(lua_Reader reader, void* data, const char* chunkname = "=")
+        {
+#if LUA_VERSION_NUM >= 502
+            return lua_load(L, reader, data, chunkname, nullptr);
+#else
+            return lua_load(L, reader, data, chunkname);
+#endif
+        }
+
+        // reader(size_t* size) -> const char* returns the next piece of the chunk, nullptr or size 0 at the end
+        template<typename F> requires detail::is_chunk_reader<F>
+        int load(F&& reader, const char* chunkname = "=")
+        {
+            return load([](lua_State*, void* ud, size_t* size) -> const char* {
+                return (*(std::remove_reference_t<F>*)ud)(size);
+            }, &reader, chunkname);
+        }
+
+        int exec(const char* code, int argn = 0, int nres = 0)
+        {
+            if (load(code, strlen(code), code) || LuaBinding::pcall(L, argn, nres))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return lua_gettop(L);
+        }
+
+        int exec(const Environment& env, const char* code, int argn = 0, int nres = 0)
         {
-            Function::fun<void>(L, func);
+            if (load(code, strlen(code), code) || env.pcall(argn, nres))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return lua_gettop(L);
         }
 
-        template <class F>
-        void fun(const char* name, F&& func)
+        int exec(std::vector<char>& code, int argn = 0, int nres = 0, const char* name = "=")
         {
-            auto str = string_type(name);
-            if (str.find('.') != string_type::npos)
+            if (load(code.data(), code.size(), name) || LuaBinding::pcall(L, argn, nres))
             {
-                auto enclosing_table = str.substr(0, str.find('.'));
-                auto real_class_name = str.substr(str.find('.') + 1);
-                if (!luaL_getglobal(L, enclosing_table.c_str()))
-                {
-                    lua_pop(L, 1);
-                    lua_newtable(L);
-                    lua_pushvalue(L, -1);
-                    lua_setglobal(L, enclosing_table.c_str());
-                }
-                fun(func);
-                lua_setfield(L, -2, real_class_name.c_str());
-                lua_pop(L, 1);
-            } else {
-                fun(func);
-                lua_setglobal(L, name);
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
             }
+            return lua_gettop(L);
         }
 
-        template <class F>
-        void cfun(F& func)
+        int exec(const Environment& env, std::vector<char>& code, int argn = 0, int nres = 0, const char* name = "=")
         {
-            Function::cfun<void>(L, func);
+            if (load(code.data(), code.size(), name) || env.pcall(argn, nres))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return lua_gettop(L);
         }
 
-        template <class F>
-        void cfun(const char* name, F& func)
+        int exec_file(const char* path, int argn = 0, int nres = 0)
         {
-            auto str = string_type(name);
-            if (str.find('.') != string_type::npos)
+            if (load_file(path) || LuaBinding::pcall(L, argn, nres))
             {
-                auto enclosing_table = str.substr(0, str.find('.'));
-                auto real_class_name = str.substr(str.find('.') + 1);
-                if (!luaL_getglobal(L, enclosing_table.c_str()))
-                {
-                    lua_pop(L, 1);
-                    lua_newtable(L);
-                    lua_pushvalue(L, -1);
-                    lua_setglobal(L, enclosing_table.c_str());
-                }
-                cfun(func);
-                lua_setfield(L, -2, real_class_name.c_str());
-                lua_pop(L, 1);
-            } else {
-                cfun(func);
-                lua_setglobal(L, name);
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
             }
+            return lua_gettop(L);
         }
 
-        template <class F>
-        void cfun(F&& func)
+        int exec_file(const Environment& env, const char* path, int argn = 0, int nres = 0)
         {
-            Function::cfun<void>(L, func);
+            if (load_file(path) || env.pcall(argn, nres))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return lua_gettop(L);
         }
 
-        template <class F>
-        void cfun(const char* name, F&& func)
+        int exec(const Bytecode& bytecode, int argn = 0, int nres = 0)
         {
-            auto str = string_type(name);
-            if (str.find('.') != string_type::npos)
+            if (load(bytecode) || LuaBinding::pcall(L, argn, nres))
             {
-                auto enclosing_table = str.substr(0, str.find('.'));
-                auto real_class_name = str.substr(str.find('.') + 1);
-                if (!luaL_getglobal(L, enclosing_table.c_str()))
-                {
-                    lua_pop(L, 1);
-                    lua_newtable(L);
-                    lua_pushvalue(L, -1);
-                    lua_setglobal(L, enclosing_table.c_str());
-                }
-                cfun(func);
-                lua_setfield(L, -2, real_class_name.c_str());
-                lua_pop(L, 1);
-            } else {
-                cfun(func);
-                lua_setglobal(L, name);
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
             }
+            return lua_gettop(L);
         }
 
-        template<typename ...Funcs>
-        void overload(const char* name, Funcs... functions) {
-            OverloadedFunction<void, Funcs...>(L, functions...);
-            lua_setglobal(L, name);
-        }
-
-        int exec(const char* code, int argn = 0, int nres = 0)
+        int exec(const MappedFile& file, const char* chunkname = "=", int argn = 0, int nres = 0)
         {
-            if (luaL_loadstring(L, code) || LuaBinding::pcall(L, argn, nres))
+            if (load(file, chunkname) || LuaBinding::pcall(L, argn, nres))
             {
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
@@ -5374,9 +9482,10 @@ namespace LuaBinding {
             return lua_gettop(L);
         }
 
-        int exec(Environment env, const char* code, int argn = 0, int nres = 0)
+        template<typename F> requires detail::is_chunk_reader<F>
+        int exec(F&& reader, const char* chunkname = "=", int argn = 0, int nres = 0)
         {
-            if (luaL_loadstring(L, code) || env.pcall(argn, nres))
+            if (load(std::forward<F>(reader), chunkname) || LuaBinding::pcall(L, argn, nres))
             {
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
@@ -5385,9 +9494,9 @@ namespace LuaBinding {
             return lua_gettop(L);
         }
 
-        int exec(std::vector<char>& code, int argn = 0, int nres = 0, const char* name = "=")
+        int exec_named(const char* name, const char* code, int argn = 0, int nres = 0)
         {
-            if (luaL_loadbuffer(L, code.data(), code.size(), name) || LuaBinding::pcall(L, argn, nres))
+            if (load(code, strlen(code), code, name) || LuaBinding::pcall(L, argn, nres))
             {
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
@@ -5396,9 +9505,9 @@ namespace LuaBinding {
             return lua_gettop(L);
         }
 
-        int exec(Environment env, std::vector<char>& code, int argn = 0, int nres = 0, const char* name = "=")
+        int exec_named(const Environment& env, const char* name, const char* code, int argn = 0, int nres = 0)
         {
-            if (luaL_loadbuffer(L, code.data(), code.size(), name) || env.pcall(argn, nres))
+            if (load(code, strlen(code), code, name) || env.pcall(argn, nres))
             {
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
@@ -5422,20 +9531,13 @@ namespace LuaBinding {
 #endif
             }
 
-            luaL_Buffer buf;
-            luaL_buffinit(L, &buf);
-#if LUA_VERSION_NUM >= 503
-            if (!lua_dump(L, (lua_Writer)base64_write, &buf, 1))
-#else
-            if (!lua_dump(L, (lua_Writer)base64_write, &buf))
-#endif
+            string_type r;
+            if (!detail::dump(L, detail::write_string, &r))
             {
-                luaL_pushresult(&buf);
-                size_t len = 0;
-                auto r = string_type(const_cast<char *>(lua_tolstring(L, -1, &len)), len);
-                lua_pop(L, 2);
+                lua_pop(L, 1);
                 return r;
             }
+            lua_pushliteral(L, "unable to dump given function");
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
 #endif
@@ -5450,18 +9552,14 @@ namespace LuaBinding {
 #endif
             }
 
-            luaL_Buffer buf;
-            luaL_buffinit(L, &buf);
-#if LUA_VERSION_NUM >= 503
-            if (!lua_dump(L, (lua_Writer)base64_write, &buf, 1))
-#else
-            if (!lua_dump(L, (lua_Writer)base64_write, &buf))
-#endif
+            string_type r;
+            if (!detail::dump(L, detail::write_string, &r))
             {
-                luaL_pushresult(&buf);
-                lua_remove(L, -2);
+                lua_pop(L, 1);
+                lua_pushlstring(L, r.data(), r.size());
                 return ObjectRef(L, -1, false);
             }
+            lua_pushliteral(L, "unable to dump given function");
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
 #endif
@@ -5527,7 +9625,7 @@ namespace LuaBinding {
         }
 
         template<typename R, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
-        R call(Env env, Params... param) {
+        R call(const Env& env, Params... param) {
             if constexpr (sizeof...(param) > 0)
                 (void)std::initializer_list<int>{ push(param...) };
             if constexpr (std::is_same_v<void, R>) {
@@ -5565,7 +9663,7 @@ namespace LuaBinding {
         }
 
         template<int R, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
-        void call(Env env, Params... param) {
+        void call(const Env& env, Params... param) {
             if constexpr (sizeof...(param) > 0)
                 (void)std::initializer_list<int>{ detail::push(L, param)... };
             if (env.pcall(sizeof...(param), R))
@@ -5627,6 +9725,81 @@ namespace LuaBinding {
             return ObjectRef(L, -1, false);
         }
 
+        template<typename T>
+        T get(const char* name)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get<Object> would point at a popped stack slot, use get<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            lua_getglobal(L, name);
+            auto result = detail::get<T>(L, -1);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T>
+        T get_or(const char* name, T def)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get_or<Object> would point at a popped stack slot, use get_or<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            lua_getglobal(L, name);
+            auto result = detail::get_or<T>(L, -1, def);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T>
+        T get(const Path& path)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get<Object> would point at a popped stack slot, use get<ObjectRef> instead");
+            return path.get<T>(L);
+        }
+
+        template<typename T>
+        T get_or(const Path& path, T def)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get_or<Object> would point at a popped stack slot, use get_or<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            path.push(L);
+            auto result = detail::get_or<T>(L, -1, def);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T>
+        bool set(const Path& path, T&& value)
+        {
+            return path.set(L, std::forward<T>(value));
+        }
+
+        template<typename T, typename ...Keys>
+        T get_path(Keys... keys)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get_path<Object> would point at a popped stack slot, use get_path<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            lua_pushglobaltable(L);
+            detail::push_path(L, top + 1, keys...);
+            auto result = detail::get<T>(L, -1);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T, typename ...Keys>
+        T get_path_or(T def, Keys... keys)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get_path_or<Object> would point at a popped stack slot, use get_path_or<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            lua_pushglobaltable(L);
+            detail::push_path(L, top + 1, keys...);
+            auto result = detail::get_or<T>(L, -1, def);
+            lua_settop(L, top);
+            return result;
+        }
+
+        StackFrame frame()
+        {
+            return StackFrame(L);
+        }
+
         Object top()
         {
             return Object(L, n());
@@ -5677,7 +9850,7 @@ namespace LuaBinding {
 
         IndexProxy operator[](const char* idx)
         {
-            return IndexProxy(globals(), idx);
+            return IndexProxy(L, idx);
         }
 
         template <class T>
@@ -5728,6 +9901,242 @@ namespace LuaBinding {
     };
 }
 
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+
+namespace LuaBinding {
+    // Registrations recorded once and replayed into any number of States. Steps run in the order
+    // they were added; chunks given to exec are compiled when recorded and only loaded on replay.
+    // apply may run on several threads at once, so steps must not mutate shared captures.
+    class BindingRecipe {
+        std::vector<std::function<void(State&)>> steps;
+        Lib open = Lib::All;
+        Lib lazy = Lib::None;
+    public:
+        // standard libraries of the States made by create()
+        BindingRecipe& libs(Lib open, Lib lazy = Lib::None)
+        {
+            this->open = open;
+            this->lazy = lazy;
+            return *this;
+        }
+
+        BindingRecipe& step(std::function<void(State&)> f)
+        {
+            steps.push_back(std::move(f));
+            return *this;
+        }
+
+        // define(Class<T>&) adds the members, the name is copied
+        template<class T, class F>
+        BindingRecipe& addClass(const char* name, F&& define)
+        {
+            return step([name = string_type(name), define = std::forward<F>(define)](State& S) {
+                auto c = S.addClass<T>(name.c_str());
+                define(c);
+            });
+        }
+
+        template<class F>
+        BindingRecipe& fun(const char* name, F&& func)
+        {
+            return step([name = string_type(name), func = std::forward<F>(func)](State& S) {
+                auto f = func;
+                S.fun(name.c_str(), f);
+            });
+        }
+
+        template<class F>
+        BindingRecipe& cfun(const char* name, F&& func)
+        {
+            return step([name = string_type(name), func = std::forward<F>(func)](State& S) {
+                auto f = func;
+                S.cfun(name.c_str(), f);
+            });
+        }
+
+        template<class T>
+        BindingRecipe& global(const char* name, T value)
+        {
+            return step([name = string_type(name), value = std::move(value)](State& S) {
+                S.global(name.c_str(), value);
+            });
+        }
+
+        BindingRecipe& exec(const char* code, const char* chunkname = "=")
+        {
+            Bytecode bytecode;
+            bytecode.chunkname = chunkname;
+            auto L = luaL_newstate();
+            if (luaL_loadbuffer(L, code, strlen(code), chunkname))
+            {
+                bytecode.error = lua_tostring(L, -1);
+                lua_close(L);
+#ifndef NOEXCEPTIONS
+                throw std::exception(bytecode.error.c_str());
+#endif
+                return *this;
+            }
+            detail::dump(L, detail::write_string, &bytecode.code, false);
+            lua_close(L);
+            return step([bytecode = std::move(bytecode)](State& S) {
+                S.exec(bytecode);
+            });
+        }
+
+        void apply(State& S) const
+        {
+            for (auto& f : steps)
+                f(S);
+        }
+
+        [[nodiscard]] std::unique_ptr<State> create() const
+        {
+            auto S = std::make_unique<State>(open, lazy);
+            apply(*S);
+            return S;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return steps.size();
+        }
+    };
+
+    // States built from a recipe ahead of time. A background thread keeps `warm` States ready,
+    // acquire hands one out and builds it on the caller's thread only when none is left.
+    // local() gives every calling thread its own State, built once and kept for the thread's lifetime.
+    class StatePool {
+        BindingRecipe recipe;
+        std::vector<std::unique_ptr<State>> ready;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::thread filler;
+        size_t warm;
+        bool stopping = false;
+        uint64_t id;
+
+        static uint64_t next_id()
+        {
+            static std::atomic<uint64_t> counter{ 0 };
+            return ++counter;
+        }
+
+        // keyed by pool id, an address could be reused by a later pool with another recipe
+        static std::unordered_map<uint64_t, std::unique_ptr<State>>& locals()
+        {
+            thread_local std::unordered_map<uint64_t, std::unique_ptr<State>> states;
+            return states;
+        }
+
+        void fill()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;)
+            {
+                cv.wait(lock, [this] { return stopping || ready.size() < warm; });
+                if (stopping)
+                    break;
+                lock.unlock();
+                auto S = recipe.create();
+                lock.lock();
+                if (ready.size() < warm)
+                    ready.push_back(std::move(S));
+            }
+        }
+    public:
+        explicit StatePool(BindingRecipe recipe, size_t warm = 0) : recipe(std::move(recipe)), warm(warm), id(next_id())
+        {
+            if (warm)
+                filler = std::thread([this] { fill(); });
+        }
+        StatePool(const StatePool&) = delete;
+        StatePool& operator=(const StatePool&) = delete;
+        // States handed out by acquire stay valid, thread local States of other threads
+        // are closed when those threads exit
+        ~StatePool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            cv.notify_all();
+            if (filler.joinable())
+                filler.join();
+            locals().erase(id);
+        }
+
+        [[nodiscard]] std::unique_ptr<State> acquire()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!ready.empty())
+                {
+                    auto S = std::move(ready.back());
+                    ready.pop_back();
+                    cv.notify_one();
+                    return S;
+                }
+            }
+            return recipe.create();
+        }
+
+        // takes back a State for reuse, the caller is responsible for it being clean
+        void release(std::unique_ptr<State> S)
+        {
+            if (!S)
+                return;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ready.size() < warm)
+                ready.push_back(std::move(S));
+        }
+
+        State& local()
+        {
+            auto& S = locals()[id];
+            if (!S)
+                S = acquire();
+            return *S;
+        }
+
+        // builds the missing warm States on the calling thread
+        void prewarm()
+        {
+            for (;;)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (ready.size() >= warm)
+                        return;
+                }
+                auto S = recipe.create();
+                std::lock_guard<std::mutex> lock(mutex);
+                if (ready.size() >= warm)
+                    return;
+                ready.push_back(std::move(S));
+            }
+        }
+
+        [[nodiscard]] size_t available()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return ready.size();
+        }
+
+        [[nodiscard]] const BindingRecipe& bindings() const
+        {
+            return recipe;
+        }
+    };
+}
+
 
 
 #include <tuple>
@@ -5860,12 +10269,13 @@ namespace LuaBinding {
         static int f(lua_State* L) {
             ParamList params;
             assign_tup(L, params, 1);
-            auto m = (void*)malloc(sizeof(T));
+            auto m = detail::new_object(L, sizeof(T));
             make_from_tuple<T>(m, params);
             auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
             *u = (void*)m; *(u + 1) = (void*)0xC0FFEE;
             lua_pushvalue(L, 1);
             lua_setmetatable(L, -2);
+            detail::report_object(L, (T*)m);
             return 1;
         }
     };
@@ -0,0 +1,150 @@
+#pragma once
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace LuaBinding {
+    // lua_Alloc keeping freed blocks of up to 256 bytes in per size class free lists, carved from
+    // slabs, so the small strings, tables and userdata boxes Lua churns through skip malloc.
+    // Bigger blocks go to realloc/free. Not thread safe: give every State its own allocator,
+    // and keep it alive until the State is closed.
+    class PoolAllocator {
+        static constexpr size_t granularity = 16;
+        static constexpr size_t classes = 16;
+        static constexpr size_t max_small = granularity * classes;
+
+        struct Node {
+            Node* next;
+        };
+
+        Node* lists[classes] = {};
+        std::vector<void*> slabs;
+        char* cursor = nullptr;
+        char* end = nullptr;
+        size_t slab_size;
+        size_t in_use = 0;
+
+        static size_t size_class(size_t size)
+        {
+            return (size - 1) / granularity;
+        }
+
+        void* take(size_t c)
+        {
+            if (auto node = lists[c])
+            {
+                lists[c] = node->next;
+                return node;
+            }
+            auto size = (c + 1) * granularity;
+            if ((size_t)(end - cursor) < size)
+            {
+                // the tail of the old slab is handed out to the smaller classes
+                while ((size_t)(end - cursor) >= granularity)
+                {
+                    auto rest = size_class(end - cursor);
+                    if ((rest + 1) * granularity > (size_t)(end - cursor))
+                        rest--;
+                    give(cursor, rest);
+                    cursor += (rest + 1) * granularity;
+                }
+                auto slab = (char*)malloc(slab_size);
+                if (!slab)
+                    return nullptr;
+                slabs.push_back(slab);
+                cursor = slab;
+                end = slab + slab_size;
+            }
+            auto p = cursor;
+            cursor += size;
+            return p;
+        }
+
+        void give(void* p, size_t c)
+        {
+            auto node = (Node*)p;
+            node->next = lists[c];
+            lists[c] = node;
+        }
+    public:
+        explicit PoolAllocator(size_t slab_size = 64 * 1024) : slab_size(slab_size < max_small ? max_small : slab_size)
+        {}
+        PoolAllocator(const PoolAllocator&) = delete;
+        PoolAllocator& operator=(const PoolAllocator&) = delete;
+        ~PoolAllocator()
+        {
+            for (auto slab : slabs)
+                free(slab);
+        }
+
+        // the lua_Alloc, ud is the PoolAllocator
+        static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+        {
+            return ((PoolAllocator*)ud)->reallocate(ptr, osize, nsize);
+        }
+
+        void* reallocate(void* ptr, size_t osize, size_t nsize)
+        {
+            // without a block osize is the type of the new object
+            if (!ptr)
+                osize = 0;
+            auto small = osize && osize <= max_small;
+            if (!nsize)
+            {
+                if (small)
+                    give(ptr, size_class(osize));
+                else
+                    free(ptr);
+                in_use -= osize;
+                return nullptr;
+            }
+            if (small && nsize <= max_small && size_class(osize) == size_class(nsize))
+            {
+                in_use += nsize - osize;
+                return ptr;
+            }
+            if (ptr && !small && nsize > max_small)
+            {
+                auto p = realloc(ptr, nsize);
+                if (p)
+                    in_use += nsize - osize;
+                return p;
+            }
+            auto p = nsize <= max_small ? take(size_class(nsize)) : malloc(nsize);
+            if (!p)
+            {
+                // Lua expects shrinking to succeed; the old block is big enough, and it ends up
+                // in the free list of its new size
+                if (ptr && nsize <= osize)
+                {
+                    in_use -= osize - nsize;
+                    return ptr;
+                }
+                return nullptr;
+            }
+            if (ptr)
+            {
+                memcpy(p, ptr, osize < nsize ? osize : nsize);
+                if (small)
+                    give(ptr, size_class(osize));
+                else
+                    free(ptr);
+            }
+            in_use += nsize - osize;
+            return p;
+        }
+
+        // bytes Lua currently holds
+        [[nodiscard]] size_t used() const
+        {
+            return in_use;
+        }
+
+        // bytes taken by slabs, blocks above 256 bytes not included
+        [[nodiscard]] size_t reserved() const
+        {
+            return slabs.size() * slab_size;
+        }
+    };
+}
\ No newline at end of file
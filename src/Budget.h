@@ -0,0 +1,90 @@
+#pragma once
+#include <chrono>
+#include "Hooks.h"
+
+namespace LuaBinding {
+    // Bounds the Lua code run while it lives, in VM instructions and wall clock time, checked
+    // every `check` instructions. Past either limit each check raises Budget::message, so a
+    // script cannot swallow it with pcall; exec/call report it like any Lua error and tripped()
+    // tells it apart. C++ functions and coroutines created before it are not interrupted. On
+    // LuaJIT count hooks do not fire inside compiled traces, so the JIT is flushed and switched
+    // off while a budget lives, and switched back on after it if it was on.
+    class Budget {
+        using clock = std::chrono::steady_clock;
+        lua_State* L;
+        int hook = 0;
+        uint64_t instructions;
+        uint64_t executed = 0;
+        clock::time_point deadline;
+        bool timed;
+        bool hit = false;
+#ifdef LUAJIT_VERSION_NUM
+        bool jit_was_on = false;
+
+        // jit.status() when the jit library is loaded, the engine is on by default otherwise
+        static bool jit_enabled(lua_State* L)
+        {
+            auto on = true;
+            lua_getfield(L, LUA_REGISTRYINDEX, "_LOADED");
+            lua_getfield(L, -1, "jit");
+            if (lua_istable(L, -1))
+            {
+                lua_getfield(L, -1, "status");
+                if (lua_isfunction(L, -1) && !lua_pcall(L, 0, 1, 0))
+                    on = lua_toboolean(L, -1);
+                lua_pop(L, 1);
+            }
+            lua_pop(L, 2);
+            return on;
+        }
+#endif
+    public:
+        static constexpr const char* message = "execution budget exceeded";
+
+        // 0 instructions or time is no limit
+        Budget(lua_State* L, uint64_t instructions, std::chrono::microseconds time = std::chrono::microseconds(0), int check = 1000)
+            : L(L), instructions(instructions), deadline(clock::now() + time), timed(time.count() > 0)
+        {
+            if (check < 1)
+                check = 1;
+#ifdef LUAJIT_VERSION_NUM
+            jit_was_on = jit_enabled(L);
+            if (jit_was_on)
+            {
+                luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_FLUSH);
+                luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_OFF);
+            }
+#endif
+            hook = Hooks::of(L).add(LUA_MASKCOUNT, check, [this, check](lua_State* T, lua_Debug*) {
+                executed += check;
+                if (!hit && ((this->instructions && executed >= this->instructions) || (timed && clock::now() >= deadline)))
+                    hit = true;
+                if (hit)
+                    luaL_error(T, message);
+            });
+        }
+        Budget(const Budget&) = delete;
+        Budget& operator=(const Budget&) = delete;
+        ~Budget()
+        {
+            if (hook)
+                Hooks::of(L).remove(hook);
+#ifdef LUAJIT_VERSION_NUM
+            if (jit_was_on)
+                luaJIT_setmode(L, 0, LUAJIT_MODE_ENGINE | LUAJIT_MODE_ON);
+#endif
+        }
+
+        // true once a limit was hit
+        [[nodiscard]] bool tripped() const
+        {
+            return hit;
+        }
+
+        // instructions run so far, rounded up to the check interval
+        [[nodiscard]] uint64_t used() const
+        {
+            return executed;
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,145 @@
+#pragma once
+#include <cstdio>
+#include <cstring>
+#include "StateData.h"
+#include "ChunkCache.h"
+#include "MappedFile.h"
+
+namespace LuaBinding {
+    namespace detail {
+        // skips a leading "#!" style line like luaL_loadfile, keeping its newline for line numbers
+        inline void skip_shebang(const char*& data, size_t& size)
+        {
+            if (!size || data[0] != '#')
+                return;
+            while (size && *data != '\n')
+            {
+                data++;
+                size--;
+            }
+        }
+    }
+
+    // Bytecode of compiled chunks kept in a directory across runs. Files are named after the
+    // source hash and the interpreter build, so a different Lua/LuaJIT never sees them. Each file
+    // starts with the build tag, the source length and a second source hash, checked before
+    // loading; a file that does not match or fails to load is recompiled and rewritten.
+    // Stripped bytecode loses line numbers, so only strip when warm and cold runs may differ in
+    // their error messages.
+    class BytecodeCache {
+        string_type dir;
+        bool strip;
+
+        static char* key()
+        {
+            static char k;
+            return &k;
+        }
+
+        string_type path(const char* code, size_t len, const char* chunkname) const
+        {
+            auto hash = detail::fnv1a(code, len);
+            hash = detail::fnv1a(chunkname, strlen(chunkname), hash);
+            char name[64];
+            snprintf(name, sizeof(name), "%016llx-%s.luac", (unsigned long long)hash, version());
+            return dir + "/" + name;
+        }
+
+        // build tag, '\0', source length and a hash independent of the file name one
+        static string_type header(const char* code, size_t len)
+        {
+            string_type result(version());
+            result += '\0';
+            uint64_t words[2] = { (uint64_t)len, detail::fnv1a(code, len, 0x84222325cbf29ce4ull) };
+            result.append((const char*)words, sizeof(words));
+            return result;
+        }
+
+        bool write(const string_type& file, const string_type& bytecode) const
+        {
+            auto tmp = file + ".tmp";
+            auto f = fopen(tmp.c_str(), "wb");
+            if (!f)
+                return false;
+            auto ok = fwrite(bytecode.data(), 1, bytecode.size(), f) == bytecode.size();
+            ok = !fclose(f) && ok;
+            if (ok)
+            {
+#ifdef _WIN32
+                remove(file.c_str());
+#endif
+                ok = !rename(tmp.c_str(), file.c_str());
+            }
+            if (!ok)
+                remove(tmp.c_str());
+            return ok;
+        }
+    public:
+        BytecodeCache(string_type dir, bool strip) : dir(std::move(dir)), strip(strip)
+        {}
+
+        static BytecodeCache* get(lua_State* L)
+        {
+            return detail::state_data<BytecodeCache>(L, key());
+        }
+
+        static BytecodeCache* enable(lua_State* L, const char* dir, bool strip = false)
+        {
+            disable(L);
+            return detail::make_state_data<BytecodeCache>(L, key(), string_type(dir), strip);
+        }
+
+        static void disable(lua_State* L)
+        {
+            if (get(L))
+                detail::drop_state_data(L, key());
+        }
+
+        // interpreter build the bytecode belongs to, part of every file name
+        static const char* version()
+        {
+            static const string_type tag = [] {
+                char buf[48];
+#ifdef LUAJIT_VERSION_NUM
+                snprintf(buf, sizeof(buf), "jit%d-p%d-n%d", LUAJIT_VERSION_NUM, (int)sizeof(void*), (int)sizeof(lua_Number));
+#else
+                snprintf(buf, sizeof(buf), "lua%d-p%d-n%d", LUA_VERSION_NUM, (int)sizeof(void*), (int)sizeof(lua_Number));
+#endif
+                return string_type(buf);
+            }();
+            return tag.c_str();
+        }
+
+        // pushes the compiled chunk from disk, or compiles it and stores the bytecode
+        int load(lua_State* L, const char* code, size_t len, const char* chunkname)
+        {
+            auto file = path(code, len, chunkname);
+            auto head = header(code, len);
+            {
+                MappedFile mapped(file.c_str());
+                if (mapped.valid() && mapped.size() > head.size() && !memcmp(mapped.data(), head.data(), head.size()))
+                {
+                    if (!detail::load_bytecode(L, mapped.data() + head.size(), mapped.size() - head.size(), chunkname))
+                        return 0;
+                    lua_pop(L, 1);
+                }
+            }
+            auto status = luaL_loadbuffer(L, code, len, chunkname);
+            if (status)
+                return status;
+            if (!detail::dump(L, detail::write_string, &head, strip))
+                write(file, head);
+            return 0;
+        }
+
+        bool invalidate(const char* code, size_t len, const char* chunkname)
+        {
+            return !remove(path(code, len, chunkname).c_str());
+        }
+
+        [[nodiscard]] const string_type& directory() const
+        {
+            return dir;
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,337 @@
+#pragma once
+#if defined(LUABINDING_CALL_STATS) || defined(LUABINDING_SYMBOL_MAP)
+#include <cstdio>
+#endif
+#ifdef LUABINDING_CALL_STATS
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "StateData.h"
+#endif
+
+namespace LuaBinding {
+#if defined(LUABINDING_CALL_STATS) || defined(LUABINDING_SYMBOL_MAP)
+    namespace detail {
+        // the registry table of named bindings, name -> closure
+        inline char* bindings_key()
+        {
+            static char k;
+            return &k;
+        }
+    }
+#endif
+
+#ifdef LUABINDING_CALL_STATS
+    // Calls of one bound function, histogram bucket i counts calls taking [2^(i-1), 2^i) microseconds
+    struct CallStat {
+        static constexpr int buckets = 24;
+        string_type name;
+        uint64_t calls = 0;
+        uint64_t bytes_in = 0;
+        uint64_t bytes_out = 0;
+        std::chrono::nanoseconds total{ 0 };
+        std::chrono::nanoseconds max{ 0 };
+        uint64_t histogram[buckets] = {};
+    };
+
+    // Counters of the bound functions of a lua_State, filled by the thunk wrappers when
+    // LUABINDING_CALL_STATS is defined. Bindings are keyed by their upvalue, so each registration counts on its own; the
+    // names come from State/Class registration. Bytes are string bytes passed in and returned.
+    // Calls that raise an error are not recorded.
+    class CallStats {
+    public:
+        // see TraceRecorder: TraceCall sees the arguments before each call and returns a ticket,
+        // TraceDone gets it back with the time once the call returns without an error
+        using TraceCall = uint64_t(*)(void* ud, lua_State* L, const void* k, int args);
+        using TraceDone = void(*)(void* ud, uint64_t ticket, std::chrono::nanoseconds time);
+        // called as each binding returns, with its frame still on the stack, see Profiler
+        using Sampler = void(*)(void* ud, lua_State* L);
+    private:
+        std::unordered_map<const void*, CallStat> stats;
+        TraceCall trace_call = nullptr;
+        TraceDone trace_done = nullptr;
+        void* trace_ud = nullptr;
+        Sampler sampler = nullptr;
+        void* sampler_ud = nullptr;
+        std::shared_ptr<void> token = std::make_shared<char>();
+
+        static char* key()
+        {
+            static char k;
+            return &k;
+        }
+
+        static size_t string_bytes(lua_State* L, int from, int to)
+        {
+            size_t bytes = 0;
+            for (auto i = from; i <= to; i++)
+                if (lua_type(L, i) == LUA_TSTRING)
+                    bytes += lua_getlen(L, i);
+            return bytes;
+        }
+    public:
+        static CallStats* get(lua_State* L)
+        {
+            return detail::state_data<CallStats>(L, key());
+        }
+
+        static CallStats& of(lua_State* L)
+        {
+            if (auto calls = get(L))
+                return *calls;
+            return *detail::make_state_data<CallStats>(L, key());
+        }
+
+        // the key of the bound closure at idx: its first upvalue, or the C function without one
+        static const void* binding(lua_State* L, int idx)
+        {
+            idx = lua_absindex(L, idx);
+            const void* k = nullptr;
+            if (lua_getupvalue(L, idx, 1))
+            {
+                k = lua_topointer(L, -1);
+                lua_pop(L, 1);
+            }
+            return k ? k : (const void*)lua_tocfunction(L, idx);
+        }
+
+        void name(const void* k, string_type name)
+        {
+            stats[k].name = std::move(name);
+        }
+
+        // pushes the binding registered as name, or nil
+        static void push_binding(lua_State* L, const char* name)
+        {
+            if (lua_rawgetp(L, LUA_REGISTRYINDEX, detail::bindings_key()) != LUA_TTABLE)
+                return;
+            lua_getfield(L, -1, name);
+            lua_remove(L, -2);
+        }
+
+        void set_trace(TraceCall call, TraceDone done, void* ud)
+        {
+            trace_call = call;
+            trace_done = done;
+            trace_ud = ud;
+        }
+
+        void set_sampler(Sampler f, void* ud)
+        {
+            sampler = f;
+            sampler_ud = ud;
+        }
+
+        void sample(lua_State* L)
+        {
+            if (sampler)
+                sampler(sampler_ud, L);
+        }
+
+        // expires when the counters are destroyed with their lua_State, see Hooks::alive
+        [[nodiscard]] std::weak_ptr<void> alive() const
+        {
+            return token;
+        }
+
+        [[nodiscard]] bool tracing() const
+        {
+            return trace_call != nullptr;
+        }
+
+        uint64_t trace_begin(lua_State* L, const void* k, int args)
+        {
+            return trace_call ? trace_call(trace_ud, L, k, args) : 0;
+        }
+
+        void trace_end(uint64_t ticket, std::chrono::nanoseconds time)
+        {
+            if (ticket && trace_done)
+                trace_done(trace_ud, ticket, time);
+        }
+
+        void record(lua_State* L, const void* k, int args, int results, std::chrono::nanoseconds time)
+        {
+            auto& s = stats[k];
+            s.calls++;
+            s.total += time;
+            if (time > s.max)
+                s.max = time;
+            auto us = (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(time).count();
+            int bucket = 0;
+            while (us && bucket < CallStat::buckets - 1)
+            {
+                us >>= 1;
+                bucket++;
+            }
+            s.histogram[bucket]++;
+            s.bytes_in += string_bytes(L, 1, args);
+            s.bytes_out += string_bytes(L, lua_gettop(L) - results + 1, lua_gettop(L));
+        }
+
+        [[nodiscard]] const std::unordered_map<const void*, CallStat>& entries() const
+        {
+            return stats;
+        }
+
+        // clears the counters, names stay
+        void reset()
+        {
+            for (auto& [k, s] : stats)
+            {
+                auto name = std::move(s.name);
+                s = CallStat();
+                s.name = std::move(name);
+            }
+        }
+
+        // lua_CFunction returning { [name] = { calls, total_us, max_us, bytes_in, bytes_out, histogram } }
+        // for the bindings that were called; unnamed ones show up as "?"
+        static int table(lua_State* L)
+        {
+            lua_newtable(L);
+            auto calls = get(L);
+            if (!calls)
+                return 1;
+            for (auto& [k, s] : calls->stats)
+            {
+                if (!s.calls)
+                    continue;
+                lua_createtable(L, 0, 6);
+                lua_pushnumber(L, (lua_Number)s.calls);
+                lua_setfield(L, -2, "calls");
+                lua_pushnumber(L, (lua_Number)s.total.count() / 1000.0);
+                lua_setfield(L, -2, "total_us");
+                lua_pushnumber(L, (lua_Number)s.max.count() / 1000.0);
+                lua_setfield(L, -2, "max_us");
+                lua_pushnumber(L, (lua_Number)s.bytes_in);
+                lua_setfield(L, -2, "bytes_in");
+                lua_pushnumber(L, (lua_Number)s.bytes_out);
+                lua_setfield(L, -2, "bytes_out");
+                lua_createtable(L, CallStat::buckets, 0);
+                for (int i = 0; i < CallStat::buckets; i++)
+                {
+                    lua_pushnumber(L, (lua_Number)s.histogram[i]);
+                    lua_rawseti(L, -2, i + 1);
+                }
+                lua_setfield(L, -2, "histogram");
+                lua_setfield(L, -2, s.name.empty() ? "?" : s.name.c_str());
+            }
+            return 1;
+        }
+    };
+
+    namespace detail {
+        // the C function each probed<F> wraps, for SymbolMap
+        class ProbedTargets {
+            static std::mutex& lock()
+            {
+                static std::mutex m;
+                return m;
+            }
+
+            static std::unordered_map<lua_CFunction, lua_CFunction>& targets()
+            {
+                static std::unordered_map<lua_CFunction, lua_CFunction> t;
+                return t;
+            }
+        public:
+            static void add(lua_CFunction wrapper, lua_CFunction target)
+            {
+                std::lock_guard guard(lock());
+                targets().emplace(wrapper, target);
+            }
+
+            // the function f wraps, or nullptr
+            static lua_CFunction find(lua_CFunction f)
+            {
+                std::lock_guard guard(lock());
+                auto it = targets().find(f);
+                return it == targets().end() ? nullptr : it->second;
+            }
+        };
+
+        // wraps a thunk, timing it and counting the string bytes of its arguments and results
+        template<lua_CFunction F>
+        int probed(lua_State* L)
+        {
+            auto k = lua_topointer(L, lua_upvalueindex(1));
+            if (!k)
+                k = (const void*)&probed<F>;
+            auto args = lua_gettop(L);
+            auto& calls = CallStats::of(L);
+            // F may overwrite its arguments, so a trace takes them first
+            auto ticket = calls.trace_begin(L, k, args);
+            auto start = std::chrono::steady_clock::now();
+            auto n = F(L);
+            auto time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            calls.record(L, k, args, n, time);
+            calls.trace_end(ticket, time);
+            calls.sample(L);
+            return n;
+        }
+
+        // probed<F>, remembering that it runs F
+        template<lua_CFunction F>
+        lua_CFunction probe()
+        {
+            static const bool added = (ProbedTargets::add(probed<F>, F), true);
+            (void)added;
+            return probed<F>;
+        }
+    }
+#define LUABINDING_THUNK(...) LuaBinding::detail::probe<__VA_ARGS__>()
+#else
+#define LUABINDING_THUNK(...) __VA_ARGS__
+#endif
+
+    namespace detail {
+#if defined(LUABINDING_CALL_STATS) || defined(LUABINDING_SYMBOL_MAP)
+        // names the bound closure at idx as prefix.name, and keeps it under that name for
+        // replays and symbol maps
+        inline void name_call(lua_State* L, int idx, const char* prefix, const char* name)
+        {
+            idx = lua_absindex(L, idx);
+            auto full = prefix ? string_type(prefix) + "." + name : string_type(name);
+#ifdef LUABINDING_CALL_STATS
+            CallStats::of(L).name(CallStats::binding(L, idx), full);
+#endif
+            if (lua_rawgetp(L, LUA_REGISTRYINDEX, bindings_key()) != LUA_TTABLE)
+            {
+                lua_pop(L, 1);
+                lua_newtable(L);
+                lua_pushvalue(L, -1);
+                lua_rawsetp(L, LUA_REGISTRYINDEX, bindings_key());
+            }
+            lua_pushvalue(L, idx);
+            lua_setfield(L, -2, full.c_str());
+            lua_pop(L, 1);
+        }
+
+        // names an OverloadedFunction at idx, and its overloads after it as name#1, name#2...
+        inline void name_overloads(lua_State* L, int idx, const char* prefix, const char* name)
+        {
+            idx = lua_absindex(L, idx);
+            name_call(L, idx, prefix, name);
+            if (!lua_getupvalue(L, idx, 1))
+                return;
+            for (lua_Integer i = 1; lua_rawgeti(L, -1, i) == LUA_TTABLE; i++)
+            {
+                char index[24];
+                snprintf(index, sizeof(index), "#%lld", (long long)i);
+                if (lua_getfield(L, -1, "f") == LUA_TFUNCTION)
+                    name_call(L, -1, prefix, (string_type(name) + index).c_str());
+                lua_pop(L, 2);
+            }
+            lua_pop(L, 2);
+        }
+#else
+        inline void name_call(lua_State*, int, const char*, const char*)
+        {}
+
+        inline void name_overloads(lua_State*, int, const char*, const char*)
+        {}
+#endif
+    }
+}
\ No newline at end of file
@@ -0,0 +1,246 @@
+#pragma once
+#include <deque>
+#include <cstring>
+#include "StateData.h"
+
+namespace LuaBinding {
+    namespace detail {
+        inline uint64_t fnv1a(const char* data, size_t len, uint64_t hash = 0xcbf29ce484222325ull)
+        {
+            for (size_t i = 0; i < len; i++)
+            {
+                hash ^= (unsigned char)data[i];
+                hash *= 0x100000001b3ull;
+            }
+            return hash;
+        }
+
+        inline int write_string(lua_State*, const void* p, size_t size, void* ud)
+        {
+            ((string_type*)ud)->append((const char*)p, size);
+            return 0;
+        }
+
+        // lua_dump of the function on top of the stack
+        inline int dump(lua_State* L, lua_Writer writer, void* ud, bool strip = true)
+        {
+#if LUA_VERSION_NUM >= 503
+            return lua_dump(L, writer, ud, strip);
+#else
+            return lua_dump(L, writer, ud);
+#endif
+        }
+
+        struct BufferReader {
+            const char* data;
+            size_t size;
+        };
+
+        inline const char* read_buffer(lua_State*, void* ud, size_t* size)
+        {
+            auto reader = (BufferReader*)ud;
+            *size = reader->size;
+            reader->size = 0;
+            return *size ? reader->data : nullptr;
+        }
+
+        // loads precompiled bytecode only, text is rejected
+        inline int load_bytecode(lua_State* L, const char* data, size_t size, const char* chunkname)
+        {
+            BufferReader reader = { data, size };
+#if LUA_VERSION_NUM >= 502
+            return lua_load(L, read_buffer, &reader, chunkname, "b");
+#else
+            if (!size || data[0] != LUA_SIGNATURE[0])
+            {
+                lua_pushliteral(L, "not a precompiled chunk");
+                return LUA_ERRSYNTAX;
+            }
+            return lua_load(L, read_buffer, &reader, chunkname);
+#endif
+        }
+    }
+
+    // Compiled chunks of a lua_State, keyed by source and chunkname or by a caller supplied name;
+    // a named chunk keeps the chunkname it was first compiled with until it is invalidated. Entries keep the bytecode in a registry table and every hit loads a fresh
+    // closure from it, so runs in different Environments never share upvalues; loading bytecode
+    // still skips the parser. The oldest entry is dropped once limit is reached.
+    class ChunkCache {
+        std::deque<string_type> order;
+        size_t limit;
+        int chunks;
+
+        static char* key()
+        {
+            static char k;
+            return &k;
+        }
+
+        // '#' + 8 byte source hash + chunkname, or '@' + name. Hash keys also keep the source in
+        // their entry and compare it on a hit. Chunknames longer than LUA_IDSIZE, like the code
+        // itself passed by exec, are replaced by '\0' + their 8 byte hash to keep keys short.
+        static string_type make_key(const char* code, size_t len, const char* chunkname, const char* name)
+        {
+            if (name)
+                return string_type("@") + name;
+            auto hash = detail::fnv1a(code, len);
+            auto chunkname_len = strlen(chunkname);
+            if (chunkname_len <= LUA_IDSIZE)
+            {
+                string_type result(1 + sizeof(hash), '#');
+                memcpy(result.data() + 1, &hash, sizeof(hash));
+                return result + chunkname;
+            }
+            auto chunkname_hash = chunkname == code && chunkname_len == len ? hash : detail::fnv1a(chunkname, chunkname_len);
+            string_type result(2 + 2 * sizeof(hash), '#');
+            memcpy(result.data() + 1, &hash, sizeof(hash));
+            result[1 + sizeof(hash)] = '\0';
+            memcpy(result.data() + 2 + sizeof(hash), &chunkname_hash, sizeof(hash));
+            return result;
+        }
+
+        void erase(lua_State* L, const string_type& k)
+        {
+            lua_rawgeti(L, LUA_REGISTRYINDEX, chunks);
+            lua_pushlstring(L, k.data(), k.size());
+            lua_pushnil(L);
+            lua_rawset(L, -3);
+            lua_pop(L, 1);
+            for (auto it = order.begin(); it != order.end(); ++it)
+            {
+                if (*it == k)
+                {
+                    order.erase(it);
+                    break;
+                }
+            }
+        }
+    public:
+        ChunkCache(lua_State* L, size_t limit) : limit(limit)
+        {
+            lua_newtable(L);
+            chunks = luaL_ref(L, LUA_REGISTRYINDEX);
+        }
+        ChunkCache(const ChunkCache&) = delete;
+        ChunkCache& operator=(const ChunkCache&) = delete;
+
+        static ChunkCache* get(lua_State* L)
+        {
+            return detail::state_data<ChunkCache>(L, key());
+        }
+
+        static ChunkCache* enable(lua_State* L, size_t limit)
+        {
+            disable(L);
+            if (!limit)
+                return nullptr;
+            return detail::make_state_data<ChunkCache>(L, key(), L, limit);
+        }
+
+        static void disable(lua_State* L)
+        {
+            if (auto cache = get(L))
+            {
+                cache->clear(L);
+                luaL_unref(L, LUA_REGISTRYINDEX, cache->chunks);
+                detail::drop_state_data(L, key());
+            }
+        }
+
+        // pushes a fresh closure of the cached chunk and returns true, or returns false with the stack untouched
+        bool fetch(lua_State* L, const char* code, size_t len, const char* chunkname = "=", const char* name = nullptr)
+        {
+            auto k = make_key(code, len, chunkname, name);
+            auto top = lua_gettop(L);
+            lua_rawgeti(L, LUA_REGISTRYINDEX, chunks);
+            lua_pushlstring(L, k.data(), k.size());
+            lua_rawget(L, -2);
+            if (!lua_istable(L, -1))
+            {
+                lua_settop(L, top);
+                return false;
+            }
+            if (!name)
+            {
+                lua_rawgeti(L, -1, 2);
+                size_t source_len;
+                auto source = lua_tolstring(L, -1, &source_len);
+                auto same = source && source_len == len && !memcmp(source, code, len);
+                lua_pop(L, 1);
+                if (!same)
+                {
+                    lua_settop(L, top);
+                    return false;
+                }
+            }
+            lua_rawgeti(L, -1, 1);
+            size_t size;
+            auto bytecode = lua_tolstring(L, -1, &size);
+            if (!bytecode || detail::load_bytecode(L, bytecode, size, chunkname))
+            {
+                lua_settop(L, top);
+                return false;
+            }
+            lua_replace(L, top + 1);
+            lua_settop(L, top + 1);
+            return true;
+        }
+
+        // caches the function on top of the stack, leaving it there
+        void insert(lua_State* L, const char* code, size_t len, const char* chunkname = "=", const char* name = nullptr)
+        {
+            string_type bytecode;
+            if (detail::dump(L, detail::write_string, &bytecode, false))
+                return;
+            auto k = make_key(code, len, chunkname, name);
+            erase(L, k);
+            lua_rawgeti(L, LUA_REGISTRYINDEX, chunks);
+            if (order.size() >= limit)
+            {
+                lua_pushlstring(L, order.front().data(), order.front().size());
+                lua_pushnil(L);
+                lua_rawset(L, -3);
+                order.pop_front();
+            }
+            order.push_back(k);
+            lua_pushlstring(L, k.data(), k.size());
+            lua_createtable(L, 2, 0);
+            lua_pushlstring(L, bytecode.data(), bytecode.size());
+            lua_rawseti(L, -2, 1);
+            if (!name)
+            {
+                lua_pushlstring(L, code, len);
+                lua_rawseti(L, -2, 2);
+            }
+            lua_rawset(L, -3);
+            lua_pop(L, 1);
+        }
+
+        void invalidate(lua_State* L, const char* name)
+        {
+            erase(L, make_key(nullptr, 0, nullptr, name));
+        }
+
+        void invalidate(lua_State* L, const char* code, size_t len, const char* chunkname = "=")
+        {
+            erase(L, make_key(code, len, chunkname, nullptr));
+        }
+
+        void clear(lua_State* L)
+        {
+            lua_newtable(L);
+            lua_rawseti(L, LUA_REGISTRYINDEX, chunks);
+            order.clear();
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return order.size();
+        }
+
+        [[nodiscard]] size_t capacity() const
+        {
+            return limit;
+        }
+    };
+}
\ No newline at end of file
@@ -57,6 +57,8 @@ namespace LuaBinding {
             lua_pushcclosure(L, tostring, 1);
             lua_setfield(L, -2, "__tostring");
 
+            ExternalMemory::of(L).name(detail::type_key<T>(), name);
+
 #ifdef LUABINDING_DYN_CLASSES
             lua_pushcfunction(L, dyn_read);
             lua_setfield(L, -2, "Read");
@@ -91,7 +93,7 @@ namespace LuaBinding {
             }
             auto u = (void**)lua_touserdata(S, 1);
             if (*(u + 1) == (void*)0xC0FFEE) {
-                free(*u);
+                detail::free_object(S, *u, detail::type_key<T>());
             }
             return 0;
         }
@@ -263,6 +265,14 @@ namespace LuaBinding {
             }
             lua_remove(L, -2);
         }
+
+        // names the property accessor on top of the stack Class.name:get or Class.name:set
+        void name_accessor([[maybe_unused]] const char* name, [[maybe_unused]] const char* kind)
+        {
+#ifdef LUABINDING_CALL_STATS
+            detail::name_call(L, -1, class_name, (string_type(name) + ":" + kind).c_str());
+#endif
+        }
     public:
         template<typename F>
         Class<T>& idx_cfun(F func)
@@ -299,7 +309,8 @@ namespace LuaBinding {
 
                 lua_createtable(L, 0, 1);
                 lua_pushstring(L, "__call");
-                lua_pushcclosure(L, TraitsCtor<T, Params...>::f, 0);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsCtor<T, Params...>::f), 0);
+                detail::name_call(L, -1, class_name, "new");
                 lua_settable(L, -3);
                 //lua_pushcclosure(L, lua_CGCProtector, 0);
                 //lua_setfield(L, -2, "__newindex");
@@ -318,7 +329,8 @@ namespace LuaBinding {
 
                 lua_createtable(L, 0, 1);
                 lua_pushstring(L, "__call");
-                lua_pushcclosure(L, TraitsCtor<T, Params...>::f, 0);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsCtor<T, Params...>::f), 0);
+                detail::name_call(L, -1, class_name, "new");
                 lua_settable(L, -3);
                 //lua_pushcclosure(L, lua_CGCProtector, 0);
                 //lua_setfield(L, -2, "__newindex");
@@ -342,10 +354,19 @@ namespace LuaBinding {
             return *this;
         }
 
+        // bytes an instance owns outside Lua, reported to the collector when it is boxed;
+        // shared by all States
+        Class<T>& external_size(size_t(*size)(const T&))
+        {
+            ExternalSize<T>::size = size;
+            return *this;
+        }
+
         template<typename ...Funcs>
         Class<T>& overload(const char* name, Funcs... functions) {
             push_function_index();
             OverloadedFunction<T, Funcs...>(L, functions...);
+            detail::name_overloads(L, -1, class_name, name);
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -356,6 +377,7 @@ namespace LuaBinding {
         {
             push_function_index();
             Function::fun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -366,6 +388,7 @@ namespace LuaBinding {
         {
             push_function_index();
             Function::fun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -421,6 +444,7 @@ namespace LuaBinding {
         {
             push_function_index();
             Function::cfun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -431,6 +455,7 @@ namespace LuaBinding {
         {
             push_function_index();
             Function::cfun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -460,6 +485,7 @@ namespace LuaBinding {
             using FnType = decltype (func);
             push_metatable();
             Function::fun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -474,6 +500,7 @@ namespace LuaBinding {
             using func_t = decltype (func);
             push_metatable();
             Function::cfun<T>(L, func);
+            detail::name_call(L, -1, class_name, name);
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -484,16 +511,18 @@ namespace LuaBinding {
         {
             using PropType = decltype (prop);
 
-            push_property_index();
-
+            // each accessor gets its own copy, so their call stats stay apart
             push_property_newindex();
             new (lua_newuserdata(L, sizeof(prop))) PropType(prop);
-            lua_pushvalue(L, -1);
-            lua_pushcclosure(L, TraitsClassProperty<std::decay_t<R>, std::decay_t<Base>>::set, 1);
-            lua_setfield(L, -3, name);
-            lua_remove(L, -2);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassProperty<std::decay_t<R>, std::decay_t<Base>>::set), 1);
+            name_accessor(name, "set");
+            lua_setfield(L, -2, name);
+            lua_pop(L, 1);
 
-            lua_pushcclosure(L, TraitsClassProperty<std::decay_t<R>, std::decay_t<Base>>::get, 1);
+            push_property_index();
+            new (lua_newuserdata(L, sizeof(prop))) PropType(prop);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassProperty<std::decay_t<R>, std::decay_t<Base>>::get), 1);
+            name_accessor(name, "get");
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -509,14 +538,16 @@ namespace LuaBinding {
             {
                 push_property_newindex();
                 new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                lua_pushcclosure(L, TraitsClassPropertyNFn<R, T>::set, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFn<R, T>::set), 1);
+                name_accessor(name, "set");
                 lua_setfield(L, -2, name);
                 lua_pop(L, 1);
             }
 
             push_property_index();
             new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            lua_pushcclosure(L, TraitsClassPropertyNFn<R, T>::get, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFn<R, T>::get), 1);
+            name_accessor(name, "get");
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -532,14 +563,16 @@ namespace LuaBinding {
             {
                 push_property_newindex();
                 new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                lua_pushcclosure(L, TraitsClassPropertyFn<R, Base>::set, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFn<R, Base>::set), 1);
+                name_accessor(name, "set");
                 lua_setfield(L, -2, name);
                 lua_pop(L, 1);
             }
 
             push_property_index();
             new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            lua_pushcclosure(L, TraitsClassPropertyFn<R, Base>::get, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFn<R, Base>::get), 1);
+            name_accessor(name, "get");
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -555,14 +588,16 @@ namespace LuaBinding {
             {
                 push_property_newindex();
                 new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                lua_pushcclosure(L, TraitsClassPropertyFn<R, Base>::set, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFn<R, Base>::set), 1);
+                name_accessor(name, "set");
                 lua_setfield(L, -2, name);
                 lua_pop(L, 1);
             }
 
             push_property_index();
             new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            lua_pushcclosure(L, TraitsClassPropertyFn<R, Base>::get, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFn<R, Base>::get), 1);
+            name_accessor(name, "get");
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -578,14 +613,16 @@ namespace LuaBinding {
             {
                 push_property_newindex();
                 new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                lua_pushcclosure(L, TraitsClassPropertyNFunFn<R, T>::set, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunFn<R, T>::set), 1);
+                name_accessor(name, "set");
                 lua_setfield(L, -2, name);
                 lua_pop(L, 1);
             }
 
             push_property_index();
             new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            lua_pushcclosure(L, TraitsClassPropertyNFunFn<R, T>::get, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunFn<R, T>::get), 1);
+            name_accessor(name, "get");
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -601,14 +638,16 @@ namespace LuaBinding {
             {
                 push_property_newindex();
                 new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                lua_pushcclosure(L, TraitsClassPropertyFunFn<R, Base>::set, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunFn<R, Base>::set), 1);
+                name_accessor(name, "set");
                 lua_setfield(L, -2, name);
                 lua_pop(L, 1);
             }
 
             push_property_index();
             new (lua_newuserdata(L, sizeof(get))) get_t(get);
-            lua_pushcclosure(L, TraitsClassPropertyFunFn<R, Base>::get, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunFn<R, Base>::get), 1);
+            name_accessor(name, "get");
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
             return *this;
@@ -644,7 +683,8 @@ namespace LuaBinding {
                 else if constexpr (std::is_same_v<U, State>)
                 {
                     new (lua_newuserdata(L, sizeof(set))) set_t(set);
-                    lua_pushcclosure(L, TraitsClassPropertyNCFun<R, T>::set, 1);
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNCFun<R, T>::set), 1);
+                    name_accessor(name, "set");
                 }
                 lua_setfield(L, -2, name);
                 lua_pop(L, 1);
@@ -658,7 +698,8 @@ namespace LuaBinding {
             else if constexpr (std::is_same_v<U, State>)
             {
                 new (lua_newuserdata(L, sizeof(get))) get_t(get);
-                lua_pushcclosure(L, TraitsClassPropertyNCFun<R, T>::get, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNCFun<R, T>::get), 1);
+                name_accessor(name, "get");
             }
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
@@ -677,11 +718,13 @@ namespace LuaBinding {
                 new (lua_newuserdata(L, sizeof(set))) set_t(set);
                 if constexpr (std::is_same_v<U, lua_State*>)
                 {
-                    lua_pushcclosure(L, TraitsClassPropertyCFunL<R, Base>::set, 1);
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyCFunL<R, Base>::set), 1);
+                    name_accessor(name, "set");
                 }
                 else if constexpr (std::is_same_v<U, State>)
                 {
-                    lua_pushcclosure(L, TraitsClassPropertyCFunS<R, Base>::set, 1);
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyCFunS<R, Base>::set), 1);
+                    name_accessor(name, "set");
                 }
                 lua_setfield(L, -2, name);
                 lua_pop(L, 1);
@@ -691,11 +734,13 @@ namespace LuaBinding {
             new (lua_newuserdata(L, sizeof(get))) get_t(get);
             if constexpr (std::is_same_v<U, lua_State*>)
             {
-                lua_pushcclosure(L, TraitsClassPropertyCFunL<R, Base>::get, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyCFunL<R, Base>::get), 1);
+                name_accessor(name, "get");
             }
             else if constexpr (std::is_same_v<U, State>)
             {
-                lua_pushcclosure(L, TraitsClassPropertyCFunS<R, Base>::get, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyCFunS<R, Base>::get), 1);
+                name_accessor(name, "get");
             }
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
@@ -714,11 +759,13 @@ namespace LuaBinding {
                 new (lua_newuserdata(L, sizeof(set))) set_t(set);
                 if constexpr (std::is_same_v<U, lua_State*>)
                 {
-                    lua_pushcclosure(L, TraitsClassPropertyNFunLCFn<R, T>::set, 1);
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunLCFn<R, T>::set), 1);
+                    name_accessor(name, "set");
                 }
                 else if constexpr (std::is_same_v<U, State>)
                 {
-                    lua_pushcclosure(L, TraitsClassPropertyNFunCFn<R, T>::set, 1);
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunCFn<R, T>::set), 1);
+                    name_accessor(name, "set");
                 }
                 lua_setfield(L, -2, name);
                 lua_pop(L, 1);
@@ -728,11 +775,13 @@ namespace LuaBinding {
             new (lua_newuserdata(L, sizeof(get))) get_t(get);
             if constexpr (std::is_same_v<U, lua_State*>)
             {
-                lua_pushcclosure(L, TraitsClassPropertyNFunLCFn<R, T>::get, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunLCFn<R, T>::get), 1);
+                name_accessor(name, "get");
             }
             else if constexpr (std::is_same_v<U, State>)
             {
-                lua_pushcclosure(L, TraitsClassPropertyNFunCFn<R, T>::get, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyNFunCFn<R, T>::get), 1);
+                name_accessor(name, "get");
             }
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
@@ -751,11 +800,13 @@ namespace LuaBinding {
                 new (lua_newuserdata(L, sizeof(set))) set_t(set);
                 if constexpr (std::is_same_v<U, lua_State*>)
                 {
-                    lua_pushcclosure(L, TraitsClassPropertyFunLCFn<R, Base>::set, 1);
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunLCFn<R, Base>::set), 1);
+                    name_accessor(name, "set");
                 }
                 else if constexpr (std::is_same_v<U, State>)
                 {
-                    lua_pushcclosure(L, TraitsClassPropertyFunC<R, Base>::set, 1);
+                    lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunC<R, Base>::set), 1);
+                    name_accessor(name, "set");
                 }
                 lua_setfield(L, -2, name);
                 lua_pop(L, 1);
@@ -765,11 +816,13 @@ namespace LuaBinding {
             new (lua_newuserdata(L, sizeof(get))) get_t(get);
             if constexpr (std::is_same_v<U, lua_State*>)
             {
-                lua_pushcclosure(L, TraitsClassPropertyFunLCFn<R, Base>::get, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunLCFn<R, Base>::get), 1);
+                name_accessor(name, "get");
             }
             else if constexpr (std::is_same_v<U, State>)
             {
-                lua_pushcclosure(L, TraitsClassPropertyFunC<R, Base>::get, 1);
+                lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassPropertyFunC<R, Base>::get), 1);
+                name_accessor(name, "get");
             }
             lua_setfield(L, -2, name);
             lua_pop(L, 1);
@@ -0,0 +1,162 @@
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "BytecodeCache.h"
+#include "MappedFile.h"
+
+namespace LuaBinding {
+    // Result of a background compile, loaded into a State with State::load(bytecode)
+    struct Bytecode {
+        string_type chunkname;
+        string_type code;
+        string_type error;
+
+        [[nodiscard]] bool ok() const
+        {
+            return error.empty();
+        }
+    };
+
+    // Compiles chunks to bytecode on worker threads, each owning a scratch lua_State.
+    // Callbacks run on the worker thread; hand the Bytecode over to the thread owning the State.
+    class Compiler {
+        using Job = std::function<void(lua_State*)>;
+        std::vector<std::thread> workers;
+        std::deque<Job> jobs;
+        std::mutex mutex;
+        std::condition_variable cv;
+        bool stopping = false;
+        bool strip;
+
+        void run()
+        {
+            lua_State* L = nullptr;
+            for (;;)
+            {
+                Job job;
+                {
+                    std::unique_lock<std::mutex> lock(mutex);
+                    cv.wait(lock, [this] { return stopping || !jobs.empty(); });
+                    if (jobs.empty())
+                        break;
+                    job = std::move(jobs.front());
+                    jobs.pop_front();
+                }
+                // without a state the job fails, the next one tries again
+                if (!L)
+                    L = luaL_newstate();
+                job(L);
+                if (L)
+                    lua_settop(L, 0);
+            }
+            if (L)
+                lua_close(L);
+        }
+
+        void post(Job job)
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                jobs.push_back(std::move(job));
+            }
+            cv.notify_one();
+        }
+
+        static Bytecode build(lua_State* L, const char* code, size_t len, string_type chunkname, bool strip)
+        {
+            Bytecode result;
+            result.chunkname = std::move(chunkname);
+            if (!L)
+                result.error = "not enough memory";
+            else if (luaL_loadbuffer(L, code, len, result.chunkname.c_str()))
+            {
+                size_t size = 0;
+                auto error = lua_tolstring(L, -1, &size);
+                result.error = error ? string_type(error, size) : string_type("compile error");
+            }
+            else if (detail::dump(L, detail::write_string, &result.code, strip))
+                result.error = "unable to dump given function";
+            return result;
+        }
+    public:
+        explicit Compiler(size_t threads = 1, bool strip = false) : strip(strip)
+        {
+            if (!threads)
+                threads = 1;
+            workers.reserve(threads);
+            for (size_t i = 0; i < threads; i++)
+                workers.emplace_back([this] { run(); });
+        }
+        Compiler(const Compiler&) = delete;
+        Compiler& operator=(const Compiler&) = delete;
+        // finishes the queued jobs before returning
+        ~Compiler()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            cv.notify_all();
+            for (auto& worker : workers)
+                worker.join();
+        }
+
+        void compile(string_type source, string_type chunkname, std::function<void(Bytecode)> done)
+        {
+            post([this, source = std::move(source), chunkname = std::move(chunkname), done = std::move(done)](lua_State* L) mutable {
+                done(build(L, source.data(), source.size(), std::move(chunkname), strip));
+            });
+        }
+
+        std::future<Bytecode> compile(string_type source, string_type chunkname = "=")
+        {
+            auto promise = std::make_shared<std::promise<Bytecode>>();
+            auto future = promise->get_future();
+            compile(std::move(source), std::move(chunkname), [promise](Bytecode bytecode) {
+                promise->set_value(std::move(bytecode));
+            });
+            return future;
+        }
+
+        // the file is mapped on the worker, chunkname is "@path"
+        void compile_file(string_type path, std::function<void(Bytecode)> done)
+        {
+            post([this, path = std::move(path), done = std::move(done)](lua_State* L) mutable {
+                MappedFile file(path.c_str());
+                if (!file.valid())
+                {
+                    Bytecode result;
+                    result.chunkname = "@" + path;
+                    result.error = "cannot open " + path;
+                    done(std::move(result));
+                    return;
+                }
+                auto data = file.data();
+                auto size = file.size();
+                detail::skip_shebang(data, size);
+                done(build(L, data, size, "@" + path, strip));
+            });
+        }
+
+        std::future<Bytecode> compile_file(string_type path)
+        {
+            auto promise = std::make_shared<std::promise<Bytecode>>();
+            auto future = promise->get_future();
+            compile_file(std::move(path), [promise](Bytecode bytecode) {
+                promise->set_value(std::move(bytecode));
+            });
+            return future;
+        }
+
+        [[nodiscard]] size_t pending()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return jobs.size();
+        }
+    };
+}
\ No newline at end of file
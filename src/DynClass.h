@@ -42,6 +42,8 @@ namespace LuaBinding {
             lua_pushlightuserdata(L, this);
             lua_setfield(L, -2, "__key");
 
+            ExternalMemory::of(L).name(this, name);
+
             lua_pushcfunction(L, dyn_call);
             lua_setfield(L, -2, "New");
 
@@ -90,7 +92,13 @@ namespace LuaBinding {
             }
             auto u = (void**)lua_touserdata(S, 1);
             if (*(u + 1) == (void*)0xC0FFEE) {
-                free(*u);
+                const void* c = nullptr;
+                if (luaL_getmetafield(S, 1, "__key"))
+                {
+                    c = lua_touserdata(S, -1);
+                    lua_pop(S, 1);
+                }
+                detail::free_object(S, *u, c);
             }
             return 0;
         }
@@ -402,13 +410,14 @@ namespace LuaBinding {
 
             auto size = lua_isinteger(L, 2) ? lua_tointeger(L, 2) : c->get_size();
 
-            auto udata = (void*)malloc(size);
+            auto udata = detail::new_object(L, size);
             memset(udata, 0, size);
             auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
             *u = udata; *(u + 1) = (void*)0xC0FFEE;
 
             push_metatable(L, c, true);
             lua_setmetatable(L, -2);
+            detail::report_object(L, udata, size, c);
 
             return 1;
         }
@@ -1,8 +1,37 @@
 #pragma once
+#include <vector>
+#include "MemoryQuota.h"
 
 namespace LuaBinding {
     class Environment : public ObjectRef {
+        friend class EnvironmentPool;
     protected:
+        // calls upvalue 2 in the quota scope of the env in upvalue 1, whose registry ref is
+        // upvalue 3; the env comes first so Environment::pcall rebinding it changes nothing
+        static int quota_call(lua_State* L)
+        {
+            auto env = (int)lua_tointeger(L, lua_upvalueindex(3));
+            lua_rawgeti(L, LUA_REGISTRYINDEX, env);
+            auto alive = lua_rawequal(L, -1, lua_upvalueindex(1));
+            lua_pop(L, 1);
+            lua_pushvalue(L, lua_upvalueindex(2));
+            lua_insert(L, 1);
+            // the ref was released and may belong to another env now
+            if (!alive)
+            {
+                lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+                return lua_gettop(L);
+            }
+            int status;
+            {
+                MemoryQuota::Scope scope(L, env);
+                status = lua_pcall(L, lua_gettop(L) - 1, LUA_MULTRET, 0);
+            }
+            if (status)
+                return lua_error(L);
+            return lua_gettop(L);
+        }
+
         static int lookup_global(lua_State* L)
         {
             lua_pushvalue(L, -2);
@@ -18,6 +47,60 @@ namespace LuaBinding {
 #endif
             return !lua_isnoneornil(L, -1);
         }
+
+        // pushes the value at index, as a shallow copy for tables when snapshot is set;
+        // the globals table itself becomes env
+        static void push_global_copy(lua_State* L, int index, int env, bool snapshot)
+        {
+            index = lua_absindex(L, index);
+            lua_pushglobaltable(L);
+            auto is_globals = lua_rawequal(L, index, -1);
+            lua_pop(L, 1);
+            if (is_globals)
+                lua_pushvalue(L, env);
+            else if (snapshot && lua_type(L, index) == LUA_TTABLE)
+            {
+                lua_newtable(L);
+                lua_pushnil(L);
+                while (lua_next(L, index))
+                {
+                    lua_pushvalue(L, -2);
+                    lua_insert(L, -2);
+                    lua_rawset(L, -4);
+                }
+                if (lua_getmetatable(L, index))
+                    lua_setmetatable(L, -2);
+            } else
+                lua_pushvalue(L, index);
+        }
+
+        // copies the listed globals (all of them when empty) into the table at env
+        static void populate(lua_State* L, int env, const std::vector<const char*>& globals, bool snapshot)
+        {
+            env = lua_absindex(L, env);
+            lua_pushglobaltable(L);
+            auto g = lua_gettop(L);
+            if (globals.empty())
+            {
+                lua_pushnil(L);
+                while (lua_next(L, g))
+                {
+                    lua_pushvalue(L, -2);
+                    push_global_copy(L, -2, env, snapshot);
+                    lua_rawset(L, env);
+                    lua_pop(L, 1);
+                }
+            } else {
+                for (auto name : globals)
+                {
+                    lua_getfield(L, g, name);
+                    push_global_copy(L, -1, env, snapshot);
+                    lua_setfield(L, env, name);
+                    lua_pop(L, 1);
+                }
+            }
+            lua_pop(L, 1);
+        }
     public:
         Environment() = default;
         explicit Environment(lua_State* L)
@@ -30,7 +113,25 @@ namespace LuaBinding {
             lua_setfield(L, -2, "__index");
             lua_setmetatable(L, -2);
 
-            this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
+            this->idx = RegistryRefs::ref(L);
+        }
+        // Flattened env: the listed globals (all of them when empty) are copied in, so lookups
+        // hit the env table directly. Writes land in the env only; snapshot also copies tables
+        // one level deep so writes like math.x stay in the sandbox. Names that were not copied
+        // resolve through _G only with fallback.
+        Environment(lua_State* L, const std::vector<const char*>& globals, bool snapshot = false, bool fallback = false)
+        {
+            this->L = L;
+            lua_createtable(L, 0, (int)globals.size());
+            populate(L, -1, globals, snapshot);
+            if (fallback)
+            {
+                lua_newtable(L);
+                lua_pushglobaltable(L);
+                lua_setfield(L, -2, "__index");
+                lua_setmetatable(L, -2);
+            }
+            this->idx = RegistryRefs::ref(L);
         }
         explicit Environment(lua_State* L, int findex)
         {
@@ -40,7 +141,7 @@ namespace LuaBinding {
 #else
             lua_getupvalue(L, findex, 1);
 #endif
-            this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
+            this->idx = RegistryRefs::ref(L);
         }
         explicit Environment(lua_State* L, bool)
         {
@@ -50,9 +151,53 @@ namespace LuaBinding {
 #else
             lua_getupvalue(L, lua_upvalueindex(1), 1);
 #endif
-            this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
+            this->idx = RegistryRefs::ref(L);
         }
-        int pcall(int narg = 0, int nres = 0) {
+        // binds the env of the function at findex once, later calls through LuaBinding::pcall or
+        // ObjectRef::call need no Environment. With a MemoryQuota the function at findex is
+        // replaced by a wrapper running it in the env's quota scope; calls through it cannot yield.
+        void bind(int findex) const
+        {
+            findex = lua_absindex(L, findex);
+            lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
+#if LUA_VERSION_NUM < 502
+            lua_setfenv(L, findex);
+#else
+            if (!lua_setupvalue(L, findex, 1))
+                lua_pop(L, 1);
+#endif
+            if (MemoryQuota::get(L))
+            {
+                lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
+                lua_pushvalue(L, findex);
+                lua_pushinteger(L, idx);
+                lua_pushcclosure(L, quota_call, 3);
+                lua_replace(L, findex);
+            }
+        }
+
+        // compiles a fresh chunk bound to this env, the result can be called any number of times
+        ObjectRef load(const char* code, size_t len, const char* chunkname = "=") const
+        {
+            if (luaL_loadbuffer(L, code, len, chunkname))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+                lua_pop(L, 1);
+                return {};
+            }
+            bind(-1);
+            return ObjectRef(L, -1, false);
+        }
+
+        ObjectRef load(const char* code) const
+        {
+            return load(code, strlen(code), code);
+        }
+
+        int pcall(int narg = 0, int nres = 0) const {
+            MemoryQuota::Scope scope(L, idx);
             lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
 #if LUA_VERSION_NUM < 502
             lua_setfenv(L, lua_gettop(L) - narg - 1);
@@ -0,0 +1,159 @@
+#pragma once
+#include <vector>
+#include "Environment.h"
+
+namespace LuaBinding {
+    // Prebuilt Environments handed out per request. Keys a script adds to its env are recorded by
+    // a __newindex hook and cleared when the env comes back, copied globals are written again,
+    // so reuse costs a few rawsets instead of a new table, metatable and registry ref.
+    // Writes through rawset bypass the hook and are not cleared.
+    class EnvironmentPool {
+        lua_State* L;
+        std::vector<string_type> names;
+        std::vector<const char*> globals;
+        bool flatten;
+        bool snapshot;
+        bool fallback;
+        std::vector<Environment> free;
+
+        // __newindex(env, key, value) with the set of dirty keys as upvalue
+        static int track(lua_State* L)
+        {
+            lua_settop(L, 3);
+            lua_pushvalue(L, 2);
+            lua_pushvalue(L, 3);
+            lua_rawset(L, 1);
+            if (!lua_isnil(L, 3))
+            {
+                lua_pushvalue(L, 2);
+                lua_pushboolean(L, 1);
+                lua_rawset(L, lua_upvalueindex(1));
+            }
+            return 0;
+        }
+
+        Environment create()
+        {
+            lua_newtable(L);
+            if (flatten)
+                Environment::populate(L, -1, globals, snapshot);
+            lua_newtable(L);
+            if (fallback)
+            {
+                lua_pushglobaltable(L);
+                lua_setfield(L, -2, "__index");
+            }
+            lua_newtable(L);
+            lua_pushcclosure(L, track, 1);
+            lua_setfield(L, -2, "__newindex");
+            lua_setmetatable(L, -2);
+            Environment env;
+            env.L = L;
+            env.idx = RegistryRefs::ref(L);
+            return env;
+        }
+
+        // false when the script replaced the metatable or its tracker, the env cannot be reused then
+        bool reset(const Environment& env)
+        {
+            env.push();
+            auto t = lua_gettop(L);
+            if (!lua_istable(L, t) || !lua_getmetatable(L, t))
+            {
+                lua_settop(L, t - 1);
+                return false;
+            }
+            lua_getfield(L, -1, "__newindex");
+            if (lua_tocfunction(L, -1) != track || !lua_getupvalue(L, -1, 1) || !lua_istable(L, -1))
+            {
+                lua_settop(L, t - 1);
+                return false;
+            }
+            auto dirty = lua_gettop(L);
+            lua_pushnil(L);
+            while (lua_next(L, dirty))
+            {
+                lua_pop(L, 1);
+                lua_pushvalue(L, -1);
+                lua_pushnil(L);
+                lua_rawset(L, t);
+            }
+            // a fresh set, so one busy lease does not leave a large table behind
+            lua_newtable(L);
+            lua_setupvalue(L, dirty - 1, 1);
+            if (flatten)
+                Environment::populate(L, t, globals, snapshot);
+            lua_settop(L, t - 1);
+            return true;
+        }
+    public:
+        class Lease {
+            EnvironmentPool* pool = nullptr;
+            Environment env;
+        public:
+            Lease(EnvironmentPool* pool, Environment&& env) : pool(pool), env(std::move(env))
+            {}
+            Lease(const Lease&) = delete;
+            Lease& operator=(const Lease&) = delete;
+            Lease(Lease&& other) noexcept : pool(other.pool), env(std::move(other.env))
+            {
+                other.pool = nullptr;
+            }
+            ~Lease()
+            {
+                if (pool)
+                    pool->release(std::move(env));
+            }
+
+            const Environment& get() const
+            {
+                return env;
+            }
+
+            operator const Environment& () const
+            {
+                return env;
+            }
+
+            const Environment* operator->() const
+            {
+                return &env;
+            }
+        };
+
+        // empty globals: plain envs reading through _G, otherwise flattened like Environment(L, globals, ...)
+        explicit EnvironmentPool(lua_State* L, const std::vector<const char*>& globals = {}, bool snapshot = false, bool fallback = true, size_t prebuilt = 0)
+            : L(L), names(globals.begin(), globals.end()), flatten(!globals.empty()), snapshot(snapshot), fallback(fallback || globals.empty())
+        {
+            for (auto& name : names)
+                this->globals.push_back(name.c_str());
+            free.reserve(prebuilt);
+            for (size_t i = 0; i < prebuilt; i++)
+                free.push_back(create());
+        }
+        EnvironmentPool(const EnvironmentPool&) = delete;
+        EnvironmentPool& operator=(const EnvironmentPool&) = delete;
+
+        Lease acquire()
+        {
+            if (free.empty())
+                return Lease(this, create());
+            auto env = std::move(free.back());
+            free.pop_back();
+            return Lease(this, std::move(env));
+        }
+
+        // an env whose tracking was tampered with is dropped, acquire builds a new one
+        void release(Environment&& env)
+        {
+            if (!env.valid(L) || !reset(env))
+                return;
+            free.push_back(std::move(env));
+        }
+
+        [[nodiscard]] size_t available() const
+        {
+            return free.size();
+        }
+    };
+}
\ No newline at end of file
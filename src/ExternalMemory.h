@@ -0,0 +1,212 @@
+#pragma once
+#include <climits>
+#include <cstddef>
+#include <unordered_map>
+#include "StateData.h"
+
+namespace LuaBinding {
+    // Size reported to the collector for a boxed T, sizeof(T) unless set through Class<T>::external_size
+    template<class T>
+    struct ExternalSize {
+        static inline size_t (*size)(const T&) = nullptr;
+
+        static size_t of(const T& t)
+        {
+            return size ? size(t) : sizeof(T);
+        }
+    };
+
+    // Boxed objects of one class, external is the bytes reported for the live ones
+    struct InstanceStats {
+        string_type name;
+        size_t created = 0;
+        size_t collected = 0;
+        size_t peak = 0;
+        size_t external = 0;
+
+        [[nodiscard]] size_t live() const
+        {
+            return created - collected;
+        }
+    };
+
+    // C++ memory owned by userdata boxes. Lua only sees the two pointer box, so the bytes are fed
+    // to the collector as lua_gc steps once they add up to step_size.
+    class ExternalMemory {
+        size_t total = 0;
+        size_t debt = 0;
+        size_t step = 64 * 1024;
+        std::unordered_map<const void*, InstanceStats> types;
+
+        static char* key()
+        {
+            static char k;
+            return &k;
+        }
+    public:
+        static ExternalMemory* get(lua_State* L)
+        {
+            return detail::state_data<ExternalMemory>(L, key());
+        }
+
+        static ExternalMemory& of(lua_State* L)
+        {
+            if (auto memory = get(L))
+                return *memory;
+            return *detail::make_state_data<ExternalMemory>(L, key());
+        }
+
+        void add(lua_State* L, size_t bytes)
+        {
+            total += bytes;
+            debt += bytes;
+            if (debt < step)
+                return;
+            auto kb = (int)(debt / 1024 > INT_MAX ? INT_MAX : debt / 1024);
+            debt = 0;
+            lua_gc(L, LUA_GCSTEP, kb);
+        }
+
+        void remove(size_t bytes)
+        {
+            total = total > bytes ? total - bytes : 0;
+        }
+
+        // bytes reported and not freed yet
+        [[nodiscard]] size_t size() const
+        {
+            return total;
+        }
+
+        void created(const void* type, size_t bytes)
+        {
+            auto& t = types[type];
+            t.created++;
+            t.external += bytes;
+            if (t.live() > t.peak)
+                t.peak = t.live();
+        }
+
+        void collected(const void* type, size_t bytes)
+        {
+            auto& t = types[type];
+            t.collected++;
+            t.external = t.external > bytes ? t.external - bytes : 0;
+        }
+
+        void resized(const void* type, size_t from, size_t to)
+        {
+            auto& t = types[type];
+            t.external = t.external + to > from ? t.external + to - from : 0;
+        }
+
+        // Sizes are taken when an object is boxed. Call this when a boxed T owned by Lua, one
+        // constructed by a script or pushed by value, changed what it owns; bytes defaults to
+        // ExternalSize<T>::of(*p). Pointers pushed by reference have no size to update.
+        template<class T>
+        static void resize(lua_State* L, T* p, size_t bytes);
+
+        template<class T>
+        static void resize(lua_State* L, T* p)
+        {
+            resize(L, p, ExternalSize<T>::of(*p));
+        }
+
+        void name(const void* type, string_type name)
+        {
+            types[type].name = std::move(name);
+        }
+
+        // per class, keyed by detail::type_key<T>() or the DynClass
+        [[nodiscard]] const std::unordered_map<const void*, InstanceStats>& instances() const
+        {
+            return types;
+        }
+
+        // pending bytes before the collector is stepped
+        void set_step_size(size_t bytes)
+        {
+            step = bytes;
+        }
+
+        [[nodiscard]] size_t step_size() const
+        {
+            return step;
+        }
+    };
+
+    namespace detail {
+        // identifies T in ExternalMemory::instances()
+        template<class T>
+        const void* type_key()
+        {
+            static char k;
+            return &k;
+        }
+
+        // C++ objects boxed in userdata come from the allocator of their State. The block starts
+        // with its size and the size reported to ExternalMemory, both needed by the free.
+        constexpr size_t object_header = alignof(std::max_align_t) > 2 * sizeof(size_t) ? alignof(std::max_align_t) : 2 * sizeof(size_t);
+
+        inline void* new_object(lua_State* L, size_t size)
+        {
+            void* ud;
+            auto f = lua_getallocf(L, &ud);
+            auto p = (char*)f(ud, nullptr, 0, size + object_header);
+            if (!p)
+                luaL_error(L, "not enough memory");
+            ((size_t*)p)[0] = size;
+            ((size_t*)p)[1] = 0;
+            return p + object_header;
+        }
+
+        // reports the object of the given type once its box is set up on the stack, may run a collector step
+        inline void report_object(lua_State* L, void* p, size_t external, const void* type)
+        {
+            ((size_t*)((char*)p - object_header))[1] = external;
+            auto& memory = ExternalMemory::of(L);
+            memory.created(type, external);
+            memory.add(L, external);
+        }
+
+        template<class T>
+        void report_object(lua_State* L, T* p)
+        {
+            report_object(L, (void*)p, ExternalSize<T>::of(*p), type_key<std::remove_cv_t<T>>());
+        }
+
+        inline void resize_object(lua_State* L, void* p, size_t external, const void* type)
+        {
+            auto& reported = ((size_t*)((char*)p - object_header))[1];
+            auto old = reported;
+            reported = external;
+            auto& memory = ExternalMemory::of(L);
+            memory.resized(type, old, external);
+            if (external > old)
+                memory.add(L, external - old);
+            else
+                memory.remove(old - external);
+        }
+
+        inline void free_object(lua_State* L, void* p, const void* type)
+        {
+            if (!p)
+                return;
+            auto block = (char*)p - object_header;
+            if (auto memory = ExternalMemory::get(L))
+            {
+                memory->remove(((size_t*)block)[1]);
+                memory->collected(type, ((size_t*)block)[1]);
+            }
+            void* ud;
+            auto f = lua_getallocf(L, &ud);
+            f(ud, block, ((size_t*)block)[0] + object_header, 0);
+        }
+    }
+
+    template<class T>
+    void ExternalMemory::resize(lua_State* L, T* p, size_t bytes)
+    {
+        detail::resize_object(L, (void*)p, bytes, detail::type_key<std::remove_cv_t<T>>());
+    }
+}
\ No newline at end of file
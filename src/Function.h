@@ -548,7 +548,7 @@ namespace LuaBinding {
         {
             using FnType = decltype (func);
             new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsNClass<R, Params...>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsNClass<R, Params...>::f), 1);
         }
 
         template <class T, class R, class... Params>
@@ -556,7 +556,7 @@ namespace LuaBinding {
         {
             using FnType = decltype (func);
             new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClass<R, T, Params...>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClass<R, T, Params...>::f), 1);
         }
 
         template <class T, class R, class... Params>
@@ -564,7 +564,7 @@ namespace LuaBinding {
         {
             using FnType = std::decay_t<decltype (func)>;
             new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClass<R, T, Params...>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClass<R, T, Params...>::f), 1);
         }
 
         template <class T, class R, class... Params>
@@ -572,7 +572,7 @@ namespace LuaBinding {
         {
             using FnType = decltype (func);
             new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsFunClass<R, T, Params...>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsFunClass<R, T, Params...>::f), 1);
         }
 
         template <class T, class R, class... Params>
@@ -580,7 +580,7 @@ namespace LuaBinding {
         {
             using FnType = std::decay_t<decltype (func)>;
             new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsFunClass<R, T, Params...>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsFunClass<R, T, Params...>::f), 1);
         }
 
         template <class T, class R> requires std::is_integral_v<R>
@@ -588,7 +588,7 @@ namespace LuaBinding {
         {
             using func_t = decltype (func);
             new (lua_newuserdata(L, sizeof(func))) func_t(func);
-            lua_pushcclosure(L, TraitsClassLCFunc<T>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassLCFunc<T>::f), 1);
         }
 
         template <class T, class R> requires std::is_integral_v<R>
@@ -596,7 +596,7 @@ namespace LuaBinding {
         {
             using FnType = decltype (func);
             new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClassFunLCFunc<T>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassFunLCFunc<T>::f), 1);
         }
 
         template <class T, class R> requires std::is_integral_v<R>
@@ -610,7 +610,7 @@ namespace LuaBinding {
         {
             using FnType = decltype (func);
             new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClassFunNLCFunc<T>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassFunNLCFunc<T>::f), 1);
         }
 
         template <class T, class R, class U> requires std::is_integral_v<R>
@@ -618,7 +618,7 @@ namespace LuaBinding {
         {
             using func_t = decltype (func);
             new (lua_newuserdata(L, sizeof(func))) func_t(func);
-            lua_pushcclosure(L, TraitsClassCFunc<T>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassCFunc<T>::f), 1);
         }
 
         template <class T, class R, class U> requires std::is_integral_v<R>
@@ -626,14 +626,14 @@ namespace LuaBinding {
         {
             using func_t = decltype (func);
             new (lua_newuserdata(L, sizeof(func))) func_t(func);
-            lua_pushcclosure(L, TraitsClassCFunc<T>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassCFunc<T>::f), 1);
         }
 
         template <class T, class R, class U> requires std::is_integral_v<R>
         void cfun(lua_State *L, R(*func)(U))
         {
             lua_pushlightuserdata(L, reinterpret_cast<void*>(func));
-            lua_pushcclosure(L, TraitsCFunc<T>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsCFunc<T>::f), 1);
         }
 
         template <class T, class R, class U> requires std::is_integral_v<R>
@@ -641,7 +641,7 @@ namespace LuaBinding {
         {
             using FnType = decltype (func);
             new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClassFunNCFunc<T>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassFunNCFunc<T>::f), 1);
         }
 
         template <class T, class R, class U> requires std::is_integral_v<R>
@@ -649,7 +649,7 @@ namespace LuaBinding {
         {
             using FnType = decltype (func);
             new (lua_newuserdata(L, sizeof(func))) FnType(func);
-            lua_pushcclosure(L, TraitsClassFunCFunc<T>::f, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(TraitsClassFunCFunc<T>::f), 1);
         }
         
         template <class T, class F>
@@ -829,7 +829,7 @@ namespace LuaBinding {
                 return 0;
             };
             (push_fun(L, functions), ...);
-            lua_pushcclosure(L, call, 1);
+            lua_pushcclosure(L, LUABINDING_THUNK(call), 1);
         }
         static int call(lua_State* L) {
             auto argn = lua_gettop(L);
@@ -0,0 +1,181 @@
+#pragma once
+#include <chrono>
+#include "StateData.h"
+
+namespace LuaBinding {
+    // Explicit collector work of a State, measured by GarbageCollector. Automatic steps taken
+    // while Lua allocates are not included.
+    struct GCStats {
+        size_t steps = 0;
+        size_t cycles = 0;
+        size_t collections = 0;
+        std::chrono::microseconds last_pause{ 0 };
+        std::chrono::microseconds max_pause{ 0 };
+        std::chrono::microseconds total{ 0 };
+        // set by GarbageCollector::generational/incremental, mode switches done from Lua are not seen
+        bool generational = false;
+    };
+
+    // Collector control of a lua_State, from State::gc()
+    class GarbageCollector {
+        using clock = std::chrono::steady_clock;
+        lua_State* L;
+
+        static char* key()
+        {
+            static char k;
+            return &k;
+        }
+
+        GCStats& data()
+        {
+            if (auto stats = detail::state_data<GCStats>(L, key()))
+                return *stats;
+            return *detail::make_state_data<GCStats>(L, key());
+        }
+
+        void record(clock::time_point start)
+        {
+            auto pause = std::chrono::duration_cast<std::chrono::microseconds>(clock::now() - start);
+            auto& stats = data();
+            stats.last_pause = pause;
+            if (pause > stats.max_pause)
+                stats.max_pause = pause;
+            stats.total += pause;
+        }
+    public:
+        explicit GarbageCollector(lua_State* L) : L(L)
+        {}
+
+        // pause and stepmul in percent, 0 keeps the current value; stepsize is log2 bytes (5.4)
+        void incremental(int pause = 0, int stepmul = 0, int stepsize = 0)
+        {
+            data().generational = false;
+#if LUA_VERSION_NUM >= 504
+            lua_gc(L, LUA_GCINC, pause, stepmul, stepsize);
+#else
+            (void)stepsize;
+#if LUA_VERSION_NUM == 502
+            lua_gc(L, LUA_GCINC, 0);
+#endif
+            if (pause)
+                lua_gc(L, LUA_GCSETPAUSE, pause);
+            if (stepmul)
+                lua_gc(L, LUA_GCSETSTEPMUL, stepmul);
+#endif
+        }
+
+        // false when the interpreter has no generational mode (5.2 and 5.4 have one)
+        bool generational(int minormul = 0, int majormul = 0)
+        {
+#if LUA_VERSION_NUM >= 504
+            lua_gc(L, LUA_GCGEN, minormul, majormul);
+            data().generational = true;
+            return true;
+#elif LUA_VERSION_NUM == 502
+            (void)minormul; (void)majormul;
+            lua_gc(L, LUA_GCGEN, 0);
+            return true;
+#else
+            (void)minormul; (void)majormul;
+            return false;
+#endif
+        }
+
+        // returns the previous value
+        int set_pause(int percent)
+        {
+            return lua_gc(L, LUA_GCSETPAUSE, percent);
+        }
+
+        int set_stepmul(int percent)
+        {
+            return lua_gc(L, LUA_GCSETSTEPMUL, percent);
+        }
+
+        void stop()
+        {
+            lua_gc(L, LUA_GCSTOP, 0);
+        }
+
+        void restart()
+        {
+            lua_gc(L, LUA_GCRESTART, 0);
+        }
+
+#if LUA_VERSION_NUM >= 502
+        [[nodiscard]] bool running()
+        {
+            return lua_gc(L, LUA_GCISRUNNING, 0);
+        }
+#endif
+
+        // bytes in use by Lua
+        [[nodiscard]] size_t count()
+        {
+            return (size_t)lua_gc(L, LUA_GCCOUNT, 0) * 1024 + lua_gc(L, LUA_GCCOUNTB, 0);
+        }
+
+        void collect()
+        {
+            auto start = clock::now();
+            lua_gc(L, LUA_GCCOLLECT, 0);
+            record(start);
+            data().collections++;
+        }
+
+        // one step, as if kb were allocated (0 is a basic step); true when a cycle finished
+        bool step(int kb = 0)
+        {
+            auto start = clock::now();
+            auto finished = lua_gc(L, LUA_GCSTEP, kb) != 0;
+            record(start);
+            auto& stats = data();
+            stats.steps++;
+            if (finished)
+                stats.cycles++;
+            return finished;
+        }
+
+        // steps until a cycle finished or the budget is spent, overrunning it by at most one step;
+        // the atomic phase is always a single step, a smaller stepsize in incremental() makes the
+        // others finer. Meant for idle time, usually with the automatic collector stopped.
+        // True when a cycle finished. In the 5.4 generational mode a step is a whole young
+        // collection that never reports an end, so that mode takes one step and returns true.
+        bool collect_for(std::chrono::microseconds budget, int kb = 0)
+        {
+            auto start = clock::now();
+            auto& stats = data();
+#if LUA_VERSION_NUM >= 504
+            if (stats.generational)
+            {
+                lua_gc(L, LUA_GCSTEP, kb);
+                stats.steps++;
+                stats.cycles++;
+                record(start);
+                return true;
+            }
+#endif
+            auto finished = false;
+            do
+            {
+                finished = lua_gc(L, LUA_GCSTEP, kb) != 0;
+                stats.steps++;
+            } while (!finished && clock::now() - start < budget);
+            if (finished)
+                stats.cycles++;
+            record(start);
+            return finished;
+        }
+
+        [[nodiscard]] GCStats stats()
+        {
+            return data();
+        }
+
+        void reset_stats()
+        {
+            data() = GCStats();
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,208 @@
+#pragma once
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <vector>
+#include "StateData.h"
+
+namespace LuaBinding {
+    // Shares the single lua_Hook of a lua_State between several users. Count hooks run at the
+    // gcd of the requested counts and fire each callback at its own rate. Only the main thread
+    // and coroutines created after a change see it, like lua_sethook; debug.sethook replaces it.
+    // Callbacks may raise Lua errors but must not add or remove hooks.
+    class Hooks {
+    public:
+        using Callback = std::function<void(lua_State*, lua_Debug*)>;
+    private:
+        struct Entry {
+            int id;
+            int mask;
+            int count;
+            int left;
+            Callback f;
+            std::atomic<bool> pending{ false };
+        };
+
+        lua_State* L;
+        std::vector<std::unique_ptr<Entry>> entries;
+        std::atomic<bool> armed{ false };
+        int next_id = 0;
+        int step = 0;
+        std::shared_ptr<void> token = std::make_shared<char>();
+
+        static char* key()
+        {
+            static char k;
+            return &k;
+        }
+
+        static int gcd(int a, int b)
+        {
+            while (b)
+            {
+                auto t = a % b;
+                a = b;
+                b = t;
+            }
+            return a;
+        }
+
+        static int event_mask(int event)
+        {
+            switch (event)
+            {
+            case LUA_HOOKCALL:
+                return LUA_MASKCALL;
+            case LUA_HOOKRET:
+                return LUA_MASKRET;
+            case LUA_HOOKLINE:
+                return LUA_MASKLINE;
+            case LUA_HOOKCOUNT:
+                return LUA_MASKCOUNT;
+            default:
+                // tail calls, and tail returns of 5.1
+#if LUA_VERSION_NUM < 502
+                return LUA_MASKRET;
+#else
+                return LUA_MASKCALL;
+#endif
+            }
+        }
+
+        void install()
+        {
+            int mask = 0;
+            int count = 0;
+            for (auto& e : entries)
+            {
+                mask |= e->mask;
+                if (e->mask & LUA_MASKCOUNT)
+                    count = gcd(count, e->count);
+            }
+            if (armed)
+            {
+                mask |= LUA_MASKCOUNT;
+                count = 1;
+            }
+            step = count;
+            lua_sethook(L, mask ? dispatch : nullptr, mask, count);
+        }
+
+        static void dispatch(lua_State* L, lua_Debug* ar)
+        {
+            if (auto hooks = detail::state_data<Hooks>(L, key()))
+                hooks->run(L, ar);
+        }
+
+        void run(lua_State* T, lua_Debug* ar)
+        {
+            auto mask = event_mask(ar->event);
+            for (size_t i = 0; i < entries.size(); i++)
+            {
+                auto e = entries[i].get();
+                if (!(e->mask & mask))
+                    continue;
+                if (mask == LUA_MASKCOUNT)
+                {
+                    e->left -= step;
+                    if (e->left > 0)
+                        continue;
+                    e->left += e->count;
+                }
+                e->f(T, ar);
+            }
+            if (mask != LUA_MASKCOUNT || !armed.exchange(false))
+                return;
+            Entry* hit = nullptr;
+            for (auto& e : entries)
+            {
+                if (hit)
+                {
+                    if (e->pending)
+                        armed = true;
+                }
+                else if (e->pending.exchange(false))
+                    hit = e.get();
+            }
+            install();
+            if (hit)
+                hit->f(T, ar);
+        }
+    public:
+        explicit Hooks(lua_State* L) : L(L)
+        {}
+        Hooks(const Hooks&) = delete;
+        Hooks& operator=(const Hooks&) = delete;
+
+        static Hooks* get(lua_State* L)
+        {
+            return detail::state_data<Hooks>(L, key());
+        }
+
+        // created on first use, lives as long as the lua_State
+        static Hooks& of(lua_State* L)
+        {
+            if (auto hooks = get(L))
+                return *hooks;
+            return *detail::make_state_data<Hooks>(L, key(), L);
+        }
+
+        // mask of LUA_MASKCALL, LUA_MASKRET, LUA_MASKLINE, LUA_MASKCOUNT; count is for LUA_MASKCOUNT.
+        // A mask of 0 adds a callback that only runs through fire(id).
+        int add(int mask, int count, Callback f)
+        {
+            if (count < 1)
+                count = 1;
+            auto e = std::make_unique<Entry>();
+            e->id = ++next_id;
+            e->mask = mask;
+            e->count = count;
+            e->left = count;
+            e->f = std::move(f);
+            entries.push_back(std::move(e));
+            install();
+            return next_id;
+        }
+
+        void remove(int id)
+        {
+            for (auto it = entries.begin(); it != entries.end(); ++it)
+            {
+                if ((*it)->id == id)
+                {
+                    entries.erase(it);
+                    install();
+                    return;
+                }
+            }
+        }
+
+        // runs the callback before the next instruction. Touches no Lua memory, so it can be
+        // called from a lua_Alloc, or from another thread while no hooks are added or removed.
+        void fire(int id)
+        {
+            for (auto& e : entries)
+            {
+                if (e->id == id)
+                {
+                    e->pending = true;
+                    armed = true;
+                    step = 1;
+                    lua_sethook(L, dispatch, LUA_MASKCOUNT | lua_gethookmask(L), 1);
+                    return;
+                }
+            }
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return entries.size();
+        }
+
+        // expires when the hooks are destroyed with their lua_State, for owners that may outlive it
+        [[nodiscard]] std::weak_ptr<void> alive() const
+        {
+            return token;
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,127 @@
+#pragma once
+#include <cstdint>
+
+namespace LuaBinding {
+    // Standard libraries for State(open, lazy), combined with |
+    enum class Lib : uint32_t {
+        None = 0,
+        Base = 1 << 0,
+        Package = 1 << 1,
+        Coroutine = 1 << 2,
+        Table = 1 << 3,
+        IO = 1 << 4,
+        OS = 1 << 5,
+        String = 1 << 6,
+        Math = 1 << 7,
+        UTF8 = 1 << 8,
+        Debug = 1 << 9,
+        Bit = 1 << 10,
+        JIT = 1 << 11,
+        FFI = 1 << 12,
+        All = 0xFFFFFFFF
+    };
+
+    constexpr Lib operator|(Lib a, Lib b)
+    {
+        return (Lib)((uint32_t)a | (uint32_t)b);
+    }
+
+    constexpr Lib operator&(Lib a, Lib b)
+    {
+        return (Lib)((uint32_t)a & (uint32_t)b);
+    }
+
+    constexpr Lib operator~(Lib a)
+    {
+        return (Lib)~(uint32_t)a;
+    }
+
+    namespace detail {
+        struct LibEntry {
+            Lib lib;
+            const char* name;
+            lua_CFunction open;
+        };
+
+        // libraries this interpreter has, in luaL_openlibs order; missing ones are skipped
+        inline const LibEntry* lib_entries()
+        {
+            static const LibEntry entries[] = {
+                { Lib::Base, "_G", luaopen_base },
+                { Lib::Package, LUA_LOADLIBNAME, luaopen_package },
+#if LUA_VERSION_NUM >= 502
+                { Lib::Coroutine, LUA_COLIBNAME, luaopen_coroutine },
+#endif
+                { Lib::Table, LUA_TABLIBNAME, luaopen_table },
+                { Lib::IO, LUA_IOLIBNAME, luaopen_io },
+                { Lib::OS, LUA_OSLIBNAME, luaopen_os },
+                { Lib::String, LUA_STRLIBNAME, luaopen_string },
+                { Lib::Math, LUA_MATHLIBNAME, luaopen_math },
+#if LUA_VERSION_NUM >= 503
+                { Lib::UTF8, LUA_UTF8LIBNAME, luaopen_utf8 },
+#endif
+                { Lib::Debug, LUA_DBLIBNAME, luaopen_debug },
+#if defined(LUA_BITLIBNAME) && !defined(LUAJIT_VERSION_NUM)
+                { Lib::Bit, LUA_BITLIBNAME, luaopen_bit32 },
+#endif
+#ifdef LUAJIT_VERSION_NUM
+                { Lib::Bit, LUA_BITLIBNAME, luaopen_bit },
+                { Lib::JIT, LUA_JITLIBNAME, luaopen_jit },
+                { Lib::FFI, LUA_FFILIBNAME, luaopen_ffi },
+#endif
+                { Lib::None, nullptr, nullptr }
+            };
+            return entries;
+        }
+
+        inline void open_lib(lua_State* L, const LibEntry& e)
+        {
+#if LUA_VERSION_NUM >= 502
+            luaL_requiref(L, e.name, e.open, 1);
+            lua_pop(L, 1);
+#else
+            lua_pushcfunction(L, e.open);
+            lua_pushstring(L, e.name);
+            lua_call(L, 1, 0);
+#endif
+        }
+
+        // package.preload loader, also sets the global like the eager libraries do
+        inline int open_lazy_lib(lua_State* L)
+        {
+            auto name = luaL_checkstring(L, 1);
+            lua_pushcfunction(L, lua_tocfunction(L, lua_upvalueindex(1)));
+            lua_pushstring(L, name);
+            lua_call(L, 1, 1);
+            lua_pushvalue(L, -1);
+            lua_setglobal(L, name);
+            return 1;
+        }
+
+        // opens the libraries in open, lazy ones go to package.preload and start on first require.
+        // Lazy libraries need package, so it is opened with them; base cannot be lazy.
+        inline void open_libs(lua_State* L, Lib open, Lib lazy)
+        {
+            if ((lazy & ~(open | Lib::Base)) != Lib::None)
+                open = open | Lib::Package;
+            lazy = lazy & ~(open | Lib::Base);
+            auto entries = lib_entries();
+            for (auto e = entries; e->name; e++)
+                if ((open & e->lib) != Lib::None)
+                    open_lib(L, *e);
+            if (lazy == Lib::None)
+                return;
+            lua_getglobal(L, LUA_LOADLIBNAME);
+            lua_getfield(L, -1, "preload");
+            for (auto e = entries; e->name; e++)
+            {
+                if ((lazy & e->lib) == Lib::None)
+                    continue;
+                lua_pushcfunction(L, e->open);
+                lua_pushcclosure(L, open_lazy_lib, 1);
+                lua_setfield(L, -2, e->name);
+            }
+            lua_pop(L, 2);
+        }
+    }
+}
\ No newline at end of file
@@ -119,6 +119,12 @@
     {
         return (unsigned int)lua_tonumber(L, idx);
     }
+#ifndef lua_pushglobaltable
+    inline void lua_pushglobaltable(lua_State* L)
+    {
+        lua_pushvalue(L, LUA_GLOBALSINDEX);
+    }
+#endif
 #else
     inline int lua_getlen(lua_State* L, int idx)
     {
@@ -294,10 +300,14 @@ namespace LuaBinding {
     }
 }
 
+#include "Allocator.h"
+#include "ExternalMemory.h"
+#include "CallStats.h"
 #include "ClassPreDefs.h"
 #include "Object.h"
 #include "Environment.h"
 #include "State.h"
+#include "StatePool.h"
 #include "Traits.h"
 #include "Stack.h"
 #include "Class.h"
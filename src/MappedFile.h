@@ -0,0 +1,143 @@
+#pragma once
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace LuaBinding {
+    // Read-only view of a whole file, mapped instead of copied
+    class MappedFile {
+        const char* ptr = nullptr;
+        size_t len = 0;
+#ifdef _WIN32
+        HANDLE file = INVALID_HANDLE_VALUE;
+        HANDLE mapping = nullptr;
+#endif
+    public:
+        MappedFile() = default;
+        explicit MappedFile(const char* path)
+        {
+            open(path);
+        }
+        MappedFile(const MappedFile&) = delete;
+        MappedFile& operator=(const MappedFile&) = delete;
+        MappedFile(MappedFile&& other) noexcept
+        {
+            *this = std::move(other);
+        }
+        MappedFile& operator=(MappedFile&& other) noexcept
+        {
+            if (this != &other)
+            {
+                close();
+                std::swap(ptr, other.ptr);
+                std::swap(len, other.len);
+#ifdef _WIN32
+                std::swap(file, other.file);
+                std::swap(mapping, other.mapping);
+#endif
+            }
+            return *this;
+        }
+        ~MappedFile()
+        {
+            close();
+        }
+
+        bool open(const char* path)
+        {
+            close();
+#ifdef _WIN32
+            file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (file == INVALID_HANDLE_VALUE)
+                return false;
+            LARGE_INTEGER size;
+            if (!GetFileSizeEx(file, &size))
+            {
+                close();
+                return false;
+            }
+            len = (size_t)size.QuadPart;
+            if (!len)
+            {
+                ptr = "";
+                return true;
+            }
+            mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            if (mapping)
+                ptr = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+#else
+            auto fd = ::open(path, O_RDONLY);
+            if (fd < 0)
+                return false;
+            struct stat st;
+            if (fstat(fd, &st))
+            {
+                ::close(fd);
+                return false;
+            }
+            len = (size_t)st.st_size;
+            if (!len)
+            {
+                ::close(fd);
+                ptr = "";
+                return true;
+            }
+            auto view = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+            ::close(fd);
+            if (view != MAP_FAILED)
+                ptr = (const char*)view;
+#endif
+            if (!ptr)
+                close();
+            return ptr != nullptr;
+        }
+
+        void close()
+        {
+            if (ptr && len)
+            {
+#ifdef _WIN32
+                UnmapViewOfFile(ptr);
+#else
+                munmap((void*)ptr, len);
+#endif
+            }
+#ifdef _WIN32
+            if (mapping)
+                CloseHandle(mapping);
+            if (file != INVALID_HANDLE_VALUE)
+                CloseHandle(file);
+            mapping = nullptr;
+            file = INVALID_HANDLE_VALUE;
+#endif
+            ptr = nullptr;
+            len = 0;
+        }
+
+        [[nodiscard]] const char* data() const
+        {
+            return ptr;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return len;
+        }
+
+        [[nodiscard]] bool valid() const
+        {
+            return ptr != nullptr;
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,192 @@
+#pragma once
+#include <cstdlib>
+#include <unordered_map>
+#include "Hooks.h"
+
+namespace LuaBinding {
+    namespace detail {
+        // the allocator luaL_newstate uses
+        inline void* default_alloc(void*, void* ptr, size_t, size_t nsize)
+        {
+            if (!nsize)
+            {
+                free(ptr);
+                return nullptr;
+            }
+            return realloc(ptr, nsize);
+        }
+    }
+
+    // Accounting lua_Alloc wrapped around another allocator, one per State. Growing past the
+    // hard limit fails the allocation, so Lua raises its "not enough memory" error which pcall
+    // catches. Crossing the soft limit raises "memory soft limit exceeded" before the next
+    // instruction, once per crossing. Memory is attributed to the Environment whose pcall, or
+    // function from Environment::load/bind, is running; frees done by the collector meanwhile
+    // are credited to it too, so per env numbers are an estimate.
+    class MemoryQuota {
+    public:
+        struct Usage {
+            size_t allocated = 0;
+            size_t freed = 0;
+            size_t limit = 0;
+
+            [[nodiscard]] size_t used() const
+            {
+                return allocated > freed ? allocated - freed : 0;
+            }
+        };
+
+        // attributes allocations to env until destroyed, restoring the previous env
+        class Scope {
+            MemoryQuota* quota;
+            Usage* previous = nullptr;
+        public:
+            Scope(lua_State* L, int env) : quota(MemoryQuota::get(L))
+            {
+                if (!quota)
+                    return;
+                previous = quota->current;
+                quota->current = &quota->envs[env];
+            }
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+            ~Scope()
+            {
+                if (quota)
+                    quota->current = previous;
+            }
+        };
+    private:
+        lua_Alloc inner;
+        void* inner_ud;
+        size_t hard;
+        size_t soft;
+        size_t in_use = 0;
+        size_t high = 0;
+        bool over_soft = false;
+        Hooks* hooks = nullptr;
+        int soft_hook = 0;
+        std::unordered_map<int, Usage> envs;
+        Usage* current = nullptr;
+
+        void* reallocate(void* ptr, size_t osize, size_t nsize)
+        {
+            if (!ptr)
+                osize = 0;
+            if (nsize > osize)
+            {
+                auto grow = nsize - osize;
+                if (hard && in_use + grow > hard)
+                    return nullptr;
+                if (current && current->limit && current->used() + grow > current->limit)
+                    return nullptr;
+            }
+            auto p = inner(inner_ud, ptr, osize, nsize);
+            if (!p && nsize)
+                return nullptr;
+            in_use += nsize - osize;
+            if (in_use > high)
+                high = in_use;
+            if (current)
+            {
+                if (nsize > osize)
+                    current->allocated += nsize - osize;
+                else
+                    current->freed += osize - nsize;
+            }
+            if (soft && in_use > soft)
+            {
+                if (!over_soft && hooks)
+                    hooks->fire(soft_hook);
+                over_soft = true;
+            }
+            else
+                over_soft = false;
+            return p;
+        }
+
+        static void soft_limit_hit(lua_State* L, lua_Debug*)
+        {
+            luaL_error(L, "memory soft limit exceeded");
+        }
+    public:
+        // limits of 0 are off; inner defaults to realloc/free, or pass PoolAllocator::alloc
+        explicit MemoryQuota(size_t hard = 0, size_t soft = 0, lua_Alloc inner = nullptr, void* ud = nullptr)
+            : inner(inner ? inner : detail::default_alloc), inner_ud(ud), hard(hard), soft(soft)
+        {}
+        MemoryQuota(const MemoryQuota&) = delete;
+        MemoryQuota& operator=(const MemoryQuota&) = delete;
+
+        // the lua_Alloc, ud is the MemoryQuota
+        static void* alloc(void* ud, void* ptr, size_t osize, size_t nsize)
+        {
+            return ((MemoryQuota*)ud)->reallocate(ptr, osize, nsize);
+        }
+
+        // the quota L allocates through, if any
+        static MemoryQuota* get(lua_State* L)
+        {
+            void* ud;
+            return lua_getallocf(L, &ud) == alloc ? (MemoryQuota*)ud : nullptr;
+        }
+
+        // registers the soft limit hook, done by State(quota, ...)
+        void attach(lua_State* L)
+        {
+            hooks = &Hooks::of(L);
+            soft_hook = hooks->add(0, 0, soft_limit_hit);
+        }
+
+        void set_limits(size_t hard, size_t soft = 0)
+        {
+            this->hard = hard;
+            this->soft = soft;
+            over_soft = soft && in_use > soft;
+        }
+
+        // caps the memory the env gains while it runs, 0 removes the cap
+        void set_limit(const ObjectRef& env, size_t bytes)
+        {
+            envs[env.index()].limit = bytes;
+        }
+
+        [[nodiscard]] Usage usage(const ObjectRef& env) const
+        {
+            auto it = envs.find(env.index());
+            return it == envs.end() ? Usage() : it->second;
+        }
+
+        // drops the numbers of an env, its registry ref may be reused by a later one
+        void forget(const ObjectRef& env)
+        {
+            auto it = envs.find(env.index());
+            if (it != envs.end() && &it->second != current)
+                envs.erase(it);
+        }
+
+        [[nodiscard]] size_t used() const
+        {
+            return in_use;
+        }
+
+        [[nodiscard]] size_t peak() const
+        {
+            return high;
+        }
+
+        void reset_peak()
+        {
+            high = in_use;
+        }
+
+        [[nodiscard]] size_t limit() const
+        {
+            return hard;
+        }
+
+        [[nodiscard]] size_t soft_limit() const
+        {
+            return soft;
+        }
+    };
+}
\ No newline at end of file
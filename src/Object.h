@@ -1,6 +1,9 @@
 #pragma once
 #include "Stack.h"
 #include "Function.h"
+#include "Path.h"
+#include "StackFrame.h"
+#include "RegistryRefs.h"
 #include <memory>
 
 namespace LuaBinding {
@@ -19,150 +22,289 @@ namespace LuaBinding {
         int base;
     };
 
+    template<typename K, typename V>
+    class TablePairs
+    {
+    public:
+        class iterator
+        {
+        public:
+            typedef std::input_iterator_tag iterator_category;
+            iterator(lua_State* L, int table) : L(L), table(table)
+            {
+                if (L)
+                {
+                    lua_pushnil(L);
+                    next();
+                }
+            }
+            iterator& operator++() { lua_pop(L, 1); next(); return *this; }
+            std::pair<K, V> operator*()
+            {
+                auto top = lua_gettop(L);
+                if constexpr (std::is_same_v<K, Object>)
+                {
+                    std::pair<K, V> result = { detail::get<K>(L, top - 1), detail::get<V>(L, top) };
+                    lua_settop(L, top);
+                    return result;
+                } else {
+                    // convert a copy, lua_tostring on the key itself would confuse lua_next
+                    lua_pushvalue(L, top - 1);
+                    std::pair<K, V> result = { detail::get<K>(L, top + 1), detail::get<V>(L, top) };
+                    lua_settop(L, top);
+                    return result;
+                }
+            }
+            bool operator!=(const iterator& rhs) const { return table != rhs.table; }
+        private:
+            void next() { if (!lua_next(L, table)) table = 0; }
+            lua_State* L;
+            int table;
+        };
+
+        TablePairs(lua_State* L, int table, int top) : L(L), table(table), top(top) { }
+        TablePairs(const TablePairs&) = delete;
+        TablePairs& operator=(const TablePairs&) = delete;
+        ~TablePairs() { lua_settop(L, top); }
+
+        iterator begin() { return iterator(L, table); }
+        iterator end() { return iterator(nullptr, 0); }
+    private:
+        lua_State* L;
+        int table;
+        int top;
+    };
+
+    template<typename V>
+    class TableIPairs
+    {
+    public:
+        class iterator
+        {
+        public:
+            typedef std::input_iterator_tag iterator_category;
+            iterator(lua_State* L, int table, int index, int last) : L(L), table(table), index(index), last(last)
+            {
+                if (index <= last)
+                    lua_rawgeti(L, table, index);
+            }
+            iterator& operator++()
+            {
+                lua_pop(L, 1);
+                if (++index <= last)
+                    lua_rawgeti(L, table, index);
+                return *this;
+            }
+            std::pair<int, V> operator*()
+            {
+                auto top = lua_gettop(L);
+                std::pair<int, V> result = { index, detail::get<V>(L, top) };
+                lua_settop(L, top);
+                return result;
+            }
+            bool operator!=(const iterator& rhs) const { return index != rhs.index; }
+        private:
+            lua_State* L;
+            int table;
+            int index;
+            int last;
+        };
+
+        TableIPairs(lua_State* L, int table, int top) : L(L), table(table), top(top), last(lua_getlen(L, table)) { }
+        TableIPairs(const TableIPairs&) = delete;
+        TableIPairs& operator=(const TableIPairs&) = delete;
+        ~TableIPairs() { lua_settop(L, top); }
+
+        iterator begin() { return iterator(L, table, 1, last); }
+        iterator end() { return iterator(L, table, last + 1, last); }
+    private:
+        lua_State* L;
+        int table;
+        int top;
+        int last;
+    };
+
     template <typename T>
     concept has_lua_state = requires(T t)
     {
         { t.lua_state() } -> std::convertible_to<void*>;
     };
 
-    class Object {
-    protected:
-        int idx = LUA_REFNIL;
-        lua_State* L = nullptr;
-        bool owned = false;
-    public:
-        Object() = default;
-        Object(lua_State* L, int idx) : L(L)
+    namespace detail {
+        inline int push_field(lua_State* L, int index, const char* key)
         {
-            this->idx = lua_absindex(L, idx);
-        }
-        Object(lua_State* L, int idx, bool owned) : L(L)
-        {
-            this->idx = lua_absindex(L, idx);
-            this->owned = owned;
+            return luaL_getfield(L, index, key);
         }
-        Object(const Object& other) : L(other.L), idx(other.idx), owned(false)
-        {}
-        Object(Object&& other) noexcept : L(other.L), idx(other.idx), owned(other.owned)
+
+        template<class K> requires std::is_integral_v<K>
+        int push_field(lua_State* L, int index, K key)
         {
-            other.idx = LUA_REFNIL;
-            other.owned = false;
+            lua_geti(L, index, (lua_Integer)key);
+            return lua_type(L, -1);
         }
-        Object& operator=(const Object& other)
+
+        inline int push_field(lua_State* L, int index, const Path& path)
         {
-            this->L = other.L;
-            this->idx = other.idx;
-            this->owned = false;
-            return *this;
-        }
-        ~Object() {
-            if (owned)
-                pop();
+            path.push(L, index);
+            return lua_type(L, -1);
         }
 
-        virtual const char* tostring()
+        // pushes t[k1][k2]...[kn], or nil as soon as a step hits something that cannot be indexed
+        template<class ...Keys>
+        int push_path(lua_State* L, int index, Keys... keys)
         {
-            return lua_tostring(L, idx);
+            lua_pushvalue(L, index);
+            auto step = [L](auto key) {
+                auto t = lua_type(L, -1);
+                if (t != LUA_TTABLE && t != LUA_TUSERDATA)
+                {
+                    lua_pop(L, 1);
+                    lua_pushnil(L);
+                    return false;
+                }
+                push_field(L, lua_gettop(L), key);
+                lua_replace(L, -2);
+                return true;
+            };
+            (void)(step(keys) && ...);
+            return lua_type(L, -1);
         }
 
-        virtual const char* tolstring()
+        template<class T>
+        T get_or(lua_State* L, int index, T def)
         {
-            return luaL_tolstring(L, -1, nullptr);
+            if (lua_isnoneornil(L, index) || !detail::is<T>(L, index))
+                return def;
+            return detail::get<T>(L, index);
         }
+    }
 
-        template<typename T>
-        T as()
+    // Shared accessors of Object, ObjectRef and IndexProxy, resolved at compile time.
+    // Derived provides push()/pop() and acquire()/release(): acquire returns a stack index
+    // holding the value (pushing it if it does not live on the stack) and release undoes it.
+    template<class Derived>
+    class BasicObject {
+    protected:
+        int idx = LUA_REFNIL;
+        lua_State* L = nullptr;
+
+        Derived& self()
         {
-            return detail::get<T>(L, idx);
+            return static_cast<Derived&>(*this);
         }
 
-        template<typename T>
-        T extract()
+        const Derived& self() const
         {
-            auto res = detail::get<T>(L, idx);
-            pop();
-            return res;
+            return static_cast<const Derived&>(*this);
         }
-
-        template <class T>
-        operator T () const requires (!std::is_same_v<T, ObjectRef>)
+    public:
+        const char* tostring() const
         {
-            return as <T> ();
+            auto i = self().acquire();
+            auto result = lua_tostring(L, i);
+            self().release();
+            return result;
         }
 
-        template <class T> requires (!std::is_same_v<T, ObjectRef>)
-        operator T ()
+        const char* tolstring() const
         {
-            return as <T> ();
+            auto top = lua_gettop(L);
+            auto i = self().acquire();
+            auto result = luaL_tolstring(L, i, nullptr);
+            lua_settop(L, top);
+            return result;
         }
 
         template<typename T>
-        bool is()
+        T as() const
         {
-            if constexpr (std::is_same_v<T, void>)
-            {
-                return lua_isnoneornil(L, idx);
-            } else {
-                return detail::is<T>(L, idx);
-            }
+            auto i = self().acquire();
+            auto result = detail::get<T>(L, i);
+            self().release();
+            return result;
         }
 
-        virtual bool is(int t)
+        template<typename T>
+        T extract()
         {
-            return lua_type(L, idx) == t;
+            auto result = as<T>();
+            self().pop();
+            return result;
         }
 
-        [[nodiscard]] virtual const void* topointer() const
+        template<typename T>
+        bool is() const
         {
-            return lua_topointer(L, idx);
+            auto i = self().acquire();
+            bool result;
+            if constexpr (std::is_same_v<T, void>)
+                result = lua_isnoneornil(L, i);
+            else
+                result = detail::is<T>(L, i);
+            self().release();
+            return result;
         }
 
-        virtual int push(int i = -1) const
+        bool is(int t) const
         {
-            lua_pushvalue(L, idx);
-            if (i != -1)
-                lua_insert(L, i);
-            return 1;
+            return type() == t;
         }
 
-        virtual int push(int i = -1)
+        [[nodiscard]] const void* topointer() const
         {
-            lua_pushvalue(L, idx);
-            if (i != -1)
-                lua_insert(L, i);
-            return 1;
+            auto i = self().acquire();
+            auto result = lua_topointer(L, i);
+            self().release();
+            return result;
         }
 
-        virtual void pop() {
-            lua_remove(L, idx);
-            this->idx = LUA_REFNIL;
+        template<typename T, typename K>
+        T get(const K& key) const
+        {
+            static_assert(!std::is_same_v<T, Object>, "get<Object> would point at a popped stack slot, use get<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            detail::push_field(L, self().acquire(), key);
+            auto result = detail::get<T>(L, -1);
+            lua_settop(L, top);
+            return result;
         }
 
-        template<typename Ref = ObjectRef> requires std::is_base_of_v<ObjectRef, Ref>
-        Ref operator[](size_t index)
+        template<typename T, typename K>
+        T get_or(const K& key, T def) const
         {
-            lua_geti(L, this->idx, index);
-            return Ref(L, lua_gettop(L), false);
+            static_assert(!std::is_same_v<T, Object>, "get_or<Object> would point at a popped stack slot, use get_or<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            detail::push_field(L, self().acquire(), key);
+            auto result = detail::get_or<T>(L, -1, def);
+            lua_settop(L, top);
+            return result;
         }
 
-        template<typename Ref = ObjectRef> requires std::is_base_of_v<ObjectRef, Ref>
-        Ref operator[](const char* index)
+        template<typename T, typename ...Keys>
+        T get_path(Keys... keys) const
         {
-            lua_getfield(L, this->idx, index);
-            return Ref(L, lua_gettop(L), false);
+            static_assert(!std::is_same_v<T, Object>, "get_path<Object> would point at a popped stack slot, use get_path<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            detail::push_path(L, self().acquire(), keys...);
+            auto result = detail::get<T>(L, -1);
+            lua_settop(L, top);
+            return result;
         }
 
-        template<typename T>
-        Object& operator=(T value)
+        template<typename T, typename ...Keys>
+        T get_path_or(T def, Keys... keys) const
         {
-            detail::push(L, value);
-            lua_replace(L, idx);
-            return *this;
+            static_assert(!std::is_same_v<T, Object>, "get_path_or<Object> would point at a popped stack slot, use get_path_or<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            detail::push_path(L, self().acquire(), keys...);
+            auto result = detail::get_or<T>(L, -1, def);
+            lua_settop(L, top);
+            return result;
         }
 
         template<typename R>
         R call() {
-            push();
+            self().push();
             if constexpr (std::is_same_v<void, R>) {
                 if (LuaBinding::pcall(L, 0, 0))
                 {
@@ -185,7 +327,7 @@ namespace LuaBinding {
 
         template<int R>
         void call() {
-            push();
+            self().push();
             if (LuaBinding::pcall(L, 0, R))
             {
 #ifndef NOEXCEPTIONS
@@ -196,7 +338,7 @@ namespace LuaBinding {
 
         template<typename R, typename ...Params> requires (sizeof...(Params) > 0 && !std::is_same_v<std::tuple_element_t<0, std::tuple<Params...>>, Environment>)
         R call(Params... param) {
-            push();
+            self().push();
             if constexpr (sizeof...(param) > 0)
                 (void)std::initializer_list<int>{ detail::push(L, param)... };
             if constexpr (std::is_same_v<void, R>) {
@@ -221,7 +363,7 @@ namespace LuaBinding {
 
         template<int R, typename ...Params> requires (sizeof...(Params) > 0 && !std::is_same_v<std::tuple_element_t<0, std::tuple<Params...>>, Environment>)
         void call(Params... param) {
-            push();
+            self().push();
             if constexpr (sizeof...(param) > 0)
                 (void)std::initializer_list<int>{ detail::push(L, param)... };
             if (LuaBinding::pcall(L, sizeof...(param), R))
@@ -233,8 +375,8 @@ namespace LuaBinding {
         }
 
         template<typename R, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
-        R call(Env env, Params... param) {
-            push();
+        R call(const Env& env, Params... param) {
+            self().push();
             if constexpr (sizeof...(param) > 0)
                 (void)std::initializer_list<int>{ detail::push(L, param)... };
             if constexpr (std::is_same_v<void, R>) {
@@ -258,8 +400,8 @@ namespace LuaBinding {
         }
 
         template<int R, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
-        void call(Env env, Params... param) {
-            push();
+        void call(const Env& env, Params... param) {
+            self().push();
             if constexpr (sizeof...(param) > 0)
                 (void)std::initializer_list<int>{ detail::push(L, param)... };
             if (env.pcall(sizeof...(param), R))
@@ -272,7 +414,7 @@ namespace LuaBinding {
 
         template<typename Ref = ObjectRef> requires std::is_base_of_v<ObjectRef, Ref>
         Ref operator() () {
-            push();
+            self().push();
             if (LuaBinding::pcall(L, 0, 1))
             {
 #ifndef NOEXCEPTIONS
@@ -284,7 +426,7 @@ namespace LuaBinding {
 
         template<typename Ref = ObjectRef, typename ...Params> requires (std::is_base_of_v<ObjectRef, Ref>) && (sizeof...(Params) > 0 && !std::is_same_v<std::tuple_element_t<0, std::tuple<Params...>>, Environment>)
         Ref operator() (Params... param) {
-            push();
+            self().push();
             if constexpr (sizeof...(param) > 0)
                 (void)std::initializer_list<int>{ detail::push(L, param)... };
             if (LuaBinding::pcall(L, sizeof...(param), 1))
@@ -297,8 +439,8 @@ namespace LuaBinding {
         }
 
         template<typename Ref = ObjectRef, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
-        Ref operator()(Env env, Params... param) {
-            push();
+        Ref operator()(const Env& env, Params... param) {
+            self().push();
             if constexpr (sizeof...(param) > 0)
                 (void)std::initializer_list<int>{ detail::push(L, param)... };
             if (env.pcall(sizeof...(param), 1))
@@ -313,85 +455,82 @@ namespace LuaBinding {
         template <typename T>
         void set(const char* index, T&& other)
         {
+            auto i = self().acquire();
             detail::push(L, other);
-            lua_setfield(L, idx, index);
+            lua_setfield(L, i, index);
+            self().release();
         }
 
         template <typename T>
         void set(int index, T&& other)
         {
+            auto i = self().acquire();
             lua_pushinteger(L, index);
             detail::push(L, other);
-            lua_settable(L, idx);
+            lua_settable(L, i);
+            self().release();
+        }
+
+        template <typename T>
+        bool set(const Path& path, T&& other)
+        {
+            auto i = self().acquire();
+            auto result = path.set(L, i, other);
+            self().release();
+            return result;
         }
 
         void unset(const char* index)
         {
+            auto i = self().acquire();
             lua_pushnil(L);
-            lua_setfield(L, idx, index);
+            lua_setfield(L, i, index);
+            self().release();
         }
 
         void unset(int index)
         {
+            auto i = self().acquire();
             lua_pushinteger(L, index);
             lua_pushnil(L);
-            lua_settable(L, idx);
-        }
-
-        template <typename T>
-        void fun(int index, T& other)
-        {
-            Function::fun<void>(L, other);
-            lua_rawseti(L, idx, index);
+            lua_settable(L, i);
+            self().release();
         }
 
         template <typename T>
         void fun(int index, T&& other)
         {
+            auto i = self().acquire();
             Function::fun<void>(L, other);
-            lua_rawseti(L, idx, index);
-        }
-
-        template <typename T>
-        void cfun(int index, T& other)
-        {
-            Function::cfun<void>(L, other);
-            lua_rawseti(L, idx, index);
+            lua_rawseti(L, i, index);
+            self().release();
         }
 
         template <typename T>
         void cfun(int index, T&& other)
         {
+            auto i = self().acquire();
             Function::cfun<void>(L, other);
-            lua_rawseti(L, idx, index);
-        }
-
-        template <typename T>
-        void fun(const char* index, T& other)
-        {
-            Function::fun<void>(L, other);
-            lua_setfield(L, idx, index);
+            lua_rawseti(L, i, index);
+            self().release();
         }
 
         template <typename T>
         void fun(const char* index, T&& other)
         {
+            auto i = self().acquire();
             Function::fun<void>(L, other);
-            lua_setfield(L, idx, index);
-        }
-
-        template <typename T>
-        void cfun(const char* index, T& other)
-        {
-            Function::cfun<void>(L, other);
-            lua_setfield(L, idx, index);
+            lua_setfield(L, i, index);
+            self().release();
         }
 
         template <typename T>
         void cfun(const char* index, T&& other)
         {
+            auto i = self().acquire();
             Function::cfun<void>(L, other);
-            lua_setfield(L, idx, index);
+            lua_setfield(L, i, index);
+            self().release();
         }
 
         [[nodiscard]] int index() const
@@ -404,24 +543,12 @@ namespace LuaBinding {
             return L;
         }
 
-        lua_State* lua_state()
-        {
-            return L;
-        }
-
-        virtual int type()
-        {
-            return lua_type(L, idx);
-        }
-
-        virtual int type() const
-        {
-            return lua_type(L, idx);
-        }
-
-        bool valid()
+        int type() const
         {
-            return L && this->idx != LUA_REFNIL;
+            auto i = self().acquire();
+            auto result = lua_type(L, i);
+            self().release();
+            return result;
         }
 
         bool valid() const
@@ -429,73 +556,40 @@ namespace LuaBinding {
             return L && this->idx != LUA_REFNIL;
         }
 
-        bool valid(lua_State *S)
-        {
-            return L && L == S && this->idx != LUA_REFNIL;
-        }
-
         bool valid(lua_State *S) const
         {
             return L && L == S && this->idx != LUA_REFNIL;
         }
 
-        template <typename T>
-        bool valid(T *S) requires has_lua_state<T>
-        {
-            return L && S && L == S->lua_state() && this->idx != LUA_REFNIL;
-        }
-
         template <typename T>
         bool valid(T *S) const requires has_lua_state<T>
         {
             return L && S && L == S->lua_state() && this->idx != LUA_REFNIL;
         }
 
-        template <typename T>
-        bool valid(std::shared_ptr<T> S) requires has_lua_state<T>
-        {
-            return L && S && L == S->lua_state() && this->idx != LUA_REFNIL;
-        }
-
         template <typename T>
         bool valid(std::shared_ptr<T> S) const requires has_lua_state<T>
         {
             return L && S && L == S->lua_state() && this->idx != LUA_REFNIL;
         }
 
-        bool valid(int ltype)
-        {
-            return L && this->idx != LUA_REFNIL && type() == ltype;
-        }
-
         bool valid(int ltype) const
         {
             return L && this->idx != LUA_REFNIL && type() == ltype;
         }
 
-        bool valid(lua_State *S, int ltype)
-        {
-            return L && L == S && this->idx != LUA_REFNIL && type() == ltype;
-        }
-
         bool valid(lua_State *S, int ltype) const
         {
             return L && L == S && this->idx != LUA_REFNIL && type() == ltype;
         }
 
-        template <typename T>
-        bool valid(T *S, int ltype) requires has_lua_state<T>
-        {
-            return L && L == S->lua_state() && this->idx != LUA_REFNIL && type() == ltype;
-        }
-
         template <typename T>
         bool valid(T *S, int ltype) const requires has_lua_state<T>
         {
             return L && L == S->lua_state() && this->idx != LUA_REFNIL && type() == ltype;
         }
 
-        const char* type_name()
+        const char* type_name() const
         {
             return lua_typename(L, type());
         }
@@ -506,284 +600,275 @@ namespace LuaBinding {
             this->idx = LUA_REFNIL;
         }
 
-        virtual int len()
+        int len() const
         {
-            return lua_getlen(L, idx);
+            auto i = self().acquire();
+            auto result = lua_getlen(L, i);
+            self().release();
+            return result;
         }
 
-        virtual int len() const
+        template<typename K = Object, typename V = Object>
+        TablePairs<K, V> pairs() const
         {
-            return lua_getlen(L, idx);
+            auto top = lua_gettop(L);
+            return TablePairs<K, V>(L, self().acquire(), top);
         }
 
-        TableIter<ObjectRef> begin()
-        {
-            return TableIter<ObjectRef>(L, 1, this->idx);
-        }
-        TableIter<ObjectRef> end()
-        {
-            return TableIter<ObjectRef>(L, lua_getlen(L, idx) + 1, this->idx);
-        }
-        TableIter<ObjectRef> begin() const
+        template<typename V = Object>
+        TableIPairs<V> ipairs() const
         {
-            return TableIter<ObjectRef>(L, 1, this->idx);
+            auto top = lua_gettop(L);
+            return TableIPairs<V>(L, self().acquire(), top);
         }
-        TableIter<ObjectRef> end() const
+    };
+
+    class Object : public BasicObject<Object> {
+        friend class BasicObject<Object>;
+    protected:
+        bool owned = false;
+
+        int acquire() const
         {
-            return TableIter<ObjectRef>(L, lua_getlen(L, idx) + 1, this->idx);
+            return idx;
         }
-    };
 
-    class ObjectRef : public Object {
+        void release() const
+        {}
     public:
-        ObjectRef() = default;
-        ObjectRef(lua_State* L, int idx, bool copy = true)
+        Object() = default;
+        Object(lua_State* L, int idx)
         {
             this->L = L;
-            if (copy || idx != -1 && idx != lua_gettop(L))
-                lua_pushvalue(L, idx);
-            this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
+            this->idx = lua_absindex(L, idx);
         }
-        template<typename T> requires std::is_same_v<IndexProxy, T>
-        ObjectRef(const T& other)
+        Object(lua_State* L, int idx, bool owned)
         {
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
+            this->L = L;
+            this->idx = lua_absindex(L, idx);
+            this->owned = owned && !StackFrame::covers(L, this->idx);
         }
-        template<typename T> requires std::is_same_v<IndexProxy, T>
-        ObjectRef& operator=(T&& other) noexcept
+        Object(const Object& other) : owned(false)
         {
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
-            return *this;
+            this->L = other.L;
+            this->idx = other.idx;
         }
-        ObjectRef(const Object& other)
+        Object(Object&& other) noexcept : owned(other.owned)
         {
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
+            this->L = other.L;
+            this->idx = other.idx;
+            other.idx = LUA_REFNIL;
+            other.owned = false;
         }
-        ObjectRef& operator=(Object&& other) noexcept {
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
+        Object& operator=(const Object& other)
+        {
+            this->L = other.L;
+            this->idx = other.idx;
+            this->owned = false;
             return *this;
         }
-        ObjectRef(const ObjectRef& other)
-        {
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
-        }
-        ObjectRef& operator=(ObjectRef&& other) noexcept {
-            if (valid(other.lua_state()))
-            {
-                luaL_unref(L, LUA_REGISTRYINDEX, idx);
-                idx = LUA_REFNIL;
-                L = nullptr;
-            }
-            this->L = other.lua_state();
-            if (other.valid(L))
-            {
-                other.push();
-                this->idx = luaL_ref(L, LUA_REGISTRYINDEX);
-            }
-            return *this;
-        }
-        ~ObjectRef() {
-            if (valid(L))
-            {
-                luaL_unref(L, LUA_REGISTRYINDEX, idx);
-                idx = LUA_REFNIL;
-                L = nullptr;
-            }
+        ~Object() {
+            if (owned)
+                pop();
         }
 
-        const char* tostring() override
+        template <class T>
+        operator T () const requires (!std::is_same_v<T, ObjectRef>)
         {
-            push();
-            auto result = lua_tostring(L, -1);
-            lua_pop(L, 1);
-            return result;
+            return as <T> ();
         }
 
-        const char* tolstring() override
+        int push(int i = -1) const
         {
-            push();
-            auto result = luaL_tolstring(L, -1, nullptr);
-            lua_pop(L, 1);
-            return result;
+            lua_pushvalue(L, idx);
+            if (i != -1)
+                lua_insert(L, i);
+            return 1;
         }
 
-        template <class T>
-        operator T () const
-        {
-            return as <T> ();
+        void pop() {
+            lua_remove(L, idx);
+            this->idx = LUA_REFNIL;
+            this->owned = false;
         }
 
-        template <class T>
-        operator T ()
+        template<typename Ref = ObjectRef> requires std::is_base_of_v<ObjectRef, Ref>
+        Ref operator[](size_t index)
         {
-            return as <T> ();
+            lua_geti(L, this->idx, index);
+            return Ref(L, lua_gettop(L), false);
         }
 
-        template<typename T>
-        T as()
+        template<typename Ref = ObjectRef> requires std::is_base_of_v<ObjectRef, Ref>
+        Ref operator[](const char* index)
         {
-            push();
-            auto t = detail::get<T>(L, -1);
-            lua_pop(L, 1);
-            return t;
+            lua_getfield(L, this->idx, index);
+            return Ref(L, lua_gettop(L), false);
         }
 
         template<typename T>
-        bool is()
+        Object& operator=(T value)
         {
-            if constexpr (std::is_same_v<T, void>)
-            {
-                push();
-                auto t = lua_isnoneornil(L, -1);
-                lua_pop(L, 1);
-                return t;
-            } else {
-                push();
-                auto t = detail::is<T>(L, -1);
-                lua_pop(L, 1);
-                return t;
-            }
+            detail::push(L, value);
+            lua_replace(L, idx);
+            return *this;
         }
 
-        bool is(int t) override
+        TableIter<ObjectRef> begin() const
         {
-            push();
-            auto b = lua_type(L, -1) == t;
-            lua_pop(L, 1);
-            return b;
+            return TableIter<ObjectRef>(L, 1, this->idx);
         }
-
-        template <typename T>
-        void set(const char* index, T&& other)
+        TableIter<ObjectRef> end() const
         {
-            push();
-            detail::push(L, other);
-            lua_setfield(L, -2, index);
-            lua_pop(L, 1);
+            return TableIter<ObjectRef>(L, lua_getlen(L, idx) + 1, this->idx);
         }
+    };
 
-        template <typename T>
-        void set(int index, T&& other)
+    class ObjectRef : public BasicObject<ObjectRef> {
+        friend class BasicObject<ObjectRef>;
+    protected:
+#ifdef LUABINDING_TRACK_REFS
+        // where this ref was declared or taken; operator= cannot default a source_location,
+        // so the refs it stores are recorded here
+        std::source_location site;
+#endif
+
+        int acquire() const
         {
             push();
-            lua_pushinteger(L, index);
-            detail::push(L, other);
-            lua_settable(L, -3);
-            lua_pop(L, 1);
+            return lua_gettop(L);
         }
 
-        void unset(const char* index)
+        void release() const
         {
-            push();
-            lua_pushnil(L);
-            lua_setfield(L, -2, index);
             lua_pop(L, 1);
         }
 
-        void unset(int index)
+        // refs other, then drops the held ref
+        template<typename T>
+        void assign(const T& other)
         {
-            push();
-            lua_pushinteger(L, index);
-            lua_pushnil(L);
-            lua_settable(L, -3);
-            lua_pop(L, 1);
+            auto from = other.lua_state();
+            int ref = LUA_REFNIL;
+            if (other.valid(from))
+            {
+                other.push();
+#ifdef LUABINDING_TRACK_REFS
+                ref = RegistryRefs::ref(from, site);
+#else
+                ref = RegistryRefs::ref(from);
+#endif
+            }
+            if (valid(L))
+                RegistryRefs::unref(L, idx);
+            this->L = from;
+            this->idx = ref;
         }
-
-        template <typename T>
-        void fun(int index, T& other)
+    public:
+#ifdef LUABINDING_TRACK_REFS
+        ObjectRef(std::source_location where = std::source_location::current()) : site(where) {}
+#else
+        ObjectRef() = default;
+#endif
+        ObjectRef(lua_State* L, int idx, bool copy = true LUABINDING_REF_SITE)
         {
-            push();
-            Function::fun<void>(L, other);
-            lua_rawseti(L, -2, index);
-            lua_pop(L, 1);
+            this->L = L;
+            if (copy || idx != -1 && idx != lua_gettop(L))
+                lua_pushvalue(L, idx);
+            this->idx = RegistryRefs::ref(L LUABINDING_REF_WHERE);
+#ifdef LUABINDING_TRACK_REFS
+            site = where;
+#endif
         }
-
-        template <typename T>
-        void fun(int index, T&& other)
+        template<typename T> requires std::is_same_v<IndexProxy, T>
+        ObjectRef(const T& other LUABINDING_REF_SITE)
         {
-            push();
-            Function::fun<void>(L, other);
-            lua_rawseti(L, -2, index);
-            lua_pop(L, 1);
+#ifdef LUABINDING_TRACK_REFS
+            site = where;
+#endif
+            this->L = other.lua_state();
+            if (other.valid(L))
+            {
+                other.push();
+                this->idx = RegistryRefs::ref(L LUABINDING_REF_WHERE);
+            }
         }
-
-        template <typename T>
-        void cfun(int index, T& other)
+        template<typename T> requires std::is_same_v<IndexProxy, T>
+        ObjectRef& operator=(T&& other) noexcept
         {
-            push();
-            Function::cfun<void>(L, other);
-            lua_rawseti(L, -2, index);
-            lua_pop(L, 1);
+            assign(other);
+            return *this;
         }
-
-        template <typename T>
-        void cfun(int index, T&& other)
+        ObjectRef(const Object& other LUABINDING_REF_SITE)
         {
-            push();
-            Function::cfun<void>(L, other);
-            lua_rawseti(L, -2, index);
-            lua_pop(L, 1);
+#ifdef LUABINDING_TRACK_REFS
+            site = where;
+#endif
+            this->L = other.lua_state();
+            if (other.valid(L))
+            {
+                other.push();
+                this->idx = RegistryRefs::ref(L LUABINDING_REF_WHERE);
+            }
         }
-
-        template <typename T>
-        void fun(const char* index, T& other)
+        ObjectRef& operator=(Object&& other) noexcept {
+            assign(other);
+            return *this;
+        }
+        ObjectRef(const ObjectRef& other LUABINDING_REF_SITE)
         {
-            push();
-            Function::fun<void>(L, other);
-            lua_setfield(L, -2, index);
-            lua_pop(L, 1);
+#ifdef LUABINDING_TRACK_REFS
+            site = where;
+#endif
+            this->L = other.lua_state();
+            if (other.valid(L))
+            {
+                other.push();
+                this->idx = RegistryRefs::ref(L LUABINDING_REF_WHERE);
+            }
         }
-
-        template <typename T>
-        void fun(const char* index, T&& other)
+        ObjectRef(ObjectRef&& other) noexcept
         {
-            push();
-            Function::fun<void>(L, other);
-            lua_setfield(L, -2, index);
-            lua_pop(L, 1);
+#ifdef LUABINDING_TRACK_REFS
+            site = other.site;
+#endif
+            this->L = other.L;
+            this->idx = other.idx;
+            other.idx = LUA_REFNIL;
+        }
+        ObjectRef& operator=(ObjectRef&& other) noexcept {
+            if (this == &other)
+                return *this;
+            if (valid(L))
+                RegistryRefs::unref(L, idx);
+#ifdef LUABINDING_TRACK_REFS
+            site = other.site;
+#endif
+            this->L = other.L;
+            this->idx = other.idx;
+            other.idx = LUA_REFNIL;
+            return *this;
+        }
+        ~ObjectRef() {
+            if (valid(L))
+            {
+                RegistryRefs::unref(L, idx);
+                idx = LUA_REFNIL;
+                L = nullptr;
+            }
         }
 
-        template <typename T>
-        void cfun(const char* index, T& other)
+        // a stack copy owning its slot, for code taking Object
+        operator Object () const
         {
             push();
-            Function::cfun<void>(L, other);
-            lua_setfield(L, -2, index);
-            lua_pop(L, 1);
+            return Object(L, -1, true);
         }
 
-        template <typename T>
-        void cfun(const char* index, T&& other)
+        template <class T> requires (!std::is_same_v<T, Object>)
+        operator T () const
         {
-            push();
-            Function::cfun<void>(L, other);
-            lua_setfield(L, -2, index);
-            lua_pop(L, 1);
+            return as <T> ();
         }
 
         Object get() {
@@ -791,6 +876,8 @@ namespace LuaBinding {
             return Object(L, -1, true);
         }
 
+        using BasicObject<ObjectRef>::get;
+
         template<typename IP = IndexProxy> requires std::is_base_of_v<IP, IndexProxy>
         IP operator[](size_t idx)
         {
@@ -803,15 +890,7 @@ namespace LuaBinding {
             return IP(*this, idx);
         }
 
-        [[nodiscard]] const void* topointer() const override
-        {
-            push();
-            auto t = lua_topointer(L, -1);
-            lua_pop(L, 1);
-            return t;
-        }
-
-        int push(int i = -1) const override
+        int push(int i = -1) const
         {
             lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
             if (i != -1)
@@ -819,93 +898,132 @@ namespace LuaBinding {
             return 1;
         }
 
-        int push(int i = -1) override
+        void pop()
         {
-            lua_rawgeti(L, LUA_REGISTRYINDEX, idx);
-            if (i != -1)
-                lua_insert(L, i);
-            return 1;
+            RegistryRefs::unref(L, idx);
+            this->idx = LUA_REFNIL;
         }
+    };
 
-        void pop() override
+    class IndexProxy : public BasicObject<IndexProxy> {
+        friend class BasicObject<IndexProxy>;
+    protected:
+        // the value is looked up through root, through parent for chained proxies,
+        // or in the globals table when both are null
+        const ObjectRef* root = nullptr;
+        const IndexProxy* parent = nullptr;
+        const char* str_index;
+        int int_index;
+
+        int acquire() const
         {
-            luaL_unref(L, LUA_REGISTRYINDEX, idx);
-            this->idx = LUA_REFNIL;
+            push();
+            return lua_gettop(L);
         }
 
-        int type() override
+        void release() const
         {
-            push();
-            auto t = lua_type(L, -1);
             lua_pop(L, 1);
-            return t;
         }
 
-        int type() const override
+        void push_container() const
         {
-            push();
-            auto t = lua_type(L, -1);
-            lua_pop(L, 1);
-            return t;
+            if (parent)
+                parent->push();
+            else if (root)
+                root->push();
+            else
+                lua_pushglobaltable(L);
         }
 
-        int len() override
+        // (-2)[index] = (top), pops the value
+        void store(bool raw) const
         {
-            push();
-            auto t = lua_getlen(L, -1);
-            lua_pop(L, 1);
-            return t;
+            if (str_index)
+                lua_setfield(L, -2, str_index);
+            else if (raw)
+                lua_rawseti(L, -2, int_index);
+            else
+            {
+                lua_pushinteger(L, int_index);
+                lua_insert(L, -2);
+                lua_settable(L, -3);
+            }
         }
 
-        int len() const override
+        template <typename T>
+        void assign(const T& rhs)
         {
-            push();
-            auto t = lua_getlen(L, -1);
+            push_container();
+            if constexpr (detail::is_pushable_cfun<T>) {
+                Function::cfun<void>(L, rhs);
+                store(true);
+            } else if constexpr (detail::is_pushable_fun<T>) {
+                Function::fun<void>(L, rhs);
+                store(true);
+            } else if constexpr (std::is_same_v<T, IndexProxy>) {
+                rhs.push();
+                store(false);
+            } else {
+                detail::push(L, rhs);
+                store(false);
+            }
             lua_pop(L, 1);
-            return t;
         }
-    };
-
-    class IndexProxy : public ObjectRef {
-    protected:
-        ObjectRef& element;
-        const char* str_index;
-        int int_index;
-
     public:
-        IndexProxy(ObjectRef& el, const char* str_index) : element(el), str_index(str_index), int_index(-1) {
+        // proxies own no slot, idx only marks them as valid
+        IndexProxy(lua_State* L, const char* str_index) : str_index(str_index), int_index(-1) {
+            this->L = L;
+            this->idx = LUA_NOREF;
+        }
+        IndexProxy(const ObjectRef& el, const char* str_index) : root(&el), str_index(str_index), int_index(-1) {
+            this->L = el.lua_state();
+            this->idx = LUA_NOREF;
+        }
+        IndexProxy(const ObjectRef& el, int int_index) : root(&el), str_index(nullptr), int_index(int_index) {
             this->L = el.lua_state();
+            this->idx = LUA_NOREF;
         }
-        IndexProxy(ObjectRef& el, int int_index) : element(el), str_index(nullptr), int_index(int_index) {
+        IndexProxy(const IndexProxy& el, const char* str_index) : parent(&el), str_index(str_index), int_index(-1) {
             this->L = el.lua_state();
+            this->idx = LUA_NOREF;
+        }
+        IndexProxy(const IndexProxy& el, int int_index) : parent(&el), str_index(nullptr), int_index(int_index) {
+            this->L = el.lua_state();
+            this->idx = LUA_NOREF;
         }
 
         operator ObjectRef () const {
-            element.push();
-            if (str_index)
-                lua_getfield(L, -1, str_index);
-            else
-                lua_rawgeti(L, -1, int_index);
-            lua_remove(L, -2);
+            push();
             return ObjectRef(L, -1, false);
         }
 
-        int push(int i = -1) const override
+        // a stack copy owning its slot, for code taking Object
+        operator Object () const
         {
-            element.push();
-            if (str_index)
-                lua_getfield(L, -1, str_index);
-            else
-                lua_rawgeti(L, -1, int_index);
-            lua_remove(L, -2);
-            if (i != -1)
-                lua_insert(L, i);
-            return 1;
+            push();
+            return Object(L, -1, true);
         }
 
-        int push(int i = -1) override
+        template <class T> requires (!std::is_same_v<T, ObjectRef> && !std::is_same_v<T, Object>)
+        operator T () const
+        {
+            return as <T> ();
+        }
+
+        IndexProxy operator[](size_t index) const
         {
-            element.push();
+            return IndexProxy(*this, (int)index);
+        }
+
+        IndexProxy operator[](const char* index) const
+        {
+            return IndexProxy(*this, index);
+        }
+
+        int push(int i = -1) const
+        {
+            push_container();
             if (str_index)
                 lua_getfield(L, -1, str_index);
             else
@@ -916,56 +1034,28 @@ namespace LuaBinding {
             return 1;
         }
 
-        void pop() override
+        void pop()
         {
-            element.push();
+            push_container();
             lua_pushnil(L);
-            if (str_index)
-                lua_setfield(L, -2, str_index);
-            else
-                lua_rawseti(L, -2, int_index);
+            store(true);
             lua_pop(L, 1);
         }
 
+        IndexProxy& operator=(const IndexProxy& rhs) {
+            assign(rhs);
+            return *this;
+        }
+
         template <typename T>
         IndexProxy& operator=(const T& rhs) {
-            if constexpr (detail::is_pushable_cfun<T>) {
-                if (str_index)
-                    element.cfun(str_index, rhs);
-                else
-                    element.cfun(int_index, rhs);
-            } else if constexpr (detail::is_pushable_fun<T>) {
-                if (str_index)
-                    element.fun(str_index, rhs);
-                else
-                    element.fun(int_index, rhs);
-            } else {
-                if (str_index)
-                    element.set(str_index, rhs);
-                else
-                    element.set(int_index, rhs);
-            }
+            assign(rhs);
             return *this;
         }
 
         template <typename T>
         IndexProxy& operator=(const T&& rhs) {
-            if constexpr (detail::is_pushable_cfun<T>) {
-                if (str_index)
-                    element.cfun(str_index, rhs);
-                else
-                    element.cfun(int_index, rhs);
-            } else if constexpr (detail::is_pushable_fun<T>) {
-                if (str_index)
-                    element.fun(str_index, rhs);
-                else
-                    element.fun(int_index, rhs);
-            } else {
-                if (str_index)
-                    element.set(str_index, rhs);
-                else
-                    element.set(int_index, rhs);
-            }
+            assign(rhs);
             return *this;
         }
     };
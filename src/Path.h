@@ -0,0 +1,280 @@
+#pragma once
+#include <vector>
+#include "RegistryRefs.h"
+
+namespace LuaBinding {
+    // Keys of a lookup chain. An interned Path holds a registry ref of its lua_State, so it must be
+    // released or destroyed before that State closes; copies take their own ref.
+    class Path {
+        struct Key {
+            string_type str;
+            lua_Integer num = 0;
+            bool is_str = false;
+        };
+        std::vector<Key> keys;
+        lua_State* L = nullptr;
+        int interned = LUA_NOREF;
+
+        void add(const char* key)
+        {
+            keys.push_back({ key, 0, true });
+        }
+
+        void add(const string_type& key)
+        {
+            keys.push_back({ key, 0, true });
+        }
+
+        template<class K> requires std::is_integral_v<K>
+        void add(K key)
+        {
+            keys.push_back({ {}, (lua_Integer)key, false });
+        }
+
+        static bool indexable(lua_State* L, int index)
+        {
+            auto t = lua_type(L, index);
+            return t == LUA_TTABLE || t == LUA_TUSERDATA;
+        }
+
+        void copy_interned(const Path& other)
+        {
+            if (!other.L || other.interned == LUA_NOREF)
+                return;
+            lua_rawgeti(other.L, LUA_REGISTRYINDEX, other.interned);
+            interned = RegistryRefs::ref(other.L);
+            L = other.L;
+        }
+
+        int push_names(lua_State* S) const
+        {
+            if (interned == LUA_NOREF || S != L)
+                return 0;
+            lua_rawgeti(S, LUA_REGISTRYINDEX, interned);
+            return lua_gettop(S);
+        }
+
+        // pushes (top)[keys[i]]
+        void fetch(lua_State* S, size_t i, int names) const
+        {
+            if (names)
+            {
+                lua_rawgeti(S, names, (int)i + 1);
+                lua_gettable(S, -2);
+            } else if (keys[i].is_str)
+                lua_getfield(S, -1, keys[i].str.c_str());
+            else
+                lua_geti(S, lua_gettop(S), keys[i].num);
+        }
+
+        // (-2)[keys[i]] = (top), pops the value
+        void store(lua_State* S, size_t i, int names) const
+        {
+            if (names)
+            {
+                lua_rawgeti(S, names, (int)i + 1);
+                lua_insert(S, -2);
+                lua_settable(S, -3);
+            } else if (keys[i].is_str)
+                lua_setfield(S, -2, keys[i].str.c_str());
+            else
+            {
+                lua_pushinteger(S, keys[i].num);
+                lua_insert(S, -2);
+                lua_settable(S, -3);
+            }
+        }
+    public:
+        Path() = default;
+
+        template<class ...Keys> requires (sizeof...(Keys) > 0) && ((std::is_convertible_v<Keys, const char*> || std::is_convertible_v<Keys, string_type> || std::is_integral_v<Keys>) && ...)
+        explicit Path(Keys... k)
+        {
+            keys.reserve(sizeof...(Keys));
+            (add(k), ...);
+        }
+
+        Path(const Path& other) : keys(other.keys)
+        {
+            copy_interned(other);
+        }
+
+        Path(Path&& other) noexcept : keys(std::move(other.keys)), L(other.L), interned(other.interned)
+        {
+            other.L = nullptr;
+            other.interned = LUA_NOREF;
+        }
+
+        Path& operator=(const Path& other)
+        {
+            if (this != &other)
+            {
+                release();
+                keys = other.keys;
+                copy_interned(other);
+            }
+            return *this;
+        }
+
+        Path& operator=(Path&& other) noexcept
+        {
+            if (this != &other)
+            {
+                release();
+                keys = std::move(other.keys);
+                L = other.L;
+                interned = other.interned;
+                other.L = nullptr;
+                other.interned = LUA_NOREF;
+            }
+            return *this;
+        }
+
+        ~Path()
+        {
+            release();
+        }
+
+        static Path parse(const char* dotted)
+        {
+            Path path;
+            auto str = string_type(dotted);
+            size_t start = 0, dot;
+            while ((dot = str.find('.', start)) != string_type::npos)
+            {
+                path.add(str.substr(start, dot - start));
+                start = dot + 1;
+            }
+            path.add(str.substr(start));
+            return path;
+        }
+
+        // keeps the keys as lua values in the registry so lookups skip string interning
+        Path& intern(lua_State* S)
+        {
+            release();
+            lua_createtable(S, (int)keys.size(), 0);
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                if (keys[i].is_str)
+                    lua_pushlstring(S, keys[i].str.data(), keys[i].str.size());
+                else
+                    lua_pushinteger(S, keys[i].num);
+                lua_rawseti(S, -2, (int)i + 1);
+            }
+            interned = RegistryRefs::ref(S);
+            L = S;
+            return *this;
+        }
+
+        void release()
+        {
+            if (L && interned != LUA_NOREF)
+                RegistryRefs::unref(L, interned);
+            L = nullptr;
+            interned = LUA_NOREF;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return keys.size();
+        }
+
+        int push(lua_State* S, int index) const
+        {
+            index = lua_absindex(S, index);
+            auto names = push_names(S);
+            lua_pushvalue(S, index);
+            for (size_t i = 0; i < keys.size(); i++)
+            {
+                if (!indexable(S, -1))
+                {
+                    lua_pop(S, 1);
+                    lua_pushnil(S);
+                    break;
+                }
+                fetch(S, i, names);
+                lua_replace(S, -2);
+            }
+            if (names)
+                lua_remove(S, names);
+            return 1;
+        }
+
+        int push(lua_State* S) const
+        {
+            lua_pushglobaltable(S);
+            push(S, -1);
+            lua_remove(S, -2);
+            return 1;
+        }
+
+        template<typename T>
+        bool set(lua_State* S, int index, T&& value) const
+        {
+            if (keys.empty())
+                return false;
+            auto top = lua_gettop(S);
+            index = lua_absindex(S, index);
+            auto names = push_names(S);
+            lua_pushvalue(S, index);
+            for (size_t i = 0; i + 1 < keys.size(); i++)
+            {
+                if (!indexable(S, -1))
+                {
+                    lua_settop(S, top);
+                    return false;
+                }
+                fetch(S, i, names);
+                if (lua_isnil(S, -1))
+                {
+                    lua_pop(S, 1);
+                    lua_newtable(S);
+                    lua_insert(S, -2);
+                    lua_pushvalue(S, -2);
+                    store(S, i, names);
+                    lua_pop(S, 1);
+                } else
+                    lua_replace(S, -2);
+            }
+            if (!indexable(S, -1))
+            {
+                lua_settop(S, top);
+                return false;
+            }
+            detail::push(S, value);
+            store(S, keys.size() - 1, names);
+            lua_settop(S, top);
+            return true;
+        }
+
+        template<typename T>
+        bool set(lua_State* S, T&& value) const
+        {
+            lua_pushglobaltable(S);
+            auto result = set(S, -1, std::forward<T>(value));
+            lua_pop(S, 1);
+            return result;
+        }
+
+        template<typename T>
+        T get(lua_State* S, int index) const
+        {
+            auto top = lua_gettop(S);
+            push(S, index);
+            auto result = detail::get<T>(S, -1);
+            lua_settop(S, top);
+            return result;
+        }
+
+        template<typename T>
+        T get(lua_State* S) const
+        {
+            auto top = lua_gettop(S);
+            push(S);
+            auto result = detail::get<T>(S, -1);
+            lua_settop(S, top);
+            return result;
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,208 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "Hooks.h"
+#include "CallStats.h"
+
+namespace LuaBinding {
+    // Sampling profiler on a count hook, aggregating Lua call stacks into folded stacks for
+    // flamegraph.pl / speedscope. Samples are taken every n VM instructions, or when a timer
+    // thread flags that interval has passed. Hooks only run inside Lua code, so C++ functions
+    // appear in stacks only while Lua code they called is running, except with the timer and
+    // LUABINDING_CALL_STATS: a bound function returning after the interval passed is sampled
+    // as the leaf. Bound functions are named after their call site, or after their registration
+    // with LUABINDING_CALL_STATS. It may outlive its State: once the State is closed, stop() and
+    // the destructor no longer touch it.
+    class Profiler {
+        lua_State* L;
+        std::unordered_map<string_type, uint64_t> stacks;
+        uint64_t count = 0;
+        int hook = 0;
+        Hooks* hooks = nullptr;
+        std::weak_ptr<void> hooks_alive;
+        int depth;
+        std::vector<string_type> frames;
+        std::thread timer;
+        std::atomic<bool> due{ false };
+        std::atomic<bool> stopping{ false };
+
+        static string_type frame_name([[maybe_unused]] lua_State* T, lua_Debug& ar)
+        {
+            string_type frame;
+            if (ar.name)
+                frame = ar.name;
+#ifdef LUABINDING_CALL_STATS
+            if (*ar.what == 'C' && frame.empty())
+            {
+                if (auto calls = CallStats::get(T))
+                {
+                    lua_getinfo(T, "f", &ar);
+                    auto it = calls->entries().find(CallStats::binding(T, -1));
+                    lua_pop(T, 1);
+                    if (it != calls->entries().end())
+                        frame = it->second.name;
+                }
+            }
+#endif
+            if (*ar.what == 'm')
+                frame = "main chunk";
+            else if (frame.empty())
+                frame = "?";
+            if (*ar.what == 'C')
+                frame += " [C]";
+            else
+            {
+                char where[64];
+                snprintf(where, sizeof(where), ":%d)", ar.linedefined);
+                frame += " (";
+                frame += ar.short_src;
+                frame += where;
+            }
+            // ';' separates frames and the last space separates the count
+            for (auto& c : frame)
+                if (c == ';' || c == '\n')
+                    c = ',';
+            return frame;
+        }
+
+        void sample(lua_State* T)
+        {
+            frames.clear();
+            lua_Debug ar;
+            for (int level = 0; level < depth && lua_getstack(T, level, &ar); level++)
+            {
+                lua_getinfo(T, "Sn", &ar);
+                frames.push_back(frame_name(T, ar));
+            }
+            if (frames.empty())
+                return;
+            // outermost frame first
+            string_type stack;
+            for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+            {
+                if (!stack.empty())
+                    stack += ';';
+                stack += *it;
+            }
+            stacks[stack]++;
+            count++;
+        }
+#ifdef LUABINDING_CALL_STATS
+        static void sample_due(void* ud, lua_State* T)
+        {
+            auto profiler = (Profiler*)ud;
+            if (profiler->due.exchange(false) && lua_checkstack(T, 2))
+                profiler->sample(T);
+        }
+#endif
+
+        void attach()
+        {
+            hooks = &Hooks::of(L);
+            hooks_alive = hooks->alive();
+        }
+    public:
+        explicit Profiler(lua_State* L, int depth = 64) : L(L), depth(depth)
+        {}
+        Profiler(const Profiler&) = delete;
+        Profiler& operator=(const Profiler&) = delete;
+        ~Profiler()
+        {
+            stop();
+        }
+
+        // samples every n VM instructions
+        void start(int instructions = 1000)
+        {
+            stop();
+            attach();
+            hook = hooks->add(LUA_MASKCOUNT, instructions, [this](lua_State* T, lua_Debug*) {
+                sample(T);
+            });
+        }
+
+        // samples once per interval of wall clock time, checked every `check` instructions
+        void start(std::chrono::microseconds interval, int check = 100)
+        {
+            stop();
+            stopping = false;
+            attach();
+            hook = hooks->add(LUA_MASKCOUNT, check, [this](lua_State* T, lua_Debug*) {
+                if (due.exchange(false))
+                    sample(T);
+            });
+#ifdef LUABINDING_CALL_STATS
+            CallStats::of(L).set_sampler(sample_due, this);
+#endif
+            timer = std::thread([this, interval] {
+                while (!stopping)
+                {
+                    std::this_thread::sleep_for(interval);
+                    due = true;
+                }
+            });
+        }
+
+        void stop()
+        {
+            if (hook && !hooks_alive.expired())
+            {
+                hooks->remove(hook);
+#ifdef LUABINDING_CALL_STATS
+                if (auto calls = CallStats::get(L))
+                    calls->set_sampler(nullptr, nullptr);
+#endif
+            }
+            hook = 0;
+            stopping = true;
+            if (timer.joinable())
+                timer.join();
+            due = false;
+        }
+
+        [[nodiscard]] bool running() const
+        {
+            return hook != 0;
+        }
+
+        // "outer;inner count" lines
+        [[nodiscard]] string_type folded() const
+        {
+            string_type out;
+            for (auto& [stack, n] : stacks)
+            {
+                char num[24];
+                snprintf(num, sizeof(num), " %llu\n", (unsigned long long)n);
+                out += stack;
+                out += num;
+            }
+            return out;
+        }
+
+        bool write(const char* path) const
+        {
+            auto f = fopen(path, "wb");
+            if (!f)
+                return false;
+            auto out = folded();
+            auto ok = fwrite(out.data(), 1, out.size(), f) == out.size();
+            return !fclose(f) && ok;
+        }
+
+        [[nodiscard]] uint64_t samples() const
+        {
+            return count;
+        }
+
+        void clear()
+        {
+            stacks.clear();
+            count = 0;
+        }
+    };
+}
\ No newline at end of file
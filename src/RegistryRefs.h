@@ -0,0 +1,128 @@
+#pragma once
+#include <atomic>
+#ifdef LUABINDING_TRACK_REFS
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <source_location>
+#include <string_view>
+#include <vector>
+// extra constructor parameter recording where a ref was taken
+#define LUABINDING_REF_SITE , std::source_location where = std::source_location::current()
+#define LUABINDING_REF_WHERE , where
+#else
+#define LUABINDING_REF_SITE
+#define LUABINDING_REF_WHERE
+#endif
+
+namespace LuaBinding {
+#ifdef LUABINDING_TRACK_REFS
+    struct RefSite {
+        lua_State* L;
+        int ref;
+        std::source_location where;
+    };
+#endif
+
+    // Registry slots held by ObjectRef, Environment and Path, across all States. live() is a
+    // relaxed atomic counter; with LUABINDING_TRACK_REFS each slot also keeps where it was taken,
+    // for the ObjectRef constructors that is the caller, and refs stored by assignment are put
+    // down where the assigned ObjectRef was declared. Refs still held when their State closes
+    // stay counted, so check before closing.
+    class RegistryRefs {
+        static std::atomic<size_t>& counter()
+        {
+            static std::atomic<size_t> n{ 0 };
+            return n;
+        }
+#ifdef LUABINDING_TRACK_REFS
+        static std::mutex& lock()
+        {
+            static std::mutex m;
+            return m;
+        }
+
+        static std::map<std::pair<lua_State*, int>, std::source_location>& tracked()
+        {
+            static std::map<std::pair<lua_State*, int>, std::source_location> sites;
+            return sites;
+        }
+
+        // refs are shared by the threads of a state
+        static lua_State* main_thread(lua_State* L)
+        {
+#if LUA_VERSION_NUM >= 502
+            lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+            auto main = lua_tothread(L, -1);
+            lua_pop(L, 1);
+            return main;
+#else
+            return L;
+#endif
+        }
+#endif
+    public:
+        // luaL_ref of the value on top of the stack, popping it
+#ifdef LUABINDING_TRACK_REFS
+        static int ref(lua_State* L, std::source_location where = std::source_location::current())
+#else
+        static int ref(lua_State* L)
+#endif
+        {
+            auto r = luaL_ref(L, LUA_REGISTRYINDEX);
+            if (r == LUA_REFNIL || r == LUA_NOREF)
+                return r;
+            counter().fetch_add(1, std::memory_order_relaxed);
+#ifdef LUABINDING_TRACK_REFS
+            std::lock_guard guard(lock());
+            tracked().insert_or_assign({ main_thread(L), r }, where);
+#endif
+            return r;
+        }
+
+        static void unref(lua_State* L, int r)
+        {
+            if (r == LUA_REFNIL || r == LUA_NOREF)
+                return;
+            luaL_unref(L, LUA_REGISTRYINDEX, r);
+            counter().fetch_sub(1, std::memory_order_relaxed);
+#ifdef LUABINDING_TRACK_REFS
+            std::lock_guard guard(lock());
+            tracked().erase({ main_thread(L), r });
+#endif
+        }
+
+        [[nodiscard]] static size_t live()
+        {
+            return counter().load(std::memory_order_relaxed);
+        }
+
+#ifdef LUABINDING_TRACK_REFS
+        // the live refs of L, or of all States
+        [[nodiscard]] static std::vector<RefSite> sites(lua_State* L = nullptr)
+        {
+            auto main = L ? main_thread(L) : nullptr;
+            std::vector<RefSite> out;
+            std::lock_guard guard(lock());
+            for (auto& [k, where] : tracked())
+                if (!main || k.first == main)
+                    out.push_back({ k.first, k.second, where });
+            return out;
+        }
+
+        // one "file:line function" line per live ref, counted per site
+        static void report(FILE* f, lua_State* L = nullptr)
+        {
+            std::map<std::pair<std::string_view, unsigned>, std::pair<const char*, size_t>> counts;
+            for (auto& s : sites(L))
+            {
+                auto& c = counts[{ s.where.file_name(), s.where.line() }];
+                c.first = s.where.function_name();
+                c.second++;
+            }
+            for (auto& [k, c] : counts)
+                fprintf(f, "%zu ref(s) from %.*s:%u %s\n", c.second, (int)k.first.size(), k.first.data(), k.second, c.first);
+        }
+#endif
+    };
+}
\ No newline at end of file
@@ -163,20 +163,22 @@ namespace LuaBinding {
     public:
         static int push(lua_State* L, T& t) requires (!std::is_convertible_v<T, void*>)
         {
-            auto _t = new (malloc(sizeof(T))) T(t);
+            auto _t = new (detail::new_object(L, sizeof(T))) T(t);
             auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
             *u = _t; *(u + 1) = (void*)0xC0FFEE;
             helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
             lua_setmetatable(L, -2);
+            detail::report_object(L, _t);
             return 1;
         }
         static int push(lua_State* L, T&& t) requires (!std::is_convertible_v<T, void*>)
         {
-            auto _t = new (malloc(sizeof(T))) T(t);
+            auto _t = new (detail::new_object(L, sizeof(T))) T(t);
             auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
             *u = _t; *(u + 1) = (void*)0xC0FFEE;
             helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
             lua_setmetatable(L, -2);
+            detail::report_object(L, _t);
             return 1;
         }
         static int push(lua_State* L, T& t) requires std::is_convertible_v<T, void*>
@@ -0,0 +1,63 @@
+#pragma once
+
+namespace LuaBinding {
+    // Restores the stack top with a single lua_settop when it goes out of scope.
+    // Owned Objects created above the frame base are treated as views, so temporaries
+    // no longer lua_remove themselves one by one.
+    class StackFrame {
+        lua_State* L = nullptr;
+        int base = 0;
+        int results = 0;
+        StackFrame* prev = nullptr;
+
+        static StackFrame*& innermost()
+        {
+            static thread_local StackFrame* frame = nullptr;
+            return frame;
+        }
+    public:
+        explicit StackFrame(lua_State* L) : L(L), base(lua_gettop(L)), prev(innermost())
+        {
+            innermost() = this;
+        }
+        StackFrame(const StackFrame&) = delete;
+        StackFrame& operator=(const StackFrame&) = delete;
+        ~StackFrame()
+        {
+            auto top = lua_gettop(L);
+            if (results > top - base)
+                results = top - base;
+            for (int i = 1; i <= results; i++)
+            {
+                lua_pushvalue(L, top - results + i);
+                lua_replace(L, base + i);
+            }
+            lua_settop(L, base + results);
+            innermost() = prev;
+        }
+
+        // keeps the top n values, they end up right above the frame base
+        void keep(int n)
+        {
+            results = n;
+        }
+
+        [[nodiscard]] int bottom() const
+        {
+            return base;
+        }
+
+        [[nodiscard]] int n() const
+        {
+            return lua_gettop(L) - base;
+        }
+
+        static bool covers(lua_State* L, int idx)
+        {
+            for (auto frame = innermost(); frame; frame = frame->prev)
+                if (frame->L == L && idx > frame->base)
+                    return true;
+            return false;
+        }
+    };
+}
\ No newline at end of file
@@ -3,15 +3,44 @@
 #include "DynClass.h"
 #endif
 #include "Object.h"
+#include "Libs.h"
+#include "Allocator.h"
+#include "ExternalMemory.h"
+#include "GarbageCollector.h"
+#include "CallStats.h"
+#include "Trace.h"
+#include "SymbolMap.h"
+#include "Profiler.h"
+#include "Budget.h"
 #include "Stack.h"
 #include "Class.h"
 #include "StackIter.h"
 #include "Environment.h"
+#include "EnvironmentPool.h"
 #include "Function.h"
+#include "ChunkCache.h"
+#include "BytecodeCache.h"
+#include "Compiler.h"
+#include <cstdio>
 #include <vector>
 #include <stdexcept>
 
 namespace LuaBinding {
+    namespace detail {
+        // what luaL_newstate installs, lua_newstate leaves the panic function unset
+        inline int panic(lua_State* L)
+        {
+            auto msg = lua_tostring(L, -1);
+            fprintf(stderr, "PANIC: unprotected error in call to Lua API (%s)\n", msg ? msg : "error object is not a string");
+            fflush(stderr);
+            return 0;
+        }
+
+        // reader(size_t* size) -> const char*, lua objects convert to anything and would match too
+        template<typename F>
+        concept is_chunk_reader = std::is_invocable_r_v<const char*, F&, size_t*> && !std::is_convertible_v<std::remove_cvref_t<F>, ObjectRef>;
+    }
+
     template< class T >
     inline constexpr bool is_state_v = std::is_same<T, State*>::value;
 
@@ -29,16 +58,40 @@ namespace LuaBinding {
         }
 #endif
 
-        ObjectRef& globals() {
-            static ObjectRef globals = at("_G");
-            return globals;
-        }
-
     public:
         State() = default;
-        State(bool) {
-            L = luaL_newstate();
-            luaL_openlibs(L);
+        State(bool) : State(Lib::All) {}
+        // opens only the libraries in open, the ones in lazy load on their first require
+        State(Lib open, Lib lazy = Lib::None) : State(nullptr, nullptr, open, lazy) {}
+        // allocator must outlive the State, it is not thread safe
+        State(PoolAllocator& allocator, Lib open = Lib::All, Lib lazy = Lib::None) : State(PoolAllocator::alloc, &allocator, open, lazy) {}
+        // quota must outlive the State
+        State(MemoryQuota& quota, Lib open = Lib::All, Lib lazy = Lib::None) : State(MemoryQuota::alloc, &quota, open, lazy) {
+            if (L)
+                quota.attach(L);
+        }
+        // lua_newstate with a custom allocator, nullptr uses the default one
+        State(lua_Alloc alloc, void* ud, Lib open = Lib::All, Lib lazy = Lib::None) {
+            if (alloc)
+            {
+                L = lua_newstate(alloc, ud);
+                if (L)
+                    lua_atpanic(L, detail::panic);
+            }
+            else
+                L = luaL_newstate();
+            if (!L)
+            {
+                view = true;
+#ifndef NOEXCEPTIONS
+                throw std::exception("cannot create lua_State");
+#endif
+                return;
+            }
+            if (open == Lib::All && lazy == Lib::None)
+                luaL_openlibs(L);
+            else
+                detail::open_libs(L, open, lazy);
             lua_newtable(L);
             lua_setglobal(L, "__METASTORE");
 #ifdef LUABINDING_DYN_CLASSES
@@ -84,11 +137,7 @@ namespace LuaBinding {
         }
 
         ~State() {
-            if (view) {
-                if (globals().valid(this))
-                    globals().pop();
-            } else {
-                globals().invalidate();
+            if (!view) {
 #ifdef LUABINDING_DYN_CLASSES
                 for (auto& c : *get_dynamic_classes())
                     delete c;
@@ -135,6 +184,11 @@ namespace LuaBinding {
             return Environment(L);
         }
 
+        Environment addEnv(const std::vector<const char*>& globals, bool snapshot = false, bool fallback = false)
+        {
+            return Environment(L, globals, snapshot, fallback);
+        }
+
         void pop(int n = 1)
         {
             lua_pop(L, n);
@@ -150,23 +204,25 @@ namespace LuaBinding {
         template<class T, class ...Params> requires std::is_constructible_v<T, Params...>
         T* alloc(Params... params)
         {
-            auto t = new (malloc(sizeof(T))) T(params...);
+            auto t = new (detail::new_object(L, sizeof(T))) T(params...);
             auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
             *u = t; *(u + 1) = (void*)0xC0FFEE;
             helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
             lua_setmetatable(L, -2);
+            detail::report_object(L, t);
             return t;
         }
 
         template<class T, class ...Params> requires (!std::is_constructible_v<T, Params...>)
         T* alloc()
         {
-            auto t = (T*)malloc(sizeof(T));
+            auto t = (T*)detail::new_object(L, sizeof(T));
             memset(t, 0, sizeof(T));
             auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
             *u = t; *(u + 1) = (void*)0xC0FFEE;
             helper<std::remove_pointer_t<std::decay_t<T>>>::push_metatable(L);
             lua_setmetatable(L, -2);
+            detail::report_object(L, t);
             return t;
         }
 
@@ -192,10 +248,12 @@ namespace LuaBinding {
                     lua_setglobal(L, enclosing_table.c_str());
                 }
                 fun(func);
+                detail::name_call(L, -1, nullptr, name);
                 lua_setfield(L, -2, real_class_name.c_str());
                 lua_pop(L, 1);
             } else {
                 fun(func);
+                detail::name_call(L, -1, nullptr, name);
                 lua_setglobal(L, name);
             }
         }
@@ -222,10 +280,12 @@ namespace LuaBinding {
                     lua_setglobal(L, enclosing_table.c_str());
                 }
                 fun(func);
+                detail::name_call(L, -1, nullptr, name);
                 lua_setfield(L, -2, real_class_name.c_str());
                 lua_pop(L, 1);
             } else {
                 fun(func);
+                detail::name_call(L, -1, nullptr, name);
                 lua_setglobal(L, name);
             }
         }
@@ -252,10 +312,12 @@ namespace LuaBinding {
                     lua_setglobal(L, enclosing_table.c_str());
                 }
                 cfun(func);
+                detail::name_call(L, -1, nullptr, name);
                 lua_setfield(L, -2, real_class_name.c_str());
                 lua_pop(L, 1);
             } else {
                 cfun(func);
+                detail::name_call(L, -1, nullptr, name);
                 lua_setglobal(L, name);
             }
         }
@@ -282,10 +344,12 @@ namespace LuaBinding {
                     lua_setglobal(L, enclosing_table.c_str());
                 }
                 cfun(func);
+                detail::name_call(L, -1, nullptr, name);
                 lua_setfield(L, -2, real_class_name.c_str());
                 lua_pop(L, 1);
             } else {
                 cfun(func);
+                detail::name_call(L, -1, nullptr, name);
                 lua_setglobal(L, name);
             }
         }
@@ -293,12 +357,146 @@ namespace LuaBinding {
         template<typename ...Funcs>
         void overload(const char* name, Funcs... functions) {
             OverloadedFunction<void, Funcs...>(L, functions...);
+            detail::name_overloads(L, -1, nullptr, name);
             lua_setglobal(L, name);
         }
 
+        GarbageCollector gc()
+        {
+            return GarbageCollector(L);
+        }
+
+        // Budget budget = S.budget(...); bounds the Lua code run until it goes out of scope
+        Budget budget(uint64_t instructions, std::chrono::microseconds time = std::chrono::microseconds(0), int check = 1000)
+        {
+            return Budget(L, instructions, time, check);
+        }
+
+        // bytes held by boxed C++ objects, paced into the collector every step bytes
+        size_t external_memory()
+        {
+            auto memory = ExternalMemory::get(L);
+            return memory ? memory->size() : 0;
+        }
+
+        void external_step(size_t bytes)
+        {
+            ExternalMemory::of(L).set_step_size(bytes);
+        }
+
+        // boxed objects of T created and collected so far
+        template<class T>
+        InstanceStats instances()
+        {
+            auto memory = ExternalMemory::get(L);
+            if (!memory)
+                return InstanceStats();
+            auto it = memory->instances().find(detail::type_key<T>());
+            return it == memory->instances().end() ? InstanceStats() : it->second;
+        }
+
+        // of every class that had objects or a Class registration, unnamed ones were never registered
+        std::vector<InstanceStats> instances()
+        {
+            std::vector<InstanceStats> out;
+            if (auto memory = ExternalMemory::get(L))
+                for (auto& [type, stats] : memory->instances())
+                    out.push_back(stats);
+            return out;
+        }
+
+        ChunkCache* cache_chunks(size_t limit = 256)
+        {
+            return ChunkCache::enable(L, limit);
+        }
+
+        void uncache_chunks()
+        {
+            ChunkCache::disable(L);
+        }
+
+        BytecodeCache* cache_bytecode(const char* dir, bool strip = false)
+        {
+            return BytecodeCache::enable(L, dir, strip);
+        }
+
+        void uncache_bytecode()
+        {
+            BytecodeCache::disable(L);
+        }
+
+        void invalidate_chunk(const char* name)
+        {
+            if (auto cache = ChunkCache::get(L))
+                cache->invalidate(L, name);
+        }
+
+        // pushes the compiled chunk, served from the chunk cache when it is enabled
+        int load(const char* code, size_t len, const char* chunkname = "=", const char* name = nullptr)
+        {
+            auto cache = ChunkCache::get(L);
+            if (cache && cache->fetch(L, code, len, chunkname, name))
+                return 0;
+            auto bytecode = BytecodeCache::get(L);
+            auto status = bytecode ? bytecode->load(L, code, len, chunkname) : luaL_loadbuffer(L, code, len, chunkname);
+            if (!status && cache)
+                cache->insert(L, code, len, chunkname, name);
+            return status;
+        }
+
+        int load(const MappedFile& file, const char* chunkname = "=", const char* name = nullptr)
+        {
+            return load(file.data(), file.size(), chunkname, name);
+        }
+
+        // maps the file instead of reading it into memory, chunkname is "@path" like luaL_loadfile
+        int load_file(const char* path, const char* name = nullptr)
+        {
+            MappedFile file(path);
+            if (!file.valid())
+            {
+                lua_pushfstring(L, "cannot open %s", path);
+                return LUA_ERRFILE;
+            }
+            auto data = file.data();
+            auto size = file.size();
+            detail::skip_shebang(data, size);
+            auto chunkname = "@" + string_type(path);
+            return load(data, size, chunkname.c_str(), name);
+        }
+
+        // loads the output of a Compiler, pushing its error message if compiling failed
+        int load(const Bytecode& bytecode)
+        {
+            if (!bytecode.ok())
+            {
+                lua_pushlstring(L, bytecode.error.data(), bytecode.error.size());
+                return LUA_ERRSYNTAX;
+            }
+            return detail::load_bytecode(L, bytecode.code.data(), bytecode.code.size(), bytecode.chunkname.c_str());
+        }
+
+        int load(lua_Reader reader, void* data, const char* chunkname = "=")
+        {
+#if LUA_VERSION_NUM >= 502
+            return lua_load(L, reader, data, chunkname, nullptr);
+#else
+            return lua_load(L, reader, data, chunkname);
+#endif
+        }
+
+        // reader(size_t* size) -> const char* returns the next piece of the chunk, nullptr or size 0 at the end
+        template<typename F> requires detail::is_chunk_reader<F>
+        int load(F&& reader, const char* chunkname = "=")
+        {
+            return load([](lua_State*, void* ud, size_t* size) -> const char* {
+                return (*(std::remove_reference_t<F>*)ud)(size);
+            }, &reader, chunkname);
+        }
+
         int exec(const char* code, int argn = 0, int nres = 0)
         {
-            if (luaL_loadstring(L, code) || LuaBinding::pcall(L, argn, nres))
+            if (load(code, strlen(code), code) || LuaBinding::pcall(L, argn, nres))
             {
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
@@ -307,9 +505,9 @@ namespace LuaBinding {
             return lua_gettop(L);
         }
 
-        int exec(Environment env, const char* code, int argn = 0, int nres = 0)
+        int exec(const Environment& env, const char* code, int argn = 0, int nres = 0)
         {
-            if (luaL_loadstring(L, code) || env.pcall(argn, nres))
+            if (load(code, strlen(code), code) || env.pcall(argn, nres))
             {
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
@@ -320,7 +518,7 @@ namespace LuaBinding {
 
         int exec(std::vector<char>& code, int argn = 0, int nres = 0, const char* name = "=")
         {
-            if (luaL_loadbuffer(L, code.data(), code.size(), name) || LuaBinding::pcall(L, argn, nres))
+            if (load(code.data(), code.size(), name) || LuaBinding::pcall(L, argn, nres))
             {
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
@@ -329,9 +527,87 @@ namespace LuaBinding {
             return lua_gettop(L);
         }
 
-        int exec(Environment env, std::vector<char>& code, int argn = 0, int nres = 0, const char* name = "=")
+        int exec(const Environment& env, std::vector<char>& code, int argn = 0, int nres = 0, const char* name = "=")
         {
-            if (luaL_loadbuffer(L, code.data(), code.size(), name) || env.pcall(argn, nres))
+            if (load(code.data(), code.size(), name) || env.pcall(argn, nres))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return lua_gettop(L);
+        }
+
+        int exec_file(const char* path, int argn = 0, int nres = 0)
+        {
+            if (load_file(path) || LuaBinding::pcall(L, argn, nres))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return lua_gettop(L);
+        }
+
+        int exec_file(const Environment& env, const char* path, int argn = 0, int nres = 0)
+        {
+            if (load_file(path) || env.pcall(argn, nres))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return lua_gettop(L);
+        }
+
+        int exec(const Bytecode& bytecode, int argn = 0, int nres = 0)
+        {
+            if (load(bytecode) || LuaBinding::pcall(L, argn, nres))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return lua_gettop(L);
+        }
+
+        int exec(const MappedFile& file, const char* chunkname = "=", int argn = 0, int nres = 0)
+        {
+            if (load(file, chunkname) || LuaBinding::pcall(L, argn, nres))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return lua_gettop(L);
+        }
+
+        template<typename F> requires detail::is_chunk_reader<F>
+        int exec(F&& reader, const char* chunkname = "=", int argn = 0, int nres = 0)
+        {
+            if (load(std::forward<F>(reader), chunkname) || LuaBinding::pcall(L, argn, nres))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return lua_gettop(L);
+        }
+
+        int exec_named(const char* name, const char* code, int argn = 0, int nres = 0)
+        {
+            if (load(code, strlen(code), code, name) || LuaBinding::pcall(L, argn, nres))
+            {
+#ifndef NOEXCEPTIONS
+                    throw std::exception(lua_tostring(L, -1));
+#endif
+            }
+            return lua_gettop(L);
+        }
+
+        int exec_named(const Environment& env, const char* name, const char* code, int argn = 0, int nres = 0)
+        {
+            if (load(code, strlen(code), code, name) || env.pcall(argn, nres))
             {
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
@@ -355,20 +631,13 @@ namespace LuaBinding {
 #endif
             }
 
-            luaL_Buffer buf;
-            luaL_buffinit(L, &buf);
-#if LUA_VERSION_NUM >= 503
-            if (!lua_dump(L, (lua_Writer)base64_write, &buf, 1))
-#else
-            if (!lua_dump(L, (lua_Writer)base64_write, &buf))
-#endif
+            string_type r;
+            if (!detail::dump(L, detail::write_string, &r))
             {
-                luaL_pushresult(&buf);
-                size_t len = 0;
-                auto r = string_type(const_cast<char *>(lua_tolstring(L, -1, &len)), len);
-                lua_pop(L, 2);
+                lua_pop(L, 1);
                 return r;
             }
+            lua_pushliteral(L, "unable to dump given function");
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
 #endif
@@ -383,18 +652,14 @@ namespace LuaBinding {
 #endif
             }
 
-            luaL_Buffer buf;
-            luaL_buffinit(L, &buf);
-#if LUA_VERSION_NUM >= 503
-            if (!lua_dump(L, (lua_Writer)base64_write, &buf, 1))
-#else
-            if (!lua_dump(L, (lua_Writer)base64_write, &buf))
-#endif
+            string_type r;
+            if (!detail::dump(L, detail::write_string, &r))
             {
-                luaL_pushresult(&buf);
-                lua_remove(L, -2);
+                lua_pop(L, 1);
+                lua_pushlstring(L, r.data(), r.size());
                 return ObjectRef(L, -1, false);
             }
+            lua_pushliteral(L, "unable to dump given function");
 #ifndef NOEXCEPTIONS
                     throw std::exception(lua_tostring(L, -1));
 #endif
@@ -460,7 +725,7 @@ namespace LuaBinding {
         }
 
         template<typename R, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
-        R call(Env env, Params... param) {
+        R call(const Env& env, Params... param) {
             if constexpr (sizeof...(param) > 0)
                 (void)std::initializer_list<int>{ push(param...) };
             if constexpr (std::is_same_v<void, R>) {
@@ -498,7 +763,7 @@ namespace LuaBinding {
         }
 
         template<int R, typename Env, typename ...Params> requires (std::is_same_v<Env, Environment>)
-        void call(Env env, Params... param) {
+        void call(const Env& env, Params... param) {
             if constexpr (sizeof...(param) > 0)
                 (void)std::initializer_list<int>{ detail::push(L, param)... };
             if (env.pcall(sizeof...(param), R))
@@ -560,6 +825,81 @@ namespace LuaBinding {
             return ObjectRef(L, -1, false);
         }
 
+        template<typename T>
+        T get(const char* name)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get<Object> would point at a popped stack slot, use get<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            lua_getglobal(L, name);
+            auto result = detail::get<T>(L, -1);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T>
+        T get_or(const char* name, T def)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get_or<Object> would point at a popped stack slot, use get_or<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            lua_getglobal(L, name);
+            auto result = detail::get_or<T>(L, -1, def);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T>
+        T get(const Path& path)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get<Object> would point at a popped stack slot, use get<ObjectRef> instead");
+            return path.get<T>(L);
+        }
+
+        template<typename T>
+        T get_or(const Path& path, T def)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get_or<Object> would point at a popped stack slot, use get_or<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            path.push(L);
+            auto result = detail::get_or<T>(L, -1, def);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T>
+        bool set(const Path& path, T&& value)
+        {
+            return path.set(L, std::forward<T>(value));
+        }
+
+        template<typename T, typename ...Keys>
+        T get_path(Keys... keys)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get_path<Object> would point at a popped stack slot, use get_path<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            lua_pushglobaltable(L);
+            detail::push_path(L, top + 1, keys...);
+            auto result = detail::get<T>(L, -1);
+            lua_settop(L, top);
+            return result;
+        }
+
+        template<typename T, typename ...Keys>
+        T get_path_or(T def, Keys... keys)
+        {
+            static_assert(!std::is_same_v<T, Object>, "get_path_or<Object> would point at a popped stack slot, use get_path_or<ObjectRef> instead");
+            auto top = lua_gettop(L);
+            lua_pushglobaltable(L);
+            detail::push_path(L, top + 1, keys...);
+            auto result = detail::get_or<T>(L, -1, def);
+            lua_settop(L, top);
+            return result;
+        }
+
+        StackFrame frame()
+        {
+            return StackFrame(L);
+        }
+
         Object top()
         {
             return Object(L, n());
@@ -610,7 +950,7 @@ namespace LuaBinding {
 
         IndexProxy operator[](const char* idx)
         {
-            return IndexProxy(globals(), idx);
+            return IndexProxy(L, idx);
         }
 
         template <class T>
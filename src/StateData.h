@@ -0,0 +1,54 @@
+#pragma once
+#include <new>
+
+namespace LuaBinding {
+    namespace detail {
+        // C++ objects owned by a lua_State: a userdata in the registry under the address of key,
+        // destroyed by its __gc when the state closes or when it is dropped. The __gc also clears
+        // the registry entry, so finalizers running later during lua_close see no object.
+        template<class T>
+        T* state_data(lua_State* L, const void* key)
+        {
+            lua_rawgetp(L, LUA_REGISTRYINDEX, key);
+            auto data = (T*)lua_touserdata(L, -1);
+            lua_pop(L, 1);
+            return data;
+        }
+
+        template<class T>
+        int destroy_state_data(lua_State* L)
+        {
+            auto data = (T*)lua_touserdata(L, 1);
+            auto key = lua_touserdata(L, lua_upvalueindex(1));
+            lua_rawgetp(L, LUA_REGISTRYINDEX, key);
+            auto current = lua_touserdata(L, -1) == data;
+            lua_pop(L, 1);
+            if (current)
+            {
+                lua_pushnil(L);
+                lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+            }
+            data->~T();
+            return 0;
+        }
+
+        template<class T, class ...Args>
+        T* make_state_data(lua_State* L, const void* key, Args&&... args)
+        {
+            auto data = new (lua_newuserdata(L, sizeof(T))) T(std::forward<Args>(args)...);
+            lua_newtable(L);
+            lua_pushlightuserdata(L, (void*)key);
+            lua_pushcclosure(L, destroy_state_data<T>, 1);
+            lua_setfield(L, -2, "__gc");
+            lua_setmetatable(L, -2);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+            return data;
+        }
+
+        inline void drop_state_data(lua_State* L, const void* key)
+        {
+            lua_pushnil(L);
+            lua_rawsetp(L, LUA_REGISTRYINDEX, key);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,236 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include "State.h"
+
+namespace LuaBinding {
+    // Registrations recorded once and replayed into any number of States. Steps run in the order
+    // they were added; chunks given to exec are compiled when recorded and only loaded on replay.
+    // apply may run on several threads at once, so steps must not mutate shared captures.
+    class BindingRecipe {
+        std::vector<std::function<void(State&)>> steps;
+        Lib open = Lib::All;
+        Lib lazy = Lib::None;
+    public:
+        // standard libraries of the States made by create()
+        BindingRecipe& libs(Lib open, Lib lazy = Lib::None)
+        {
+            this->open = open;
+            this->lazy = lazy;
+            return *this;
+        }
+
+        BindingRecipe& step(std::function<void(State&)> f)
+        {
+            steps.push_back(std::move(f));
+            return *this;
+        }
+
+        // define(Class<T>&) adds the members, the name is copied
+        template<class T, class F>
+        BindingRecipe& addClass(const char* name, F&& define)
+        {
+            return step([name = string_type(name), define = std::forward<F>(define)](State& S) {
+                auto c = S.addClass<T>(name.c_str());
+                define(c);
+            });
+        }
+
+        template<class F>
+        BindingRecipe& fun(const char* name, F&& func)
+        {
+            return step([name = string_type(name), func = std::forward<F>(func)](State& S) {
+                auto f = func;
+                S.fun(name.c_str(), f);
+            });
+        }
+
+        template<class F>
+        BindingRecipe& cfun(const char* name, F&& func)
+        {
+            return step([name = string_type(name), func = std::forward<F>(func)](State& S) {
+                auto f = func;
+                S.cfun(name.c_str(), f);
+            });
+        }
+
+        template<class T>
+        BindingRecipe& global(const char* name, T value)
+        {
+            return step([name = string_type(name), value = std::move(value)](State& S) {
+                S.global(name.c_str(), value);
+            });
+        }
+
+        BindingRecipe& exec(const char* code, const char* chunkname = "=")
+        {
+            Bytecode bytecode;
+            bytecode.chunkname = chunkname;
+            auto L = luaL_newstate();
+            if (luaL_loadbuffer(L, code, strlen(code), chunkname))
+            {
+                bytecode.error = lua_tostring(L, -1);
+                lua_close(L);
+#ifndef NOEXCEPTIONS
+                throw std::exception(bytecode.error.c_str());
+#endif
+                return *this;
+            }
+            detail::dump(L, detail::write_string, &bytecode.code, false);
+            lua_close(L);
+            return step([bytecode = std::move(bytecode)](State& S) {
+                S.exec(bytecode);
+            });
+        }
+
+        void apply(State& S) const
+        {
+            for (auto& f : steps)
+                f(S);
+        }
+
+        [[nodiscard]] std::unique_ptr<State> create() const
+        {
+            auto S = std::make_unique<State>(open, lazy);
+            apply(*S);
+            return S;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return steps.size();
+        }
+    };
+
+    // States built from a recipe ahead of time. A background thread keeps `warm` States ready,
+    // acquire hands one out and builds it on the caller's thread only when none is left.
+    // local() gives every calling thread its own State, built once and kept for the thread's lifetime.
+    class StatePool {
+        BindingRecipe recipe;
+        std::vector<std::unique_ptr<State>> ready;
+        std::mutex mutex;
+        std::condition_variable cv;
+        std::thread filler;
+        size_t warm;
+        bool stopping = false;
+        uint64_t id;
+
+        static uint64_t next_id()
+        {
+            static std::atomic<uint64_t> counter{ 0 };
+            return ++counter;
+        }
+
+        // keyed by pool id, an address could be reused by a later pool with another recipe
+        static std::unordered_map<uint64_t, std::unique_ptr<State>>& locals()
+        {
+            thread_local std::unordered_map<uint64_t, std::unique_ptr<State>> states;
+            return states;
+        }
+
+        void fill()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            for (;;)
+            {
+                cv.wait(lock, [this] { return stopping || ready.size() < warm; });
+                if (stopping)
+                    break;
+                lock.unlock();
+                auto S = recipe.create();
+                lock.lock();
+                if (ready.size() < warm)
+                    ready.push_back(std::move(S));
+            }
+        }
+    public:
+        explicit StatePool(BindingRecipe recipe, size_t warm = 0) : recipe(std::move(recipe)), warm(warm), id(next_id())
+        {
+            if (warm)
+                filler = std::thread([this] { fill(); });
+        }
+        StatePool(const StatePool&) = delete;
+        StatePool& operator=(const StatePool&) = delete;
+        // States handed out by acquire stay valid, thread local States of other threads
+        // are closed when those threads exit
+        ~StatePool()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                stopping = true;
+            }
+            cv.notify_all();
+            if (filler.joinable())
+                filler.join();
+            locals().erase(id);
+        }
+
+        [[nodiscard]] std::unique_ptr<State> acquire()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (!ready.empty())
+                {
+                    auto S = std::move(ready.back());
+                    ready.pop_back();
+                    cv.notify_one();
+                    return S;
+                }
+            }
+            return recipe.create();
+        }
+
+        // takes back a State for reuse, the caller is responsible for it being clean
+        void release(std::unique_ptr<State> S)
+        {
+            if (!S)
+                return;
+            std::lock_guard<std::mutex> lock(mutex);
+            if (ready.size() < warm)
+                ready.push_back(std::move(S));
+        }
+
+        State& local()
+        {
+            auto& S = locals()[id];
+            if (!S)
+                S = acquire();
+            return *S;
+        }
+
+        // builds the missing warm States on the calling thread
+        void prewarm()
+        {
+            for (;;)
+            {
+                {
+                    std::lock_guard<std::mutex> lock(mutex);
+                    if (ready.size() >= warm)
+                        return;
+                }
+                auto S = recipe.create();
+                std::lock_guard<std::mutex> lock(mutex);
+                if (ready.size() >= warm)
+                    return;
+                ready.push_back(std::move(S));
+            }
+        }
+
+        [[nodiscard]] size_t available()
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            return ready.size();
+        }
+
+        [[nodiscard]] const BindingRecipe& bindings() const
+        {
+            return recipe;
+        }
+    };
+}
\ No newline at end of file
@@ -0,0 +1,87 @@
+#pragma once
+#if defined(LUABINDING_CALL_STATS) || defined(LUABINDING_SYMBOL_MAP)
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+#if defined(__linux__) || defined(__APPLE__)
+#include <dlfcn.h>
+#endif
+#include "CallStats.h"
+
+namespace LuaBinding {
+    // Writes "symbol<TAB>name,name..." lines mapping the native symbols of the binding thunks to
+    // their Lua names, to annotate the output of perf script --no-demangle or other native
+    // profilers. A thunk serves every binding of one signature, so its line lists all of them;
+    // with LUABINDING_CALL_STATS the timing wrapper and the thunk it runs both get a line.
+    // Symbols come from dladdr, so functions of an executable only resolve when it is linked
+    // with -rdynamic; the others are written as module+0xoffset for addr2line -f. Needs
+    // LUABINDING_CALL_STATS or LUABINDING_SYMBOL_MAP, which keep the names at registration.
+    class SymbolMap {
+        static string_type symbol(lua_CFunction f)
+        {
+            char buffer[32];
+#if defined(__linux__) || defined(__APPLE__)
+            Dl_info info;
+            if (dladdr((void*)f, &info))
+            {
+                // dladdr falls back to the nearest symbol before f, which is not f
+                if (info.dli_sname && info.dli_saddr == (void*)f)
+                    return info.dli_sname;
+                if (info.dli_fname)
+                {
+                    auto module = strrchr(info.dli_fname, '/');
+                    snprintf(buffer, sizeof(buffer), "+0x%llx", (unsigned long long)((uintptr_t)f - (uintptr_t)info.dli_fbase));
+                    return string_type(module ? module + 1 : info.dli_fname) + buffer;
+                }
+            }
+#endif
+            snprintf(buffer, sizeof(buffer), "0x%llx", (unsigned long long)(uintptr_t)f);
+            return buffer;
+        }
+    public:
+        // overwrites path; call once after registering
+        static bool write(lua_State* L, const char* path)
+        {
+            std::map<lua_CFunction, std::vector<string_type>> thunks;
+            if (lua_rawgetp(L, LUA_REGISTRYINDEX, detail::bindings_key()) == LUA_TTABLE)
+            {
+                lua_pushnil(L);
+                while (lua_next(L, -2))
+                {
+                    auto f = lua_tocfunction(L, -1);
+                    if (f && lua_type(L, -2) == LUA_TSTRING)
+                    {
+                        thunks[f].push_back(lua_tostring(L, -2));
+#ifdef LUABINDING_CALL_STATS
+                        if (auto target = detail::ProbedTargets::find(f))
+                            thunks[target].push_back(lua_tostring(L, -2));
+#endif
+                    }
+                    lua_pop(L, 1);
+                }
+            }
+            lua_pop(L, 1);
+            std::map<string_type, string_type> lines;
+            for (auto& [f, names] : thunks)
+            {
+                std::sort(names.begin(), names.end());
+                auto& line = lines[symbol(f)];
+                for (auto& name : names)
+                {
+                    if (!line.empty())
+                        line += ",";
+                    line += name;
+                }
+            }
+            auto f = fopen(path, "wb");
+            if (!f)
+                return false;
+            for (auto& [sym, names] : lines)
+                fprintf(f, "%s\t%s\n", sym.c_str(), names.c_str());
+            return !fclose(f);
+        }
+    };
+}
+#endif
@@ -0,0 +1,372 @@
+#pragma once
+#ifdef LUABINDING_CALL_STATS
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <vector>
+#include "CallStats.h"
+
+namespace LuaBinding {
+    namespace detail {
+        // trace file: "LBTRACE" and a version byte, then records. 'N' id name names a binding the
+        // first time it is called, 'C' id argc args... is a call as it starts, 'T' n nanoseconds
+        // is the time of the nth call once it returned. Numbers are LEB128, args are a type byte
+        // followed by a value for nil, booleans, numbers and strings.
+        constexpr char trace_magic[8] = { 'L', 'B', 'T', 'R', 'A', 'C', 'E', 2 };
+        enum : unsigned char { trace_name = 'N', trace_call = 'C', trace_time = 'T', trace_integer = 0x80 | LUA_TNUMBER };
+
+        inline void put_varint(std::vector<unsigned char>& out, uint64_t v)
+        {
+            while (v >= 0x80)
+            {
+                out.push_back((unsigned char)(v | 0x80));
+                v >>= 7;
+            }
+            out.push_back((unsigned char)v);
+        }
+
+        inline bool get_varint(const unsigned char*& p, const unsigned char* end, uint64_t& v)
+        {
+            v = 0;
+            for (int shift = 0; p < end && shift < 64; shift += 7)
+            {
+                auto b = *p++;
+                v |= (uint64_t)(b & 0x7F) << shift;
+                if (!(b & 0x80))
+                    return true;
+            }
+            return false;
+        }
+    }
+
+    // Logs every call of a named binding, with its arguments and time, to a binary trace file
+    // while it lives. Arguments are logged before the binding runs, tables, functions and
+    // userdata by type only. Needs LUABINDING_CALL_STATS; one recorder per State.
+    class TraceRecorder {
+        lua_State* L;
+        FILE* f;
+        std::weak_ptr<void> calls_alive;
+        std::unordered_map<const void*, uint64_t> ids;
+        std::vector<unsigned char> buffer;
+        uint64_t started = 0;
+        size_t count = 0;
+
+        static uint64_t trace_call(void* ud, lua_State* L, const void* k, int args)
+        {
+            return ((TraceRecorder*)ud)->write_call(L, k, args);
+        }
+
+        static void trace_done(void* ud, uint64_t ticket, std::chrono::nanoseconds time)
+        {
+            ((TraceRecorder*)ud)->write_time(ticket, time);
+        }
+
+        // returns the number of the call, 0 for an unnamed binding
+        uint64_t write_call(lua_State* L, const void* k, int args)
+        {
+            buffer.clear();
+            auto it = ids.find(k);
+            if (it == ids.end())
+            {
+                auto& entries = CallStats::of(L).entries();
+                auto name = entries.find(k);
+                if (name == entries.end() || name->second.name.empty())
+                    return 0;
+                it = ids.emplace(k, ids.size()).first;
+                buffer.push_back(detail::trace_name);
+                detail::put_varint(buffer, it->second);
+                detail::put_varint(buffer, name->second.name.size());
+                buffer.insert(buffer.end(), name->second.name.begin(), name->second.name.end());
+            }
+            buffer.push_back(detail::trace_call);
+            detail::put_varint(buffer, it->second);
+            detail::put_varint(buffer, (uint64_t)args);
+            for (int i = 1; i <= args; i++)
+            {
+                auto type = lua_type(L, i);
+                if (type == LUA_TBOOLEAN)
+                {
+                    buffer.push_back((unsigned char)type);
+                    buffer.push_back((unsigned char)lua_toboolean(L, i));
+                }
+                else if (type == LUA_TNUMBER && lua_isinteger(L, i))
+                {
+                    buffer.push_back(detail::trace_integer);
+                    auto v = (int64_t)lua_tointeger(L, i);
+                    detail::put_varint(buffer, ((uint64_t)v << 1) ^ (uint64_t)(v >> 63));
+                }
+                else if (type == LUA_TNUMBER)
+                {
+                    buffer.push_back((unsigned char)type);
+                    double v = (double)lua_tonumber(L, i);
+                    unsigned char bytes[sizeof(double)];
+                    memcpy(bytes, &v, sizeof(double));
+                    buffer.insert(buffer.end(), bytes, bytes + sizeof(double));
+                }
+                else if (type == LUA_TSTRING)
+                {
+                    buffer.push_back((unsigned char)type);
+                    size_t len;
+                    auto s = lua_tolstring(L, i, &len);
+                    detail::put_varint(buffer, len);
+                    buffer.insert(buffer.end(), s, s + len);
+                }
+                else
+                    buffer.push_back((unsigned char)type);
+            }
+            fwrite(buffer.data(), 1, buffer.size(), f);
+            return ++started;
+        }
+
+        void write_time(uint64_t ticket, std::chrono::nanoseconds time)
+        {
+            buffer.clear();
+            buffer.push_back(detail::trace_time);
+            detail::put_varint(buffer, ticket);
+            detail::put_varint(buffer, (uint64_t)time.count());
+            fwrite(buffer.data(), 1, buffer.size(), f);
+            count++;
+        }
+    public:
+        TraceRecorder(lua_State* L, const char* path) : L(L), f(fopen(path, "wb"))
+        {
+            if (!f)
+                return;
+            fwrite(detail::trace_magic, 1, sizeof(detail::trace_magic), f);
+            auto& calls = CallStats::of(L);
+            calls.set_trace(trace_call, trace_done, this);
+            calls_alive = calls.alive();
+        }
+        TraceRecorder(const TraceRecorder&) = delete;
+        TraceRecorder& operator=(const TraceRecorder&) = delete;
+        ~TraceRecorder()
+        {
+            if (!f)
+                return;
+            // the State may have been closed first
+            if (!calls_alive.expired())
+                CallStats::of(L).set_trace(nullptr, nullptr, nullptr);
+            fclose(f);
+        }
+
+        // false when the file could not be created
+        [[nodiscard]] bool valid() const
+        {
+            return f != nullptr;
+        }
+
+        [[nodiscard]] size_t calls() const
+        {
+            return count;
+        }
+
+        void flush()
+        {
+            if (f)
+                fflush(f);
+        }
+    };
+
+    struct ReplayStats {
+        size_t calls = 0;
+        size_t failed = 0;
+        size_t missing = 0;
+        size_t skipped = 0;
+        std::chrono::nanoseconds recorded{ 0 };
+        std::chrono::nanoseconds elapsed{ 0 };
+    };
+
+    // Drives the bindings of a State through the calls of a trace, as a benchmark of its free
+    // functions. Bindings are looked up by their registered name. Calls with an argument logged
+    // by type only cannot be rebuilt and are skipped, which is every method and property call
+    // since self is userdata; calls raising errors are counted.
+    // Calls that raised an error while recorded have no time and are left out.
+    class TraceReplay {
+        struct Arg {
+            int type;
+            bool boolean = false;
+            lua_Integer integer = 0;
+            lua_Number number = 0;
+            string_type str{};
+        };
+        struct Call {
+            uint64_t id;
+            std::chrono::nanoseconds time{ 0 };
+            std::vector<Arg> args{};
+            bool complete = true;
+            bool returned = false;
+        };
+        std::vector<string_type> names;
+        std::vector<Call> trace;
+        bool ok = false;
+
+        bool parse(const unsigned char* p, const unsigned char* end)
+        {
+            if (end - p < (ptrdiff_t)sizeof(detail::trace_magic) || memcmp(p, detail::trace_magic, sizeof(detail::trace_magic)))
+                return false;
+            p += sizeof(detail::trace_magic);
+            while (p < end)
+            {
+                auto tag = *p++;
+                uint64_t id, n;
+                if (!detail::get_varint(p, end, id))
+                    return false;
+                if (tag == detail::trace_name)
+                {
+                    if (!detail::get_varint(p, end, n) || (uint64_t)(end - p) < n)
+                        return false;
+                    if (names.size() <= id)
+                        names.resize(id + 1);
+                    names[id] = string_type((const char*)p, n);
+                    p += n;
+                    continue;
+                }
+                if (tag == detail::trace_time)
+                {
+                    if (!detail::get_varint(p, end, n))
+                        return false;
+                    if (id >= 1 && id <= trace.size())
+                    {
+                        trace[id - 1].time = std::chrono::nanoseconds(n);
+                        trace[id - 1].returned = true;
+                    }
+                    continue;
+                }
+                if (tag != detail::trace_call || id >= names.size())
+                    return false;
+                uint64_t argc;
+                if (!detail::get_varint(p, end, argc))
+                    return false;
+                Call call{ .id = id };
+                for (uint64_t i = 0; i < argc; i++)
+                {
+                    if (p >= end)
+                        return false;
+                    Arg arg{ .type = *p++ };
+                    if (arg.type == LUA_TBOOLEAN)
+                    {
+                        if (p >= end)
+                            return false;
+                        arg.boolean = *p++ != 0;
+                    }
+                    else if (arg.type == detail::trace_integer)
+                    {
+                        if (!detail::get_varint(p, end, n))
+                            return false;
+                        arg.integer = (lua_Integer)(int64_t)((n >> 1) ^ (~(n & 1) + 1));
+                    }
+                    else if (arg.type == LUA_TNUMBER)
+                    {
+                        if (end - p < (ptrdiff_t)sizeof(double))
+                            return false;
+                        double v;
+                        memcpy(&v, p, sizeof(double));
+                        arg.number = (lua_Number)v;
+                        p += sizeof(double);
+                    }
+                    else if (arg.type == LUA_TSTRING)
+                    {
+                        if (!detail::get_varint(p, end, n) || (uint64_t)(end - p) < n)
+                            return false;
+                        arg.str = string_type((const char*)p, n);
+                        p += n;
+                    }
+                    else if (arg.type != LUA_TNIL)
+                        call.complete = false;
+                    call.args.push_back(std::move(arg));
+                }
+                trace.push_back(std::move(call));
+            }
+            std::erase_if(trace, [](const Call& call) { return !call.returned; });
+            return true;
+        }
+
+        static void push(lua_State* L, const Arg& arg)
+        {
+            switch (arg.type)
+            {
+            case LUA_TBOOLEAN:
+                lua_pushboolean(L, arg.boolean);
+                break;
+            case detail::trace_integer:
+                lua_pushinteger(L, arg.integer);
+                break;
+            case LUA_TNUMBER:
+                lua_pushnumber(L, arg.number);
+                break;
+            case LUA_TSTRING:
+                lua_pushlstring(L, arg.str.data(), arg.str.size());
+                break;
+            default:
+                lua_pushnil(L);
+            }
+        }
+    public:
+        explicit TraceReplay(const char* path)
+        {
+            auto f = fopen(path, "rb");
+            if (!f)
+                return;
+            std::vector<unsigned char> data;
+            unsigned char chunk[64 * 1024];
+            size_t n;
+            while ((n = fread(chunk, 1, sizeof(chunk), f)) > 0)
+                data.insert(data.end(), chunk, chunk + n);
+            fclose(f);
+            ok = parse(data.data(), data.data() + data.size());
+        }
+
+        // false when the file is missing or malformed
+        [[nodiscard]] bool valid() const
+        {
+            return ok;
+        }
+
+        [[nodiscard]] size_t size() const
+        {
+            return trace.size();
+        }
+
+        // replays the trace repeat times; recorded is the time the replayed calls took when traced
+        ReplayStats run(lua_State* L, int repeat = 1)
+        {
+            ReplayStats stats;
+            auto top = lua_gettop(L);
+            luaL_checkstack(L, (int)names.size() + LUA_MINSTACK, "trace replay");
+            for (auto& name : names)
+                CallStats::push_binding(L, name.c_str());
+            auto start = std::chrono::steady_clock::now();
+            for (int r = 0; r < repeat; r++)
+            {
+                for (auto& call : trace)
+                {
+                    auto f = top + 1 + (int)call.id;
+                    if (!lua_isfunction(L, f))
+                    {
+                        stats.missing++;
+                        continue;
+                    }
+                    if (!call.complete)
+                    {
+                        stats.skipped++;
+                        continue;
+                    }
+                    stats.recorded += call.time;
+                    lua_pushvalue(L, f);
+                    for (auto& arg : call.args)
+                        push(L, arg);
+                    if (lua_pcall(L, (int)call.args.size(), 0, 0))
+                    {
+                        lua_pop(L, 1);
+                        stats.failed++;
+                    }
+                    stats.calls++;
+                }
+            }
+            stats.elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+            lua_settop(L, top);
+            return stats;
+        }
+    };
+}
+#endif
\ No newline at end of file
@@ -131,12 +131,13 @@ namespace LuaBinding {
         static int f(lua_State* L) {
             ParamList params;
             assign_tup(L, params, 1);
-            auto m = (void*)malloc(sizeof(T));
+            auto m = detail::new_object(L, sizeof(T));
             make_from_tuple<T>(m, params);
             auto u = (void**)lua_newuserdata(L, sizeof(void*) * 2);
             *u = (void*)m; *(u + 1) = (void*)0xC0FFEE;
             lua_pushvalue(L, 1);
             lua_setmetatable(L, -2);
+            detail::report_object(L, (T*)m);
             return 1;
         }
     };